@@ -0,0 +1,137 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Expression evaluation microbenchmarks: evaluation stack allocated from heap
+   against allocated from a cycle arena. Binary is linked with
+   -Wl,--wrap=malloc, so heap allocations can be counted. */
+
+#include "rb_arena.h"
+#include "rb_bitmap.h"
+#include "rb_expr.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/// Vector variables length, like a walk of many interfaces
+#define VECTOR_LEN 64
+/// Operations evaluated in a sensor cycle, between arena resets
+#define CYCLE_OPS 16
+#define ROUNDS (64 * 1024)
+
+/// Expression variables
+#define VARS 3
+
+static double values[VARS][VECTOR_LEN];
+static double result[VECTOR_LEN];
+static uint64_t result_valid[RB_BITMAP_WORDS(VECTOR_LEN)];
+
+/// Heap allocations since start
+static size_t mallocs;
+
+void *__real_malloc(size_t size);
+void *__wrap_malloc(size_t size);
+
+void *__wrap_malloc(size_t size) {
+	mallocs++;
+	return __real_malloc(size);
+}
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void report(const char *name, double start_ns, size_t start_mallocs) {
+	printf("%-32s %8.1f ns/op %8.4f mallocs/op\n",
+	       name,
+	       (now_ns() - start_ns) / ROUNDS,
+	       (double)(mallocs - start_mallocs) / ROUNDS);
+}
+
+static void prepare_samples(struct rb_expr_value *vars, bool vector) {
+	srand(1);
+	for (size_t v = 0; v < VARS; ++v) {
+		for (size_t i = 0; i < VECTOR_LEN; ++i) {
+			values[v][i] = 1 + rand() % 100000;
+		}
+		vars[v].values = values[v];
+		vars[v].valid = NULL;
+		vars[v].vector = vector;
+	}
+}
+
+static void bench_eval(const char *expression, bool vector) {
+	char name[64];
+	bool result_vector = false;
+	struct rb_expr_value vars[VARS];
+	struct rb_arena arena;
+	const size_t n = vector ? VECTOR_LEN : 1;
+
+	struct rb_expr *expr = rb_expr_compile(expression);
+	if (NULL == expr || VARS != rb_expr_vars_count(expr)) {
+		fprintf(stderr, "Couldn't compile %s\n", expression);
+		exit(1);
+	}
+
+	prepare_samples(vars, vector);
+	rb_arena_init(&arena, 0);
+
+	double start = now_ns();
+	size_t start_mallocs = mallocs;
+	for (size_t r = 0; r < ROUNDS; ++r) {
+		rb_expr_eval(expr,
+			     NULL,
+			     vars,
+			     n,
+			     result,
+			     result_valid,
+			     &result_vector);
+	}
+	snprintf(name, sizeof(name), "heap(%s)", vector ? "vector" : "scalar");
+	report(name, start, start_mallocs);
+
+	start = now_ns();
+	start_mallocs = mallocs;
+	for (size_t r = 0; r < ROUNDS; ++r) {
+		if (0 == r % CYCLE_OPS) {
+			rb_arena_reset(&arena);
+		}
+		rb_expr_eval(expr,
+			     &arena,
+			     vars,
+			     n,
+			     result,
+			     result_valid,
+			     &result_vector);
+	}
+	snprintf(name, sizeof(name), "arena(%s)", vector ? "vector" : "scalar");
+	report(name, start, start_mallocs);
+
+	rb_arena_done(&arena);
+	rb_expr_done(expr);
+}
+
+int main(void) {
+	static const char expression[] = "100 * (a - b) / c";
+	bench_eval(expression, false);
+	bench_eval(expression, true);
+	return 0;
+}
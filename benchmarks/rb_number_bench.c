@@ -0,0 +1,159 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Numeric codec microbenchmarks: rb_number functions against libc ones */
+
+#include "rb_number.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SAMPLES 4096
+#define ROUNDS 256
+
+static double values[SAMPLES];
+static int64_t integers[SAMPLES];
+static char strings[SAMPLES][32];
+
+/// Avoid compiler to remove benchmarked code
+static volatile double double_sink;
+static volatile size_t size_sink;
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void report(const char *name, double start_ns) {
+	printf("%-32s %8.1f ns/op\n",
+	       name,
+	       (now_ns() - start_ns) / (SAMPLES * ROUNDS));
+}
+
+/// Values like the ones seen in monitors: counters, percentages, loads
+static void prepare_samples(void) {
+	srand(1);
+	for (size_t i = 0; i < SAMPLES; ++i) {
+		switch (i % 4) {
+		case 0:
+			values[i] = rand() % 100000000;
+			break;
+		case 1:
+			values[i] = (rand() % 10000) / 100.;
+			break;
+		case 2:
+			values[i] = (double)rand() / RAND_MAX;
+			break;
+		default:
+			values[i] = (rand() % 1000) / 8.;
+			break;
+		};
+		integers[i] = (int64_t)rand() * rand();
+		snprintf(strings[i], sizeof(strings[i]), "%.6f", values[i]);
+	}
+}
+
+static void bench_parse(void) {
+	double start = now_ns();
+	for (size_t r = 0; r < ROUNDS; ++r) {
+		for (size_t i = 0; i < SAMPLES; ++i) {
+			double_sink = strtod(strings[i], NULL);
+		}
+	}
+	report("strtod", start);
+
+	start = now_ns();
+	for (size_t r = 0; r < ROUNDS; ++r) {
+		for (size_t i = 0; i < SAMPLES; ++i) {
+			double_sink = rb_number_parse(strings[i], NULL);
+		}
+	}
+	report("rb_number_parse", start);
+}
+
+static void bench_format(void) {
+	char buf[RB_NUMBER_BUFSIZ];
+
+	double start = now_ns();
+	for (size_t r = 0; r < ROUNDS; ++r) {
+		for (size_t i = 0; i < SAMPLES; ++i) {
+			size_sink = (size_t)snprintf(
+					buf, sizeof(buf), "%lf", values[i]);
+		}
+	}
+	report("snprintf(\"%lf\")", start);
+
+	start = now_ns();
+	for (size_t r = 0; r < ROUNDS; ++r) {
+		for (size_t i = 0; i < SAMPLES; ++i) {
+			size_sink = rb_number_format(buf, values[i], 6);
+		}
+	}
+	report("rb_number_format(6)", start);
+
+	start = now_ns();
+	for (size_t r = 0; r < ROUNDS; ++r) {
+		for (size_t i = 0; i < SAMPLES; ++i) {
+			size_sink = (size_t)snprintf(
+					buf, sizeof(buf), "%.17g", values[i]);
+		}
+	}
+	report("snprintf(\"%.17g\")", start);
+
+	start = now_ns();
+	for (size_t r = 0; r < ROUNDS; ++r) {
+		for (size_t i = 0; i < SAMPLES; ++i) {
+			size_sink = rb_number_format(
+					buf,
+					values[i],
+					RB_NUMBER_PRECISION_SHORTEST);
+		}
+	}
+	report("rb_number_format(shortest)", start);
+
+	start = now_ns();
+	for (size_t r = 0; r < ROUNDS; ++r) {
+		for (size_t i = 0; i < SAMPLES; ++i) {
+			size_sink = (size_t)snprintf(buf,
+						     sizeof(buf),
+						     "%" PRId64,
+						     integers[i]);
+		}
+	}
+	report("snprintf(\"%\" PRId64)", start);
+
+	start = now_ns();
+	for (size_t r = 0; r < ROUNDS; ++r) {
+		for (size_t i = 0; i < SAMPLES; ++i) {
+			size_sink = rb_number_format_int(buf, integers[i]);
+		}
+	}
+	report("rb_number_format_int", start);
+}
+
+int main(void) {
+	prepare_samples();
+	bench_parse();
+	bench_format();
+	return 0;
+}
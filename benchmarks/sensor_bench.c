@@ -0,0 +1,170 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Sensor cycle benchmark: time and heap allocations of a whole sensor cycle,
+   from monitors polling to printed messages. Binary is linked with
+   -Wl,--wrap for heap functions, so allocations can be counted.
+
+   Usage: sensor_bench [cycles] [-p]. With -p, cycle messages are printed, so
+   the output of two builds can be compared. */
+
+#include "poller/spawn_server.h"
+#include "rb_arena.h"
+#include "rb_sensor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_CYCLES 2000
+
+/// Local monitors of every kind: proc scalars and vector, cached split
+/// system commands, given timestamps, and scalar and vector operations with
+/// default, fixed and shortest precision
+static const char sensor_config[] =
+		"{\"sensor_name\":\"bench\",\"sensor_id\":1,"
+		"\"enrichment\":{\"site\":\"mad\",\"n\":3,\"b\":true},"
+		"\"monitors\":["
+		"{\"name\":\"load_1\",\"proc\":\"loadavg:1\"},"
+		"{\"name\":\"load_5\",\"proc\":\"loadavg:2\"},"
+		"{\"name\":\"rx\",\"proc\":\"net/dev:*:rx_bytes\","
+		"\"split_op\":\"sum\"},"
+		"{\"name\":\"vec\","
+		"\"system\":\"echo '1;2;3;4;5;6;7;8;9;10;11;12;13;14;15;16'\","
+		"\"split\":\";\",\"split_op\":\"mean\",\"cache_ttl\":3600,"
+		"\"instance_prefix\":\"cpu-\",\"unit\":\"%\"},"
+		"{\"name\":\"ts\",\"system\":\"echo '1000:1;1000:2;1000:3'\","
+		"\"split\":\";\",\"timestamp_given\":1,"
+		"\"name_split_suffix\":\"_x\",\"group_id\":\"7\","
+		"\"instance_prefix\":\"t-\",\"cache_ttl\":3600},"
+		"{\"name\":\"op1\",\"op\":\"load_1*2+load_5\"},"
+		"{\"name\":\"op2\",\"op\":\"vec*2\",\"precision\":2,"
+		"\"split_op\":\"sum\"},"
+		"{\"name\":\"op3\",\"op\":\"vec+vec\","
+		"\"precision\":\"shortest\",\"integer\":1}"
+		"]}";
+
+/// Heap allocations since start
+static size_t allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *str);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t nmemb, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+char *__wrap_strdup(const char *str);
+
+void *__wrap_malloc(size_t size) {
+	allocs++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+	allocs++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	allocs++;
+	return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *str) {
+	allocs++;
+	return __real_strdup(str);
+}
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/** Release cycle messages, printing them if asked
+  @param msgs Messages
+  @param print Print messages payload
+  @return Number of messages
+  */
+static size_t messages_done(rb_message_list *msgs, bool print) {
+	size_t ret = 0;
+	while (!rb_message_list_empty(msgs)) {
+		rb_message_array_t *array = rb_message_list_first(msgs);
+		rb_message_list_remove(msgs, array);
+		for (size_t i = 0; print && i < array->count; ++i) {
+			printf("%.*s\n",
+			       (int)array->msgs[i].len,
+			       (const char *)array->msgs[i].payload);
+		}
+		ret += array->count;
+		rb_message_array_put(array);
+	}
+
+	return ret;
+}
+
+int main(int argc, char **argv) {
+	const int cycles = argc > 1 ? atoi(argv[1]) : DEFAULT_CYCLES;
+	const bool print = argc > 2 && 0 == strcmp(argv[2], "-p");
+	struct rb_arena arena;
+	size_t messages = 0;
+
+	if (cycles < 2 || 0 != spawn_server_start()) {
+		fprintf(stderr, "Usage: %s [cycles > 1] [-p]\n", argv[0]);
+		return 1;
+	}
+
+	json_object *config = json_tokener_parse(sensor_config);
+	rb_sensor_t *sensor = config ? parse_rb_sensor(config) : NULL;
+	if (NULL == sensor) {
+		fprintf(stderr, "Couldn't parse benchmark sensor\n");
+		return 1;
+	}
+	rb_arena_init(&arena, 0);
+
+	// First cycle fills caches and arenas, so it is not measured
+	rb_message_list msgs;
+	rb_message_list_init(&msgs);
+	process_rb_sensor(sensor, &arena, &msgs);
+	messages_done(&msgs, print);
+
+	const size_t start_allocs = allocs;
+	const double start = now_ns();
+	for (int i = 1; i < cycles; ++i) {
+		process_rb_sensor(sensor, &arena, &msgs);
+		messages += messages_done(&msgs, print);
+	}
+
+	// Keep stdout for messages when printing them
+	fprintf(print ? stderr : stdout,
+		"%-32s %8.1f us/cycle %8.1f allocations/cycle %4zu "
+		"messages/cycle\n",
+		"process_rb_sensor",
+		(now_ns() - start) / 1000 / (cycles - 1),
+		(double)(allocs - start_allocs) / (cycles - 1),
+		messages / (size_t)(cycles - 1));
+
+	rb_arena_done(&arena);
+	rb_sensor_put(sensor);
+	json_object_put(config);
+	spawn_server_stop();
+	return 0;
+}
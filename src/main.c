@@ -21,8 +21,12 @@
 
 #include "utils.h"
 
+#include "poller/spawn_server.h"
+#include "rb_avro.h"
+#include "rb_output.h"
 #include "rb_sensor.h"
 #include "rb_sensor_queue.h"
+#include "rb_sensor_scheduler.h"
 
 #ifdef HAVE_ZOOKEEPER
 #include "rb_monitor_zk.h"
@@ -72,6 +76,11 @@ static const char *str_default_config = /* "conf:" */ "{"
 	"\"max_snmp_fails\": 2,"
 	"\"sleep_main\": 10,"
 	"\"sleep_worker\": 2,"
+	"\"snmp_async\": 1,"
+	"\"snmp_max_inflight\": 4,"
+	"\"overrun_policy\": \"skip\","
+	"\"message_batch\": \"none\","
+	"\"kafka_key\": \"sensor_name\","
 "}";
 // clang-format on
 
@@ -88,12 +97,23 @@ struct _worker_info {
 #endif
 
 	rd_kafka_t *rk;
-	rd_kafka_topic_t *rkt;
 	rd_kafka_conf_t *rk_conf;
 	rd_kafka_topic_conf_t *rkt_conf;
+	enum rb_output_kafka_key kafka_key; ///< Default kafka messages key
+	json_object *sinks;		    ///< Output sinks configuration
+	const char *schema_store_path;      ///< Avro schema store file
+	struct rb_avro_schema_store *schema_store; ///< Avro schema store
+	const char *spool_dir;		    ///< Sinks spools directory
+	struct rb_output *output;	   ///< Output stage
 	int64_t sleep_worker, max_snmp_fails, timeout, debug_output_flags;
 	int64_t kafka_timeout;
-	rd_fifoq_t *queue;
+	int64_t snmp_async, snmp_max_inflight;
+	/// Default sensors overrun policy
+	enum rb_sensor_overrun_policy overrun_policy;
+	/// Default sensors messages batch mode
+	enum rb_message_batch message_batch;
+	struct rb_snmp_engine *snmp_engine; ///< Async SNMP engine, if any
+	sensor_queue_t *queue;
 #ifdef HAVE_RBHTTP
 	int64_t http_mode;
 	int64_t http_insecure;
@@ -282,6 +302,38 @@ static json_bool parse_json_config(json_object *config,
 		} else if (0 == strcmp(key, "max_snmp_fails")) {
 			worker_info->max_snmp_fails =
 					json_object_get_int64(val);
+		} else if (0 == strcmp(key, "snmp_async")) {
+			worker_info->snmp_async = json_object_get_int64(val);
+		} else if (0 == strcmp(key, "snmp_max_inflight")) {
+			worker_info->snmp_max_inflight =
+					json_object_get_int64(val);
+		} else if (0 == strcmp(key, "overrun_policy")) {
+			const char *sval = json_object_get_string(val);
+			if (!sval || !rb_sensor_overrun_policy_parse(
+						     sval,
+						     &worker_info->overrun_policy)) {
+				rdlog(LOG_ERR,
+				      "Invalid overrun_policy %s",
+				      sval ? sval : "(null)");
+			}
+		} else if (0 == strcmp(key, "message_batch")) {
+			const char *sval = json_object_get_string(val);
+			if (!sval || !rb_message_batch_parse(
+						     sval,
+						     &worker_info->message_batch)) {
+				rdlog(LOG_ERR,
+				      "Invalid message_batch %s",
+				      sval ? sval : "(null)");
+			}
+		} else if (0 == strcmp(key, "kafka_key")) {
+			const char *sval = json_object_get_string(val);
+			if (!sval || !rb_output_kafka_key_parse(
+						     sval,
+						     &worker_info->kafka_key)) {
+				rdlog(LOG_ERR,
+				      "Invalid kafka_key %s",
+				      sval ? sval : "(null)");
+			}
 		} else if (0 == strcmp(key, "max_kafka_fails")) {
 			worker_info->max_kafka_fails =
 					json_object_get_string(val);
@@ -298,6 +350,17 @@ static json_bool parse_json_config(json_object *config,
 			worker_info->kafka_broker = json_object_get_string(val);
 		} else if (0 == strcmp(key, "kafka_topic")) {
 			worker_info->kafka_topic = json_object_get_string(val);
+		} else if (0 == strcmp(key, "schema_store")) {
+			worker_info->schema_store_path =
+					json_object_get_string(val);
+		} else if (0 == strcmp(key, "spool_dir")) {
+			worker_info->spool_dir = json_object_get_string(val);
+		} else if (0 == strcmp(key, "sinks")) {
+			if (!json_object_is_type(val, json_type_array)) {
+				rdlog(LOG_ERR, "sinks must be an array");
+			} else {
+				worker_info->sinks = val;
+			}
 		} else if (0 == strcmp(key, "kafka_timeout")) {
 			worker_info->kafka_timeout = json_object_get_int64(val);
 		} else if (0 == strcmp(key, "sleep_worker")) {
@@ -365,19 +428,21 @@ static json_bool parse_json_config(json_object *config,
  * See rdkafka.h for more information.
  */
 static void msg_delivered(rd_kafka_t *rk,
-			  void *payload,
-			  size_t len,
-			  int error_code,
-			  void *opaque,
-			  void *msg_opaque) {
-	(void)rk, (void)opaque, (void)payload, (void)msg_opaque;
-	if (error_code) {
+			  const rd_kafka_message_t *rkmessage,
+			  void *opaque) {
+	(void)rk, (void)opaque;
+	if (rkmessage->err) {
 		rdlog(LOG_ERR,
 		      "%% Message delivery failed: %s",
-		      rd_kafka_err2str(error_code));
+		      rd_kafka_err2str(rkmessage->err));
 	} else {
-		rdlog(LOG_DEBUG, "%% Message delivered (%zd bytes)", len);
+		rdlog(LOG_DEBUG,
+		      "%% Message delivered (%zd bytes)",
+		      rkmessage->len);
 	}
+
+	// Sink spool takes care of failed messages
+	rb_output_kafka_delivered(rkmessage);
 }
 
 #ifdef HAVE_RBHTTP
@@ -401,9 +466,12 @@ static void msg_callback(struct rb_http_handler_s *rb_http_handler,
 	}
 
 	(void)rb_http_handler;
-	(void)bufsiz;
-	(void)buff;
-	(void)opaque;
+
+	// Sink spool takes care of failed messages
+	rb_output_http_delivered(opaque,
+				 status_code == 0 && http_status == 200,
+				 buff,
+				 bufsiz);
 }
 
 static void *get_report_thread(void *http_handler) {
@@ -504,127 +572,117 @@ static void process_rb_http_options(struct _worker_info *worker_info) {
 
 #endif
 
-static int worker_process_sensor_send_array(struct _worker_info *worker_info,
-					    rb_message_array_t *msgs) {
-	for (size_t i = 0; i < msgs->count; ++i) {
-		char *msg = msgs->msgs[i].payload;
-		size_t len = msgs->msgs[i].len;
-
-		if (worker_info->kafka_broker) {
-			rdlog(LOG_DEBUG, "[Kafka] %s", msg);
-			const int produce_rc = rd_kafka_produce(
-					worker_info->rkt,
-					RD_KAFKA_PARTITION_UA,
-					RD_KAFKA_MSG_F_COPY,
-					/* Payload and length */
-					msg,
-					len,
-					/* Optional key and its length */
-					NULL,
-					0,
-					/* Message opaque, provided in delivery
-					 * report
-					 * callback as
-					 * msg_opaque. */
-					NULL);
-			if (0 != produce_rc) {
-				rdlog(LOG_ERR,
-				      "[Kafka] Cannot produce kafka message: "
-				      "%s",
-				      rd_kafka_err2str(rd_kafka_errno2err(
-						      errno)));
-			}
-		} /* if kafka */
-
-#ifdef HAVE_RBHTTP
-		if (worker_info->http_handler) {
-			char err[BUFSIZ];
-			rdlog(LOG_DEBUG, "[HTTP] %s", msg);
-			const int produce_rc = rb_http_produce(
-					worker_info->http_handler,
-					msg,
-					len,
-					RB_HTTP_MESSAGE_F_COPY,
-					err,
-					sizeof(err),
-					NULL);
-			if (0 != produce_rc) {
-				rdlog(LOG_ERR,
-				      "[HTTP] Cannot produce message: %s",
-				      err);
-			}
-		}
-#endif
-		free(msg);
-	}
-
-	message_array_done(msgs);
+static int worker_process_sensor_send_messages(struct _worker_info *worker_info,
+					       rb_message_list *msgs) {
+	rb_output_send(worker_info->output, msgs);
 	return 0;
 }
 
-static int worker_process_sensor_send_messages(struct _worker_info *worker_info,
-					       rb_message_list *msgs) {
-	while (!(rb_message_list_empty(msgs))) {
-		rb_message_array_t *array = rb_message_list_first(msgs);
-		rb_message_list_remove(msgs, array);
-		worker_process_sensor_send_array(worker_info, array);
-	}
+/** Sensor SNMP responses are ready, so we can re-queue it to process
+  @param sensor Sensor
+  @param vworker_info Common information to all workers
+  */
+static void worker_sensor_snmp_ready(rb_sensor_t *sensor, void *vworker_info) {
+	struct _worker_info *worker_info = vworker_info;
+	queue_sensor(worker_info->queue, sensor);
+}
 
-	return 0;
+/** Finish a sensor cycle, processing it again if a coalesced cycle is pending
+  @param worker_info Common information to all workers
+  @param sensor Sensor
+  */
+static void worker_sensor_cycle_done(struct _worker_info *worker_info,
+				     rb_sensor_t *sensor) {
+	if (rb_sensor_cycle_done(sensor)) {
+		// Reuse the sensor reference for the coalesced cycle
+		queue_sensor(worker_info->queue, sensor);
+	} else {
+		rb_sensor_put(sensor);
+	}
 }
 
 /** Process sensor
   @param worker_info Common information to all workers
   @param sensor Sensor to process
+  @param arena Worker cycle arena
   @return OK
   */
-static int
-worker_process_sensor(struct _worker_info *worker_info, rb_sensor_t *sensor) {
+static int worker_process_sensor(struct _worker_info *worker_info,
+				 rb_sensor_t *sensor,
+				 struct rb_arena *arena) {
 	rb_message_list messages;
 	rb_message_list_init(&messages);
 
 	assert(sensor);
 	assert_rb_sensor(sensor);
 
-	process_rb_sensor(sensor, &messages);
-	rb_sensor_put(sensor);
+	if (worker_info->snmp_engine) {
+		switch (rb_sensor_snmp_async_request(sensor,
+						     worker_info->snmp_engine,
+						     worker_sensor_snmp_ready,
+						     worker_info)) {
+		case RB_SENSOR_SNMP_ASYNC_PENDING:
+			/* Sensor will be queued again when ready */
+			return 0;
+		case RB_SENSOR_SNMP_ASYNC_BUSY:
+			worker_sensor_cycle_done(worker_info, sensor);
+			return 0;
+		case RB_SENSOR_SNMP_ASYNC_READY:
+		default:
+			break;
+		};
+	}
+
+	process_rb_sensor(sensor, arena, &messages);
+	rb_sensor_batch_messages(sensor, worker_info->message_batch, &messages);
+	worker_sensor_cycle_done(worker_info, sensor);
 
 	worker_process_sensor_send_messages(worker_info, &messages);
 
 	return 0;
 }
 
+/// Worker thread information
+struct worker_thread {
+	pthread_t thread;		  ///< Thread
+	struct _worker_info *worker_info; ///< Common information to all workers
+	size_t idx;			  ///< Worker index in sensors queue
+};
+
 /** Worker main function thread
-  @param _info worker info
+  @param _info worker thread info
   @return provided _info
   */
 static void *worker(void *_info) {
-	struct _worker_info *worker_info = _info;
+	struct worker_thread *worker_thread = _info;
+	struct _worker_info *worker_info = worker_thread->worker_info;
+	rb_sensor_t *sensors[SENSOR_QUEUE_BATCH];
+	size_t sensors_count = 0;
+	struct rb_arena arena;
 
+	rb_arena_init(&arena, 0);
 	rdlog(LOG_INFO, "Worker connected successfuly.");
-	while (run) {
-		rb_sensor_t *sensor = NULL;
+	while ((sensors_count = pop_sensors(worker_info->queue,
+					    worker_thread->idx,
+					    sensors,
+					    RD_ARRAYSIZE(sensors)))) {
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-		while ((sensor = pop_sensor(worker_info->queue, 100)) && run) {
-			worker_process_sensor(worker_info, sensor);
+		for (size_t i = 0; i < sensors_count; ++i) {
+			worker_process_sensor(worker_info, sensors[i], &arena);
 		}
 		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 	}
 
-	return _info; // just avoiding warning.
-}
+	rdlog(LOG_DEBUG,
+	      "Worker arena: %zu allocations in %zu cycles, %zu chunks, "
+	      "%zu bytes max",
+	      arena.stats.allocs,
+	      arena.stats.resets,
+	      arena.stats.chunk_allocs,
+	      arena.stats.high_water);
+	rb_arena_done(&arena);
 
-/** Queue sensors from array to sensors queue, increasing 1 it's reference
-  counter
-  @param sarray Sensors array
-  @param squeue Sensors queue
-  */
-static void queue_sensors(rb_sensors_array_t *sarray, rd_fifoq_t *squeue) {
-	for (size_t i = 0; i < sarray->count; ++i) {
-		rb_sensor_t *sensor = sarray->elms[i];
-		rb_sensor_get(sensor);
-		queue_sensor(squeue, sensor);
-	}
+	return _info; // just avoiding warning.
 }
 
 static void *rdkafka_delivery_reports_poll_f(void *void_worker_info) {
@@ -738,9 +796,8 @@ int main(int argc, char *argv[]) {
 	worker_info.rk_conf = rd_kafka_conf_new();
 	worker_info.rkt_conf = rd_kafka_topic_conf_new();
 
-	pthread_t *pd_thread = NULL;
-	rd_fifoq_t queue;
-	sensor_queue_init(&queue);
+	struct worker_thread *pd_thread = NULL;
+	sensor_queue_t queue;
 
 	assert(default_config);
 
@@ -818,6 +875,18 @@ int main(int argc, char *argv[]) {
 					       // values.
 	}
 
+	if (0 != sensor_queue_init(&queue, main_info.threads)) {
+		rdlog(LOG_CRIT, "Couldn't create sensors queue. Exiting");
+		exit(1);
+	}
+
+	// Needs to be forked before any thread is created
+	if (0 != spawn_server_start()) {
+		rdlog(LOG_ERR,
+		      "Couldn't start spawn server, system monitors will "
+		      "not work");
+	}
+
 	if (FALSE != json_object_object_get_ex(config_file, "zookeeper", &zk)) {
 #ifndef HAVE_ZOOKEEPER
 		rdlog(LOG_ERR, "This monitor does not have zookeeper enabled.");
@@ -832,7 +901,7 @@ int main(int argc, char *argv[]) {
 	// rd_init();
 
 	if (worker_info.kafka_broker) {
-		rd_kafka_conf_set_dr_cb(worker_info.rk_conf, msg_delivered);
+		rd_kafka_conf_set_dr_msg_cb(worker_info.rk_conf, msg_delivered);
 		char errstr[BUFSIZ];
 		if (!(worker_info.rk = rd_kafka_new(RD_KAFKA_PRODUCER,
 						    worker_info.rk_conf,
@@ -853,12 +922,7 @@ int main(int argc, char *argv[]) {
 			exit(1);
 		}
 
-		worker_info.rkt = rd_kafka_topic_new(worker_info.rk,
-						     worker_info.kafka_topic,
-						     worker_info.rkt_conf);
-
 		worker_info.rk_conf = NULL;
-		worker_info.rkt_conf = NULL;
 
 		pthread_create(&rdkafka_delivery_reports_poll_thread,
 			       NULL,
@@ -867,7 +931,6 @@ int main(int argc, char *argv[]) {
 	} else {
 		// Not needed
 		rd_kafka_conf_destroy(worker_info.rk_conf);
-		rd_kafka_topic_conf_destroy(worker_info.rkt_conf);
 	}
 
 #ifdef HAVE_RBHTTP
@@ -900,14 +963,60 @@ int main(int argc, char *argv[]) {
 	}
 #endif /* HAVE_RBHTTP */
 
+	if (worker_info.schema_store_path) {
+		worker_info.schema_store = rb_avro_schema_store_new(
+				worker_info.schema_store_path);
+		if (NULL == worker_info.schema_store) {
+			rdlog(LOG_CRIT, "Couldn't load schema store. Exiting");
+			exit(1);
+		}
+	}
+
+	const struct rb_output_handlers output_handlers = {
+		.rk = worker_info.rk,
+		.rkt_conf = worker_info.rkt_conf,
+		.kafka_topic = worker_info.kafka_topic,
+		.kafka_key = worker_info.kafka_key,
+#ifdef HAVE_RBHTTP
+		.http_handler = worker_info.http_handler,
+#endif
+		.schema_store = worker_info.schema_store,
+		.spool_dir = worker_info.spool_dir,
+	};
+	worker_info.output = rb_output_new(worker_info.sinks, &output_handlers);
+	rd_kafka_topic_conf_destroy(worker_info.rkt_conf);
+	worker_info.rkt_conf = NULL;
+	if (NULL == worker_info.output) {
+		rdlog(LOG_CRIT, "Couldn't create output sinks. Exiting");
+		exit(1);
+	}
+
+	// Need to load MIBs before resolve monitors OIDs
+	init_snmp("redBorder-monitor");
 	rb_sensors_array_t *sensors_array = parse_sensors(config_file);
 	if (!sensors_array) {
 		rdlog(LOG_ERR, "Couldn't create sensor array (OOM?)");
 		exit(1);
 	}
 
-	init_snmp("redBorder-monitor");
-	pd_thread = malloc(sizeof(pthread_t) * main_info.threads);
+	if (worker_info.snmp_async) {
+		if (worker_info.snmp_max_inflight <= 0) {
+			rdlog(LOG_WARNING,
+			      "Can't use %" PRId64 " SNMP max inflight, using 1",
+			      worker_info.snmp_max_inflight);
+			worker_info.snmp_max_inflight = 1;
+		}
+
+		worker_info.snmp_engine = rb_snmp_engine_new(
+				(size_t)worker_info.snmp_max_inflight);
+		if (NULL == worker_info.snmp_engine) {
+			rdlog(LOG_ERR,
+			      "Couldn't create async SNMP engine, using "
+			      "synchronous SNMP requests");
+		}
+	}
+
+	pd_thread = malloc(sizeof(pd_thread[0]) * main_info.threads);
 	if (!pd_thread) {
 		rdlog(LOG_CRIT,
 		      "[EE] Unable to allocate threads memory. Exiting.");
@@ -919,24 +1028,55 @@ int main(int argc, char *argv[]) {
 	      "Starting workers threads.");
 
 	for (size_t i = 0; i < main_info.threads; ++i) {
-		pthread_create(&pd_thread[i],
+		pd_thread[i].worker_info = &worker_info;
+		pd_thread[i].idx = i;
+		pthread_create(&pd_thread[i].thread,
 			       NULL,
 			       worker,
-			       (void *)&worker_info);
+			       (void *)&pd_thread[i]);
+	}
+
+	struct rb_sensors_scheduler *scheduler =
+			rb_sensors_scheduler_new(sensors_array,
+						 1000 * main_info.sleep_main,
+						 worker_info.overrun_policy,
+						 &queue);
+	if (NULL == scheduler) {
+		rdlog(LOG_CRIT, "Couldn't create sensors scheduler. Exiting.");
+		exit(1);
 	}
 
 	while (run) {
-		queue_sensors(sensors_array, &queue);
-		sleep(main_info.sleep_main);
+		// Wake up at least every second to check if we need to exit
+		rb_sensors_scheduler_run(scheduler, 1000);
+	}
+
+	rb_sensors_scheduler_done(scheduler);
+
+	// Cancelled requests callbacks queue their sensors, so workers can
+	// release them
+	if (worker_info.snmp_engine) {
+		rb_snmp_engine_done(worker_info.snmp_engine);
 	}
 
 	rdlog(LOG_INFO, "Leaving, wait for workers...");
+	sensor_queue_stop(&queue);
 	for (size_t i = 0; i < main_info.threads; ++i) {
-		pthread_join(pd_thread[i], NULL);
+		pthread_join(pd_thread[i].thread, NULL);
 	}
 	free(pd_thread);
+	// Release sensors queued after workers exit
+	sensor_queue_done(&queue);
 
+	// Streams use spawn server socket until stream manager thread exits
 	rb_sensors_array_done(sensors_array);
+	spawn_server_stop();
+
+	// Send queued messages before flushing kafka and HTTP handlers
+	rb_output_done(worker_info.output);
+	if (worker_info.schema_store) {
+		rb_avro_schema_store_done(worker_info.schema_store);
+	}
 
 	if (worker_info.kafka_broker) {
 		int msg_left = 0;
@@ -951,9 +1091,7 @@ int main(int argc, char *argv[]) {
 				rd_kafka_poll(worker_info.rk, 1000);
 			}
 
-			rd_kafka_topic_destroy(worker_info.rkt);
 			rd_kafka_destroy(worker_info.rk);
-			worker_info.rkt = NULL;
 			worker_info.rk = NULL;
 		}
 	}
@@ -968,7 +1106,6 @@ int main(int argc, char *argv[]) {
 
 	json_object_put(default_config);
 	json_object_put(config_file);
-	sensor_queue_done(&queue);
 	closelog();
 
 	return ret;
@@ -0,0 +1,639 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include "proc.h"
+
+#include "rb_number.h"
+
+#include <librd/rd.h>
+#include <librd/rdlog.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/// Initial read buffer of a proc file
+#define PROC_FILE_MIN_READ 4096
+
+/// Cached /proc or /sys file
+struct proc_file {
+	const char *path;    ///< File path
+	int fd;		     ///< Cached file descriptor, -1 if not opened yet
+	size_t size_hint;    ///< Biggest size read, to read it in one call
+};
+
+/** Extract row name from a file line
+  @param line Line start
+  @param eol Line end
+  @param row Row name
+  @param row_len Row name length
+  @return Row values start, or NULL if line has no row
+  */
+typedef const char *(*proc_row_fn)(const char *line,
+				   const char *eol,
+				   const char **row,
+				   size_t *row_len);
+
+/// Proc file format
+struct proc_source {
+	const char *name;	     ///< Name in monitor argument
+	struct proc_file *file;      ///< File to read, NULL if given by user
+	size_t header_lines;	 ///< Lines to skip before values
+	proc_row_fn row;	     ///< Row name extractor, NULL if no rows
+	const char *const *columns;  ///< Columns names
+	size_t columns_count;	///< Length of columns
+};
+
+struct proc_query {
+	const struct proc_source *source; ///< Format of file
+	struct proc_file *file;		  ///< File to read
+	struct proc_file own_file;	///< File, if it is given by user
+	char *row;			  ///< Row to select, NULL if no rows
+	size_t row_len;			  ///< Row length, without '*'
+	bool vector;			  ///< Select all rows with row prefix
+	size_t column;			  ///< Column of row values
+};
+
+/// Proc file read in a snapshot
+struct proc_snapshot_file {
+	const struct proc_file *file; ///< File read
+	char *buf;		      ///< File content, or NULL if error
+	size_t len;		      ///< Length of buf
+};
+
+struct proc_snapshot {
+	struct proc_snapshot_file *files; ///< Files read
+	size_t count;			  ///< Number of files read
+	size_t capacity;		  ///< Length of files
+};
+
+/*
+ *  PARSING HELPERS
+ */
+
+/** Check if character separate values
+  @param c Character
+  @return true if it is a separator
+  */
+static bool proc_is_sep(char c) {
+	return c == ' ' || c == '\t' || c == '/';
+}
+
+/** Skip separators
+  @param cursor String
+  @param eol Line end
+  @return First non separator char
+  */
+static const char *proc_skip_sep(const char *cursor, const char *eol) {
+	while (cursor < eol && proc_is_sep(*cursor)) {
+		cursor++;
+	}
+	return cursor;
+}
+
+/** Skip a token
+  @param cursor String
+  @param eol Line end
+  @return First separator after token
+  */
+static const char *proc_skip_token(const char *cursor, const char *eol) {
+	while (cursor < eol && !proc_is_sep(*cursor)) {
+		cursor++;
+	}
+	return cursor;
+}
+
+/** Get nth number of a line
+  @param values Values start
+  @param eol Line end
+  @param n Position of number
+  @param value Extracted value
+  @return true if the number was found
+  */
+static bool proc_nth_number(const char *values,
+			    const char *eol,
+			    size_t n,
+			    double *value) {
+	const char *cursor = proc_skip_sep(values, eol);
+	for (; n > 0 && cursor < eol; --n) {
+		cursor = proc_skip_sep(proc_skip_token(cursor, eol), eol);
+	}
+
+	if (cursor >= eol) {
+		return false;
+	}
+
+	// Buffer is null-terminated, and number ends before eol
+	char *end = NULL;
+	*value = rb_number_parse(cursor, &end);
+	return end != cursor && end <= eol;
+}
+
+/** Row name is the first token of the line */
+static const char *proc_row_first_token(const char *line,
+					const char *eol,
+					const char **row,
+					size_t *row_len) {
+	*row = proc_skip_sep(line, eol);
+	const char *row_end = proc_skip_token(*row, eol);
+	*row_len = (size_t)(row_end - *row);
+	return *row_len ? row_end : NULL;
+}
+
+/** Row name is the third token of the line */
+static const char *proc_row_third_token(const char *line,
+					const char *eol,
+					const char **row,
+					size_t *row_len) {
+	const char *cursor = proc_skip_sep(line, eol);
+	cursor = proc_skip_sep(proc_skip_token(cursor, eol), eol);
+	cursor = proc_skip_sep(proc_skip_token(cursor, eol), eol);
+	return proc_row_first_token(cursor, eol, row, row_len);
+}
+
+/** Row name is the text before ':' */
+static const char *proc_row_colon(const char *line,
+				  const char *eol,
+				  const char **row,
+				  size_t *row_len) {
+	const char *colon = memchr(line, ':', (size_t)(eol - line));
+	if (NULL == colon) {
+		return NULL;
+	}
+
+	*row = proc_skip_sep(line, colon);
+	*row_len = (size_t)(colon - *row);
+	return colon + 1;
+}
+
+/*
+ *  SOURCES
+ */
+
+static struct proc_file proc_loadavg_file = {
+		.path = "/proc/loadavg", .fd = -1,
+};
+static struct proc_file proc_meminfo_file = {
+		.path = "/proc/meminfo", .fd = -1,
+};
+static struct proc_file proc_stat_file = {
+		.path = "/proc/stat", .fd = -1,
+};
+static struct proc_file proc_net_dev_file = {
+		.path = "/proc/net/dev", .fd = -1,
+};
+static struct proc_file proc_diskstats_file = {
+		.path = "/proc/diskstats", .fd = -1,
+};
+
+static const char *const proc_loadavg_columns[] = {
+		"1", "5", "15", "running", "total",
+};
+
+static const char *const proc_stat_columns[] = {
+		"user",
+		"nice",
+		"system",
+		"idle",
+		"iowait",
+		"irq",
+		"softirq",
+		"steal",
+		"guest",
+		"guest_nice",
+};
+
+static const char *const proc_net_dev_columns[] = {
+		"rx_bytes",
+		"rx_packets",
+		"rx_errs",
+		"rx_drop",
+		"rx_fifo",
+		"rx_frame",
+		"rx_compressed",
+		"rx_multicast",
+		"tx_bytes",
+		"tx_packets",
+		"tx_errs",
+		"tx_drop",
+		"tx_fifo",
+		"tx_colls",
+		"tx_carrier",
+		"tx_compressed",
+};
+
+static const char *const proc_diskstats_columns[] = {
+		"reads",
+		"reads_merged",
+		"sectors_read",
+		"read_ms",
+		"writes",
+		"writes_merged",
+		"sectors_written",
+		"write_ms",
+		"io_in_progress",
+		"io_ms",
+		"weighted_io_ms",
+};
+
+#define PROC_SOURCE_COLUMNS(cols) .columns = cols,                            \
+				  .columns_count = RD_ARRAYSIZE(cols)
+
+static const struct proc_source proc_sources[] = {
+		{
+				.name = "loadavg",
+				.file = &proc_loadavg_file,
+				PROC_SOURCE_COLUMNS(proc_loadavg_columns),
+		},
+		{
+				.name = "meminfo",
+				.file = &proc_meminfo_file,
+				.row = proc_row_colon,
+		},
+		{
+				.name = "stat",
+				.file = &proc_stat_file,
+				.row = proc_row_first_token,
+				PROC_SOURCE_COLUMNS(proc_stat_columns),
+		},
+		{
+				.name = "net/dev",
+				.file = &proc_net_dev_file,
+				.header_lines = 2,
+				.row = proc_row_colon,
+				PROC_SOURCE_COLUMNS(proc_net_dev_columns),
+		},
+		{
+				.name = "diskstats",
+				.file = &proc_diskstats_file,
+				.row = proc_row_third_token,
+				PROC_SOURCE_COLUMNS(proc_diskstats_columns),
+		},
+		{
+				.name = "file",
+		},
+};
+
+/** Open a proc file if it is not opened yet
+  @param file File
+  @return 0 if success, !0 in other case
+  */
+static int proc_file_open(struct proc_file *file) {
+	if (ATOMIC_OP(add, fetch, &file->fd, 0) >= 0) {
+		return 0;
+	}
+
+	const int fd = open(file->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		rdlog(LOG_ERR,
+		      "Couldn't open %s: %s",
+		      file->path,
+		      strerror(errno));
+		return -1;
+	}
+
+	if (!__sync_bool_compare_and_swap(&file->fd, -1, fd)) {
+		// Other thread opened it first
+		close(fd);
+	}
+
+	return 0;
+}
+
+/** Read a whole proc file
+  @param file File
+  @param len Length of read content
+  @return Null-terminated file content, or NULL in case of error
+  */
+static char *proc_file_read(struct proc_file *file, size_t *len) {
+	const size_t size_hint = ATOMIC_OP(add, fetch, &file->size_hint, 0);
+	size_t capacity = RD_MAX(size_hint + 1, (size_t)PROC_FILE_MIN_READ);
+	char *buf = malloc(capacity + 1);
+
+	*len = 0;
+	while (buf) {
+		const ssize_t rc = pread(file->fd,
+					 &buf[*len],
+					 capacity - *len,
+					 (off_t)*len);
+		if (rc < 0 && errno == EINTR) {
+			continue;
+		} else if (rc < 0) {
+			rdlog(LOG_ERR,
+			      "Couldn't read %s: %s",
+			      file->path,
+			      strerror(errno));
+			free(buf);
+			return NULL;
+		} else if (0 == rc) {
+			break;
+		}
+
+		*len += (size_t)rc;
+		if (*len == capacity) {
+			capacity *= 2;
+			char *new_buf = realloc(buf, capacity + 1);
+			if (NULL == new_buf) {
+				free(buf);
+			}
+			buf = new_buf;
+		}
+	}
+
+	if (NULL == buf) {
+		rdlog(LOG_ERR, "Couldn't allocate %s buffer (OOM?)", file->path);
+		return NULL;
+	}
+
+	buf[*len] = '\0';
+	if (*len > size_hint) {
+		__sync_bool_compare_and_swap(&file->size_hint, size_hint, *len);
+	}
+	return buf;
+}
+
+/** Get a file content, reading it if it is not in the snapshot yet
+  @param snapshot Snapshot
+  @param file File to read
+  @param len File content length
+  @return File content, or NULL in case of error
+  */
+static const char *proc_snapshot_file(struct proc_snapshot *snapshot,
+				      struct proc_file *file,
+				      size_t *len) {
+	for (size_t i = 0; i < snapshot->count; ++i) {
+		if (snapshot->files[i].file == file) {
+			*len = snapshot->files[i].len;
+			return snapshot->files[i].buf;
+		}
+	}
+
+	if (snapshot->count == snapshot->capacity) {
+		const size_t new_capacity =
+				snapshot->capacity ? 2 * snapshot->capacity : 4;
+		struct proc_snapshot_file *files =
+				realloc(snapshot->files,
+					new_capacity * sizeof(files[0]));
+		if (NULL == files) {
+			rdlog(LOG_ERR, "Couldn't grow proc snapshot (OOM?)");
+			return NULL;
+		}
+		snapshot->files = files;
+		snapshot->capacity = new_capacity;
+	}
+
+	// Errors are cached too, so we don't retry in the same cycle
+	struct proc_snapshot_file *snapshot_file =
+			&snapshot->files[snapshot->count++];
+	snapshot_file->file = file;
+	snapshot_file->buf = proc_file_read(file, &snapshot_file->len);
+	*len = snapshot_file->len;
+	return snapshot_file->buf;
+}
+
+/*
+ *  QUERY
+ */
+
+/** Resolve a column name or position
+  @param source Query source
+  @param column Column name or position, NULL for first column
+  @param pos Column position
+  @return true if column is valid
+  */
+static bool proc_query_column(const struct proc_source *source,
+			      const char *column,
+			      size_t *pos) {
+	if (NULL == column || '\0' == *column) {
+		*pos = 0;
+		return true;
+	}
+
+	for (size_t i = 0; i < source->columns_count; ++i) {
+		if (0 == strcmp(source->columns[i], column)) {
+			*pos = i;
+			return true;
+		}
+	}
+
+	char *end = NULL;
+	errno = 0;
+	const unsigned long ret = strtoul(column, &end, 10);
+	if (0 != errno || '\0' != *end || '-' == column[0]) {
+		return false;
+	}
+
+	*pos = ret;
+	return true;
+}
+
+struct proc_query *proc_query_new(const char *arg) {
+	const char *source_end = strchr(arg, ':');
+	const struct proc_source *source = NULL;
+	const char *column = NULL;
+
+	if (NULL == source_end) {
+		rdlog(LOG_ERR, "Invalid proc monitor %s: no source", arg);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < RD_ARRAYSIZE(proc_sources); ++i) {
+		const size_t name_len = strlen(proc_sources[i].name);
+		if (name_len == (size_t)(source_end - arg) &&
+		    0 == strncmp(proc_sources[i].name, arg, name_len)) {
+			source = &proc_sources[i];
+			break;
+		}
+	}
+
+	if (NULL == source) {
+		rdlog(LOG_ERR, "Invalid proc monitor %s: unknown source", arg);
+		return NULL;
+	}
+
+	struct proc_query *ret = calloc(1, sizeof(*ret));
+	if (NULL == ret) {
+		rdlog(LOG_ERR, "Couldn't allocate proc query (OOM?)");
+		return NULL;
+	}
+
+	ret->source = source;
+	ret->own_file.fd = -1;
+	const char *params = source_end + 1;
+
+	if (NULL == source->file) {
+		// User file
+		if (0 != strncmp(params, "/proc/", strlen("/proc/")) &&
+		    0 != strncmp(params, "/sys/", strlen("/sys/"))) {
+			rdlog(LOG_ERR,
+			      "Invalid proc monitor %s: file must be in /proc "
+			      "or /sys",
+			      arg);
+			goto err;
+		}
+
+		ret->own_file.path = strdup(params);
+		if (NULL == ret->own_file.path) {
+			goto err_oom;
+		}
+		ret->file = &ret->own_file;
+	} else if (source->row) {
+		const char *row_end = strchr(params, ':');
+		const size_t row_len = row_end ? (size_t)(row_end - params)
+					       : strlen(params);
+		if (0 == row_len) {
+			rdlog(LOG_ERR, "Invalid proc monitor %s: no row", arg);
+			goto err;
+		}
+
+		ret->row = strndup(params, row_len);
+		if (NULL == ret->row) {
+			goto err_oom;
+		}
+		ret->row_len = row_len;
+		ret->vector = '*' == ret->row[row_len - 1];
+		if (ret->vector) {
+			ret->row_len--;
+		}
+		column = row_end ? row_end + 1 : NULL;
+		ret->file = source->file;
+	} else {
+		column = params;
+		ret->file = source->file;
+	}
+
+	if (!proc_query_column(source, column, &ret->column)) {
+		rdlog(LOG_ERR, "Invalid proc monitor %s: unknown column", arg);
+		goto err;
+	}
+
+	if (0 != proc_file_open(ret->file)) {
+		goto err;
+	}
+
+	return ret;
+
+err_oom:
+	rdlog(LOG_ERR, "Couldn't allocate proc query (OOM?)");
+err:
+	proc_query_done(ret);
+	return NULL;
+}
+
+void proc_query_done(struct proc_query *query) {
+	if (query->own_file.fd >= 0) {
+		close(query->own_file.fd);
+	}
+	free((char *)query->own_file.path);
+	free(query->row);
+	free(query);
+}
+
+/** Check if a row is selected by query
+  @param query Query
+  @param row Row name
+  @param row_len Row name length
+  @return true if selected
+  */
+static bool proc_query_row_match(const struct proc_query *query,
+				 const char *row,
+				 size_t row_len) {
+	if (query->vector) {
+		return row_len > query->row_len &&
+		       0 == memcmp(row, query->row, query->row_len);
+	}
+
+	return row_len == query->row_len &&
+	       0 == memcmp(row, query->row, query->row_len);
+}
+
+size_t proc_query_eval(const struct proc_query *query,
+		       struct proc_snapshot *snapshot,
+		       proc_query_cb cb,
+		       void *opaque) {
+	size_t len = 0, ret = 0;
+	const char *buf = proc_snapshot_file(snapshot, query->file, &len);
+	if (NULL == buf) {
+		return 0;
+	}
+
+	const char *end = buf + len;
+	const char *next_line = NULL;
+	size_t line_no = 0;
+	for (const char *line = buf; line < end; line = next_line, line_no++) {
+		const char *eol = memchr(line, '\n', (size_t)(end - line));
+		if (NULL == eol) {
+			eol = end;
+		}
+		next_line = eol + 1;
+
+		if (line_no < query->source->header_lines) {
+			continue;
+		}
+
+		const char *values = line;
+		const char *row = NULL;
+		size_t row_len = 0;
+		if (query->source->row) {
+			values = query->source->row(line, eol, &row, &row_len);
+			if (NULL == values ||
+			    !proc_query_row_match(query, row, row_len)) {
+				continue;
+			}
+		}
+
+		double value = 0;
+		if (!proc_nth_number(values, eol, query->column, &value)) {
+			continue;
+		}
+
+		cb(query->vector ? row : NULL, row_len, value, opaque);
+		ret++;
+		if (!query->vector) {
+			break;
+		}
+	}
+
+	return ret;
+}
+
+/*
+ *  SNAPSHOT
+ */
+
+struct proc_snapshot *proc_snapshot_new(void) {
+	struct proc_snapshot *ret = calloc(1, sizeof(*ret));
+	if (NULL == ret) {
+		rdlog(LOG_ERR, "Couldn't allocate proc snapshot (OOM?)");
+	}
+	return ret;
+}
+
+void proc_snapshot_done(struct proc_snapshot *snapshot) {
+	for (size_t i = 0; i < snapshot->count; ++i) {
+		free(snapshot->files[i].buf);
+	}
+	free(snapshot->files);
+	free(snapshot);
+}
@@ -0,0 +1,87 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Query over a /proc or /sys file, parsed from a proc monitor argument:
+  - loadavg:<1|5|15|running|total>
+  - meminfo:<key>
+  - stat:<row>[:<column>], like stat:cpu:idle or stat:ctxt
+  - net/dev:<interface>:<column>, like net/dev:eth0:rx_bytes
+  - diskstats:<device>:<column>, like diskstats:sda:reads
+  - file:<path>, first number of any /proc or /sys file
+
+  Rows ending in '*' select all the rows with that prefix (except the prefix
+  itself) as a vector, like stat:cpu*:idle or net/dev:*:tx_bytes. Columns can
+  be given by name or by position.
+  */
+struct proc_query;
+
+/** Files read in a cycle. Every file is read at most once per snapshot, no
+  matter how many queries use it. */
+struct proc_snapshot;
+
+/** Parse a proc query
+  @param arg Proc monitor argument
+  @return New query, or NULL in case of error
+  */
+struct proc_query *proc_query_new(const char *arg);
+
+/** Free a proc query
+  @param query Query to free
+  */
+void proc_query_done(struct proc_query *query);
+
+/** Proc query result callback
+  @param instance Matched row name (not null-terminated), or NULL if query is
+  not a vector
+  @param instance_len Length of instance
+  @param value Value
+  @param opaque Opaque passed to proc_query_eval
+  */
+typedef void (*proc_query_cb)(const char *instance,
+			      size_t instance_len,
+			      double value,
+			      void *opaque);
+
+/** Evaluate a proc query. Results are passed to the callback, so no memory is
+  allocated in the parsing.
+  @param query Query
+  @param snapshot Snapshot to read files from
+  @param cb Callback to call for each value
+  @param opaque Callback opaque
+  @return Number of values found
+  */
+size_t proc_query_eval(const struct proc_query *query,
+		       struct proc_snapshot *snapshot,
+		       proc_query_cb cb,
+		       void *opaque);
+
+/** Create a new files snapshot
+  @return New snapshot, or NULL in case of error
+  */
+struct proc_snapshot *proc_snapshot_new(void);
+
+/** Free a files snapshot
+  @param snapshot Snapshot
+  */
+void proc_snapshot_done(struct proc_snapshot *snapshot);
@@ -0,0 +1,517 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "spawn_server.h"
+
+#include <librd/rdlog.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+/// Extra time we wait for a command output after its timeout, so spawn
+/// server has time to kill it
+#define SPAWN_SERVER_GRACE_MS 100
+
+/// Spawn server request. Command output file descriptor is sent along with it
+struct spawn_request {
+	uint64_t timeout_ms;			 ///< Command timeout
+	char command[SPAWN_SERVER_MAX_COMMAND]; ///< Null-terminated command
+};
+
+/// Socket to send requests to spawn server
+static int spawn_server_sock = -1;
+/// Spawn server process
+static pid_t spawn_server_pid = -1;
+
+uint64_t spawn_monotonic_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/*
+ *  SPAWN SERVER PROCESS
+ */
+
+/// Running command
+struct spawn_child {
+	pid_t pid;	    ///< Command process (and process group)
+	/// Time to kill it. UINT64_MAX if it has no timeout, or it has
+	/// already been killed
+	uint64_t deadline_ms;
+};
+
+/// Running commands
+struct spawn_children {
+	struct spawn_child *elms; ///< Commands
+	size_t count;		  ///< Number of running commands
+	size_t capacity;	  ///< Length of elms
+};
+
+/** Add a running command
+  @param children Running commands
+  @param pid Command pid
+  @param deadline_ms Time to kill it
+  @return 0 if success, !0 in other case
+  */
+static int spawn_children_add(struct spawn_children *children,
+			      pid_t pid,
+			      uint64_t deadline_ms) {
+	if (children->count == children->capacity) {
+		const size_t new_capacity =
+				children->capacity ? 2 * children->capacity
+						   : 16;
+		struct spawn_child *elms =
+				realloc(children->elms,
+					new_capacity * sizeof(elms[0]));
+		if (NULL == elms) {
+			return -1;
+		}
+		children->elms = elms;
+		children->capacity = new_capacity;
+	}
+
+	children->elms[children->count++] = (struct spawn_child){
+			.pid = pid, .deadline_ms = deadline_ms,
+	};
+	return 0;
+}
+
+/** Reap finished commands
+  @param children Running commands
+  */
+static void spawn_children_reap(struct spawn_children *children) {
+	pid_t pid;
+	while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+		for (size_t i = 0; i < children->count; ++i) {
+			if (children->elms[i].pid == pid) {
+				children->elms[i] =
+						children->elms[--children->count];
+				break;
+			}
+		}
+	}
+}
+
+/** Kill commands that exceeded their timeout
+  @param children Running commands
+  @param now_ms Current time
+  @return Time until next command deadline, or -1 if there is none
+  */
+static int64_t spawn_children_kill_expired(struct spawn_children *children,
+					   uint64_t now_ms) {
+	int64_t ret = -1;
+
+	for (size_t i = 0; i < children->count; ++i) {
+		struct spawn_child *child = &children->elms[i];
+		if (UINT64_MAX == child->deadline_ms) {
+			// No timeout, or already killed and waiting for reap
+			continue;
+		}
+
+		if (child->deadline_ms <= now_ms) {
+			rdlog(LOG_WARNING,
+			      "Killing command with pid %d: timeout",
+			      (int)child->pid);
+			// Kill the whole group, since shell could have children
+			kill(-child->pid, SIGKILL);
+			child->deadline_ms = UINT64_MAX;
+			continue;
+		}
+
+		const int64_t remaining = (int64_t)(child->deadline_ms - now_ms);
+		if (ret < 0 || remaining < ret) {
+			ret = remaining;
+		}
+	}
+
+	return ret;
+}
+
+/** Launch a command in its own process group
+  @param command Shell command
+  @param stdout_fd Command standard output
+  @param pid Spawned command pid
+  @return 0 if success, error number in other case
+  */
+static int spawn_command(const char *command, int stdout_fd, pid_t *pid) {
+	posix_spawn_file_actions_t file_actions;
+	posix_spawnattr_t attr;
+	sigset_t sigmask, sigdefault;
+	char *const argv[] = {"sh", "-c", (char *)command, NULL};
+
+	sigemptyset(&sigmask);
+	sigemptyset(&sigdefault);
+	sigaddset(&sigdefault, SIGCHLD);
+	sigaddset(&sigdefault, SIGPIPE);
+	sigaddset(&sigdefault, SIGINT);
+	sigaddset(&sigdefault, SIGHUP);
+
+	posix_spawn_file_actions_init(&file_actions);
+	posix_spawn_file_actions_adddup2(&file_actions, stdout_fd, STDOUT_FILENO);
+	posix_spawn_file_actions_addopen(
+			&file_actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr,
+				 POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK |
+						 POSIX_SPAWN_SETSIGDEF);
+	posix_spawnattr_setpgroup(&attr, 0);
+	posix_spawnattr_setsigmask(&attr, &sigmask);
+	posix_spawnattr_setsigdefault(&attr, &sigdefault);
+
+	const int ret = posix_spawn(
+			pid, "/bin/sh", &file_actions, &attr, argv, environ);
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&file_actions);
+	return ret;
+}
+
+/** Receive and launch pending requests
+  @param sock Requests socket
+  @param children Running commands
+  @return 0 if success, !0 if requests socket was closed
+  */
+static int spawn_server_recv(int sock, struct spawn_children *children) {
+	while (1) {
+		struct spawn_request request;
+		union {
+			struct cmsghdr cmsg;
+			char buf[CMSG_SPACE(sizeof(int))];
+		} control;
+		struct iovec iov = {
+				.iov_base = &request, .iov_len = sizeof(request),
+		};
+		struct msghdr msg = {
+				.msg_iov = &iov,
+				.msg_iovlen = 1,
+				.msg_control = control.buf,
+				.msg_controllen = sizeof(control.buf),
+		};
+
+		const ssize_t rc = recvmsg(
+				sock, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+		if (0 == rc) {
+			return -1;
+		} else if (rc < 0) {
+			return errno == EAGAIN || errno == EINTR ? 0 : -1;
+		}
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		if (NULL == cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS) {
+			rdlog(LOG_ERR, "Spawn request with no output fd");
+			continue;
+		}
+
+		int stdout_fd;
+		memcpy(&stdout_fd, CMSG_DATA(cmsg), sizeof(stdout_fd));
+
+		const size_t command_len =
+				(size_t)rc - offsetof(struct spawn_request,
+						      command);
+		if ((size_t)rc <= offsetof(struct spawn_request, command) ||
+		    request.command[command_len - 1] != '\0') {
+			rdlog(LOG_ERR, "Invalid spawn request");
+			close(stdout_fd);
+			continue;
+		}
+
+		pid_t pid;
+		const int spawn_rc =
+				spawn_command(request.command, stdout_fd, &pid);
+		// Command has its own copy now. Closing ours make caller see
+		// EOF when command finish.
+		close(stdout_fd);
+		if (0 != spawn_rc) {
+			rdlog(LOG_ERR,
+			      "Couldn't spawn command %s: %s",
+			      request.command,
+			      strerror(spawn_rc));
+			continue;
+		}
+
+		const uint64_t deadline_ms =
+				request.timeout_ms
+						? spawn_monotonic_ms() +
+								  request.timeout_ms
+						: UINT64_MAX;
+		if (0 != spawn_children_add(children, pid, deadline_ms)) {
+			rdlog(LOG_ERR,
+			      "Couldn't track command %s (OOM?), killing it",
+			      request.command);
+			kill(-pid, SIGKILL);
+		}
+	}
+}
+
+/// SIGCHLD handler. It only needs to interrupt ppoll.
+static void spawn_server_sigchld(int sig) {
+	(void)sig;
+}
+
+/** Spawn server process main loop
+  @param sock Requests socket
+  */
+static void __attribute__((noreturn)) spawn_server_main(int sock) {
+	struct spawn_children children = {0};
+	sigset_t chld_mask, ppoll_mask;
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = spawn_server_sigchld;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, NULL);
+
+	// Parent will close socket when it's time to exit
+	signal(SIGINT, SIG_IGN);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGPIPE, SIG_IGN);
+
+	// SIGCHLD is only delivered inside ppoll, so we can't miss it
+	sigemptyset(&chld_mask);
+	sigaddset(&chld_mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &chld_mask, &ppoll_mask);
+	sigdelset(&ppoll_mask, SIGCHLD);
+
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+	while (1) {
+		struct pollfd pfd = {.fd = sock, .events = POLLIN};
+		struct timespec tmo;
+
+		spawn_children_reap(&children);
+		const int64_t next_deadline_ms = spawn_children_kill_expired(
+				&children, spawn_monotonic_ms());
+		tmo.tv_sec = next_deadline_ms / 1000;
+		tmo.tv_nsec = (next_deadline_ms % 1000) * 1000000;
+
+		const int rc = ppoll(&pfd,
+				     1,
+				     next_deadline_ms >= 0 ? &tmo : NULL,
+				     &ppoll_mask);
+		if (rc > 0 && 0 != spawn_server_recv(sock, &children)) {
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < children.count; ++i) {
+		kill(-children.elms[i].pid, SIGKILL);
+	}
+	while (waitpid(-1, NULL, 0) > 0 || errno == EINTR) {
+	}
+
+	free(children.elms);
+	_exit(0);
+}
+
+int spawn_server_start(void) {
+	int sv[2];
+
+	if (0 != socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv)) {
+		rdlog(LOG_ERR,
+		      "Couldn't create spawn server socket: %s",
+		      strerror(errno));
+		return -1;
+	}
+
+	const pid_t pid = fork();
+	if (pid < 0) {
+		rdlog(LOG_ERR,
+		      "Couldn't fork spawn server: %s",
+		      strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	} else if (0 == pid) {
+		close(sv[0]);
+		spawn_server_main(sv[1]);
+	}
+
+	close(sv[1]);
+	spawn_server_sock = sv[0];
+	spawn_server_pid = pid;
+	return 0;
+}
+
+void spawn_server_stop(void) {
+	if (spawn_server_sock < 0) {
+		return;
+	}
+
+	close(spawn_server_sock);
+	spawn_server_sock = -1;
+	while (waitpid(spawn_server_pid, NULL, 0) < 0 && errno == EINTR) {
+	}
+	spawn_server_pid = -1;
+}
+
+/*
+ *  CLIENT
+ */
+
+/** Send a request to spawn server
+  @param command Command to execute
+  @param timeout_ms Command timeout
+  @param stdout_fd Command standard output
+  @return 0 if success, !0 in other case
+  */
+static int spawn_server_send(const char *command,
+			     uint64_t timeout_ms,
+			     int stdout_fd) {
+	struct spawn_request request;
+	union {
+		struct cmsghdr cmsg;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	const size_t command_len = strlen(command) + 1;
+
+	if (command_len > sizeof(request.command)) {
+		rdlog(LOG_ERR, "Command %s too long", command);
+		return -1;
+	}
+
+	request.timeout_ms = timeout_ms;
+	memcpy(request.command, command, command_len);
+
+	struct iovec iov = {
+			.iov_base = &request,
+			.iov_len = offsetof(struct spawn_request, command) +
+				   command_len,
+	};
+	struct msghdr msg = {
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = control.buf,
+			.msg_controllen = sizeof(control.buf),
+	};
+
+	memset(&control, 0, sizeof(control));
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(stdout_fd));
+	memcpy(CMSG_DATA(cmsg), &stdout_fd, sizeof(stdout_fd));
+
+	// Every request is a single SEQPACKET message, so many threads can
+	// send at the same time
+	if (sendmsg(spawn_server_sock, &msg, MSG_NOSIGNAL) < 0) {
+		rdlog(LOG_ERR,
+		      "Couldn't send command %s to spawn server: %s",
+		      command,
+		      strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int spawn_server_exec(const char *command, uint64_t timeout_ms) {
+	int fds[2];
+
+	if (spawn_server_sock < 0) {
+		rdlog(LOG_ERR, "Spawn server not running");
+		return -1;
+	}
+
+	if (0 != pipe2(fds, O_CLOEXEC)) {
+		rdlog(LOG_ERR, "Couldn't create pipe: %s", strerror(errno));
+		return -1;
+	}
+
+	// Only our end is non-blocking, command will see a regular pipe
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+	const int send_rc = spawn_server_send(command, timeout_ms, fds[1]);
+	close(fds[1]);
+	if (0 != send_rc) {
+		close(fds[0]);
+		return -1;
+	}
+
+	return fds[0];
+}
+
+ssize_t spawn_server_run(const char *command,
+			 uint64_t timeout_ms,
+			 char *buf,
+			 size_t bufsiz) {
+	size_t pos = 0;
+	bool eof = false, error = false;
+
+	assert(bufsiz > 0);
+	assert(timeout_ms > 0);
+
+	const int fd = spawn_server_exec(command, timeout_ms);
+	if (fd < 0) {
+		return -1;
+	}
+
+	const uint64_t start_ms = spawn_monotonic_ms();
+	const uint64_t deadline_ms =
+			start_ms + timeout_ms + SPAWN_SERVER_GRACE_MS;
+	while (!eof && !error && pos < bufsiz - 1) {
+		const ssize_t rc = read(fd, &buf[pos], bufsiz - 1 - pos);
+		if (rc > 0) {
+			pos += (size_t)rc;
+		} else if (0 == rc) {
+			eof = true;
+			// Spawn server closes output killing the command
+			if (spawn_monotonic_ms() >= start_ms + timeout_ms) {
+				rdlog(LOG_ERR, "Command %s timed out", command);
+				error = true;
+			}
+		} else if (errno == EAGAIN) {
+			const uint64_t now_ms = spawn_monotonic_ms();
+			if (now_ms >= deadline_ms) {
+				rdlog(LOG_ERR, "Command %s timed out", command);
+				error = true;
+				break;
+			}
+
+			struct pollfd pfd = {.fd = fd, .events = POLLIN};
+			poll(&pfd, 1, (int)(deadline_ms - now_ms));
+		} else if (errno != EINTR) {
+			rdlog(LOG_ERR,
+			      "Couldn't read command %s output: %s",
+			      command,
+			      strerror(errno));
+			error = true;
+		}
+	}
+
+	// If buffer is full, command will get SIGPIPE if it keep writing
+	close(fd);
+	buf[pos] = '\0';
+
+	return error ? -1 : (ssize_t)pos;
+}
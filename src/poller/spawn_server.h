@@ -0,0 +1,66 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/// Max length of a command sent to spawn server
+#define SPAWN_SERVER_MAX_COMMAND 4096
+
+/** Current monotonic time
+  @return Monotonic clock, in milliseconds
+  */
+uint64_t spawn_monotonic_ms(void);
+
+/** Start the spawn server. It is a small process forked at boot, that launches
+  system commands with posix_spawn, so we don't need to fork the (big,
+  multithreaded) main process for each command. It also kills commands that
+  exceed their timeout.
+
+  It must be called before any thread is created.
+  @return 0 if success, !0 in other case
+  */
+int spawn_server_start(void);
+
+/** Stop spawn server, killing all running commands */
+void spawn_server_stop(void);
+
+/** Execute a shell command through spawn server, with no wait.
+  @param command Command to execute
+  @param timeout_ms Time to let the command run before killing it, or 0 to let
+  it run until it exits.
+  @return Non-blocking file descriptor to read command output from, or -1 in
+  case of error. Command will get SIGPIPE if it writes after it is closed.
+  */
+int spawn_server_exec(const char *command, uint64_t timeout_ms);
+
+/** Execute a shell command through spawn server, and read its output.
+  @param command Command to execute
+  @param timeout_ms Time to wait for command. It will be killed after that.
+  @param buf Buffer to store command output. It will be null-terminated.
+  @param bufsiz Size of buf
+  @return Number of bytes read, or -1 in case of error or timeout
+  */
+ssize_t spawn_server_run(const char *command,
+			 uint64_t timeout_ms,
+			 char *buf,
+			 size_t bufsiz);
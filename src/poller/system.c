@@ -19,9 +19,17 @@
 
 #include "system.h"
 
+#include "spawn_server.h"
+#include "system_cache.h"
+
+#include "rb_number.h"
+
+#include <json-c/json.h>
+#include <librd/rd.h>
 #include <librd/rdlog.h>
 
 #include <ctype.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 static char *trim_end(char *buf) {
@@ -36,29 +44,415 @@ static char *trim_end(char *buf) {
 bool system_solve_response(char *buff,
 			   size_t buff_size,
 			   double *number,
-			   void *unused,
+			   void *vparams,
 			   const char *command) {
-	(void)unused;
-
+	static const struct system_solve_params default_params = {
+			.timeout_ms = SYSTEM_DEFAULT_TIMEOUT_MS,
+	};
+	const struct system_solve_params *params =
+			vparams ? vparams : &default_params;
 	bool ret = false;
-	FILE *fp = popen(command, "r");
-	if (NULL == fp) {
+
+	buff[0] = '\0';
+	char *output = system_output_cached(
+			command, params->timeout_ms, params->ttl_ms);
+	if (NULL == output) {
 		rdlog(LOG_ERR, "Cannot get system command.");
+	} else if (output[0] == '\0') {
+		rdlog(LOG_ERR, "Cannot get buffer information");
 	} else {
-		if (NULL == fgets(buff, buff_size, fp)) {
-			rdlog(LOG_ERR, "Cannot get buffer information");
-		} else {
-			rdlog(LOG_DEBUG, "System response: %s", buff);
-			trim_end(buff);
-			char *endPtr;
-			*number = strtod(buff, &endPtr);
-			if (buff != endPtr) {
-				ret = true;
+		// Only first line is considered
+		const size_t line_len = strcspn(output, "\n");
+		snprintf(buff, buff_size, "%.*s", (int)line_len, output);
+
+		rdlog(LOG_DEBUG, "System response: %s", buff);
+		trim_end(buff);
+		char *endPtr;
+		*number = rb_number_parse(buff, &endPtr);
+		if (buff != endPtr) {
+			ret = true;
+		}
+	}
+
+	free(output);
+	return ret;
+}
+
+bool system_output_format_parse(const char *name,
+				enum system_output_format *format) {
+	static const struct {
+		const char *name;
+		enum system_output_format format;
+	} formats[] = {
+			{"line", SYSTEM_OUTPUT_LINE},
+			{"kv", SYSTEM_OUTPUT_KV},
+			{"columns", SYSTEM_OUTPUT_COLUMNS},
+			{"json", SYSTEM_OUTPUT_JSON},
+	};
+
+	for (size_t i = 0; i < RD_ARRAYSIZE(formats); ++i) {
+		if (0 == strcmp(formats[i].name, name)) {
+			*format = formats[i].format;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+char *system_output(const char *command, uint64_t timeout_ms) {
+	char *ret = malloc(SYSTEM_MAX_OUTPUT);
+	if (NULL == ret) {
+		rdlog(LOG_ERR, "Couldn't allocate command output (OOM?)");
+		return NULL;
+	}
+
+	const ssize_t read_rc = spawn_server_run(
+			command, timeout_ms, ret, SYSTEM_MAX_OUTPUT);
+	if (read_rc < 0) {
+		rdlog(LOG_ERR, "Cannot get system command %s output", command);
+		free(ret);
+		return NULL;
+	}
+
+	if (read_rc == SYSTEM_MAX_OUTPUT - 1) {
+		rdlog(LOG_WARNING,
+		      "Command %s output truncated to %d bytes",
+		      command,
+		      SYSTEM_MAX_OUTPUT - 1);
+	}
+
+	return ret;
+}
+
+/*
+ *  STRUCTURED OUTPUT PARSING
+ */
+
+/** Skip spaces and tabs
+ @param cursor String
+ @param eol    Line end
+ @return       First non blank character
+ */
+static const char *skip_blank(const char *cursor, const char *eol) {
+	while (cursor < eol && (*cursor == ' ' || *cursor == '\t')) {
+		cursor++;
+	}
+	return cursor;
+}
+
+/** Skip a whitespace separated token
+ @param cursor String
+ @param eol    Line end
+ @return       First blank character after token
+ */
+static const char *skip_token(const char *cursor, const char *eol) {
+	while (cursor < eol && !isspace(*cursor)) {
+		cursor++;
+	}
+	return cursor;
+}
+
+/** Parse a number that must be the only content until end
+ @param cursor Number start
+ @param eol    Number end
+ @param value  Parsed number
+ @return       true if it is a number
+ */
+static bool parse_number(const char *cursor, const char *eol, double *value) {
+	cursor = skip_blank(cursor, eol);
+	if (cursor == eol) {
+		return false;
+	}
+
+	char *end = NULL;
+	*value = rb_number_parse(cursor, &end);
+	return end != cursor && end <= eol &&
+	       skip_blank(end, eol) == eol;
+}
+
+/** Line end
+ @param line Line start
+ @return     Line end ('\n' or '\0')
+ */
+static const char *line_end(const char *line) {
+	const char *eol = strchr(line, '\n');
+	return eol ? eol : line + strlen(line);
+}
+
+/** Parse key=value output */
+static size_t system_output_parse_kv(const char *output,
+				     const char *field,
+				     system_output_cb cb,
+				     void *opaque) {
+	const size_t field_len = field ? strlen(field) : 0;
+	size_t ret = 0;
+
+	for (const char *line = output; *line;) {
+		const char *eol = line_end(line);
+		const char *eq = memchr(line, '=', (size_t)(eol - line));
+		double value = 0;
+
+		if (eq && parse_number(eq + 1, eol, &value)) {
+			const char *key = skip_blank(line, eq);
+			const char *key_end = eq;
+			while (key_end > key && isspace(key_end[-1])) {
+				key_end--;
+			}
+			const size_t key_len = (size_t)(key_end - key);
+
+			if (NULL == field && key_len > 0) {
+				cb(key, key_len, value, opaque);
+				ret++;
+			} else if (field && key_len == field_len &&
+				   0 == memcmp(key, field, key_len)) {
+				cb(NULL, 0, value, opaque);
+				return 1;
 			}
 		}
 
-		fclose(fp);
+		line = *eol ? eol + 1 : eol;
+	}
+
+	return ret;
+}
+
+/** Get nth whitespace separated token of a line
+ @param line      Line start
+ @param eol       Line end
+ @param n         Token position
+ @param token_len Token length
+ @return          Token, or NULL if line has not enough tokens
+ */
+static const char *
+nth_token(const char *line, const char *eol, size_t n, size_t *token_len) {
+	const char *cursor = skip_blank(line, eol);
+	for (; n > 0 && cursor < eol; --n) {
+		cursor = skip_blank(skip_token(cursor, eol), eol);
+	}
+
+	if (cursor >= eol) {
+		return NULL;
+	}
+
+	*token_len = (size_t)(skip_token(cursor, eol) - cursor);
+	return cursor;
+}
+
+/** Resolve a column name or position using header
+ @param header     Header line
+ @param header_eol Header line end
+ @param column     Column name or position
+ @param column_len Length of column
+ @param pos        Column position
+ @return           true if column was found
+ */
+static bool columns_header_pos(const char *header,
+			       const char *header_eol,
+			       const char *column,
+			       size_t column_len,
+			       size_t *pos) {
+	const char *name = NULL;
+	size_t name_len = 0;
+
+	for (size_t i = 0;
+	     (name = nth_token(header, header_eol, i, &name_len));
+	     ++i) {
+		if (name_len == column_len &&
+		    0 == memcmp(name, column, column_len)) {
+			*pos = i;
+			return true;
+		}
+	}
+
+	char *end = NULL;
+	const unsigned long ret = strtoul(column, &end, 10);
+	if (end != column + column_len || !isdigit(column[0])) {
+		return false;
+	}
+
+	*pos = ret;
+	return true;
+}
+
+/** Parse header + rows output */
+static size_t system_output_parse_columns(const char *output,
+					  const char *field,
+					  system_output_cb cb,
+					  void *opaque) {
+	const char *header = output;
+	const char *header_eol = NULL;
+	const char *row = NULL, *column = "1";
+	size_t row_len = 0, column_pos = 0, ret = 0;
+
+	// Header is first non blank line
+	while (*header) {
+		header_eol = line_end(header);
+		if (skip_blank(header, header_eol) != header_eol) {
+			break;
+		}
+		header = *header_eol ? header_eol + 1 : header_eol;
+	}
+
+	if ('\0' == *header) {
+		return 0;
+	}
+
+	if (field) {
+		const char *colon = strchr(field, ':');
+		if (colon) {
+			row = field;
+			row_len = (size_t)(colon - field);
+			column = colon + 1;
+		} else {
+			column = field;
+		}
+	}
+
+	if (!columns_header_pos(header,
+				header_eol,
+				column,
+				strlen(column),
+				&column_pos)) {
+		rdlog(LOG_ERR, "Column %s not found in output", column);
+		return 0;
+	}
+
+	for (const char *line = *header_eol ? header_eol + 1 : header_eol;
+	     *line;) {
+		const char *eol = line_end(line);
+		size_t line_row_len = 0, value_len = 0;
+		const char *line_row = nth_token(line, eol, 0, &line_row_len);
+		const char *value_str =
+				nth_token(line, eol, column_pos, &value_len);
+		double value = 0;
+
+		line = *eol ? eol + 1 : eol;
+		if (NULL == line_row || NULL == value_str ||
+		    !parse_number(value_str, value_str + value_len, &value)) {
+			continue;
+		}
+
+		if (NULL == row) {
+			cb(line_row, line_row_len, value, opaque);
+			ret++;
+		} else if (row_len == line_row_len &&
+			   0 == memcmp(row, line_row, row_len)) {
+			cb(NULL, 0, value, opaque);
+			return 1;
+		}
 	}
 
 	return ret;
 }
+
+/** Get a JSON number
+ @param json  JSON object
+ @param value Number
+ @return      true if json is a number
+ */
+static bool json_number(json_object *json, double *value) {
+	if (json_object_is_type(json, json_type_double) ||
+	    json_object_is_type(json, json_type_int)) {
+		*value = json_object_get_double(json);
+		return true;
+	}
+	return false;
+}
+
+/** Parse JSON output */
+static size_t system_output_parse_json(const char *output,
+				       const char *field,
+				       system_output_cb cb,
+				       void *opaque) {
+	enum json_tokener_error jerr;
+	json_object *root = json_tokener_parse_verbose(output, &jerr);
+	json_object *json = root;
+	size_t ret = 0;
+	double value = 0;
+
+	if (NULL == root) {
+		rdlog(LOG_ERR,
+		      "Couldn't parse command output as JSON: %s",
+		      json_tokener_error_desc(jerr));
+		return 0;
+	}
+
+	// Walk the path
+	for (const char *key = field; key && json;) {
+		const char *key_end = strchr(key, '.');
+		const size_t key_len = key_end ? (size_t)(key_end - key)
+					       : strlen(key);
+		char key_buf[256];
+		snprintf(key_buf, sizeof(key_buf), "%.*s", (int)key_len, key);
+
+		json_object *child = NULL;
+		if (json_object_is_type(json, json_type_array)) {
+			char *end = NULL;
+			const unsigned long idx = strtoul(key_buf, &end, 10);
+			child = ('\0' == *end && end != key_buf)
+					? json_object_array_get_idx(json, (int)idx)
+					: NULL;
+		} else if (json_object_is_type(json, json_type_object)) {
+			json_object_object_get_ex(json, key_buf, &child);
+		}
+
+		json = child;
+		key = key_end ? key_end + 1 : NULL;
+	}
+
+	if (NULL == json) {
+		rdlog(LOG_ERR, "Field %s not found in output", field);
+	} else if (json_number(json, &value)) {
+		cb(NULL, 0, value, opaque);
+		ret = 1;
+	} else if (json_object_is_type(json, json_type_object)) {
+		json_object_object_foreach(json, key, val) {
+			if (json_number(val, &value)) {
+				cb(key, strlen(key), value, opaque);
+				ret++;
+			}
+		}
+	} else if (json_object_is_type(json, json_type_array)) {
+		for (size_t i = 0;
+		     i < (size_t)json_object_array_length(json);
+		     ++i) {
+			char instance[32];
+			json_object *val = json_object_array_get_idx(json, (int)i);
+			if (json_number(val, &value)) {
+				const int instance_len = snprintf(
+						instance,
+						sizeof(instance),
+						"%zu",
+						i);
+				cb(instance,
+				   (size_t)instance_len,
+				   value,
+				   opaque);
+				ret++;
+			}
+		}
+	}
+
+	json_object_put(root);
+	return ret;
+}
+
+size_t system_output_parse(enum system_output_format format,
+			   const char *output,
+			   const char *field,
+			   system_output_cb cb,
+			   void *opaque) {
+	switch (format) {
+	case SYSTEM_OUTPUT_KV:
+		return system_output_parse_kv(output, field, cb, opaque);
+	case SYSTEM_OUTPUT_COLUMNS:
+		return system_output_parse_columns(output, field, cb, opaque);
+	case SYSTEM_OUTPUT_JSON:
+		return system_output_parse_json(output, field, cb, opaque);
+	case SYSTEM_OUTPUT_LINE:
+	default:
+		rdlog(LOG_ERR, "Invalid structured format %d", format);
+		return 0;
+	};
+}
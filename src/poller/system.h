@@ -20,14 +20,25 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
+/// Default system command timeout, in milliseconds
+#define SYSTEM_DEFAULT_TIMEOUT_MS 10000
+
+/// System command execution parameters
+struct system_solve_params {
+	uint64_t timeout_ms; ///< Command timeout
+	uint64_t ttl_ms;     ///< Max age of a cached output to reuse
+};
+
 /**
  Exec a system command and puts the output in value_buf
  @param buff      Buffer to store the output
  @param buff_size Length of value_buf
  @param number    If possible, number conversion of value_buf
- @param unused    Just for snmp_solve_response compatibility
+ @param vparams   Execution parameters (struct system_solve_params), or NULL
+                  to use SYSTEM_DEFAULT_TIMEOUT_MS and no cache
  @param command   Command to execute
  @todo see if we can join with snmp_solve_response somehow
  @return               1 if number. 0 ioc.
@@ -35,5 +46,72 @@
 bool system_solve_response(char *buff,
 			   size_t buff_size,
 			   double *number,
-			   void *unused,
+			   void *vparams,
 			   const char *command);
+
+/// Max output size of structured system commands
+#define SYSTEM_MAX_OUTPUT (64 * 1024)
+
+/// System command output format
+enum system_output_format {
+	/// First line is a number, or a vector if split is given
+	SYSTEM_OUTPUT_LINE,
+	/// key=value lines
+	SYSTEM_OUTPUT_KV,
+	/// Header line with columns names, and one row per line. First column
+	/// is the row name
+	SYSTEM_OUTPUT_COLUMNS,
+	/// JSON document
+	SYSTEM_OUTPUT_JSON,
+};
+
+/** Parse a system output format name
+ @param name   Format name (line, kv, columns, json)
+ @param format Parsed format
+ @return       true if valid format
+ */
+bool system_output_format_parse(const char *name,
+				enum system_output_format *format);
+
+/**
+ Exec a system command and return all its output
+ @param command    Command to execute
+ @param timeout_ms Command timeout
+ @return           Null terminated output, that must be freed with free(), or
+                   NULL in case of error
+ */
+char *system_output(const char *command, uint64_t timeout_ms);
+
+/**
+ Structured output value callback
+ @param instance     Field name (not null terminated), or NULL if the field
+                     selected is a scalar
+ @param instance_len instance length
+ @param value        Field value
+ @param opaque       Opaque passed to system_output_parse
+ */
+typedef void (*system_output_cb)(const char *instance,
+				 size_t instance_len,
+				 double value,
+				 void *opaque);
+
+/**
+ Extract values from a structured output.
+  - kv: field is the key. With no field, all keys are returned as a vector.
+  - columns: field is "<column>" to get a vector of all rows, or
+    "<row>:<column>" to get a scalar. Column can be a header name or a
+    position. With no field, the second column is returned.
+  - json: field is a dot separated path. If it points to an object or array,
+    its numeric members are returned as a vector. With no field, root is used.
+ @param format Output format. It can't be SYSTEM_OUTPUT_LINE
+ @param output Command output
+ @param field  Field to select, or NULL
+ @param cb     Callback to call with each value
+ @param opaque Callback opaque
+ @return       Number of values found
+ */
+size_t system_output_parse(enum system_output_format format,
+			   const char *output,
+			   const char *field,
+			   system_output_cb cb,
+			   void *opaque);
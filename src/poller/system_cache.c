@@ -0,0 +1,162 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "system_cache.h"
+
+#include "spawn_server.h"
+#include "system.h"
+
+#include <librd/rdlog.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Number of buckets of the cache hash table
+#define SYSTEM_CACHE_BUCKETS 256
+
+/// Cached command output
+struct system_cache_entry {
+	struct system_cache_entry *next; ///< Next entry in bucket
+	char *command;			 ///< Command executed
+	char *output;			 ///< Last output, NULL if error
+	uint64_t done_ms;		 ///< Last execution end time
+	bool running;			 ///< Command is being executed
+	bool valid;			 ///< output is the result of a run
+	pthread_cond_t done;		 ///< Signaled when execution ends
+};
+
+/// Process wide cache. Commands are known at config time, so entries are
+/// never evicted: there is at most one per distinct command.
+static struct {
+	pthread_mutex_t lock;
+	struct system_cache_entry *buckets[SYSTEM_CACHE_BUCKETS];
+} system_cache = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/** Command hash bucket
+ @param command Command
+ @return        Bucket index
+ */
+static size_t system_cache_bucket(const char *command) {
+	// FNV-1a
+	uint64_t hash = UINT64_C(14695981039346656037);
+	for (const char *c = command; *c; ++c) {
+		hash ^= (uint8_t)*c;
+		hash *= UINT64_C(1099511628211);
+	}
+
+	return hash % SYSTEM_CACHE_BUCKETS;
+}
+
+/** Find or create a command entry. Need to hold cache lock.
+ @param command Command
+ @return        Cache entry, or NULL if it couldn't be created
+ */
+static struct system_cache_entry *system_cache_entry(const char *command) {
+	struct system_cache_entry **bucket =
+			&system_cache.buckets[system_cache_bucket(command)];
+	for (struct system_cache_entry *entry = *bucket; entry;
+	     entry = entry->next) {
+		if (0 == strcmp(entry->command, command)) {
+			return entry;
+		}
+	}
+
+	struct system_cache_entry *ret = calloc(1, sizeof(*ret));
+	if (NULL == ret || NULL == (ret->command = strdup(command))) {
+		rdlog(LOG_ERR, "Couldn't allocate system cache entry (OOM?)");
+		free(ret);
+		return NULL;
+	}
+
+	pthread_cond_init(&ret->done, NULL);
+	ret->next = *bucket;
+	*bucket = ret;
+	return ret;
+}
+
+/** Copy an entry output. Need to hold cache lock.
+ @param entry Cache entry
+ @return      Output copy, or NULL if error
+ */
+static char *system_cache_entry_output(const struct system_cache_entry *entry) {
+	if (NULL == entry->output) {
+		return NULL;
+	}
+
+	char *ret = strdup(entry->output);
+	if (NULL == ret) {
+		rdlog(LOG_ERR, "Couldn't copy command output (OOM?)");
+	}
+	return ret;
+}
+
+char *system_output_cached(const char *command,
+			   uint64_t timeout_ms,
+			   uint64_t ttl_ms) {
+	char *ret = NULL;
+
+	pthread_mutex_lock(&system_cache.lock);
+	struct system_cache_entry *entry = system_cache_entry(command);
+	if (NULL == entry) {
+		pthread_mutex_unlock(&system_cache.lock);
+		return system_output(command, timeout_ms);
+	}
+
+	if (entry->running) {
+		// Single flight: wait for the running execution
+		while (entry->running) {
+			pthread_cond_wait(&entry->done, &system_cache.lock);
+		}
+		ret = system_cache_entry_output(entry);
+		pthread_mutex_unlock(&system_cache.lock);
+		return ret;
+	}
+
+	if (entry->valid && spawn_monotonic_ms() < entry->done_ms + ttl_ms) {
+		ret = system_cache_entry_output(entry);
+		pthread_mutex_unlock(&system_cache.lock);
+		return ret;
+	}
+
+	entry->running = true;
+	pthread_mutex_unlock(&system_cache.lock);
+
+	char *output = system_output(command, timeout_ms);
+	// Only keep what we actually read, not the whole read buffer
+	char *shrunk = output ? realloc(output, strlen(output) + 1) : NULL;
+	if (shrunk) {
+		output = shrunk;
+	}
+
+	pthread_mutex_lock(&system_cache.lock);
+	free(entry->output);
+	entry->output = output;
+	entry->done_ms = spawn_monotonic_ms();
+	entry->valid = true;
+	entry->running = false;
+	ret = system_cache_entry_output(entry);
+	pthread_cond_broadcast(&entry->done);
+	pthread_mutex_unlock(&system_cache.lock);
+
+	return ret;
+}
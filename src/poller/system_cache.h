@@ -0,0 +1,39 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ Exec a system command, or reuse the output of a recent execution of the same
+ command. Concurrent callers with the same command always share one
+ execution, even with no TTL.
+
+ Cache is process wide, keyed by the command string, so identical commands
+ of different monitors and sensors are executed only once.
+ @param command    Command to execute
+ @param timeout_ms Command timeout
+ @param ttl_ms     Max age of a previous output to reuse
+ @return           Null terminated output, that must be freed with free(), or
+                   NULL in case of error
+ */
+char *system_output_cached(const char *command,
+			   uint64_t timeout_ms,
+			   uint64_t ttl_ms);
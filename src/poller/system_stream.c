@@ -0,0 +1,409 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "system_stream.h"
+
+#include "spawn_server.h"
+
+#include <librd/rdlog.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct system_stream {
+	struct system_stream *next; ///< Next stream in manager list
+	char *command;		    ///< Command to execute
+	int fd;			    ///< Command output, -1 if not running
+	uint64_t restart_ms;	///< Time to restart command, if not running
+	uint64_t backoff_ms;	///< Next restart delay
+	bool closing;		    ///< Stream is being closed
+	bool closed;		    ///< Manager thread does not use it anymore
+
+	char partial[BUFSIZ]; ///< Line being received
+	size_t partial_len;   ///< Length of partial
+	bool partial_overflow; ///< Line too long, discarding until newline
+
+	char last[BUFSIZ]; ///< Last complete line
+	bool last_new;	   ///< last has not been consumed yet
+	size_t skipped;    ///< Lines overwritten before being consumed
+};
+
+/// Streams manager. Its thread only runs while there are streams.
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t closed; ///< Signaled when a closing stream is closed
+	struct system_stream *streams;
+	size_t streams_count;
+	pthread_t thread;
+	/// Thread is polling streams. Only the thread clears it, when it exits
+	/// because there are no streams left.
+	bool thread_running;
+	/// Thread has exited and nobody has joined it yet
+	bool thread_joinable;
+	int wakeup[2]; ///< Pipe to wake up manager thread
+} stream_manager = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.closed = PTHREAD_COND_INITIALIZER,
+		.wakeup = {-1, -1},
+};
+
+/** Wake up manager thread */
+static void stream_manager_wakeup(void) {
+	const char c = 0;
+	// If pipe is full, the thread has pending wake ups anyway
+	(void)!write(stream_manager.wakeup[1], &c, sizeof(c));
+}
+
+/** Schedule a stream restart. Need to hold manager lock.
+ @param stream Stream
+ @param now_ms Current time
+ */
+static void stream_schedule_restart(struct system_stream *stream,
+				    uint64_t now_ms) {
+	if (stream->fd >= 0) {
+		close(stream->fd);
+		stream->fd = -1;
+	}
+
+	stream->partial_len = 0;
+	stream->partial_overflow = false;
+	stream->restart_ms = now_ms + stream->backoff_ms;
+	rdlog(LOG_WARNING,
+	      "Stream command %s exited, restarting in %" PRIu64 "ms",
+	      stream->command,
+	      stream->backoff_ms);
+
+	stream->backoff_ms *= 2;
+	if (stream->backoff_ms > SYSTEM_STREAM_MAX_BACKOFF_MS) {
+		stream->backoff_ms = SYSTEM_STREAM_MAX_BACKOFF_MS;
+	}
+}
+
+/** Process received stream bytes. Need to hold manager lock.
+ @param stream Stream
+ @param buf    Received bytes
+ @param len    Length of buf
+ */
+static void
+stream_process_bytes(struct system_stream *stream, const char *buf, size_t len) {
+	for (size_t i = 0; i < len; ++i) {
+		if ('\n' != buf[i]) {
+			if (stream->partial_len < sizeof(stream->partial) - 1) {
+				stream->partial[stream->partial_len++] = buf[i];
+			} else {
+				stream->partial_overflow = true;
+			}
+			continue;
+		}
+
+		if (stream->partial_overflow) {
+			rdlog(LOG_WARNING,
+			      "Stream command %s line too long, truncated",
+			      stream->command);
+		}
+
+		// CRLF terminated lines
+		if (stream->partial_len > 0 &&
+		    '\r' == stream->partial[stream->partial_len - 1]) {
+			stream->partial_len--;
+		}
+
+		if (stream->last_new) {
+			stream->skipped++;
+		}
+		memcpy(stream->last, stream->partial, stream->partial_len);
+		stream->last[stream->partial_len] = '\0';
+		stream->last_new = true;
+		stream->partial_len = 0;
+		stream->partial_overflow = false;
+
+		// Command is working
+		stream->backoff_ms = SYSTEM_STREAM_MIN_BACKOFF_MS;
+	}
+}
+
+/** Read all available stream output. Need to hold manager lock.
+ @param stream Stream
+ @param now_ms Current time
+ */
+static void stream_read(struct system_stream *stream, uint64_t now_ms) {
+	char buf[BUFSIZ];
+
+	while (1) {
+		const ssize_t rc = read(stream->fd, buf, sizeof(buf));
+		if (rc > 0) {
+			stream_process_bytes(stream, buf, (size_t)rc);
+		} else if (0 == rc) {
+			stream_schedule_restart(stream, now_ms);
+			return;
+		} else if (errno == EAGAIN) {
+			return;
+		} else if (errno != EINTR) {
+			rdlog(LOG_ERR,
+			      "Couldn't read stream command %s: %s",
+			      stream->command,
+			      strerror(errno));
+			stream_schedule_restart(stream, now_ms);
+			return;
+		}
+	}
+}
+
+/** Close closing streams, and (re)start due ones. Need to hold manager lock.
+ @param now_ms Current time
+ @return       Time until next restart, or -1 if there is none
+ */
+static int stream_manager_maintain(uint64_t now_ms) {
+	int ret = -1;
+
+	for (struct system_stream **it = &stream_manager.streams; *it;) {
+		struct system_stream *stream = *it;
+		if (stream->closing) {
+			*it = stream->next;
+			if (stream->fd >= 0) {
+				close(stream->fd);
+				stream->fd = -1;
+			}
+			stream->closed = true;
+			stream_manager.streams_count--;
+			pthread_cond_broadcast(&stream_manager.closed);
+			continue;
+		}
+
+		if (stream->fd < 0 && stream->restart_ms <= now_ms) {
+			stream->fd = spawn_server_exec(stream->command, 0);
+			if (stream->fd < 0) {
+				stream_schedule_restart(stream, now_ms);
+			}
+		}
+
+		if (stream->fd < 0) {
+			const uint64_t wait_ms = stream->restart_ms - now_ms;
+			if (ret < 0 || wait_ms < (uint64_t)ret) {
+				ret = wait_ms > INT32_MAX ? INT32_MAX
+							  : (int)wait_ms;
+			}
+		}
+
+		it = &stream->next;
+	}
+
+	return ret;
+}
+
+/** Streams manager thread */
+static void *stream_manager_main(void *unused) {
+	(void)unused;
+	struct pollfd *pfds = NULL;
+	struct system_stream **pstreams = NULL;
+	size_t capacity = 0;
+
+	pthread_mutex_lock(&stream_manager.lock);
+	while (stream_manager.streams_count > 0) {
+		const int tmo = stream_manager_maintain(spawn_monotonic_ms());
+		if (0 == stream_manager.streams_count) {
+			break;
+		}
+
+		if (capacity < stream_manager.streams_count + 1) {
+			capacity = stream_manager.streams_count + 1;
+			struct pollfd *new_pfds =
+					realloc(pfds, capacity * sizeof(pfds[0]));
+			struct system_stream **new_pstreams = realloc(
+					pstreams, capacity * sizeof(pstreams[0]));
+			pfds = new_pfds ? new_pfds : pfds;
+			pstreams = new_pstreams ? new_pstreams : pstreams;
+			if (NULL == new_pfds || NULL == new_pstreams) {
+				rdlog(LOG_ERR, "Couldn't grow poll set (OOM?)");
+				capacity = 0;
+				pthread_mutex_unlock(&stream_manager.lock);
+				sleep(1);
+				pthread_mutex_lock(&stream_manager.lock);
+				continue;
+			}
+		}
+
+		// Streams can't be freed while we are polling, since they are
+		// not freed until this thread closes them
+		size_t nfds = 0;
+		pfds[nfds++] = (struct pollfd){
+				.fd = stream_manager.wakeup[0], .events = POLLIN,
+		};
+		for (struct system_stream *stream = stream_manager.streams;
+		     stream;
+		     stream = stream->next) {
+			if (stream->fd >= 0) {
+				pstreams[nfds] = stream;
+				pfds[nfds++] = (struct pollfd){
+						.fd = stream->fd,
+						.events = POLLIN,
+				};
+			}
+		}
+
+		pthread_mutex_unlock(&stream_manager.lock);
+		poll(pfds, nfds, tmo);
+		pthread_mutex_lock(&stream_manager.lock);
+
+		if (pfds[0].revents) {
+			char buf[64];
+			while (read(stream_manager.wakeup[0], buf, sizeof(buf)) >
+			       0) {
+			}
+		}
+
+		const uint64_t now_ms = spawn_monotonic_ms();
+		for (size_t i = 1; i < nfds; ++i) {
+			if (pfds[i].revents && !pstreams[i]->closing) {
+				stream_read(pstreams[i], now_ms);
+			}
+		}
+	}
+
+	// Cleared under the same lock hold that saw no streams, so a new stream
+	// will start a new thread
+	stream_manager.thread_running = false;
+	stream_manager.thread_joinable = true;
+	pthread_mutex_unlock(&stream_manager.lock);
+
+	free(pfds);
+	free(pstreams);
+	return NULL;
+}
+
+/** Take the exited manager thread to join it. Need to hold manager lock.
+ @param thread Exited thread
+ @return       true if there was an exited thread to join
+ */
+static bool stream_manager_take_exited(pthread_t *thread) {
+	if (stream_manager.thread_running || !stream_manager.thread_joinable) {
+		return false;
+	}
+
+	*thread = stream_manager.thread;
+	stream_manager.thread_joinable = false;
+	return true;
+}
+
+struct system_stream *system_stream_new(const char *command) {
+	pthread_t exited_thread;
+	bool join = false;
+	struct system_stream *ret = calloc(1, sizeof(*ret));
+	if (NULL == ret || NULL == (ret->command = strdup(command))) {
+		rdlog(LOG_ERR, "Couldn't allocate stream (OOM?)");
+		free(ret);
+		return NULL;
+	}
+
+	ret->fd = -1;
+	ret->backoff_ms = SYSTEM_STREAM_MIN_BACKOFF_MS;
+
+	pthread_mutex_lock(&stream_manager.lock);
+	if (stream_manager.wakeup[0] < 0 &&
+	    0 != pipe2(stream_manager.wakeup, O_CLOEXEC | O_NONBLOCK)) {
+		rdlog(LOG_ERR,
+		      "Couldn't create streams wake up pipe: %s",
+		      strerror(errno));
+		goto err;
+	}
+
+	if (!stream_manager.thread_running) {
+		// Previous thread handle is overwritten by the new one
+		join = stream_manager_take_exited(&exited_thread);
+		if (0 != pthread_create(&stream_manager.thread,
+					NULL,
+					stream_manager_main,
+					NULL)) {
+			rdlog(LOG_ERR, "Couldn't create streams thread");
+			goto err;
+		}
+		stream_manager.thread_running = true;
+	}
+
+	ret->next = stream_manager.streams;
+	stream_manager.streams = ret;
+	stream_manager.streams_count++;
+	pthread_mutex_unlock(&stream_manager.lock);
+
+	if (join) {
+		pthread_join(exited_thread, NULL);
+	}
+
+	stream_manager_wakeup();
+	return ret;
+
+err:
+	pthread_mutex_unlock(&stream_manager.lock);
+	if (join) {
+		pthread_join(exited_thread, NULL);
+	}
+	free(ret->command);
+	free(ret);
+	return NULL;
+}
+
+void system_stream_done(struct system_stream *stream) {
+	pthread_t exited_thread;
+
+	pthread_mutex_lock(&stream_manager.lock);
+	stream->closing = true;
+	stream_manager_wakeup();
+
+	while (!stream->closed) {
+		pthread_cond_wait(&stream_manager.closed, &stream_manager.lock);
+	}
+
+	// Only one closer can take the exited thread
+	const bool join = stream_manager_take_exited(&exited_thread);
+	pthread_mutex_unlock(&stream_manager.lock);
+
+	if (join) {
+		pthread_join(exited_thread, NULL);
+	}
+
+	free(stream->command);
+	free(stream);
+}
+
+bool system_stream_last_line(struct system_stream *stream,
+			     char *buf,
+			     size_t bufsiz,
+			     size_t *skipped) {
+	bool ret = false;
+
+	pthread_mutex_lock(&stream_manager.lock);
+	if (stream->last_new) {
+		snprintf(buf, bufsiz, "%s", stream->last);
+		*skipped = stream->skipped;
+		stream->last_new = false;
+		stream->skipped = 0;
+		ret = true;
+	}
+	pthread_mutex_unlock(&stream_manager.lock);
+
+	return ret;
+}
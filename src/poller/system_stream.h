@@ -0,0 +1,59 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/// First restart delay of an exited stream command, in milliseconds
+#define SYSTEM_STREAM_MIN_BACKOFF_MS 1000
+/// Max restart delay of an exited stream command, in milliseconds
+#define SYSTEM_STREAM_MAX_BACKOFF_MS 60000
+
+/** Long running command, like `vmstat 1`. A background thread reads the
+  output of all streams with no blocking, and keeps the last complete line
+  of each one. If the command exits, it is restarted with exponential
+  backoff. */
+struct system_stream;
+
+/** Create and start a stream command
+ @param command Command to execute
+ @return        New stream, or NULL in case of error
+ */
+struct system_stream *system_stream_new(const char *command);
+
+/** Stop a stream command and free it. Command will receive SIGPIPE the next
+ time it writes.
+ @param stream Stream
+ */
+void system_stream_done(struct system_stream *stream);
+
+/** Get the last complete line of the stream
+ @param stream  Stream
+ @param buf     Buffer to copy line to, without newline
+ @param bufsiz  Size of buf
+ @param skipped Number of lines received (and discarded) before this one
+                since last call
+ @return        true if there is a new line since last call
+ */
+bool system_stream_last_line(struct system_stream *stream,
+			     char *buf,
+			     size_t bufsiz,
+			     size_t *skipped);
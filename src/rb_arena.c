@@ -0,0 +1,187 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_arena.h"
+
+#include <librd/rdlog.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Every allocation is aligned for any type (malloc one)
+#define RB_ARENA_ALIGN 16ul
+
+/// Round up to alignment
+#define RB_ARENA_ROUND(x) (((x) + RB_ARENA_ALIGN - 1) & ~(RB_ARENA_ALIGN - 1))
+
+/// Arena chunk
+struct rb_arena_chunk {
+	struct rb_arena_chunk *next; ///< Previous chunk used
+	size_t size;		     ///< Length of data
+	size_t used;		     ///< Bytes of data used
+	size_t last;		     ///< Last allocation offset
+	char data[] __attribute__((aligned(RB_ARENA_ALIGN)));
+};
+
+void rb_arena_init(struct rb_arena *arena, size_t chunk_size) {
+	memset(arena, 0, sizeof(*arena));
+	arena->chunk_size = chunk_size ? chunk_size
+				       : RB_ARENA_DEFAULT_CHUNK_SIZE;
+}
+
+/** Free a list of chunks
+  @param chunk First chunk
+  */
+static void rb_arena_chunks_free(struct rb_arena_chunk *chunk) {
+	while (chunk) {
+		struct rb_arena_chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+}
+
+void rb_arena_done(struct rb_arena *arena) {
+	rb_arena_chunks_free(arena->chunks);
+	arena->chunks = NULL;
+}
+
+/** Add a new chunk to arena
+  @param arena Arena
+  @param size Minimum chunk data size
+  @return New chunk, or NULL if error
+  */
+static struct rb_arena_chunk *rb_arena_chunk_new(struct rb_arena *arena,
+						 size_t size) {
+	if (size < arena->chunk_size) {
+		size = arena->chunk_size;
+	}
+
+	struct rb_arena_chunk *ret = malloc(sizeof(*ret) + size);
+	if (NULL == ret) {
+		rdlog(LOG_ERR, "Couldn't allocate arena chunk (OOM?)");
+		return NULL;
+	}
+
+	ret->size = size;
+	ret->used = ret->last = 0;
+	ret->next = arena->chunks;
+	arena->chunks = ret;
+	arena->stats.chunk_allocs++;
+	return ret;
+}
+
+void rb_arena_reset(struct rb_arena *arena) {
+	size_t used = 0, size = 0;
+	for (struct rb_arena_chunk *chunk = arena->chunks; chunk;
+	     chunk = chunk->next) {
+		used += chunk->used;
+		size += chunk->size;
+	}
+
+	if (used > arena->stats.high_water) {
+		arena->stats.high_water = used;
+	}
+	arena->stats.resets++;
+
+	if (arena->chunks && arena->chunks->next) {
+		// Merge all chunks in one for the next cycle
+		rb_arena_chunks_free(arena->chunks);
+		arena->chunks = NULL;
+		rb_arena_chunk_new(arena, size);
+	} else if (arena->chunks) {
+		arena->chunks->used = arena->chunks->last = 0;
+	}
+}
+
+void *rb_arena_malloc(struct rb_arena *arena, size_t size) {
+	if (size > SIZE_MAX / 2) {
+		rdlog(LOG_ERR, "Arena allocation overflow");
+		return NULL;
+	}
+
+	const size_t len = RB_ARENA_ROUND(size);
+	struct rb_arena_chunk *chunk = arena->chunks;
+	if (NULL == chunk || chunk->size - chunk->used < len) {
+		chunk = rb_arena_chunk_new(arena, len);
+		if (NULL == chunk) {
+			return NULL;
+		}
+	}
+
+	void *ret = &chunk->data[chunk->used];
+	chunk->last = chunk->used;
+	chunk->used += len;
+	arena->stats.allocs++;
+	return ret;
+}
+
+void *rb_arena_calloc(struct rb_arena *arena, size_t nmemb, size_t size) {
+	if (size && nmemb > SIZE_MAX / 2 / size) {
+		rdlog(LOG_ERR, "Arena allocation overflow");
+		return NULL;
+	}
+
+	void *ret = rb_arena_malloc(arena, nmemb * size);
+	if (ret) {
+		memset(ret, 0, RB_ARENA_ROUND(nmemb * size));
+	}
+	return ret;
+}
+
+void *rb_arena_realloc(struct rb_arena *arena,
+		       void *ptr,
+		       size_t old_size,
+		       size_t new_size) {
+	struct rb_arena_chunk *chunk = arena->chunks;
+	if (NULL == ptr) {
+		return rb_arena_calloc(arena, 1, new_size);
+	}
+
+	if (new_size <= old_size) {
+		return ptr;
+	}
+
+	const size_t len = RB_ARENA_ROUND(new_size);
+	if (ptr == &chunk->data[chunk->last] &&
+	    chunk->size - chunk->last >= len) {
+		// Last allocation, grow in place
+		memset((char *)ptr + old_size, 0, len - old_size);
+		chunk->used = chunk->last + len;
+		return ptr;
+	}
+
+	void *ret = rb_arena_calloc(arena, 1, new_size);
+	if (ret) {
+		memcpy(ret, ptr, old_size);
+	}
+	return ret;
+}
+
+char *rb_arena_strndup(struct rb_arena *arena, const char *str, size_t len) {
+	char *ret = rb_arena_calloc(arena, 1, len + 1);
+	if (ret) {
+		memcpy(ret, str, len);
+	}
+	return ret;
+}
+
+char *rb_arena_strdup(struct rb_arena *arena, const char *str) {
+	return rb_arena_strndup(arena, str, strlen(str));
+}
@@ -0,0 +1,103 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+/// Default arena chunk size
+#define RB_ARENA_DEFAULT_CHUNK_SIZE (64 * 1024)
+
+struct rb_arena_chunk;
+
+/** Bump allocator. Allocations are not freed individually: all of them are
+  released at once with rb_arena_reset. Not thread safe. */
+struct rb_arena {
+	struct rb_arena_chunk *chunks; ///< Chunks in use, current first
+	size_t chunk_size;	     ///< Minimum chunk size
+
+	/// Statistics
+	struct {
+		size_t allocs;	///< Allocations since init
+		size_t chunk_allocs;  ///< Chunks allocated since init
+		size_t resets;	///< Resets since init
+		size_t high_water;    ///< Max bytes used between resets
+	} stats;
+};
+
+/** Initialize an arena. It will not allocate any memory until needed.
+  @param arena Arena
+  @param chunk_size Minimum chunk size, or 0 to use default
+  */
+void rb_arena_init(struct rb_arena *arena, size_t chunk_size);
+
+/** Free all arena memory
+  @param arena Arena
+  */
+void rb_arena_done(struct rb_arena *arena);
+
+/** Release all arena allocations at once. If the last cycle needed many
+  chunks, they are merged in one so the next cycle does not need to chain
+  them.
+  @param arena Arena
+  */
+void rb_arena_reset(struct rb_arena *arena);
+
+/** Allocate uninitialized memory from the arena
+  @param arena Arena
+  @param size Size of allocation
+  @return Allocated memory, suitable aligned for any type, or NULL if error
+  */
+void *rb_arena_malloc(struct rb_arena *arena, size_t size);
+
+/** Allocate zero-initialized memory from the arena
+  @param arena Arena
+  @param nmemb Number of elements
+  @param size Size of each element
+  @return Allocated memory, suitable aligned for any type, or NULL if error
+  */
+void *rb_arena_calloc(struct rb_arena *arena, size_t nmemb, size_t size);
+
+/** Grow an arena allocation. If it is the last one, it is grown in place.
+  @param arena Arena
+  @param ptr Previous allocation, or NULL
+  @param old_size Previous allocation size
+  @param new_size New allocation size
+  @return Grown allocation, with new bytes set to zero, or NULL if error (ptr
+  is still valid in that case)
+  */
+void *rb_arena_realloc(struct rb_arena *arena,
+		       void *ptr,
+		       size_t old_size,
+		       size_t new_size);
+
+/** Duplicate a string in the arena
+  @param arena Arena
+  @param str String
+  @param len String length
+  @return Null terminated copy, or NULL if error
+  */
+char *rb_arena_strndup(struct rb_arena *arena, const char *str, size_t len);
+
+/** Duplicate a null terminated string in the arena
+  @param arena Arena
+  @param str String
+  @return Copy, or NULL if error
+  */
+char *rb_arena_strdup(struct rb_arena *arena, const char *str);
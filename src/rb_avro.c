@@ -0,0 +1,538 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_avro.h"
+
+#include "rb_number.h"
+
+#include <librd/rd.h>
+#include <librd/rdlog.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Avro primitive types
+enum avro_type {
+	AVRO_NULL,
+	AVRO_BOOLEAN,
+	AVRO_INT,
+	AVRO_LONG,
+	AVRO_FLOAT,
+	AVRO_DOUBLE,
+	AVRO_BYTES,
+	AVRO_STRING,
+	AVRO_TYPES_COUNT,
+};
+
+static const char *avro_type_names[] = {
+		[AVRO_NULL] = "null",
+		[AVRO_BOOLEAN] = "boolean",
+		[AVRO_INT] = "int",
+		[AVRO_LONG] = "long",
+		[AVRO_FLOAT] = "float",
+		[AVRO_DOUBLE] = "double",
+		[AVRO_BYTES] = "bytes",
+		[AVRO_STRING] = "string",
+};
+
+/// Avro record field
+struct avro_field {
+	char *name; ///< Field name
+	/// Field type, or union branches. A union can't contain the same type
+	/// twice.
+	enum avro_type types[AVRO_TYPES_COUNT];
+	size_t types_count;	///< Length of types
+	bool is_union;		///< Field is an union
+	json_object *default_value; ///< Default value, if any
+};
+
+struct rb_avro_schema {
+	int32_t id;		   ///< Schema id
+	struct avro_field *fields; ///< Record fields
+	size_t fields_count;       ///< Length of fields
+};
+
+/*
+ * ENCODING
+ */
+
+/** Append a long, zig-zag and variable length encoded
+  @param buf Buffer
+  @param value Value
+  */
+static void avro_encode_long(struct printbuf *buf, int64_t value) {
+	uint64_t n = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+	char tmp[10];
+	size_t len = 0;
+
+	do {
+		tmp[len] = (char)(n & 0x7f);
+		n >>= 7;
+		if (n) {
+			tmp[len] |= (char)0x80;
+		}
+		len++;
+	} while (n);
+
+	printbuf_memappend(buf, tmp, (int)len);
+}
+
+/** Append a little endian value
+  @param buf Buffer
+  @param value Value
+  @param size Bytes of value to append
+  */
+static void avro_encode_le(struct printbuf *buf, uint64_t value, size_t size) {
+	char tmp[sizeof(value)];
+	for (size_t i = 0; i < size; ++i) {
+		tmp[i] = (char)(value >> (8 * i));
+	}
+	printbuf_memappend(buf, tmp, (int)size);
+}
+
+/** Convert a JSON value to integer
+  @param json JSON value
+  @param value Converted value
+  @return true if success, false if it is not an integer
+  */
+static bool avro_json_long(json_object *json, int64_t *value) {
+	switch (json_object_get_type(json)) {
+	case json_type_int:
+	case json_type_boolean:
+		*value = json_object_get_int64(json);
+		return true;
+	case json_type_string: {
+		const char *str = json_object_get_string(json);
+		char *endptr = NULL;
+		errno = 0;
+		*value = strtoll(str, &endptr, 10);
+		return *str && '\0' == *endptr && 0 == errno;
+	}
+	case json_type_double:
+	case json_type_null:
+	case json_type_object:
+	case json_type_array:
+	default:
+		return false;
+	};
+}
+
+/** Convert a JSON value to double
+  @param json JSON value
+  @param value Converted value
+  @return true if success, false if it is not a number
+  */
+static bool avro_json_double(json_object *json, double *value) {
+	switch (json_object_get_type(json)) {
+	case json_type_int:
+	case json_type_double:
+		*value = json_object_get_double(json);
+		return true;
+	case json_type_string: {
+		const char *str = json_object_get_string(json);
+		char *endptr = NULL;
+		*value = rb_number_parse(str, &endptr);
+		return *str && '\0' == *endptr;
+	}
+	case json_type_boolean:
+	case json_type_null:
+	case json_type_object:
+	case json_type_array:
+	default:
+		return false;
+	};
+}
+
+/** Encode a JSON value as an Avro primitive type
+  @param buf Buffer to append value to
+  @param type Avro type
+  @param json JSON value, or NULL if not present
+  @return true if success, false if value can't be converted to type
+  */
+static bool avro_encode_value(struct printbuf *buf,
+			      enum avro_type type,
+			      json_object *json) {
+	const bool is_null = json_object_is_type(json, json_type_null);
+	int64_t l = 0;
+	double d = 0;
+
+	if (AVRO_NULL == type || is_null) {
+		return AVRO_NULL == type && is_null;
+	}
+
+	switch (type) {
+	case AVRO_BOOLEAN: {
+		if (!json_object_is_type(json, json_type_boolean)) {
+			return false;
+		}
+		const char b = json_object_get_boolean(json) ? 1 : 0;
+		printbuf_memappend(buf, &b, 1);
+		return true;
+	}
+	case AVRO_INT:
+		if (!avro_json_long(json, &l) || l < INT32_MIN ||
+		    l > INT32_MAX) {
+			return false;
+		}
+		avro_encode_long(buf, l);
+		return true;
+	case AVRO_LONG:
+		if (!avro_json_long(json, &l)) {
+			return false;
+		}
+		avro_encode_long(buf, l);
+		return true;
+	case AVRO_FLOAT: {
+		if (!avro_json_double(json, &d)) {
+			return false;
+		}
+		const float f = (float)d;
+		uint32_t bits;
+		memcpy(&bits, &f, sizeof(bits));
+		avro_encode_le(buf, bits, sizeof(bits));
+		return true;
+	}
+	case AVRO_DOUBLE: {
+		if (!avro_json_double(json, &d)) {
+			return false;
+		}
+		uint64_t bits;
+		memcpy(&bits, &d, sizeof(bits));
+		avro_encode_le(buf, bits, sizeof(bits));
+		return true;
+	}
+	case AVRO_BYTES:
+	case AVRO_STRING: {
+		if (json_object_is_type(json, json_type_object) ||
+		    json_object_is_type(json, json_type_array)) {
+			return false;
+		}
+		const char *str = json_object_get_string(json);
+		const size_t len = strlen(str);
+		avro_encode_long(buf, (int64_t)len);
+		printbuf_memappend(buf, str, (int)len);
+		return true;
+	}
+	case AVRO_NULL:
+	case AVRO_TYPES_COUNT:
+	default:
+		return false;
+	};
+}
+
+/** Encode a record field
+  @param buf Buffer to append field to
+  @param field Field
+  @param json Field JSON value, or NULL if not present
+  @return true if success, false in other case
+  */
+static bool avro_encode_field(struct printbuf *buf,
+			      const struct avro_field *field,
+			      json_object *json) {
+	if (NULL == json) {
+		json = field->default_value;
+	}
+
+	if (!field->is_union) {
+		return avro_encode_value(buf, field->types[0], json);
+	}
+
+	for (size_t i = 0; i < field->types_count; ++i) {
+		// Try every branch until value fits in one
+		const int bpos = buf->bpos;
+		avro_encode_long(buf, (int64_t)i);
+		if (avro_encode_value(buf, field->types[i], json)) {
+			return true;
+		}
+		buf->bpos = bpos;
+	}
+
+	return false;
+}
+
+bool rb_avro_encode(const struct rb_avro_schema *schema,
+		    struct printbuf *buf,
+		    json_object *record,
+		    json_object *fallback) {
+	// Schema registry wire format: magic byte and big endian schema id
+	const char header[] = {
+			0,
+			(char)(schema->id >> 24),
+			(char)(schema->id >> 16),
+			(char)(schema->id >> 8),
+			(char)schema->id,
+	};
+	printbuf_memappend(buf, header, sizeof(header));
+
+	for (size_t i = 0; i < schema->fields_count; ++i) {
+		const struct avro_field *field = &schema->fields[i];
+		json_object *value = NULL;
+		const char *name = field->name;
+		if (!json_object_object_get_ex(record, name, &value) &&
+		    fallback) {
+			json_object_object_get_ex(fallback, name, &value);
+		}
+
+		if (!avro_encode_field(buf, field, value)) {
+			rdlog(LOG_DEBUG,
+			      "Can't encode field %s of schema %" PRId32,
+			      field->name,
+			      schema->id);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * SCHEMA PARSING
+ */
+
+/** Parse an Avro primitive type
+  @param json Type name, or object with type name in "type" child
+  @param type Parsed type
+  @return true if success, false if it is not a supported type
+  */
+static bool avro_type_parse(json_object *json, enum avro_type *type) {
+	if (json_object_is_type(json, json_type_object)) {
+		json_object *type_name = NULL;
+		json_object_object_get_ex(json, "type", &type_name);
+		json = type_name;
+	}
+
+	if (!json_object_is_type(json, json_type_string)) {
+		return false;
+	}
+
+	const char *name = json_object_get_string(json);
+	for (size_t i = 0; i < RD_ARRAYSIZE(avro_type_names); ++i) {
+		if (0 == strcmp(name, avro_type_names[i])) {
+			*type = (enum avro_type)i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Parse a record field
+  @param field Field to parse. It must be zeroed.
+  @param json Field JSON definition
+  @return true if success, false in other case
+  */
+static bool avro_field_parse(struct avro_field *field, json_object *json) {
+	json_object *name = NULL, *type = NULL, *default_value = NULL;
+	json_object_object_get_ex(json, "name", &name);
+	json_object_object_get_ex(json, "type", &type);
+
+	if (!json_object_is_type(name, json_type_string) || NULL == type) {
+		rdlog(LOG_ERR, "Avro field with no name or type");
+		return false;
+	}
+
+	field->name = strdup(json_object_get_string(name));
+	if (NULL == field->name) {
+		rdlog(LOG_ERR, "Couldn't allocate avro field (OOM?)");
+		return false;
+	}
+
+	field->is_union = json_object_is_type(type, json_type_array);
+	field->types_count = field->is_union ? (size_t)json_object_array_length(
+							       type)
+					     : 1;
+	if (0 == field->types_count ||
+	    field->types_count > RD_ARRAYSIZE(field->types)) {
+		rdlog(LOG_ERR, "Invalid avro field %s union", field->name);
+		return false;
+	}
+
+	for (size_t i = 0; i < field->types_count; ++i) {
+		json_object *type_i =
+				field->is_union ? json_object_array_get_idx(
+							  type, (int)i)
+						: type;
+		if (!avro_type_parse(type_i, &field->types[i])) {
+			rdlog(LOG_ERR,
+			      "Unsupported avro field %s type %s",
+			      field->name,
+			      json_object_to_json_string(type_i));
+			return false;
+		}
+	}
+
+	if (json_object_object_get_ex(json, "default", &default_value)) {
+		field->default_value = json_object_get(default_value);
+	}
+
+	return true;
+}
+
+static void avro_schema_done(struct rb_avro_schema *schema) {
+	for (size_t i = 0; i < schema->fields_count; ++i) {
+		free(schema->fields[i].name);
+		if (schema->fields[i].default_value) {
+			json_object_put(schema->fields[i].default_value);
+		}
+	}
+	free(schema->fields);
+}
+
+/** Parse an Avro record schema
+  @param schema Schema to parse. It must be zeroed.
+  @param id Schema id
+  @param json Schema JSON definition
+  @return true if success, false in other case. Schema must be freed with
+  avro_schema_done in any case.
+  */
+static bool avro_schema_parse(struct rb_avro_schema *schema,
+			      int32_t id,
+			      json_object *json) {
+	json_object *type = NULL, *fields = NULL;
+	json_object_object_get_ex(json, "type", &type);
+	json_object_object_get_ex(json, "fields", &fields);
+
+	if (NULL == type || 0 != strcmp(json_object_get_string(type),
+					"record") ||
+	    !json_object_is_type(fields, json_type_array)) {
+		rdlog(LOG_ERR, "Avro schema %" PRId32 " is not a record", id);
+		return false;
+	}
+
+	const size_t fields_count = (size_t)json_object_array_length(fields);
+	schema->id = id;
+	schema->fields = calloc(fields_count, sizeof(schema->fields[0]));
+	if (fields_count > 0 && NULL == schema->fields) {
+		rdlog(LOG_ERR, "Couldn't allocate avro schema (OOM?)");
+		return false;
+	}
+
+	for (; schema->fields_count < fields_count; ++schema->fields_count) {
+		struct avro_field *field =
+				&schema->fields[schema->fields_count];
+		json_object *field_json = json_object_array_get_idx(
+				fields, (int)schema->fields_count);
+		if (!avro_field_parse(field, field_json)) {
+			schema->fields_count++; // Release it too
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * SCHEMA STORE
+ */
+
+/// Schema store subject
+struct avro_subject {
+	char *subject;		      ///< Subject name
+	struct rb_avro_schema schema; ///< Subject schema
+};
+
+struct rb_avro_schema_store {
+	struct avro_subject *subjects; ///< Subjects
+	size_t subjects_count;	 ///< Length of subjects
+};
+
+struct rb_avro_schema_store *rb_avro_schema_store_new(const char *path) {
+	struct rb_avro_schema_store *ret = NULL;
+	json_object *json = json_object_from_file(path);
+	if (!json_object_is_type(json, json_type_object)) {
+		rdlog(LOG_ERR, "Couldn't load avro schema store %s", path);
+		goto err;
+	}
+
+	const size_t subjects_count = (size_t)json_object_object_length(json);
+	ret = calloc(1, sizeof(*ret));
+	if (ret) {
+		ret->subjects = calloc(subjects_count,
+				       sizeof(ret->subjects[0]));
+	}
+	if (NULL == ret || (subjects_count > 0 && NULL == ret->subjects)) {
+		rdlog(LOG_ERR, "Couldn't allocate schema store (OOM?)");
+		free(ret);
+		goto err;
+	}
+
+	for (struct json_object_iterator i = json_object_iter_begin(json),
+					 end = json_object_iter_end(json);
+	     !json_object_iter_equal(&i, &end);
+	     json_object_iter_next(&i)) {
+		const char *subject = json_object_iter_peek_name(&i);
+		json_object *subject_json = json_object_iter_peek_value(&i);
+		json_object *id = NULL, *schema = NULL;
+		json_object_object_get_ex(subject_json, "id", &id);
+		json_object_object_get_ex(subject_json, "schema", &schema);
+
+		struct avro_subject *s = &ret->subjects[ret->subjects_count++];
+		s->subject = strdup(subject);
+		if (NULL == s->subject) {
+			rdlog(LOG_ERR, "Couldn't allocate subject (OOM?)");
+			goto store_err;
+		}
+
+		if (!json_object_is_type(id, json_type_int)) {
+			rdlog(LOG_ERR, "Subject %s has no valid id", subject);
+			goto store_err;
+		}
+
+		if (!avro_schema_parse(&s->schema,
+				       (int32_t)json_object_get_int64(id),
+				       schema)) {
+			rdlog(LOG_ERR, "Invalid subject %s schema", subject);
+			goto store_err;
+		}
+	}
+
+	json_object_put(json);
+	return ret;
+
+store_err:
+	rb_avro_schema_store_done(ret);
+err:
+	if (json) {
+		json_object_put(json);
+	}
+	return NULL;
+}
+
+const struct rb_avro_schema *
+rb_avro_schema_store_get(const struct rb_avro_schema_store *store,
+			 const char *subject) {
+	for (size_t i = 0; i < store->subjects_count; ++i) {
+		if (0 == strcmp(store->subjects[i].subject, subject)) {
+			return &store->subjects[i].schema;
+		}
+	}
+
+	return NULL;
+}
+
+void rb_avro_schema_store_done(struct rb_avro_schema_store *store) {
+	for (size_t i = 0; i < store->subjects_count; ++i) {
+		free(store->subjects[i].subject);
+		avro_schema_done(&store->subjects[i].schema);
+	}
+	free(store->subjects);
+	free(store);
+}
@@ -0,0 +1,70 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <json-c/json.h>
+#include <json-c/printbuf.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Avro record schema. Fields can be of any primitive type, or unions of
+  them. */
+struct rb_avro_schema;
+
+/** Encode a JSON object as an Avro record, with schema registry framing
+  (magic byte and schema id). Values are converted to the field type if
+  possible, so numbers in strings can be encoded as double fields and so on.
+  @param schema Record schema
+  @param buf Buffer to append encoded record to
+  @param record JSON object to encode
+  @param fallback Object to search fields not present in record, or NULL
+  @return true if success, false if record does not match schema. Buffer
+  content is undefined in that case.
+  */
+bool rb_avro_encode(const struct rb_avro_schema *schema,
+		    struct printbuf *buf,
+		    /* @todo const */ json_object *record,
+		    /* @todo const */ json_object *fallback);
+
+/** Stand-in for a schema registry: a JSON file with schemas by subject,
+  with the form {"<subject>":{"id":<schema id>,"schema":<avro schema>}}.
+  All schemas are parsed and cached at load time. */
+struct rb_avro_schema_store;
+
+/** Load a schema store from file
+  @param path File path
+  @return New schema store, or NULL in case of error
+  */
+struct rb_avro_schema_store *rb_avro_schema_store_new(const char *path);
+
+/** Get a subject schema
+  @param store Schema store
+  @param subject Schema subject
+  @return Schema, or NULL if not found. It is valid until store is done.
+  */
+const struct rb_avro_schema *
+rb_avro_schema_store_get(const struct rb_avro_schema_store *store,
+			 const char *subject);
+
+/** Free a schema store
+  @param store Schema store
+  */
+void rb_avro_schema_store_done(struct rb_avro_schema_store *store);
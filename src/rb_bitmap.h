@@ -0,0 +1,57 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Number of words needed by a bitmap of n bits
+#define RB_BITMAP_WORDS(n) (((n) + 63) / 64)
+
+/** Check a bitmap bit
+  @param bitmap Bitmap
+  @param i Bit position
+  @return true if bit is set
+  */
+static bool rb_bitmap_test(const uint64_t *bitmap, size_t i)
+		__attribute__((unused));
+static bool rb_bitmap_test(const uint64_t *bitmap, size_t i) {
+	return bitmap[i / 64] & (UINT64_C(1) << (i % 64));
+}
+
+/** Set a bitmap bit
+  @param bitmap Bitmap
+  @param i Bit position
+  */
+static void rb_bitmap_set(uint64_t *bitmap, size_t i) __attribute__((unused));
+static void rb_bitmap_set(uint64_t *bitmap, size_t i) {
+	bitmap[i / 64] |= UINT64_C(1) << (i % 64);
+}
+
+/** Clear a bitmap bit
+  @param bitmap Bitmap
+  @param i Bit position
+  */
+static void rb_bitmap_clear(uint64_t *bitmap, size_t i)
+		__attribute__((unused));
+static void rb_bitmap_clear(uint64_t *bitmap, size_t i) {
+	bitmap[i / 64] &= ~(UINT64_C(1) << (i % 64));
+}
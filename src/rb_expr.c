@@ -0,0 +1,722 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_expr.h"
+
+#include "rb_arena.h"
+#include "rb_bitmap.h"
+
+#include <librd/rdlog.h>
+
+#include <assert.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum rb_expr_opcode {
+	RB_EXPR_OP__VAR,
+	RB_EXPR_OP__CONST,
+	RB_EXPR_OP__ADD,
+	RB_EXPR_OP__SUB,
+	RB_EXPR_OP__MUL,
+	RB_EXPR_OP__DIV,
+	RB_EXPR_OP__POW,
+	RB_EXPR_OP__NEG,
+	RB_EXPR_OP__FUNC,
+	RB_EXPR_OP__REDUCE,
+};
+
+enum rb_expr_reduction {
+	RB_EXPR_REDUCE__SUM,
+	RB_EXPR_REDUCE__MEAN,
+	RB_EXPR_REDUCE__MIN,
+	RB_EXPR_REDUCE__MAX,
+};
+
+/// Bytecode instruction
+struct rb_expr_instr {
+	enum rb_expr_opcode opcode;
+	union {
+		size_t var;			 ///< VAR: variable index
+		double constant;		 ///< CONST: value
+		double (*func)(double);		 ///< FUNC: function
+		enum rb_expr_reduction reduction; ///< REDUCE: reduction
+	};
+};
+
+struct rb_expr {
+	/// Bytecode
+	struct {
+		struct rb_expr_instr *instr;
+		size_t count, size;
+	} code;
+
+	/// Variables names, in first appearance order
+	struct {
+		char **names;
+		size_t count;
+	} vars;
+
+	size_t max_stack; ///< Evaluation stack needed
+};
+
+static const struct {
+	const char *name;
+	double (*func)(double);
+} rb_expr_functions[] = {
+		{"exp", exp},
+		{"log", log},
+		{"sqrt", sqrt},
+		{"sin", sin},
+		{"cos", cos},
+		{"tan", tan},
+		{"asin", asin},
+		{"acos", acos},
+		{"atan", atan},
+		{"sinh", sinh},
+		{"cosh", cosh},
+		{"tanh", tanh},
+		{"abs", fabs},
+};
+
+static const struct {
+	const char *name;
+	enum rb_expr_reduction reduction;
+} rb_expr_reductions[] = {
+		{"sum", RB_EXPR_REDUCE__SUM},
+		{"mean", RB_EXPR_REDUCE__MEAN},
+		{"min", RB_EXPR_REDUCE__MIN},
+		{"max", RB_EXPR_REDUCE__MAX},
+};
+
+static const struct {
+	const char *name;
+	double value;
+} rb_expr_constants[] = {
+		{"e", M_E}, {"pi", M_PI},
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/*
+ * PARSING
+ */
+
+/// Recursive descent parser state
+struct rb_expr_parser {
+	const char *cursor;  ///< Next char to parse
+	struct rb_expr *expr; ///< Expression we are compiling
+	size_t stack;	     ///< Current evaluation stack depth
+};
+
+/** Skip spaces and return next char
+  @param parser Parser
+  @return Next non-space char
+  */
+static char parser_peek(struct rb_expr_parser *parser) {
+	while (isspace((unsigned char)*parser->cursor)) {
+		parser->cursor++;
+	}
+	return *parser->cursor;
+}
+
+/** Consume next char if it is the expected one
+  @param parser Parser
+  @param c Expected char
+  @return true if consumed
+  */
+static bool parser_accept(struct rb_expr_parser *parser, char c) {
+	if (parser_peek(parser) != c) {
+		return false;
+	}
+	parser->cursor++;
+	return true;
+}
+
+/** Append an instruction to expression bytecode
+  @param parser Parser
+  @param instr Instruction
+  @param stack_delta Stack change produced by instruction
+  @return true if success, false if OOM
+  */
+static bool parser_emit(struct rb_expr_parser *parser,
+			struct rb_expr_instr instr,
+			int stack_delta) {
+	struct rb_expr *expr = parser->expr;
+
+	if (expr->code.count == expr->code.size) {
+		const size_t new_size =
+				expr->code.size ? 2 * expr->code.size : 16;
+		struct rb_expr_instr *new_instr = realloc(
+				expr->code.instr,
+				new_size * sizeof(new_instr[0]));
+		if (NULL == new_instr) {
+			rdlog(LOG_ERR, "Couldn't allocate bytecode (OOM?)");
+			return false;
+		}
+		expr->code.instr = new_instr;
+		expr->code.size = new_size;
+	}
+
+	expr->code.instr[expr->code.count++] = instr;
+	parser->stack = (size_t)((int)parser->stack + stack_delta);
+	if (parser->stack > expr->max_stack) {
+		expr->max_stack = parser->stack;
+	}
+
+	return true;
+}
+
+/** Get variable index, adding it if it is the first time we see it
+  @param expr Expression
+  @param name Variable name
+  @param name_len Variable name length
+  @return Variable index, or expr->vars.count + 1 if error
+  */
+static size_t expr_var_idx(struct rb_expr *expr,
+			   const char *name,
+			   size_t name_len) {
+	for (size_t i = 0; i < expr->vars.count; ++i) {
+		if (strlen(expr->vars.names[i]) == name_len &&
+		    0 == strncmp(expr->vars.names[i], name, name_len)) {
+			return i;
+		}
+	}
+
+	char **names = realloc(expr->vars.names,
+			       (expr->vars.count + 1) * sizeof(names[0]));
+	if (NULL == names) {
+		goto err;
+	}
+	expr->vars.names = names;
+
+	names[expr->vars.count] = strndup(name, name_len);
+	if (NULL == names[expr->vars.count]) {
+		goto err;
+	}
+
+	return expr->vars.count++;
+
+err:
+	rdlog(LOG_ERR, "Couldn't allocate variable name (OOM?)");
+	return expr->vars.count + 1;
+}
+
+static bool parse_expression(struct rb_expr_parser *parser);
+static bool parse_unary(struct rb_expr_parser *parser);
+
+/** Parse a function or reduction call, after its name
+  @param parser Parser
+  @param name Function name
+  @param name_len Function name length
+  @return true if success
+  */
+static bool parse_call(struct rb_expr_parser *parser,
+		       const char *name,
+		       size_t name_len) {
+	struct rb_expr_instr instr;
+	bool found = false;
+
+	for (size_t i = 0; !found && i < ARRAY_SIZE(rb_expr_functions); ++i) {
+		if (strlen(rb_expr_functions[i].name) == name_len &&
+		    0 == strncmp(rb_expr_functions[i].name, name, name_len)) {
+			instr.opcode = RB_EXPR_OP__FUNC;
+			instr.func = rb_expr_functions[i].func;
+			found = true;
+		}
+	}
+
+	for (size_t i = 0; !found && i < ARRAY_SIZE(rb_expr_reductions); ++i) {
+		if (strlen(rb_expr_reductions[i].name) == name_len &&
+		    0 == strncmp(rb_expr_reductions[i].name, name, name_len)) {
+			instr.opcode = RB_EXPR_OP__REDUCE;
+			instr.reduction = rb_expr_reductions[i].reduction;
+			found = true;
+		}
+	}
+
+	if (!found) {
+		rdlog(LOG_DEBUG, "Unknown function %.*s", (int)name_len, name);
+		return false;
+	}
+
+	return parse_expression(parser) && parser_accept(parser, ')') &&
+	       parser_emit(parser, instr, 0);
+}
+
+/** Parse a number, variable, constant, call or parenthesis expression
+  @param parser Parser
+  @return true if success
+  */
+static bool parse_primary(struct rb_expr_parser *parser) {
+	const char c = parser_peek(parser);
+
+	if (parser_accept(parser, '(')) {
+		return parse_expression(parser) && parser_accept(parser, ')');
+	}
+
+	if (isdigit((unsigned char)c) || '.' == c) {
+		char *endptr = NULL;
+		const struct rb_expr_instr instr = {
+				.opcode = RB_EXPR_OP__CONST,
+				.constant = strtod(parser->cursor, &endptr),
+		};
+		if (endptr == parser->cursor) {
+			return false;
+		}
+		parser->cursor = endptr;
+		return parser_emit(parser, instr, 1);
+	}
+
+	if (!isalpha((unsigned char)c) && '_' != c) {
+		return false;
+	}
+
+	const char *name = parser->cursor;
+	while (isalnum((unsigned char)*parser->cursor) ||
+	       '_' == *parser->cursor) {
+		parser->cursor++;
+	}
+	const size_t name_len = (size_t)(parser->cursor - name);
+
+	if (parser_accept(parser, '(')) {
+		return parse_call(parser, name, name_len);
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(rb_expr_constants); ++i) {
+		if (strlen(rb_expr_constants[i].name) == name_len &&
+		    0 == strncmp(rb_expr_constants[i].name, name, name_len)) {
+			const struct rb_expr_instr instr = {
+					.opcode = RB_EXPR_OP__CONST,
+					.constant = rb_expr_constants[i].value,
+			};
+			return parser_emit(parser, instr, 1);
+		}
+	}
+
+	const struct rb_expr_instr instr = {
+			.opcode = RB_EXPR_OP__VAR,
+			.var = expr_var_idx(parser->expr, name, name_len),
+	};
+	return instr.var <= parser->expr->vars.count &&
+	       parser_emit(parser, instr, 1);
+}
+
+/** Parse an exponent: a primary expression with optional unary plus and
+  minus. It does not parse exponentiation, so power chains are folded by
+  parse_power.
+  @param parser Parser
+  @return true if success
+  */
+static bool parse_exponent(struct rb_expr_parser *parser) {
+	static const struct rb_expr_instr neg_instr = {
+			.opcode = RB_EXPR_OP__NEG,
+	};
+
+	if (parser_accept(parser, '-')) {
+		return parse_exponent(parser) &&
+		       parser_emit(parser, neg_instr, 0);
+	} else if (parser_accept(parser, '+')) {
+		return parse_exponent(parser);
+	}
+
+	return parse_primary(parser);
+}
+
+/** Parse exponentiation. As libmatheval does, it is left associative
+  (2^3^2 == (2^3)^2), and it binds tighter than unary minus in the base
+  (-x^2 == -(x^2)).
+  @param parser Parser
+  @return true if success
+  */
+static bool parse_power(struct rb_expr_parser *parser) {
+	static const struct rb_expr_instr pow_instr = {
+			.opcode = RB_EXPR_OP__POW,
+	};
+
+	if (!parse_primary(parser)) {
+		return false;
+	}
+
+	while (parser_accept(parser, '^')) {
+		if (!parse_exponent(parser) ||
+		    !parser_emit(parser, pow_instr, -1)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/** Parse unary plus and minus
+  @param parser Parser
+  @return true if success
+  */
+static bool parse_unary(struct rb_expr_parser *parser) {
+	static const struct rb_expr_instr neg_instr = {
+			.opcode = RB_EXPR_OP__NEG,
+	};
+
+	if (parser_accept(parser, '-')) {
+		return parse_unary(parser) && parser_emit(parser, neg_instr, 0);
+	} else if (parser_accept(parser, '+')) {
+		return parse_unary(parser);
+	}
+
+	return parse_power(parser);
+}
+
+/** Parse products and divisions
+  @param parser Parser
+  @return true if success
+  */
+static bool parse_term(struct rb_expr_parser *parser) {
+	if (!parse_unary(parser)) {
+		return false;
+	}
+
+	while (true) {
+		struct rb_expr_instr instr;
+		if (parser_accept(parser, '*')) {
+			instr.opcode = RB_EXPR_OP__MUL;
+		} else if (parser_accept(parser, '/')) {
+			instr.opcode = RB_EXPR_OP__DIV;
+		} else {
+			return true;
+		}
+
+		if (!parse_unary(parser) || !parser_emit(parser, instr, -1)) {
+			return false;
+		}
+	}
+}
+
+/** Parse additions and subtractions
+  @param parser Parser
+  @return true if success
+  */
+static bool parse_expression(struct rb_expr_parser *parser) {
+	if (!parse_term(parser)) {
+		return false;
+	}
+
+	while (true) {
+		struct rb_expr_instr instr;
+		if (parser_accept(parser, '+')) {
+			instr.opcode = RB_EXPR_OP__ADD;
+		} else if (parser_accept(parser, '-')) {
+			instr.opcode = RB_EXPR_OP__SUB;
+		} else {
+			return true;
+		}
+
+		if (!parse_term(parser) || !parser_emit(parser, instr, -1)) {
+			return false;
+		}
+	}
+}
+
+struct rb_expr *rb_expr_compile(const char *expression) {
+	struct rb_expr *ret = calloc(1, sizeof(*ret));
+	if (NULL == ret) {
+		rdlog(LOG_ERR, "Couldn't allocate expression (OOM?)");
+		return NULL;
+	}
+
+	struct rb_expr_parser parser = {
+			.cursor = expression, .expr = ret,
+	};
+
+	if (!parse_expression(&parser) || '\0' != parser_peek(&parser)) {
+		rdlog(LOG_DEBUG,
+		      "Couldn't compile expression %s at position %zu",
+		      expression,
+		      (size_t)(parser.cursor - expression));
+		rb_expr_done(ret);
+		return NULL;
+	}
+
+	return ret;
+}
+
+void rb_expr_done(struct rb_expr *expr) {
+	for (size_t i = 0; i < expr->vars.count; ++i) {
+		free(expr->vars.names[i]);
+	}
+	free(expr->vars.names);
+	free(expr->code.instr);
+	free(expr);
+}
+
+size_t rb_expr_vars_count(const struct rb_expr *expr) {
+	return expr->vars.count;
+}
+
+char **rb_expr_vars_names(const struct rb_expr *expr) {
+	return expr->vars.names;
+}
+
+/*
+ * EVALUATION
+ */
+
+/// Evaluation stack slot
+struct rb_expr_slot {
+	double *values;
+	uint8_t *valid;
+	bool vector; ///< If false, only element 0 is meaningful
+};
+
+/** Expand a scalar slot to a vector one
+  @param slot Slot
+  @param n Vector length
+  */
+static void slot_broadcast(struct rb_expr_slot *slot, size_t n) {
+	if (slot->vector) {
+		return;
+	}
+
+	for (size_t i = 1; i < n; ++i) {
+		slot->values[i] = slot->values[0];
+		slot->valid[i] = slot->valid[0];
+	}
+	slot->vector = true;
+}
+
+/** Load a variable in a slot
+  @param slot Slot
+  @param var Variable value
+  @param n Vector length
+  */
+static void eval_load(struct rb_expr_slot *slot,
+		      const struct rb_expr_value *var,
+		      size_t n) {
+	const size_t len = var->vector ? n : 1;
+
+	slot->vector = var->vector;
+	memcpy(slot->values, var->values, len * sizeof(slot->values[0]));
+	if (var->valid) {
+		// Byte mask is friendlier to vectorized loops
+		for (size_t i = 0; i < len; ++i) {
+			slot->valid[i] = rb_bitmap_test(var->valid, i);
+		}
+	} else {
+		memset(slot->valid, 1, len * sizeof(slot->valid[0]));
+	}
+}
+
+/** Apply a binary operation, a = a <op> b
+  @param opcode Operation
+  @param a First operand and result
+  @param b Second operand
+  @param n Vector length
+  */
+static void eval_binary(enum rb_expr_opcode opcode,
+			struct rb_expr_slot *a,
+			struct rb_expr_slot *b,
+			size_t n) {
+	size_t len = 1;
+
+	if (a->vector || b->vector) {
+		slot_broadcast(a, n);
+		slot_broadcast(b, n);
+		len = n;
+	}
+
+	double *restrict x = a->values;
+	const double *restrict y = b->values;
+
+	switch (opcode) {
+	case RB_EXPR_OP__ADD:
+		for (size_t i = 0; i < len; ++i) {
+			x[i] += y[i];
+		}
+		break;
+	case RB_EXPR_OP__SUB:
+		for (size_t i = 0; i < len; ++i) {
+			x[i] -= y[i];
+		}
+		break;
+	case RB_EXPR_OP__MUL:
+		for (size_t i = 0; i < len; ++i) {
+			x[i] *= y[i];
+		}
+		break;
+	case RB_EXPR_OP__DIV:
+		for (size_t i = 0; i < len; ++i) {
+			x[i] /= y[i];
+		}
+		break;
+	case RB_EXPR_OP__POW:
+		for (size_t i = 0; i < len; ++i) {
+			x[i] = pow(x[i], y[i]);
+		}
+		break;
+	default:
+		break;
+	};
+
+	uint8_t *restrict xv = a->valid;
+	const uint8_t *restrict yv = b->valid;
+	for (size_t i = 0; i < len; ++i) {
+		xv[i] &= yv[i];
+	}
+}
+
+/** Reduce a slot to a scalar. Invalid elements are ignored, and result is not
+  valid if there is no valid element.
+  @param reduction Reduction
+  @param slot Slot
+  @param n Vector length
+  */
+static void eval_reduce(enum rb_expr_reduction reduction,
+			struct rb_expr_slot *slot,
+			size_t n) {
+	const size_t len = slot->vector ? n : 1;
+	size_t count = 0;
+	double acc = 0;
+
+	for (size_t i = 0; i < len; ++i) {
+		if (!slot->valid[i]) {
+			continue;
+		}
+
+		const double x = slot->values[i];
+		if (0 == count++) {
+			acc = x;
+			continue;
+		}
+
+		switch (reduction) {
+		case RB_EXPR_REDUCE__SUM:
+		case RB_EXPR_REDUCE__MEAN:
+			acc += x;
+			break;
+		case RB_EXPR_REDUCE__MIN:
+			acc = x < acc ? x : acc;
+			break;
+		case RB_EXPR_REDUCE__MAX:
+			acc = x > acc ? x : acc;
+			break;
+		default:
+			break;
+		};
+	}
+
+	if (RB_EXPR_REDUCE__MEAN == reduction && count > 0) {
+		acc /= count;
+	}
+
+	slot->values[0] = acc;
+	slot->valid[0] = count > 0;
+	slot->vector = false;
+}
+
+bool rb_expr_eval(const struct rb_expr *expr,
+		  struct rb_arena *arena,
+		  const struct rb_expr_value *vars,
+		  size_t n,
+		  double *result,
+		  uint64_t *result_valid,
+		  bool *result_vector) {
+	// Scalars still need one element
+	const size_t slot_len = n > 0 ? n : 1;
+	const size_t stack_size = expr->max_stack;
+	size_t sp = 0;
+
+	// Only one allocation: values, slots and then masks
+	const size_t buf_size = stack_size * (slot_len * sizeof(double) +
+					      sizeof(struct rb_expr_slot) +
+					      slot_len * sizeof(uint8_t));
+	char *buf = arena ? rb_arena_malloc(arena, buf_size) : malloc(buf_size);
+	if (NULL == buf) {
+		rdlog(LOG_ERR, "Couldn't allocate evaluation stack (OOM?)");
+		return false;
+	}
+
+	double *values = (double *)buf;
+	struct rb_expr_slot *stack =
+			(struct rb_expr_slot *)&values[stack_size * slot_len];
+	uint8_t *valid = (uint8_t *)&stack[stack_size];
+	for (size_t i = 0; i < stack_size; ++i) {
+		stack[i].values = &values[i * slot_len];
+		stack[i].valid = &valid[i * slot_len];
+	}
+
+	for (size_t pc = 0; pc < expr->code.count; ++pc) {
+		const struct rb_expr_instr *instr = &expr->code.instr[pc];
+		struct rb_expr_slot *top = sp > 0 ? &stack[sp - 1] : NULL;
+
+		switch (instr->opcode) {
+		case RB_EXPR_OP__VAR:
+			eval_load(&stack[sp++], &vars[instr->var], n);
+			break;
+		case RB_EXPR_OP__CONST:
+			stack[sp].values[0] = instr->constant;
+			stack[sp].valid[0] = 1;
+			stack[sp].vector = false;
+			sp++;
+			break;
+		case RB_EXPR_OP__ADD:
+		case RB_EXPR_OP__SUB:
+		case RB_EXPR_OP__MUL:
+		case RB_EXPR_OP__DIV:
+		case RB_EXPR_OP__POW:
+			eval_binary(instr->opcode, &stack[sp - 2], top, n);
+			sp--;
+			break;
+		case RB_EXPR_OP__NEG: {
+			const size_t len = top->vector ? n : 1;
+			for (size_t i = 0; i < len; ++i) {
+				top->values[i] = -top->values[i];
+			}
+			break;
+		}
+		case RB_EXPR_OP__FUNC: {
+			const size_t len = top->vector ? n : 1;
+			for (size_t i = 0; i < len; ++i) {
+				top->values[i] = instr->func(top->values[i]);
+			}
+			break;
+		}
+		case RB_EXPR_OP__REDUCE:
+			eval_reduce(instr->reduction, top, n);
+			break;
+		default:
+			break;
+		};
+	}
+
+	assert(1 == sp);
+	*result_vector = stack[0].vector;
+	const size_t len = stack[0].vector ? n : 1;
+	memcpy(result, stack[0].values, len * sizeof(result[0]));
+	memset(result_valid, 0, RB_BITMAP_WORDS(len) * sizeof(result_valid[0]));
+	for (size_t i = 0; i < len; ++i) {
+		if (stack[0].valid[i]) {
+			rb_bitmap_set(result_valid, i);
+		}
+	}
+
+	if (NULL == arena) {
+		free(buf);
+	}
+	return true;
+}
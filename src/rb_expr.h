@@ -0,0 +1,90 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct rb_arena;
+
+/** Compiled arithmetic expression. It is evaluated over whole vectors at
+  once: each bytecode instruction runs over contiguous arrays of doubles,
+  with a validity mask that tracks missing or invalid elements.
+
+  Supported syntax is the libmatheval one: + - * / ^ operators, parenthesis,
+  numbers, variables, e and pi constants, and functions exp, log, sqrt, sin,
+  cos, tan, asin, acos, atan, sinh, cosh, tanh and abs. Also, reductions
+  sum(), mean(), min() and max() return a scalar from a vector expression.
+  */
+struct rb_expr;
+
+/// Expression variable value
+struct rb_expr_value {
+	const double *values; ///< Values
+	/// Validity bitmap (unset bit = element not valid), or NULL if all are
+	/// valid
+	const uint64_t *valid;
+	bool vector; ///< If false, only values[0] is used
+};
+
+/** Compile an expression
+  @param expression Expression to compile
+  @return New expression, or NULL if expression is not valid or it uses
+  something not supported. Free it with rb_expr_done.
+  */
+struct rb_expr *rb_expr_compile(const char *expression);
+
+/** Free an expression
+  @param expr Expression
+  */
+void rb_expr_done(struct rb_expr *expr);
+
+/** Get expression variables count
+  @param expr Expression
+  @return Number of variables
+  */
+size_t rb_expr_vars_count(const struct rb_expr *expr);
+
+/** Get expression variables names, in the order rb_expr_eval expects them
+  @param expr Expression
+  @return Variables names array
+  */
+char **rb_expr_vars_names(const struct rb_expr *expr);
+
+/** Evaluate an expression. It is thread safe if every thread uses its own
+  arena.
+  @param expr Expression
+  @param arena Arena to allocate evaluation stack from, or NULL to use heap
+  @param vars Variables values, in rb_expr_vars_names order
+  @param n Vector variables length (1 if none)
+  @param result Result values, with room for n elements
+  @param result_valid Result validity bitmap, with room for n bits
+  @param result_vector Result is a vector. If false, only first element of
+  result is set.
+  @return true if success, false in other case
+  */
+bool rb_expr_eval(const struct rb_expr *expr,
+		  struct rb_arena *arena,
+		  const struct rb_expr_value *vars,
+		  size_t n,
+		  double *result,
+		  uint64_t *result_valid,
+		  bool *result_vector);
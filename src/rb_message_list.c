@@ -17,9 +17,18 @@
   along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "config.h"
+
 #include "rb_message_list.h"
 
+#include "rb_monitor_template.h"
+
+#include <librd/rd.h>
+#include <librd/rdlog.h>
+
+#include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 /** Creates a new message array
   @param s Size of array
@@ -27,8 +36,9 @@
   */
 rb_message_array_t *new_messages_array(size_t s) {
 	rb_message_array_t *ret =
-			calloc(1, sizeof(ret) + s * sizeof(ret->msgs[0]));
+			calloc(1, sizeof(*ret) + s * sizeof(ret->msgs[0]));
 	if (ret) {
+		ret->refcnt = 1;
 		ret->count = s;
 	}
 
@@ -39,5 +49,159 @@ rb_message_array_t *new_messages_array(size_t s) {
   @param msgs Message array
   */
 void message_array_done(rb_message_array_t *msgs) {
+	if (msgs->tmpl) {
+		rb_monitor_template_put(msgs->tmpl);
+	}
 	free(msgs);
 }
+
+void rb_message_array_get(rb_message_array_t *msgs) {
+	ATOMIC_OP(add, fetch, &msgs->refcnt, 1);
+}
+
+void rb_message_array_put(rb_message_array_t *msgs) {
+	if (0 != ATOMIC_OP(sub, fetch, &msgs->refcnt, 1)) {
+		return;
+	}
+
+	for (size_t i = 0; i < msgs->count; ++i) {
+		free(msgs->msgs[i].payload);
+	}
+	message_array_done(msgs);
+}
+
+bool rb_message_batch_parse(const char *name, enum rb_message_batch *batch) {
+	static const struct {
+		const char *name;
+		enum rb_message_batch batch;
+	} batches[] = {
+			{"none", RB_MESSAGE_BATCH_NONE},
+			{"array", RB_MESSAGE_BATCH_ARRAY},
+			{"ndjson", RB_MESSAGE_BATCH_NDJSON},
+	};
+
+	for (size_t i = 0; i < RD_ARRAYSIZE(batches); ++i) {
+		if (0 == strcmp(name, batches[i].name)) {
+			*batch = batches[i].batch;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Length of a message once shared enrichment is hoisted out of it
+  @param msg Message
+  @param shared Shared enrichment members
+  @param shared_len Length of shared
+  @return Length of message without shared enrichment, not counting the
+  closing brace
+  */
+static size_t message_batch_len(const rb_message *msg,
+				const char *shared,
+				size_t shared_len) {
+	const char *payload = msg->payload;
+	const size_t len = msg->len - 1; // Closing brace
+
+	if (len > shared_len &&
+	    0 == memcmp(&payload[len - shared_len], shared, shared_len)) {
+		return len - shared_len;
+	}
+
+	return len;
+}
+
+rb_message_array_t *rb_message_list_batch(rb_message_list *msgs,
+					  enum rb_message_batch batch,
+					  const char *shared,
+					  size_t shared_len) {
+	assert(RB_MESSAGE_BATCH_ARRAY == batch ||
+	       RB_MESSAGE_BATCH_NDJSON == batch);
+
+	const bool ndjson = RB_MESSAGE_BATCH_NDJSON == batch;
+	const char separator = ndjson ? '\n' : ',';
+	rb_message_array_t *array = NULL;
+	// First non empty array
+	const rb_message_array_t *first = NULL;
+	size_t count = 0;
+	int priority = 0;
+
+	// Header (shared members in braces instead of first comma) and last
+	// character
+	size_t len = 2 + (shared_len ? shared_len - 1 : 0) + 1;
+	TAILQ_FOREACH(array, msgs, entry) {
+		if (array->count > 0 &&
+		    (NULL == first || array->priority > priority)) {
+			priority = array->priority;
+		}
+		if (NULL == first && array->count > 0) {
+			first = array;
+		}
+		for (size_t i = 0; i < array->count; ++i) {
+			len += message_batch_len(&array->msgs[i],
+						 shared,
+						 shared_len) +
+			       2;
+			count++;
+		}
+	}
+
+	if (0 == count) {
+		return NULL;
+	}
+
+	if (!ndjson) {
+		len++; // Array opening bracket
+	}
+
+	rb_message_array_t *ret = new_messages_array(1);
+	char *payload = malloc(len + 1);
+	if (NULL == ret || NULL == payload) {
+		rdlog(LOG_ERR, "Couldn't allocate messages batch (OOM?)");
+		free(ret);
+		free(payload);
+		return NULL;
+	}
+
+	char *cursor = payload;
+	if (!ndjson) {
+		*cursor++ = '[';
+	}
+	// Batch metadata is the first message one
+	ret->batch = true;
+	ret->tmpl = first->tmpl ? rb_monitor_template_get(first->tmpl) : NULL;
+	ret->msgs[0].timestamp = first->msgs[0].timestamp;
+	// ... but it is as important as its most important monitor
+	ret->priority = priority;
+
+	*cursor++ = '{';
+	if (shared_len) {
+		memcpy(cursor, shared + 1, shared_len - 1);
+		cursor += shared_len - 1;
+	}
+	*cursor++ = '}';
+
+	while (!rb_message_list_empty(msgs)) {
+		array = rb_message_list_first(msgs);
+		rb_message_list_remove(msgs, array);
+		for (size_t i = 0; i < array->count; ++i) {
+			rb_message *msg = &array->msgs[i];
+			const size_t msg_len = message_batch_len(
+					msg, shared, shared_len);
+			*cursor++ = separator;
+			memcpy(cursor, msg->payload, msg_len);
+			cursor += msg_len;
+			*cursor++ = '}';
+			free(msg->payload);
+		}
+		message_array_done(array);
+	}
+
+	*cursor++ = ndjson ? '\n' : ']';
+	*cursor = '\0';
+	assert((size_t)(cursor - payload) == len);
+
+	ret->msgs[0].payload = payload;
+	ret->msgs[0].len = len;
+	return ret;
+}
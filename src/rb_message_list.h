@@ -19,17 +19,34 @@
 
 #pragma once
 
-#include <librdkafka/rdkafka.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <sys/queue.h>
 
-/// Message we want to send. Re-use of librdkafka at this moment
-typedef rd_kafka_message_t rb_message;
+struct rb_monitor_template;
+
+/// Message we want to send
+typedef struct rb_message_s {
+	void *payload;	   ///< Message payload
+	size_t len;	   ///< Payload length
+	int64_t timestamp; ///< Value sample time, in milliseconds
+	int err;	   ///< Output error, if any
+} rb_message;
 
 /// Message array element
 typedef struct rb_message_array_s {
 	TAILQ_ENTRY(rb_message_array_s) entry; ///< msgs entry
-	size_t count;			       ///< # Messages in msgs
-	rb_message msgs[];		       ///< Messages
+	/// Template messages were printed with (if any), with its routing
+	/// metadata. Array holds a reference to it.
+	struct rb_monitor_template *tmpl;
+	bool batch;   ///< Array contains a batch of several monitors
+	/// Output priority, the highest of its monitors. Lowest priority
+	/// arrays are dropped first when an output sink is overloaded.
+	int priority;
+	int refcnt;   ///< Reference counter, see rb_message_array_put
+	size_t count; ///< # Messages in msgs
+	rb_message msgs[]; ///< Messages
 } rb_message_array_t;
 
 /** Creates a new message array
@@ -38,11 +55,23 @@ typedef struct rb_message_array_s {
   */
 rb_message_array_t *new_messages_array(size_t s);
 
-/** Releases message array resources
+/** Releases message array resources. Messages payload are not freed.
   @param msgs Message array
   */
 void message_array_done(rb_message_array_t *msgs);
 
+/** Increase message array reference counter. Output sinks share the same
+  array if they use the same format.
+  @param msgs Message array
+  */
+void rb_message_array_get(rb_message_array_t *msgs);
+
+/** Decrease message array reference counter. When it reaches 0, it releases
+  array and messages payload.
+  @param msgs Message array
+  */
+void rb_message_array_put(rb_message_array_t *msgs);
+
 /// List of message array
 typedef TAILQ_HEAD(, rb_message_array_s) rb_message_list;
 #define rb_message_list_init(msg_list) TAILQ_INIT(msg_list)
@@ -53,3 +82,38 @@ typedef TAILQ_HEAD(, rb_message_array_s) rb_message_list;
 #define rb_message_list_empty(msg_list) TAILQ_EMPTY(msg_list)
 #define rb_message_list_first(msg_list)                                        \
 	((rb_message_array_t *)TAILQ_FIRST(msg_list))
+
+/// How to pack the messages of a sensor cycle
+enum rb_message_batch {
+	/// Use default batch mode (only valid as a sensor setting)
+	RB_MESSAGE_BATCH_DEFAULT = -1,
+	/// One message per value
+	RB_MESSAGE_BATCH_NONE,
+	/// One JSON array per cycle
+	RB_MESSAGE_BATCH_ARRAY,
+	/// One NDJSON block per cycle
+	RB_MESSAGE_BATCH_NDJSON,
+};
+
+/** Parse a batch mode name
+  @param name Batch mode name (none, array, ndjson)
+  @param batch Parsed batch mode
+  @return true if success, false if unknown batch mode
+  */
+bool rb_message_batch_parse(const char *name, enum rb_message_batch *batch);
+
+/** Pack all messages of a list in one message. The first element (or line) of
+  the batch is a JSON object with the shared enrichment, and it is removed
+  from every message that ends with it.
+  @param msgs Messages to pack. It is empty at return if success, and
+  untouched in other case.
+  @param batch Batch mode. It can't be RB_MESSAGE_BATCH_NONE.
+  @param shared Shared enrichment members, as printed by monitors templates
+  @param shared_len Length of shared
+  @return Message array with the batch message, or NULL if there was no
+  messages to pack or in case of error.
+  */
+rb_message_array_t *rb_message_list_batch(rb_message_list *msgs,
+					  enum rb_message_batch batch,
+					  const char *shared,
+					  size_t shared_len);
@@ -0,0 +1,605 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include "rb_monitor_template.h"
+
+#include "rb_number.h"
+#include "utils.h"
+
+#include <json-c/printbuf.h>
+#include <librd/rdlog.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/// Thread local message buffer size. Bigger messages use heap directly.
+#define RB_MONITOR_TEMPLATE_BUFSIZ 4096
+
+/// Message prefix, common to all monitors
+static const char template_timestamp_key[] = "{\"timestamp\":";
+/// Integer value key
+static const char template_value_key[] = ",\"value\":";
+/// Decimal value key. Decimals are sent as strings.
+static const char template_string_value_key[] = ",\"value\":\"";
+
+/// Serialized template part
+struct template_str {
+	char *str;  ///< Serialized JSON
+	size_t len; ///< Length of str
+};
+
+/// Sensor enrichment keys, for routing metadata
+static const char template_sensor_name_key[] = "sensor_name";
+static const char template_sensor_id_key[] = "sensor_id";
+/// Monitor enrichment type key, for routing metadata
+static const char template_type_key[] = "type";
+
+struct rb_monitor_template {
+	int refcnt; ///< Reference counter
+
+	/// Routing metadata, not escaped
+	struct {
+		char *monitor;     ///< Monitor name
+		char *sensor_name; ///< Sensor name, or NULL
+		char *sensor_id;   ///< Sensor id, or NULL
+		char *group_id;    ///< Monitor group id, or NULL
+		char *type;	///< Monitor type, or NULL
+		int priority;      ///< Output priority
+	} meta;
+
+	/// Monitor key, for scalar values and split op result
+	struct template_str monitor;
+	/// Monitor key, for vector children
+	struct template_str child_monitor;
+	/// Instance key start, with instance prefix (if any) already printed
+	struct template_str instance;
+	/// Print instance key when child instance is its position
+	bool instance_by_position;
+	bool integer;  ///< Print value as an integer
+	int precision; ///< Value decimals
+	/// Group id, enrichment and message end
+	struct template_str suffix;
+};
+
+/** Duplicate the string value of a enrichment member
+  @param enrichment Enrichment
+  @param key Member key
+  @param dst Pointer to store the copy. It will be NULL if there is no member
+  @return false in case of allocation error, true in other case
+  */
+static bool template_meta_dup(json_object *enrichment,
+			      const char *key,
+			      char **dst) {
+	json_object *val = NULL;
+	if (NULL == enrichment ||
+	    !json_object_object_get_ex(enrichment, key, &val)) {
+		*dst = NULL;
+		return true;
+	}
+
+	*dst = strdup(json_object_get_string(val));
+	return NULL != *dst;
+}
+
+/** Characters that need to be escaped in a JSON string */
+static bool json_escape_needed(unsigned char c) {
+	return c < 0x20 || c == '"' || c == '\\';
+}
+
+/** JSON escape of a character
+  @param c Character
+  @param buf Buffer to print escape sequence, of at least 7 bytes
+  @return Escape sequence length
+  */
+static size_t json_escape_char(unsigned char c, char *buf) {
+	switch (c) {
+	case '"':
+		return (size_t)sprintf(buf, "\\\"");
+	case '\\':
+		return (size_t)sprintf(buf, "\\\\");
+	case '\b':
+		return (size_t)sprintf(buf, "\\b");
+	case '\f':
+		return (size_t)sprintf(buf, "\\f");
+	case '\n':
+		return (size_t)sprintf(buf, "\\n");
+	case '\r':
+		return (size_t)sprintf(buf, "\\r");
+	case '\t':
+		return (size_t)sprintf(buf, "\\t");
+	default:
+		return (size_t)sprintf(buf, "\\u%04x", c);
+	};
+}
+
+/*
+ * TEMPLATE COMPILATION
+ */
+
+/** Append a JSON escaped string to a printbuf
+  @param buf Print buffer
+  @param str String to escape
+  */
+static void printbuf_json_str(struct printbuf *buf, const char *str) {
+	const char *run = str;
+	for (; *str; ++str) {
+		if (!json_escape_needed((unsigned char)*str)) {
+			continue;
+		}
+
+		char escaped[8];
+		printbuf_memappend(buf, run, (int)(str - run));
+		printbuf_memappend(buf,
+				   escaped,
+				   (int)json_escape_char((unsigned char)*str,
+							 escaped));
+		run = str + 1;
+	}
+	printbuf_memappend(buf, run, (int)(str - run));
+}
+
+/** Append a JSON key to a printbuf, with its leading comma
+  @param buf Print buffer
+  @param key Key
+  */
+static void printbuf_json_key(struct printbuf *buf, const char *key) {
+	sprintbuf(buf, ",\"");
+	printbuf_json_str(buf, key);
+	sprintbuf(buf, "\":");
+}
+
+static void template_enrichment_str(struct printbuf *buf,
+				    const char *key,
+				    json_object *val) {
+	const char *str = json_object_get_string(val);
+	if (NULL == str) {
+		rdlog(LOG_ERR,
+		      "Cannot extract string value of enrichment key %s",
+		      key);
+	} else {
+		printbuf_json_key(buf, key);
+		sprintbuf(buf, "\"");
+		printbuf_json_str(buf, str);
+		sprintbuf(buf, "\"");
+	}
+}
+
+static void template_enrichment_int(struct printbuf *buf,
+				    const char *key,
+				    json_object *val) {
+	errno = 0;
+	int64_t integer = json_object_get_int64(val);
+	if (errno != 0) {
+		const char *errbuf = gnu_strerror_r(errno);
+		rdlog(LOG_ERR,
+		      "Cannot extract int value of enrichment key %s: %s",
+		      key,
+		      errbuf);
+	} else {
+		printbuf_json_key(buf, key);
+		sprintbuf(buf, "%" PRId64, integer);
+	}
+}
+
+/** Check if an enrichment member is shared with another enrichment object.
+  Monitors enrichment objects reference sensor enrichment values, so it is
+  enough with comparing pointers.
+  @param shared Shared enrichment, or NULL
+  @param key Member key
+  @param val Member value
+  @return true if shared enrichment has the same member
+  */
+static bool template_enrichment_shared(json_object *shared,
+				       const char *key,
+				       json_object *val) {
+	json_object *shared_val = NULL;
+	return shared && json_object_object_get_ex(shared, key, &shared_val) &&
+	       shared_val == val;
+}
+
+/** Print enrichment members
+  @param buf Print buffer
+  @param enrichment Enrichment to print
+  @param filter Enrichment to filter members with, or NULL
+  @param shared Print only members shared with filter if true, only not
+  shared ones if false
+  */
+static void template_enrichment(struct printbuf *buf,
+				json_object *enrichment,
+				json_object *filter,
+				bool shared) {
+	for (struct json_object_iterator i = json_object_iter_begin(enrichment),
+					 end = json_object_iter_end(enrichment);
+	     !json_object_iter_equal(&i, &end);
+	     json_object_iter_next(&i)) {
+		const char *key = json_object_iter_peek_name(&i);
+		json_object *val = json_object_iter_peek_value(&i);
+
+		if (filter && shared != template_enrichment_shared(
+						    filter, key, val)) {
+			continue;
+		}
+
+		const json_type type = json_object_get_type(val);
+		switch (type) {
+		case json_type_string:
+			template_enrichment_str(buf, key, val);
+			break;
+
+		case json_type_int:
+			template_enrichment_int(buf, key, val);
+			break;
+
+		case json_type_null:
+			printbuf_json_key(buf, key);
+			sprintbuf(buf, "null");
+			break;
+
+		case json_type_boolean: {
+			const json_bool b = json_object_get_boolean(val);
+			printbuf_json_key(buf, key);
+			sprintbuf(buf, "%s", b == FALSE ? "false" : "true");
+			break;
+		}
+		case json_type_double: {
+			const double d = json_object_get_double(val);
+			printbuf_json_key(buf, key);
+			sprintbuf(buf, "%lf", d);
+			break;
+		}
+		case json_type_object:
+		case json_type_array: {
+			rdlog(LOG_ERR,
+			      "Can't enrich with objects/array at this time");
+			break;
+		}
+		default:
+			rdlog(LOG_ERR,
+			      "Don't know how to duplicate JSON type "
+			      "%d",
+			      type);
+			break;
+		};
+	}
+}
+
+/** Extract printbuf content to a template part
+  @param dst Template part
+  @param buf Print buffer. Its content is stolen, and buffer is freed.
+  */
+static void template_str_steal(struct template_str *dst,
+			       struct printbuf *buf) {
+	dst->str = buf->buf;
+	dst->len = (size_t)buf->bpos;
+	buf->buf = NULL;
+	printbuf_free(buf);
+}
+
+struct rb_monitor_template *
+rb_monitor_template_new(const char *name,
+			const char *name_split_suffix,
+			const char *instance_prefix,
+			const char *group_id,
+			int priority,
+			bool integer,
+			int precision,
+			json_object *enrichment,
+			json_object *shared_enrichment) {
+	struct printbuf *monitor = printbuf_new();
+	struct printbuf *child_monitor = printbuf_new();
+	struct printbuf *instance = printbuf_new();
+	struct printbuf *suffix = printbuf_new();
+	struct rb_monitor_template *ret = calloc(1, sizeof(*ret));
+
+	if (NULL == monitor || NULL == child_monitor || NULL == instance ||
+	    NULL == suffix || NULL == ret) {
+		rdlog(LOG_ERR, "Couldn't allocate monitor template (OOM?)");
+		goto err;
+	}
+
+	sprintbuf(monitor, ",\"monitor\":\"");
+	printbuf_json_str(monitor, name);
+	sprintbuf(monitor, "\"");
+
+	sprintbuf(child_monitor, ",\"monitor\":\"");
+	printbuf_json_str(child_monitor, name);
+	if (name_split_suffix) {
+		printbuf_json_str(child_monitor, name_split_suffix);
+	}
+	sprintbuf(child_monitor, "\"");
+
+	sprintbuf(instance, ",\"instance\":\"");
+	if (instance_prefix) {
+		printbuf_json_str(instance, instance_prefix);
+	}
+
+	if (group_id) {
+		// group_id is printed as a raw JSON value
+		sprintbuf(suffix, ",\"group_id\":%s", group_id);
+	}
+	if (enrichment) {
+		// Shared members go last, so they can be hoisted out of batches
+		template_enrichment(suffix,
+				    enrichment,
+				    shared_enrichment,
+				    false);
+		if (shared_enrichment) {
+			template_enrichment(suffix,
+					    shared_enrichment,
+					    enrichment,
+					    true);
+		}
+	}
+	sprintbuf(suffix, "}");
+
+	ret->meta.monitor = strdup(name);
+	if (NULL == ret->meta.monitor ||
+	    !template_meta_dup(shared_enrichment,
+			       template_sensor_name_key,
+			       &ret->meta.sensor_name) ||
+	    !template_meta_dup(shared_enrichment,
+			       template_sensor_id_key,
+			       &ret->meta.sensor_id) ||
+	    !template_meta_dup(enrichment,
+			       template_type_key,
+			       &ret->meta.type) ||
+	    (group_id && NULL == (ret->meta.group_id = strdup(group_id)))) {
+		rdlog(LOG_ERR, "Couldn't allocate template metadata (OOM?)");
+		goto err;
+	}
+
+	ret->meta.priority = priority;
+	ret->refcnt = 1;
+	ret->instance_by_position = NULL != instance_prefix;
+	ret->integer = integer;
+	ret->precision = precision;
+	template_str_steal(&ret->monitor, monitor);
+	template_str_steal(&ret->child_monitor, child_monitor);
+	template_str_steal(&ret->instance, instance);
+	template_str_steal(&ret->suffix, suffix);
+
+	return ret;
+
+err:
+	if (monitor) {
+		printbuf_free(monitor);
+	}
+	if (child_monitor) {
+		printbuf_free(child_monitor);
+	}
+	if (instance) {
+		printbuf_free(instance);
+	}
+	if (suffix) {
+		printbuf_free(suffix);
+	}
+	if (ret) {
+		free(ret->meta.monitor);
+		free(ret->meta.sensor_name);
+		free(ret->meta.sensor_id);
+		free(ret->meta.group_id);
+		free(ret->meta.type);
+	}
+	free(ret);
+	return NULL;
+}
+
+char *rb_monitor_template_enrichment(json_object *enrichment, size_t *len) {
+	struct printbuf *buf = printbuf_new();
+	struct template_str ret;
+
+	if (NULL == buf) {
+		rdlog(LOG_ERR, "Couldn't allocate enrichment (OOM?)");
+		return NULL;
+	}
+
+	template_enrichment(buf, enrichment, NULL, false);
+	template_str_steal(&ret, buf);
+	*len = ret.len;
+	return ret.str;
+}
+
+struct rb_monitor_template *
+rb_monitor_template_get(const struct rb_monitor_template *tmpl) {
+	// Reference counter is not part of the template itself
+	struct rb_monitor_template *ret = (struct rb_monitor_template *)tmpl;
+	ATOMIC_OP(add, fetch, &ret->refcnt, 1);
+	return ret;
+}
+
+void rb_monitor_template_put(struct rb_monitor_template *tmpl) {
+	if (0 != ATOMIC_OP(sub, fetch, &tmpl->refcnt, 1)) {
+		return;
+	}
+
+	free(tmpl->meta.monitor);
+	free(tmpl->meta.sensor_name);
+	free(tmpl->meta.sensor_id);
+	free(tmpl->meta.group_id);
+	free(tmpl->meta.type);
+	free(tmpl->monitor.str);
+	free(tmpl->child_monitor.str);
+	free(tmpl->instance.str);
+	free(tmpl->suffix.str);
+	free(tmpl);
+}
+
+/*
+ * MESSAGE PRINTING
+ */
+
+/// Message being printed. It keeps counting length if buffer is exhausted.
+struct template_writer {
+	char *buf;   ///< Output buffer
+	size_t size; ///< Output buffer size
+	size_t len;  ///< Message length
+};
+
+static void template_write(struct template_writer *w,
+			   const char *str,
+			   size_t len) {
+	if (w->len + len <= w->size) {
+		memcpy(&w->buf[w->len], str, len);
+	}
+	w->len += len;
+}
+
+static void template_write_json_str(struct template_writer *w,
+				    const char *str) {
+	const char *run = str;
+	for (; *str; ++str) {
+		if (!json_escape_needed((unsigned char)*str)) {
+			continue;
+		}
+
+		char escaped[8];
+		template_write(w, run, (size_t)(str - run));
+		template_write(w,
+			       escaped,
+			       json_escape_char((unsigned char)*str, escaped));
+		run = str + 1;
+	}
+	template_write(w, run, (size_t)(str - run));
+}
+
+/** Print a message with template
+  @see rb_monitor_template_print
+  @param w Writer to print message in
+  */
+static void rb_monitor_template_write(const struct rb_monitor_template *tmpl,
+				      struct template_writer *w,
+				      time_t timestamp,
+				      double value,
+				      const char *instance_name,
+				      int instance) {
+	const bool child = instance >= 0;
+	const struct template_str *monitor =
+			child ? &tmpl->child_monitor : &tmpl->monitor;
+	char number[RB_NUMBER_BUFSIZ];
+	size_t number_len = 0;
+
+	template_write(w,
+		       template_timestamp_key,
+		       sizeof(template_timestamp_key) - 1);
+	number_len = rb_number_format_int(number, timestamp);
+	template_write(w, number, number_len);
+	template_write(w, monitor->str, monitor->len);
+
+	if (child && (instance_name || tmpl->instance_by_position)) {
+		template_write(w, tmpl->instance.str, tmpl->instance.len);
+		if (instance_name) {
+			template_write_json_str(w, instance_name);
+		} else {
+			number_len = rb_number_format_int(number, instance);
+			template_write(w, number, number_len);
+		}
+		template_write(w, "\"", 1);
+	}
+
+	if (tmpl->integer) {
+		number_len = rb_number_format_int(number, (int64_t)value);
+		template_write(w,
+			       template_value_key,
+			       sizeof(template_value_key) - 1);
+		template_write(w, number, number_len);
+	} else {
+		number_len = rb_number_format(number, value, tmpl->precision);
+		template_write(w,
+			       template_string_value_key,
+			       sizeof(template_string_value_key) - 1);
+		template_write(w, number, number_len);
+		template_write(w, "\"", 1);
+	}
+
+	template_write(w, tmpl->suffix.str, tmpl->suffix.len);
+}
+
+bool rb_monitor_template_print(const struct rb_monitor_template *tmpl,
+			       rb_message *message,
+			       time_t timestamp,
+			       double value,
+			       const char *instance_name,
+			       int instance) {
+	static __thread char buffer[RB_MONITOR_TEMPLATE_BUFSIZ];
+	struct template_writer w = {
+			.buf = buffer, .size = sizeof(buffer),
+	};
+
+	rb_monitor_template_write(
+			tmpl, &w, timestamp, value, instance_name, instance);
+
+	char *payload = malloc(w.len + 1);
+	if (NULL == payload) {
+		rdlog(LOG_ERR, "Couldn't allocate message (OOM?)");
+		return false;
+	}
+
+	if (w.len <= w.size) {
+		memcpy(payload, buffer, w.len);
+	} else {
+		// Message does not fit in thread buffer, print it again
+		w = (struct template_writer){
+				.buf = payload, .size = w.len,
+		};
+		rb_monitor_template_write(tmpl,
+					  &w,
+					  timestamp,
+					  value,
+					  instance_name,
+					  instance);
+	}
+
+	payload[w.len] = '\0';
+	message->payload = payload;
+	message->len = w.len;
+	message->timestamp = (int64_t)timestamp * 1000;
+	return true;
+}
+
+const char *
+rb_monitor_template_monitor(const struct rb_monitor_template *tmpl) {
+	return tmpl->meta.monitor;
+}
+
+const char *
+rb_monitor_template_sensor_name(const struct rb_monitor_template *tmpl) {
+	return tmpl->meta.sensor_name;
+}
+
+const char *
+rb_monitor_template_sensor_id(const struct rb_monitor_template *tmpl) {
+	return tmpl->meta.sensor_id;
+}
+
+const char *
+rb_monitor_template_group_id(const struct rb_monitor_template *tmpl) {
+	return tmpl->meta.group_id;
+}
+
+const char *rb_monitor_template_type(const struct rb_monitor_template *tmpl) {
+	return tmpl->meta.type;
+}
+
+int rb_monitor_template_priority(const struct rb_monitor_template *tmpl) {
+	return tmpl->meta.priority;
+}
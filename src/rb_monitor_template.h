@@ -0,0 +1,139 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "rb_message_list.h"
+
+#include <json-c/json.h>
+
+#include <stdbool.h>
+#include <time.h>
+
+/** Precompiled monitor message. All message parts but timestamp, value and
+  vector instance are fixed per monitor, so they are serialized and JSON
+  escaped once at monitor parse time. */
+struct rb_monitor_template;
+
+/** Creates a new monitor message template
+  @param name Monitor name
+  @param name_split_suffix Vector children name suffix, or NULL
+  @param instance_prefix Vector children instance prefix, or NULL
+  @param group_id Monitor group id, or NULL
+  @param priority Output priority, see rb_monitor_template_priority
+  @param integer Value must be printed as an integer
+  @param precision Value decimals, or RB_NUMBER_PRECISION_SHORTEST
+  @param enrichment Monitor enrichment, or NULL
+  @param shared_enrichment Sensor enrichment, or NULL. Members shared between
+  enrichment and it are printed at the end of the message, in the same order
+  and format as rb_monitor_template_enrichment prints them.
+  @return New template, or NULL in case of error
+  */
+struct rb_monitor_template *
+rb_monitor_template_new(const char *name,
+			const char *name_split_suffix,
+			const char *instance_prefix,
+			const char *group_id,
+			int priority,
+			bool integer,
+			int precision,
+			/* @todo const */ json_object *enrichment,
+			/* @todo const */ json_object *shared_enrichment);
+
+/** Serialize enrichment members the same way templates print them, each one
+  with its leading comma.
+  @param enrichment Enrichment to serialize
+  @param len Serialized enrichment length
+  @return Serialized enrichment, to free with free(), or NULL in case of error
+  */
+char *rb_monitor_template_enrichment(/* @todo const */ json_object *enrichment,
+				     size_t *len);
+
+/** Increase template reference counter. Messages arrays keep a reference to
+  the template they were printed with, so it can outlive its monitor.
+  @param tmpl Template
+  @return Template
+  */
+struct rb_monitor_template *
+rb_monitor_template_get(const struct rb_monitor_template *tmpl);
+
+/** Decrease template reference counter, freeing it if it reaches 0
+  @param tmpl Template
+  */
+void rb_monitor_template_put(struct rb_monitor_template *tmpl);
+
+/** Monitor name of template messages
+  @param tmpl Template
+  @return Monitor name
+  */
+const char *
+rb_monitor_template_monitor(const struct rb_monitor_template *tmpl);
+
+/** Sensor name of template messages
+  @param tmpl Template
+  @return Sensor name, or NULL if unknown
+  */
+const char *
+rb_monitor_template_sensor_name(const struct rb_monitor_template *tmpl);
+
+/** Sensor id of template messages
+  @param tmpl Template
+  @return Sensor id, or NULL if sensor has no id
+  */
+const char *
+rb_monitor_template_sensor_id(const struct rb_monitor_template *tmpl);
+
+/** Monitor group id of template messages
+  @param tmpl Template
+  @return Group id, or NULL if monitor has no group
+  */
+const char *
+rb_monitor_template_group_id(const struct rb_monitor_template *tmpl);
+
+/** Monitor type of template messages
+  @param tmpl Template
+  @return Monitor type, or NULL if unknown
+  */
+const char *rb_monitor_template_type(const struct rb_monitor_template *tmpl);
+
+/** Output priority of template messages
+  @param tmpl Template
+  @return Priority. Lowest priority messages are dropped first when an output
+  sink is overloaded.
+  */
+int rb_monitor_template_priority(const struct rb_monitor_template *tmpl);
+
+/** Print a value using a monitor template. Message is built in a reused
+  thread local buffer, and then copied to a heap allocated payload. Message
+  timestamp is set to value one.
+  @param tmpl Monitor template
+  @param message Message to print value in
+  @param timestamp Value timestamp
+  @param value Value
+  @param instance_name Vector child instance, if it is not its position
+  @param instance Vector child position, or negative if value is not a vector
+  child
+  @return true if message could be printed, false in other case
+  */
+bool rb_monitor_template_print(const struct rb_monitor_template *tmpl,
+			       rb_message *message,
+			       time_t timestamp,
+			       double value,
+			       const char *instance_name,
+			       int instance);
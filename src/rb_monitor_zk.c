@@ -192,7 +192,7 @@ struct rb_monitor_zk {
 	char *my_leader_node;
 	int i_am_leader;
 
-	rd_fifoq_t *workers_queue;
+	sensor_queue_t *workers_queue;
 
 	struct rb_zk *zk_handler;
 };
@@ -246,7 +246,14 @@ rb_monitor_zk_add_sensor_to_monitor_queue(char *str, size_t len, void *opaque) {
 		return;
 	}
 
-	queue_sensor(rb_mzk->workers_queue, obj);
+	rb_sensor_t *sensor = parse_rb_sensor(obj);
+	json_object_put(obj);
+	if (NULL == sensor) {
+		rdlog(LOG_ERR, "Couldn't parse zookeeper received sensor");
+		return;
+	}
+
+	queue_sensor(rb_mzk->workers_queue, sensor);
 }
 
 static void rb_monitor_zk_add_popped_sensors_to_monitor_queue(
@@ -441,7 +448,7 @@ struct rb_monitor_zk *init_rbmon_zk(char *host,
 				    uint64_t pop_watcher_timeout,
 				    uint64_t push_timeout,
 				    json_object *zk_sensors,
-				    rd_fifoq_t *workers_queue) {
+				    sensor_queue_t *workers_queue) {
 	char strerror_buf[BUFSIZ];
 
 	assert(host);
@@ -0,0 +1,210 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_msgpack.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/// MessagePack type markers
+enum msgpack_marker {
+	MSGPACK_FIXMAP = 0x80,
+	MSGPACK_FIXARRAY = 0x90,
+	MSGPACK_FIXSTR = 0xa0,
+	MSGPACK_NIL = 0xc0,
+	MSGPACK_FALSE = 0xc2,
+	MSGPACK_TRUE = 0xc3,
+	MSGPACK_FLOAT64 = 0xcb,
+	MSGPACK_UINT8 = 0xcc,
+	MSGPACK_UINT16 = 0xcd,
+	MSGPACK_UINT32 = 0xce,
+	MSGPACK_UINT64 = 0xcf,
+	MSGPACK_INT8 = 0xd0,
+	MSGPACK_INT16 = 0xd1,
+	MSGPACK_INT32 = 0xd2,
+	MSGPACK_INT64 = 0xd3,
+	MSGPACK_STR8 = 0xd9,
+	MSGPACK_STR16 = 0xda,
+	MSGPACK_STR32 = 0xdb,
+	MSGPACK_ARRAY16 = 0xdc,
+	MSGPACK_ARRAY32 = 0xdd,
+	MSGPACK_MAP16 = 0xde,
+	MSGPACK_MAP32 = 0xdf,
+};
+
+/** Append a type marker followed by a big endian integer
+  @param buf Buffer
+  @param marker Type marker
+  @param value Value to append
+  @param size Bytes of value to append
+  */
+static void msgpack_pack_be(struct printbuf *buf,
+			    enum msgpack_marker marker,
+			    uint64_t value,
+			    size_t size) {
+	char tmp[1 + sizeof(value)];
+	tmp[0] = (char)marker;
+	for (size_t i = 0; i < size; ++i) {
+		tmp[size - i] = (char)(value >> (8 * i));
+	}
+	printbuf_memappend(buf, tmp, (int)(1 + size));
+}
+
+static void msgpack_pack_byte(struct printbuf *buf, uint8_t byte) {
+	const char c = (char)byte;
+	printbuf_memappend(buf, &c, 1);
+}
+
+static void msgpack_pack_int(struct printbuf *buf, int64_t value) {
+	if (value >= 0) {
+		const uint64_t u = (uint64_t)value;
+		if (u < 0x80) {
+			msgpack_pack_byte(buf, (uint8_t)u);
+		} else if (u <= UINT8_MAX) {
+			msgpack_pack_be(buf, MSGPACK_UINT8, u, 1);
+		} else if (u <= UINT16_MAX) {
+			msgpack_pack_be(buf, MSGPACK_UINT16, u, 2);
+		} else if (u <= UINT32_MAX) {
+			msgpack_pack_be(buf, MSGPACK_UINT32, u, 4);
+		} else {
+			msgpack_pack_be(buf, MSGPACK_UINT64, u, 8);
+		}
+	} else if (value >= -32) {
+		// Negative fixint
+		msgpack_pack_byte(buf, (uint8_t)(int8_t)value);
+	} else if (value >= INT8_MIN) {
+		msgpack_pack_be(buf, MSGPACK_INT8, (uint64_t)value, 1);
+	} else if (value >= INT16_MIN) {
+		msgpack_pack_be(buf, MSGPACK_INT16, (uint64_t)value, 2);
+	} else if (value >= INT32_MIN) {
+		msgpack_pack_be(buf, MSGPACK_INT32, (uint64_t)value, 4);
+	} else {
+		msgpack_pack_be(buf, MSGPACK_INT64, (uint64_t)value, 8);
+	}
+}
+
+static void msgpack_pack_double(struct printbuf *buf, double value) {
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	msgpack_pack_be(buf, MSGPACK_FLOAT64, bits, sizeof(bits));
+}
+
+/** Append a container or string header
+  @param buf Buffer
+  @param fix Fixed size marker
+  @param fix_max Max size that fits in fixed marker
+  @param marker8 8 bits size marker, or 0 if not available
+  @param marker16 16 bits size marker
+  @param marker32 32 bits size marker
+  @param size Container size
+  */
+static void msgpack_pack_header(struct printbuf *buf,
+				enum msgpack_marker fix,
+				size_t fix_max,
+				enum msgpack_marker marker8,
+				enum msgpack_marker marker16,
+				enum msgpack_marker marker32,
+				size_t size) {
+	if (size <= fix_max) {
+		msgpack_pack_byte(buf, (uint8_t)(fix | size));
+	} else if (marker8 && size <= UINT8_MAX) {
+		msgpack_pack_be(buf, marker8, size, 1);
+	} else if (size <= UINT16_MAX) {
+		msgpack_pack_be(buf, marker16, size, 2);
+	} else {
+		msgpack_pack_be(buf, marker32, size, 4);
+	}
+}
+
+static void
+msgpack_pack_str(struct printbuf *buf, const char *str, size_t len) {
+	msgpack_pack_header(buf,
+			    MSGPACK_FIXSTR,
+			    31,
+			    MSGPACK_STR8,
+			    MSGPACK_STR16,
+			    MSGPACK_STR32,
+			    len);
+	printbuf_memappend(buf, str, (int)len);
+}
+
+void rb_msgpack_pack_json(struct printbuf *buf, json_object *json) {
+	switch (json_object_get_type(json)) {
+	case json_type_boolean:
+		msgpack_pack_byte(buf,
+				  json_object_get_boolean(json)
+						  ? MSGPACK_TRUE
+						  : MSGPACK_FALSE);
+		break;
+	case json_type_int:
+		msgpack_pack_int(buf, json_object_get_int64(json));
+		break;
+	case json_type_double:
+		msgpack_pack_double(buf, json_object_get_double(json));
+		break;
+	case json_type_string:
+		msgpack_pack_str(buf,
+				 json_object_get_string(json),
+				 (size_t)json_object_get_string_len(json));
+		break;
+	case json_type_array: {
+		const size_t len = (size_t)json_object_array_length(json);
+		msgpack_pack_header(buf,
+				    MSGPACK_FIXARRAY,
+				    15,
+				    0,
+				    MSGPACK_ARRAY16,
+				    MSGPACK_ARRAY32,
+				    len);
+		for (size_t i = 0; i < len; ++i) {
+			rb_msgpack_pack_json(
+					buf,
+					json_object_array_get_idx(json,
+								  (int)i));
+		}
+		break;
+	}
+	case json_type_object: {
+		const size_t len = (size_t)json_object_object_length(json);
+		msgpack_pack_header(buf,
+				    MSGPACK_FIXMAP,
+				    15,
+				    0,
+				    MSGPACK_MAP16,
+				    MSGPACK_MAP32,
+				    len);
+		for (struct json_object_iterator i = json_object_iter_begin(
+							 json),
+						 end = json_object_iter_end(
+							 json);
+		     !json_object_iter_equal(&i, &end);
+		     json_object_iter_next(&i)) {
+			const char *key = json_object_iter_peek_name(&i);
+			msgpack_pack_str(buf, key, strlen(key));
+			rb_msgpack_pack_json(buf,
+					     json_object_iter_peek_value(&i));
+		}
+		break;
+	}
+	case json_type_null:
+	default:
+		msgpack_pack_byte(buf, MSGPACK_NIL);
+		break;
+	};
+}
@@ -0,0 +1,32 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <json-c/json.h>
+#include <json-c/printbuf.h>
+
+/** Append a JSON value to a buffer, encoded as MessagePack. Objects are
+  encoded as maps, arrays as arrays, and strings, numbers, booleans and null
+  as their MessagePack counterparts.
+  @param buf Buffer to append value to
+  @param json JSON value
+  */
+void rb_msgpack_pack_json(struct printbuf *buf,
+			  /* @todo const */ json_object *json);
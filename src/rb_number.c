@@ -0,0 +1,318 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_number.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Powers of ten exactly representable as double
+static const double pow10_exact[] = {
+		1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+		1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+		1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/// Max significant digits that fit in an uint64_t with no overflow
+#define PARSE_MAX_DIGITS 19
+
+/// Integers bigger than this are not exact as double
+#define DOUBLE_MAX_EXACT_INT 9007199254740992.0 /* 2^53 */
+#define UINT64_MAX_EXACT_INT (UINT64_C(1) << 53)
+
+/*
+ * PARSING
+ */
+
+static bool is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+static bool is_space(char c) {
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+double rb_number_parse(const char *str, char **endptr) {
+	const char *cursor = str;
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool any_digit = false;
+
+	while (is_space(*cursor)) {
+		cursor++;
+	}
+
+	const bool negative = *cursor == '-';
+	if (*cursor == '-' || *cursor == '+') {
+		cursor++;
+	}
+
+	if (cursor[0] == '0' && (cursor[1] == 'x' || cursor[1] == 'X')) {
+		// Hexadecimal
+		goto slow;
+	}
+
+	for (; is_digit(*cursor); ++cursor) {
+		any_digit = true;
+		if (0 == mantissa && '0' == *cursor) {
+			continue;
+		}
+		if (++digits > PARSE_MAX_DIGITS) {
+			goto slow;
+		}
+		mantissa = 10 * mantissa + (uint64_t)(*cursor - '0');
+	}
+
+	if (*cursor == '.') {
+		for (cursor++; is_digit(*cursor); ++cursor) {
+			any_digit = true;
+			if (0 == mantissa && '0' == *cursor) {
+				exponent--;
+				continue;
+			}
+			if (++digits > PARSE_MAX_DIGITS) {
+				goto slow;
+			}
+			mantissa = 10 * mantissa + (uint64_t)(*cursor - '0');
+			exponent--;
+		}
+	}
+
+	if (!any_digit) {
+		// inf, nan or not a number at all
+		goto slow;
+	}
+
+	if (*cursor == 'e' || *cursor == 'E') {
+		const char *exp_cursor = cursor + 1;
+		const bool exp_negative = *exp_cursor == '-';
+		if (*exp_cursor == '-' || *exp_cursor == '+') {
+			exp_cursor++;
+		}
+
+		if (is_digit(*exp_cursor)) {
+			int exp_value = 0;
+			for (; is_digit(*exp_cursor); ++exp_cursor) {
+				if (exp_value < 10000) {
+					exp_value = 10 * exp_value +
+						    (*exp_cursor - '0');
+				}
+			}
+			exponent += exp_negative ? -exp_value : exp_value;
+			cursor = exp_cursor;
+		}
+	}
+
+	double value = 0;
+	if (0 == mantissa) {
+		value = 0;
+	} else if (mantissa > UINT64_MAX_EXACT_INT) {
+		goto slow;
+	} else if (exponent >= 0 && exponent <= 22) {
+		// Both operands are exact, so result is correctly rounded
+		value = (double)mantissa * pow10_exact[exponent];
+	} else if (exponent < 0 && exponent >= -22) {
+		value = (double)mantissa / pow10_exact[-exponent];
+	} else {
+		goto slow;
+	}
+
+	if (endptr) {
+		*endptr = (char *)cursor;
+	}
+	return negative ? -value : value;
+
+slow:
+	return strtod(str, endptr);
+}
+
+/*
+ * FORMATTING
+ */
+
+/// Two digits numbers, to print them in pairs
+static const char digits_pairs[] = "00010203040506070809"
+				   "10111213141516171819"
+				   "20212223242526272829"
+				   "30313233343536373839"
+				   "40414243444546474849"
+				   "50515253545556575859"
+				   "60616263646566676869"
+				   "70717273747576777879"
+				   "80818283848586878889"
+				   "90919293949596979899";
+
+/** Print an unsigned integer
+  @param buf Buffer to print in
+  @param value Value to print
+  @param min_digits Left pad with zeros up to this number of digits
+  @return Printed length
+  */
+static size_t format_uint(char *buf, uint64_t value, size_t min_digits) {
+	char tmp[RB_NUMBER_INT_BUFSIZ];
+	char *cursor = &tmp[sizeof(tmp)];
+
+	while (value >= 100) {
+		const size_t pair = 2 * (size_t)(value % 100);
+		value /= 100;
+		*--cursor = digits_pairs[pair + 1];
+		*--cursor = digits_pairs[pair];
+	}
+
+	if (value >= 10) {
+		const size_t pair = 2 * (size_t)value;
+		*--cursor = digits_pairs[pair + 1];
+		*--cursor = digits_pairs[pair];
+	} else {
+		*--cursor = (char)('0' + value);
+	}
+
+	while ((size_t)(&tmp[sizeof(tmp)] - cursor) < min_digits) {
+		*--cursor = '0';
+	}
+
+	const size_t len = (size_t)(&tmp[sizeof(tmp)] - cursor);
+	memcpy(buf, cursor, len);
+	return len;
+}
+
+size_t rb_number_format_int(char *buf, int64_t value) {
+	size_t len = 0;
+	uint64_t abs_value = (uint64_t)value;
+	if (value < 0) {
+		buf[len++] = '-';
+		abs_value = 0 - abs_value;
+	}
+
+	len += format_uint(&buf[len], abs_value, 1);
+	buf[len] = '\0';
+	return len;
+}
+
+/** Print an integer scaled by a power of ten as a decimal number
+  @param buf Buffer to print in
+  @param negative Print sign
+  @param scaled Number multiplied by 10^decimals
+  @param decimals Number of decimals
+  @return Printed length
+  */
+static size_t format_scaled(char *buf,
+			    bool negative,
+			    uint64_t scaled,
+			    int decimals) {
+	size_t len = 0;
+	if (negative) {
+		buf[len++] = '-';
+	}
+
+	const uint64_t divisor = (uint64_t)pow10_exact[decimals];
+	len += format_uint(&buf[len], scaled / divisor, 1);
+	if (decimals > 0) {
+		buf[len++] = '.';
+		len += format_uint(
+				&buf[len], scaled % divisor, (size_t)decimals);
+	}
+
+	buf[len] = '\0';
+	return len;
+}
+
+/** Print a double with fixed decimals, like "%.*f"
+  @see rb_number_format
+  */
+static size_t format_fixed(char *buf, double value, int precision) {
+	const double abs_value = fabs(value);
+	const double scale = pow10_exact[precision];
+	const double scaled = abs_value * scale;
+
+	if (!isfinite(value) || scaled >= DOUBLE_MAX_EXACT_INT / 2) {
+		return (size_t)sprintf(buf, "%.*f", precision, value);
+	}
+
+	// Exact product is scaled + error. Round it half to even, as printf
+	const double error = fma(abs_value, scale, -scaled);
+	const double integer = floor(scaled);
+	const double fraction = scaled - integer;
+	uint64_t rounded = (uint64_t)integer;
+	if (fraction > 0.5 || (fraction == 0.5 && error > 0) ||
+	    (fraction == 0.5 && error == 0 && (rounded & 1))) {
+		rounded++;
+	}
+
+	return format_scaled(buf, signbit(value), rounded, precision);
+}
+
+/** Print the shortest decimal that parses back to value
+  @see rb_number_format
+  */
+static size_t format_shortest(char *buf, double value) {
+	const double abs_value = fabs(value);
+
+	if (!isfinite(value)) {
+		return (size_t)sprintf(buf, "%f", value);
+	}
+
+	if (0 == abs_value) {
+		return format_scaled(buf, signbit(value), 0, 0);
+	}
+
+	// Try with fixed decimals. Division of exact integers is correctly
+	// rounded, so if it gives value back, parsing the decimal will too
+	for (int decimals = 0; decimals <= RB_NUMBER_PRECISION_MAX;
+	     ++decimals) {
+		const double scale = pow10_exact[decimals];
+		const double scaled = nearbyint(abs_value * scale);
+		if (scaled >= DOUBLE_MAX_EXACT_INT) {
+			break;
+		}
+
+		if (scaled > 0 && scaled / scale == abs_value) {
+			return format_scaled(buf,
+					     signbit(value),
+					     (uint64_t)scaled,
+					     decimals);
+		}
+	}
+
+	// Very big or very small numbers
+	int len = 0;
+	for (int digits = 15; digits <= 17; ++digits) {
+		len = sprintf(buf, "%.*g", digits, value);
+		if (rb_number_parse(buf, NULL) == value) {
+			break;
+		}
+	}
+
+	return (size_t)len;
+}
+
+size_t rb_number_format(char *buf, double value, int precision) {
+	if (precision < 0) {
+		return format_shortest(buf, value);
+	}
+
+	if (precision > RB_NUMBER_PRECISION_MAX) {
+		precision = RB_NUMBER_PRECISION_MAX;
+	}
+
+	return format_fixed(buf, value, precision);
+}
@@ -0,0 +1,63 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <float.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Print the shortest decimal that parses back to the same double
+#define RB_NUMBER_PRECISION_SHORTEST (-1)
+
+/// Maximum number of fixed decimals
+#define RB_NUMBER_PRECISION_MAX 17
+
+/// Buffer size able to hold any formatted number, including '\0'
+#define RB_NUMBER_BUFSIZ (1 + DBL_MAX_10_EXP + 1 + 1 + RB_NUMBER_PRECISION_MAX + 1)
+
+/// Buffer size able to hold any formatted integer, including '\0'
+#define RB_NUMBER_INT_BUFSIZ (sizeof("-9223372036854775808"))
+
+/** Parse a decimal number. It is a drop-in replacement of strtod, with a fast
+  path for numbers of up to 19 significant digits and small exponents, that
+  are the common case in monitor values. Other inputs are delegated to
+  strtod, so errno and endptr behave the same way.
+  @param str String to parse
+  @param endptr If not NULL, first not parsed character
+  @return Parsed number
+  */
+double rb_number_parse(const char *str, char **endptr);
+
+/** Print an integer in decimal format
+  @param buf Buffer of at least RB_NUMBER_INT_BUFSIZ bytes
+  @param value Value to print
+  @return Printed length, not including '\0'
+  */
+size_t rb_number_format_int(char *buf, int64_t value);
+
+/** Print a double in decimal format
+  @param buf Buffer of at least RB_NUMBER_BUFSIZ bytes
+  @param value Value to print
+  @param precision Number of fixed decimals, rounded like printf's "%.*f",
+  or RB_NUMBER_PRECISION_SHORTEST for the fewest decimals that parse back to
+  value (or exponent notation if value is too big or too small).
+  @return Printed length, not including '\0'
+  */
+size_t rb_number_format(char *buf, double value, int precision);
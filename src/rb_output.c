@@ -0,0 +1,1724 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include "rb_output.h"
+
+#include "rb_avro.h"
+#include "rb_json.h"
+#include "rb_monitor_template.h"
+#include "rb_msgpack.h"
+#include "rb_number.h"
+#include "rb_sink_queue.h"
+#include "rb_spool.h"
+
+#ifdef HAVE_RBHTTP
+#include <librbhttp/rb_http_handler.h>
+#endif
+
+#include <librd/rd.h>
+#include <librd/rdlog.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/// Default sink queue size, in messages
+#define SINK_QUEUE_DEFAULT_SIZE 100000
+/// Default sink queue low watermark, in percentage of high watermark
+#define SINK_DEFAULT_LOW_WATERMARK 80
+
+/// Max records appended to spool at once
+#define SINK_SPOOL_RECORDS 64
+/// Spool replay period (ms)
+#define SINK_REPLAY_INTERVAL_MS 100
+/// Spool replay probes period when sink is not healthy (ms)
+#define SINK_REPLAY_PROBE_MS 5000
+/// Sink counters log period (ms)
+#define SINK_STATS_INTERVAL_MS (60 * 1000)
+/// Default sink spool max size (bytes)
+#define SINK_SPOOL_DEFAULT_MAX_SIZE (1024 * 1024 * 1024)
+/// Default sink spool max age (s)
+#define SINK_SPOOL_DEFAULT_MAX_AGE (7 * 24 * 60 * 60)
+/// Default sink spool segment size (bytes)
+#define SINK_SPOOL_DEFAULT_SEGMENT_SIZE (64 * 1024 * 1024)
+/// Default sink spool replay rate (messages/s)
+#define SINK_DEFAULT_REPLAY_RATE 1000
+/// HTTP messages error
+#define SINK_HTTP_ERR (-1)
+
+/// Times to retry messages that do not fit in librdkafka queue
+#define KAFKA_QUEUE_FULL_RETRIES 10
+/// Time to wait for room in librdkafka queue before retrying (ms)
+#define KAFKA_QUEUE_FULL_WAIT_MS 100
+
+/*
+ * SERIALIZERS
+ */
+
+/// Messages formats
+enum output_format {
+	OUTPUT_FORMAT_JSON,
+	OUTPUT_FORMAT_MSGPACK,
+	OUTPUT_FORMAT_AVRO,
+	OUTPUT_FORMATS_COUNT,
+};
+
+/** Serialize messages in a format
+  @param json JSON messages
+  @param schema Avro schema, if format needs it
+  @param dropped Messages that could not be serialized and are not in returned
+  array
+  @return Serialized messages, or NULL in case of error. It can be json array
+  itself, with one more reference.
+  */
+typedef rb_message_array_t *(*output_serializer)(
+		rb_message_array_t *json,
+		const struct rb_avro_schema *schema,
+		size_t *dropped);
+
+/** JSON serializer. Messages are already printed as JSON. */
+static rb_message_array_t *
+output_serialize_json(rb_message_array_t *json,
+		      const struct rb_avro_schema *schema,
+		      size_t *dropped) {
+	(void)schema;
+	*dropped = 0;
+	rb_message_array_get(json);
+	return json;
+}
+
+/** Parse all the JSON values of a message. Array batches are an array
+  already, and NDJSON batches have one value per line.
+  @param msg Message
+  @param tok JSON tokener
+  @return JSON array with message values, or NULL in case of error
+  */
+static json_object *output_json_values(const rb_message *msg,
+				       struct json_tokener *tok) {
+	const char *payload = msg->payload;
+	if ('[' == payload[0]) {
+		return json_tokener_parse(payload);
+	}
+
+	json_object *ret = json_object_new_array();
+	for (const char *line = payload, *end = payload + msg->len;
+	     ret && line < end;) {
+		const char *eol = memchr(line, '\n', (size_t)(end - line));
+		const size_t line_len = (size_t)((eol ? eol : end) - line);
+
+		json_tokener_reset(tok);
+		json_object *value =
+				json_tokener_parse_ex(tok, line, (int)line_len);
+		if (NULL == value) {
+			json_object_put(ret);
+			return NULL;
+		}
+		json_object_array_add(ret, value);
+		line += line_len + 1;
+	}
+
+	return ret;
+}
+
+/** Create a serialized messages array, with json metadata
+  @param json JSON messages
+  @param count Number of messages
+  @return New messages array, or NULL in case of error
+  */
+static rb_message_array_t *
+output_serialized_array(const rb_message_array_t *json, size_t count) {
+	rb_message_array_t *ret = new_messages_array(count);
+	if (NULL == ret) {
+		rdlog(LOG_ERR, "Couldn't allocate messages (OOM?)");
+		return NULL;
+	}
+
+	ret->batch = json->batch;
+	ret->priority = json->priority;
+	ret->tmpl = json->tmpl ? rb_monitor_template_get(json->tmpl) : NULL;
+	return ret;
+}
+
+/** Move a buffer content to a message
+  @param msg Message
+  @param buf Buffer. It is reset.
+  @return 0 if success, !0 in other case
+  */
+static int output_message_from_printbuf(rb_message *msg,
+					struct printbuf *buf) {
+	msg->payload = malloc((size_t)buf->bpos);
+	if (NULL == msg->payload) {
+		rdlog(LOG_ERR, "Couldn't allocate message (OOM?)");
+		return -1;
+	}
+
+	memcpy(msg->payload, buf->buf, (size_t)buf->bpos);
+	msg->len = (size_t)buf->bpos;
+	printbuf_reset(buf);
+	return 0;
+}
+
+/** Convert a message "value" printed as a decimal string to a JSON double, so
+  it is encoded as a number in binary formats
+  @param record Message record
+  */
+static void output_json_numeric_value(json_object *record) {
+	json_object *value = NULL;
+	if (!json_object_object_get_ex(record, "value", &value) ||
+	    !json_object_is_type(value, json_type_string)) {
+		return;
+	}
+
+	char *endptr = NULL;
+	const char *str = json_object_get_string(value);
+	const double number = rb_number_parse(str, &endptr);
+	if (str == endptr || '\0' != *endptr) {
+		// Not a number, keep it as a string
+		return;
+	}
+
+	json_object *number_json = json_object_new_double(number);
+	if (NULL == number_json) {
+		rdlog(LOG_ERR, "Couldn't allocate message value (OOM?)");
+		return;
+	}
+	json_object_object_add(record, "value", number_json);
+}
+
+/** MessagePack serializer. Batches are encoded as an array, with the sensor
+  enrichment first. Decimal values are encoded as float64, and integer ones as
+  integers. */
+static rb_message_array_t *
+output_serialize_msgpack(rb_message_array_t *json,
+			 const struct rb_avro_schema *schema,
+			 size_t *dropped) {
+	(void)schema;
+	*dropped = 0;
+	struct printbuf *buf = printbuf_new();
+	struct json_tokener *tok = json_tokener_new();
+	rb_message_array_t *ret = output_serialized_array(json, json->count);
+	if (NULL == buf || NULL == tok || NULL == ret) {
+		rdlog(LOG_ERR, "Couldn't allocate msgpack messages (OOM?)");
+		goto err;
+	}
+
+	for (size_t i = 0; i < json->count; ++i) {
+		json_object *values = output_json_values(&json->msgs[i], tok);
+		if (NULL == values) {
+			rdlog(LOG_ERR, "Couldn't parse message to serialize");
+			goto err;
+		}
+
+		const int values_len = json_object_array_length(values);
+		for (int j = 0; j < values_len; ++j) {
+			output_json_numeric_value(
+					json_object_array_get_idx(values, j));
+		}
+
+		rb_msgpack_pack_json(buf,
+				     json->batch ? values
+						 : json_object_array_get_idx(
+							   values, 0));
+		json_object_put(values);
+		ret->msgs[i].timestamp = json->msgs[i].timestamp;
+		if (0 != output_message_from_printbuf(&ret->msgs[i], buf)) {
+			goto err;
+		}
+	}
+
+	json_tokener_free(tok);
+	printbuf_free(buf);
+	return ret;
+
+err:
+	if (ret) {
+		rb_message_array_put(ret);
+	}
+	if (tok) {
+		json_tokener_free(tok);
+	}
+	if (buf) {
+		printbuf_free(buf);
+	}
+	return NULL;
+}
+
+/** Avro serializer. Every batch record is encoded in its own message, with
+  the sensor enrichment fields. Messages that don't match the schema are
+  discarded. */
+static rb_message_array_t *
+output_serialize_avro(rb_message_array_t *json,
+		      const struct rb_avro_schema *schema,
+		      size_t *dropped) {
+	json_object **values = calloc(json->count, sizeof(values[0]));
+	struct printbuf *buf = printbuf_new();
+	struct json_tokener *tok = json_tokener_new();
+	rb_message_array_t *ret = NULL;
+	size_t count = 0, discarded = 0;
+	if (NULL == values || NULL == buf || NULL == tok) {
+		rdlog(LOG_ERR, "Couldn't allocate avro messages (OOM?)");
+		goto done;
+	}
+
+	for (size_t i = 0; i < json->count; ++i) {
+		values[i] = output_json_values(&json->msgs[i], tok);
+		if (NULL == values[i]) {
+			rdlog(LOG_ERR, "Couldn't parse message to serialize");
+			goto done;
+		}
+		// Batch header is not a record
+		count += (size_t)json_object_array_length(values[i]) -
+			 (json->batch ? 1 : 0);
+	}
+
+	ret = output_serialized_array(json, count);
+	if (NULL == ret) {
+		goto done;
+	}
+
+	ret->count = 0;
+	for (size_t i = 0; i < json->count; ++i) {
+		const int values_len = json_object_array_length(values[i]);
+		json_object *header =
+				json->batch ? json_object_array_get_idx(
+						      values[i], 0)
+					    : NULL;
+		for (int j = json->batch ? 1 : 0; j < values_len; ++j) {
+			json_object *record =
+					json_object_array_get_idx(values[i], j);
+			rb_message *msg = &ret->msgs[ret->count];
+			if (!rb_avro_encode(schema, buf, record, header)) {
+				printbuf_reset(buf);
+				discarded++;
+				continue;
+			}
+
+			msg->timestamp = json->msgs[i].timestamp;
+			if (0 != output_message_from_printbuf(msg, buf)) {
+				rb_message_array_put(ret);
+				ret = NULL;
+				goto done;
+			}
+			ret->count++;
+		}
+	}
+
+	if (discarded > 0) {
+		rdlog(LOG_WARNING,
+		      "Discarding %zu messages that don't match avro schema",
+		      discarded);
+	}
+	*dropped = discarded;
+
+done:
+	for (size_t i = 0; values && i < json->count; ++i) {
+		if (values[i]) {
+			json_object_put(values[i]);
+		}
+	}
+	free(values);
+	if (tok) {
+		json_tokener_free(tok);
+	}
+	if (buf) {
+		printbuf_free(buf);
+	}
+	return ret;
+}
+
+static const struct {
+	const char *name;
+	output_serializer serialize;
+} output_formats[] = {
+		[OUTPUT_FORMAT_JSON] = {"json", output_serialize_json},
+		[OUTPUT_FORMAT_MSGPACK] = {"msgpack", output_serialize_msgpack},
+		[OUTPUT_FORMAT_AVRO] = {"avro", output_serialize_avro},
+};
+
+/*
+ * SINK FILTERS
+ */
+
+/// Message properties sinks can filter by
+enum sink_filter_key {
+	SINK_FILTER_SENSOR,
+	SINK_FILTER_MONITOR,
+	SINK_FILTER_GROUP,
+	SINK_FILTER_TYPE,
+	SINK_FILTERS_COUNT,
+};
+
+/// Filter keys, and how to extract them from messages template
+static const struct {
+	const char *key;
+	const char *(*value)(const struct rb_monitor_template *tmpl);
+} sink_filter_keys[] = {
+		[SINK_FILTER_SENSOR] = {"sensor",
+					rb_monitor_template_sensor_name},
+		[SINK_FILTER_MONITOR] = {"monitor",
+					 rb_monitor_template_monitor},
+		[SINK_FILTER_GROUP] = {"group", rb_monitor_template_group_id},
+		[SINK_FILTER_TYPE] = {"type", rb_monitor_template_type},
+};
+
+/// Accepted values of a message property. Empty filter accepts everything.
+struct sink_filter {
+	char **values; ///< Accepted values
+	size_t count;  ///< Length of values
+};
+
+static void sink_filter_done(struct sink_filter *filter) {
+	for (size_t i = 0; i < filter->count; ++i) {
+		free(filter->values[i]);
+	}
+	free(filter->values);
+}
+
+/** Parse a sink filter
+  @param filter Filter to parse
+  @param json Filter value, a string or an array of strings
+  @return true if success, false in other case
+  */
+static bool sink_filter_parse(struct sink_filter *filter, json_object *json) {
+	const bool array = json_object_is_type(json, json_type_array);
+	const size_t count =
+			array ? (size_t)json_object_array_length(json) : 1;
+
+	filter->values = calloc(count, sizeof(filter->values[0]));
+	if (NULL == filter->values) {
+		rdlog(LOG_ERR, "Couldn't allocate sink filter (OOM?)");
+		return false;
+	}
+
+	for (filter->count = 0; filter->count < count; ++filter->count) {
+		const int idx = (int)filter->count;
+		json_object *value =
+				array ? json_object_array_get_idx(json, idx)
+				      : json;
+		char *str = strdup(json_object_get_string(value));
+		if (NULL == str) {
+			rdlog(LOG_ERR, "Couldn't allocate sink filter (OOM?)");
+			return false;
+		}
+		filter->values[filter->count] = str;
+	}
+
+	return true;
+}
+
+static bool sink_filter_match(const struct sink_filter *filter,
+			      const char *value) {
+	if (0 == filter->count) {
+		return true;
+	}
+
+	for (size_t i = 0; value && i < filter->count; ++i) {
+		if (0 == strcmp(filter->values[i], value)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/// Sink messages counters, updated atomically
+enum sink_counter {
+	/// New messages dropped, queue over high watermark
+	SINK_COUNTER_DROPPED_NEWEST,
+	/// Queued messages dropped to make room for new ones
+	SINK_COUNTER_DROPPED_OLDEST,
+	/// Lowest priority messages dropped
+	SINK_COUNTER_DROPPED_PRIORITY,
+	/// Messages that could not be delivered nor spooled
+	SINK_COUNTER_DROPPED_FAILED,
+	/// Messages that could not be serialized in sink format
+	SINK_COUNTER_DROPPED_SERIALIZATION,
+	SINK_COUNTER_SPOOLED, ///< Spooled messages
+	SINK_COUNTER_BLOCKED, ///< Times a worker waited for room in queue
+	SINK_COUNTERS_COUNT,
+};
+
+/// Sink counters snapshot
+struct sink_stats {
+	uint64_t counters[SINK_COUNTERS_COUNT]; ///< Messages counters
+	uint64_t discarded; ///< Messages discarded from spool
+};
+
+/*
+ * SINKS
+ */
+
+/// Sink destination
+enum sink_type {
+	SINK_KAFKA,
+	SINK_HTTP,
+};
+
+struct rb_output_sink {
+	char *name;				     ///< Sink name
+	enum sink_type type;			     ///< Destination
+	enum output_format format;		     ///< Messages format
+	const struct rb_avro_schema *schema;	 ///< Avro schema, if any
+	/// Index of first sink with the same format and schema. They share
+	/// serialized messages.
+	size_t encoder;
+	struct sink_filter filters[SINK_FILTERS_COUNT]; ///< Messages filters
+	const struct rb_output_handlers *handlers;      ///< Output handlers
+
+	rd_kafka_topic_t *rkt;		    ///< Kafka topic
+	enum rb_output_kafka_key kafka_key; ///< Kafka messages key
+
+	struct rb_sink_queue queue; ///< Messages to send
+	pthread_t *threads;      ///< Sender threads
+	size_t threads_size;     ///< Length of threads
+	size_t threads_count;    ///< Running sender threads
+	uint64_t counters[SINK_COUNTERS_COUNT]; ///< Messages counters
+
+	struct rb_spool *spool;   ///< Undeliverable messages spool, if any
+	int64_t replay_rate;      ///< Max spooled messages to replay per second
+	pthread_t maint_thread;   ///< Spool replay and counters log thread
+	bool maint_running;       ///< Maintenance thread has been created
+	/// Last delivery succeeded, so spool can be replayed. Updated
+	/// atomically.
+	int healthy;
+};
+
+/** Set sink health after a delivery attempt
+  @param sink Sink
+  @param healthy Delivery succeeded
+  */
+static void sink_set_healthy(struct rb_output_sink *sink, bool healthy) {
+	if (healthy) {
+		ATOMIC_OP(or, fetch, &sink->healthy, 1);
+	} else {
+		ATOMIC_OP(and, fetch, &sink->healthy, 0);
+	}
+}
+
+static bool sink_is_healthy(struct rb_output_sink *sink) {
+	return 0 != ATOMIC_OP(add, fetch, &sink->healthy, 0);
+}
+
+static void sink_count(struct rb_output_sink *sink,
+		       enum sink_counter counter,
+		       uint64_t n) {
+	ATOMIC_OP(add, fetch, &sink->counters[counter], n);
+}
+
+/** Take a snapshot of sink counters
+  @param sink Sink
+  @param stats Snapshot
+  */
+static void sink_stats_get(struct rb_output_sink *sink,
+			   struct sink_stats *stats) {
+	for (size_t i = 0; i < RD_ARRAYSIZE(stats->counters); ++i) {
+		stats->counters[i] =
+				ATOMIC_OP(add, fetch, &sink->counters[i], 0);
+	}
+	stats->discarded = sink->spool ? rb_spool_discarded(sink->spool) : 0;
+}
+
+/** Log sink counters increments, if any
+  @param sink Sink
+  @param stats Current counters
+  @param prev Counters at the beginning of the period
+  @param period Period description, appended to log message
+  */
+static void sink_stats_log(const struct rb_output_sink *sink,
+			   const struct sink_stats *stats,
+			   const struct sink_stats *prev,
+			   const char *period) {
+	struct sink_stats delta;
+	bool any = false;
+	for (size_t i = 0; i < RD_ARRAYSIZE(delta.counters); ++i) {
+		delta.counters[i] = stats->counters[i] - prev->counters[i];
+		any = any || delta.counters[i] > 0;
+	}
+	delta.discarded = stats->discarded - prev->discarded;
+
+	if (!any && 0 == delta.discarded) {
+		return;
+	}
+
+	rdlog(LOG_INFO,
+	      "Sink %s dropped messages%s: %" PRIu64 " newest, %" PRIu64
+	      " oldest, %" PRIu64 " low priority, %" PRIu64
+	      " undeliverable, %" PRIu64 " not serializable, %" PRIu64
+	      " discarded from spool. %" PRIu64 " spooled messages, %" PRIu64
+	      " blocked sends",
+	      sink->name,
+	      period,
+	      delta.counters[SINK_COUNTER_DROPPED_NEWEST],
+	      delta.counters[SINK_COUNTER_DROPPED_OLDEST],
+	      delta.counters[SINK_COUNTER_DROPPED_PRIORITY],
+	      delta.counters[SINK_COUNTER_DROPPED_FAILED],
+	      delta.counters[SINK_COUNTER_DROPPED_SERIALIZATION],
+	      delta.discarded,
+	      delta.counters[SINK_COUNTER_SPOOLED],
+	      delta.counters[SINK_COUNTER_BLOCKED]);
+}
+
+/** Spool messages, or drop them if sink has no spool
+  @param sink Sink
+  @param msgs Messages array
+  @param key Messages key, or NULL
+  @param err Only spool messages with this error
+  @param dropped_counter Counter of messages that can't be spooled
+  */
+static void sink_spool_messages(struct rb_output_sink *sink,
+				const rb_message_array_t *msgs,
+				const char *key,
+				int err,
+				enum sink_counter dropped_counter) {
+	struct rb_spool_record records[SINK_SPOOL_RECORDS];
+	size_t count = 0, spooled = 0, total = 0;
+
+	for (size_t i = 0; i < msgs->count; ++i) {
+		const rb_message *msg = &msgs->msgs[i];
+		if (err != msg->err || NULL == msg->payload) {
+			continue;
+		}
+
+		total++;
+		if (NULL == sink->spool) {
+			continue;
+		}
+
+		records[count++] = (struct rb_spool_record){
+				.payload = msg->payload,
+				.len = msg->len,
+				.key = key,
+				.key_len = key ? strlen(key) : 0,
+				.timestamp = msg->timestamp,
+		};
+		if (RD_ARRAYSIZE(records) == count) {
+			spooled += rb_spool_append(sink->spool, records, count);
+			count = 0;
+		}
+	}
+
+	if (count > 0) {
+		spooled += rb_spool_append(sink->spool, records, count);
+	}
+
+	sink_count(sink, SINK_COUNTER_SPOOLED, spooled);
+	sink_count(sink, dropped_counter, total - spooled);
+}
+
+bool rb_output_kafka_key_parse(const char *name,
+			       enum rb_output_kafka_key *key) {
+	static const struct {
+		const char *name;
+		enum rb_output_kafka_key key;
+	} keys[] = {
+			{"none", RB_OUTPUT_KAFKA_KEY_NONE},
+			{"sensor_name", RB_OUTPUT_KAFKA_KEY_SENSOR_NAME},
+			{"sensor_id", RB_OUTPUT_KAFKA_KEY_SENSOR_ID},
+			{"monitor", RB_OUTPUT_KAFKA_KEY_MONITOR},
+	};
+
+	for (size_t i = 0; i < RD_ARRAYSIZE(keys); ++i) {
+		if (0 == strcmp(name, keys[i].name)) {
+			*key = keys[i].key;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Kafka key of a messages array
+  @param sink Sink
+  @param msgs Messages array
+  @return Key, or NULL if messages have no key
+  */
+static const char *sink_kafka_key(const struct rb_output_sink *sink,
+				  const rb_message_array_t *msgs) {
+	if (NULL == msgs->tmpl) {
+		return NULL;
+	}
+
+	switch (sink->kafka_key) {
+	case RB_OUTPUT_KAFKA_KEY_SENSOR_NAME:
+		return rb_monitor_template_sensor_name(msgs->tmpl);
+	case RB_OUTPUT_KAFKA_KEY_SENSOR_ID:
+		return rb_monitor_template_sensor_id(msgs->tmpl);
+	case RB_OUTPUT_KAFKA_KEY_MONITOR:
+		// Batches contains many monitors
+		return msgs->batch ? NULL
+				   : rb_monitor_template_monitor(msgs->tmpl);
+	case RB_OUTPUT_KAFKA_KEY_NONE:
+	default:
+		return NULL;
+	};
+}
+
+/** Kafka headers of a messages array, with routing metadata
+  @param msgs Messages array
+  @return New headers, or NULL if there is no metadata or in case of error
+  */
+static rd_kafka_headers_t *sink_kafka_headers(const rb_message_array_t *msgs) {
+	if (NULL == msgs->tmpl) {
+		return NULL;
+	}
+
+	const struct {
+		const char *name;
+		const char *value;
+	} headers[] = {
+			{"sensor_name",
+			 rb_monitor_template_sensor_name(msgs->tmpl)},
+			{"sensor_id",
+			 rb_monitor_template_sensor_id(msgs->tmpl)},
+			{"monitor",
+			 msgs->batch ? NULL
+				     : rb_monitor_template_monitor(msgs->tmpl)},
+	};
+
+	rd_kafka_headers_t *ret = rd_kafka_headers_new(RD_ARRAYSIZE(headers));
+	if (NULL == ret) {
+		rdlog(LOG_ERR, "[Kafka] Couldn't allocate headers (OOM?)");
+		return NULL;
+	}
+
+	for (size_t i = 0; i < RD_ARRAYSIZE(headers); ++i) {
+		if (headers[i].value) {
+			rd_kafka_header_add(ret,
+					    headers[i].name,
+					    -1,
+					    headers[i].value,
+					    -1);
+		}
+	}
+
+	return ret;
+}
+
+/** Produce a message to kafka
+  @param sink Sink
+  @param msgs Messages array of message
+  @param msg Message to produce. Its payload is set to NULL if librdkafka
+  owns it.
+  @param key Message key, or NULL
+  @param copy Copy message payload instead of handing it to librdkafka
+  @return Produce error, if any
+  */
+static rd_kafka_resp_err_t sink_kafka_produce(struct rb_output_sink *sink,
+					      const rb_message_array_t *msgs,
+					      rb_message *msg,
+					      const char *key,
+					      bool copy) {
+	const int flags = copy ? RD_KAFKA_MSG_F_COPY : RD_KAFKA_MSG_F_FREE;
+	rd_kafka_headers_t *headers = sink_kafka_headers(msgs);
+
+	const rd_kafka_resp_err_t rc = rd_kafka_producev(
+			sink->handlers->rk,
+			RD_KAFKA_V_RKT(sink->rkt),
+			RD_KAFKA_V_PARTITION(RD_KAFKA_PARTITION_UA),
+			RD_KAFKA_V_MSGFLAGS(flags),
+			RD_KAFKA_V_VALUE(msg->payload, msg->len),
+			RD_KAFKA_V_KEY(key, key ? strlen(key) : 0),
+			RD_KAFKA_V_TIMESTAMP(msg->timestamp),
+			RD_KAFKA_V_HEADERS(headers),
+			RD_KAFKA_V_END);
+
+	if (RD_KAFKA_RESP_ERR_NO_ERROR == rc) {
+		// librdkafka owns headers, and payload if not copied
+		if (!copy) {
+			msg->payload = NULL;
+		}
+	} else {
+		if (headers) {
+			rd_kafka_headers_destroy(headers);
+		}
+		if (RD_KAFKA_RESP_ERR__QUEUE_FULL != rc) {
+			rdlog(LOG_ERR,
+			      "[Kafka] Cannot produce kafka message: %s",
+			      rd_kafka_err2str(rc));
+		}
+	}
+
+	return rc;
+}
+
+/** Produce a messages array to kafka. Messages that do not fit in librdkafka
+  queue are retried when there is room for them, and spooled (or discarded)
+  if there is no room after that.
+  @param sink Sink
+  @param msgs Messages to produce. Payload of enqueued messages are set to
+  NULL if they are not copied.
+  @param copy Copy messages payload instead of handing them to librdkafka
+  */
+static void sink_kafka_produce_array(struct rb_output_sink *sink,
+				     rb_message_array_t *msgs,
+				     bool copy) {
+	const char *key = sink_kafka_key(sink, msgs);
+	size_t pending = 0;
+
+	for (size_t i = 0; i < msgs->count; ++i) {
+		rb_message *msg = &msgs->msgs[i];
+		// librdkafka could free the payload as soon as it is produced
+		if (OUTPUT_FORMAT_JSON == sink->format) {
+			rdlog(LOG_DEBUG, "[Kafka] %s", (char *)msg->payload);
+		}
+		msg->err = sink_kafka_produce(sink, msgs, msg, key, copy);
+		if (RD_KAFKA_RESP_ERR__QUEUE_FULL == msg->err) {
+			pending++;
+		}
+	}
+
+	for (int retry = 0; pending > 0 && retry < KAFKA_QUEUE_FULL_RETRIES;
+	     ++retry) {
+		// Wait for delivery reports to make room in queue
+		rd_kafka_poll(sink->handlers->rk, KAFKA_QUEUE_FULL_WAIT_MS);
+
+		pending = 0;
+		for (size_t i = 0; i < msgs->count; ++i) {
+			rb_message *msg = &msgs->msgs[i];
+			if (RD_KAFKA_RESP_ERR__QUEUE_FULL != msg->err) {
+				continue;
+			}
+
+			msg->err = sink_kafka_produce(
+					sink, msgs, msg, key, copy);
+			if (RD_KAFKA_RESP_ERR__QUEUE_FULL == msg->err) {
+				pending++;
+			}
+		}
+	}
+
+	if (pending > 0) {
+		rdlog(LOG_ERR,
+		      "[Kafka] %s %zu messages: %s",
+		      sink->spool ? "Spooling" : "Discarding",
+		      pending,
+		      rd_kafka_err2str(RD_KAFKA_RESP_ERR__QUEUE_FULL));
+		sink_set_healthy(sink, false);
+		sink_spool_messages(sink,
+				    msgs,
+				    key,
+				    RD_KAFKA_RESP_ERR__QUEUE_FULL,
+				    SINK_COUNTER_DROPPED_FAILED);
+	}
+}
+
+#ifdef HAVE_RBHTTP
+/** Send a messages array through HTTP
+  @param sink Sink
+  @param msgs Messages to send
+  */
+static void sink_http_produce_array(struct rb_output_sink *sink,
+				    rb_message_array_t *msgs) {
+	bool failed = false;
+	for (size_t i = 0; i < msgs->count; ++i) {
+		char err[BUFSIZ];
+		rb_message *msg = &msgs->msgs[i];
+		if (OUTPUT_FORMAT_JSON == sink->format) {
+			rdlog(LOG_DEBUG, "[HTTP] %s", (char *)msg->payload);
+		}
+		const int produce_rc = rb_http_produce(
+				sink->handlers->http_handler,
+				msg->payload,
+				msg->len,
+				RB_HTTP_MESSAGE_F_COPY,
+				err,
+				sizeof(err),
+				sink);
+		msg->err = 0 == produce_rc ? 0 : SINK_HTTP_ERR;
+		if (0 != produce_rc) {
+			rdlog(LOG_ERR,
+			      "[HTTP] Cannot produce message: %s",
+			      err);
+			failed = true;
+		}
+	}
+
+	sink_set_healthy(sink, !failed);
+	if (failed) {
+		sink_spool_messages(sink,
+				    msgs,
+				    NULL,
+				    SINK_HTTP_ERR,
+				    SINK_COUNTER_DROPPED_FAILED);
+	}
+}
+#endif
+
+/** Sink sender thread
+  @param vsink Sink
+  @return NULL
+  */
+static void *sink_sender(void *vsink) {
+	struct rb_output_sink *sink = vsink;
+	rb_message_array_t *msgs = NULL;
+
+	while ((msgs = rb_sink_queue_pop(&sink->queue, sink->name))) {
+		switch (sink->type) {
+		case SINK_KAFKA: {
+			// Payloads can be handed to librdkafka only if no other
+			// sink is using them
+			const int refcnt =
+					ATOMIC_OP(add, fetch, &msgs->refcnt, 0);
+			const bool shared = refcnt > 1;
+			sink_kafka_produce_array(sink, msgs, shared);
+			break;
+		}
+#ifdef HAVE_RBHTTP
+		case SINK_HTTP:
+			sink_http_produce_array(sink, msgs);
+			break;
+#endif
+		default:
+			break;
+		};
+
+		rb_message_array_put(msgs);
+	}
+
+	return NULL;
+}
+
+/** Replay a spooled record. If it can't be sent, it is spooled again.
+  @param sink Sink
+  @param record Spooled record
+  */
+static void sink_replay_record(struct rb_output_sink *sink,
+			       const struct rb_spool_record *record) {
+	int rc = -1;
+
+	switch (sink->type) {
+	case SINK_KAFKA:
+		// Spool segment is acknowledged in delivery report
+		rc = rd_kafka_producev(
+				sink->handlers->rk,
+				RD_KAFKA_V_RKT(sink->rkt),
+				RD_KAFKA_V_PARTITION(RD_KAFKA_PARTITION_UA),
+				RD_KAFKA_V_MSGFLAGS(RD_KAFKA_MSG_F_COPY),
+				RD_KAFKA_V_VALUE((void *)record->payload,
+						 record->len),
+				RD_KAFKA_V_KEY(record->key, record->key_len),
+				RD_KAFKA_V_TIMESTAMP(record->timestamp),
+				RD_KAFKA_V_OPAQUE(record->segment),
+				RD_KAFKA_V_END);
+		if (RD_KAFKA_RESP_ERR_NO_ERROR == rc) {
+			return;
+		}
+		break;
+
+#ifdef HAVE_RBHTTP
+	case SINK_HTTP: {
+		// Failed deliveries are spooled again in the HTTP report
+		char err[BUFSIZ];
+		rc = rb_http_produce(sink->handlers->http_handler,
+				     (char *)record->payload,
+				     record->len,
+				     RB_HTTP_MESSAGE_F_COPY,
+				     err,
+				     sizeof(err),
+				     sink);
+		break;
+	}
+#endif
+
+	default:
+		break;
+	};
+
+	if (0 != rc) {
+		sink_set_healthy(sink, false);
+		if (0 == rb_spool_append(sink->spool, record, 1)) {
+			sink_count(sink, SINK_COUNTER_DROPPED_FAILED, 1);
+		}
+	}
+	rb_spool_ack(sink->spool, record->segment);
+}
+
+/** Sink maintenance thread. It replays spooled messages at replay rate when
+  sink is healthy and its queue is empty, and probes the sink with one message
+  from time to time when it is not. It also logs sink counters increments
+  periodically.
+  @param vsink Sink
+  @return NULL
+  */
+static void *sink_maintainer(void *vsink) {
+	struct rb_output_sink *sink = vsink;
+	// Records to replay every interval
+	const int64_t batch_rate =
+			sink->replay_rate / (1000 / SINK_REPLAY_INTERVAL_MS);
+	const size_t batch = batch_rate > 0 ? (size_t)batch_rate : 1;
+	size_t messages = 0;
+	int probe_ms = 0;
+	int stats_ms = 0;
+	struct sink_stats stats, prev_stats;
+
+	struct rb_spool_record *records = calloc(batch, sizeof(records[0]));
+	if (NULL == records) {
+		rdlog(LOG_ERR, "Couldn't allocate replay records (OOM?)");
+		return NULL;
+	}
+
+	sink_stats_get(sink, &prev_stats);
+	while (!rb_sink_queue_wait_stop(
+			&sink->queue, SINK_REPLAY_INTERVAL_MS, &messages)) {
+		stats_ms += SINK_REPLAY_INTERVAL_MS;
+		if (stats_ms >= SINK_STATS_INTERVAL_MS) {
+			sink_stats_get(sink, &stats);
+			sink_stats_log(sink,
+				       &stats,
+				       &prev_stats,
+				       " since last report");
+			prev_stats = stats;
+			stats_ms = 0;
+		}
+
+		if (NULL == sink->spool) {
+			continue;
+		}
+
+		size_t max = 0;
+		probe_ms += SINK_REPLAY_INTERVAL_MS;
+		if (sink_is_healthy(sink)) {
+			// Live messages first
+			max = 0 == messages ? batch : 0;
+		} else if (probe_ms >= SINK_REPLAY_PROBE_MS) {
+			max = 1;
+			probe_ms = 0;
+		}
+
+		const size_t count = rb_spool_replay(sink->spool, records, max);
+		for (size_t i = 0; i < count; ++i) {
+			sink_replay_record(sink, &records[i]);
+		}
+	}
+
+	free(records);
+	return NULL;
+}
+
+void rb_output_kafka_delivered(const rd_kafka_message_t *rkmessage) {
+	struct rb_output_sink *sink = rd_kafka_topic_opaque(rkmessage->rkt);
+	struct rb_spool_segment *segment = rkmessage->_private;
+	if (NULL == sink) {
+		return;
+	}
+
+	sink_set_healthy(sink, RD_KAFKA_RESP_ERR_NO_ERROR == rkmessage->err);
+	if (RD_KAFKA_RESP_ERR_NO_ERROR != rkmessage->err) {
+		const struct rb_spool_record record = {
+				.payload = rkmessage->payload,
+				.len = rkmessage->len,
+				.key = rkmessage->key,
+				.key_len = rkmessage->key_len,
+				.timestamp = rd_kafka_message_timestamp(
+						rkmessage, NULL),
+		};
+		const size_t spooled =
+				sink->spool ? rb_spool_append(
+						      sink->spool, &record, 1)
+					    : 0;
+		sink_count(sink, SINK_COUNTER_SPOOLED, spooled);
+		sink_count(sink, SINK_COUNTER_DROPPED_FAILED, 1 - spooled);
+	}
+
+	if (segment) {
+		rb_spool_ack(sink->spool, segment);
+	}
+}
+
+#ifdef HAVE_RBHTTP
+void rb_output_http_delivered(void *opaque,
+			      bool delivered,
+			      const char *payload,
+			      size_t len) {
+	struct rb_output_sink *sink = opaque;
+	if (NULL == sink) {
+		return;
+	}
+
+	sink_set_healthy(sink, delivered);
+	if (!delivered) {
+		const struct rb_spool_record record = {
+				.payload = payload,
+				.len = len,
+				.timestamp = 1000 * (int64_t)time(NULL),
+		};
+		const size_t spooled =
+				sink->spool ? rb_spool_append(
+						      sink->spool, &record, 1)
+					    : 0;
+		sink_count(sink, SINK_COUNTER_SPOOLED, spooled);
+		sink_count(sink, SINK_COUNTER_DROPPED_FAILED, 1 - spooled);
+	}
+}
+#endif
+
+/** Queue messages in sink queue, counting evicted messages
+  @param sink Sink
+  @param msgs Messages
+  @return true if queued, false if they must be dropped or spooled
+  */
+static bool sink_push(struct rb_output_sink *sink, rb_message_array_t *msgs) {
+	size_t evicted = 0;
+	bool blocked = false;
+	const bool ret = rb_sink_queue_push(
+			&sink->queue, msgs, sink->name, &evicted, &blocked);
+
+	sink_count(sink,
+		   RB_SINK_QUEUE_DROP_PRIORITY == sink->queue.policy
+				   ? SINK_COUNTER_DROPPED_PRIORITY
+				   : SINK_COUNTER_DROPPED_OLDEST,
+		   evicted);
+	if (blocked) {
+		sink_count(sink, SINK_COUNTER_BLOCKED, 1);
+	}
+
+	return ret;
+}
+
+/** Handle messages rejected by sink queue
+  @param sink Sink
+  @param msgs Rejected messages
+  */
+static void sink_overflow(struct rb_output_sink *sink,
+			  const rb_message_array_t *msgs) {
+	switch (sink->queue.policy) {
+	case RB_SINK_QUEUE_SPOOL: {
+		// Fresh messages have no error
+		const char *key = SINK_KAFKA == sink->type
+						  ? sink_kafka_key(sink, msgs)
+						  : NULL;
+		sink_spool_messages(sink,
+				    msgs,
+				    key,
+				    0,
+				    SINK_COUNTER_DROPPED_NEWEST);
+		break;
+	}
+	case RB_SINK_QUEUE_DROP_PRIORITY:
+		// New messages have the lowest priority
+		sink_count(sink, SINK_COUNTER_DROPPED_PRIORITY, msgs->count);
+		break;
+	default:
+		sink_count(sink, SINK_COUNTER_DROPPED_NEWEST, msgs->count);
+		break;
+	};
+}
+
+/** Check if a sink accepts a messages array
+  @param sink Sink
+  @param msgs Messages array
+  @return true if sink accepts messages
+  */
+static bool sink_match(const struct rb_output_sink *sink,
+		       const rb_message_array_t *msgs) {
+	for (size_t i = 0; i < SINK_FILTERS_COUNT; ++i) {
+		const struct sink_filter *filter = &sink->filters[i];
+		if (0 == filter->count) {
+			continue;
+		}
+
+		// Batches contain many monitors, so they can only be filtered
+		// by sensor
+		if (NULL == msgs->tmpl ||
+		    (msgs->batch && i != SINK_FILTER_SENSOR)) {
+			return false;
+		}
+
+		if (!sink_filter_match(filter,
+				       sink_filter_keys[i].value(msgs->tmpl))) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/** Parse a sink string option that must be in a list of names
+  @param sink_json Sink JSON
+  @param key Option key
+  @param names Valid names
+  @param names_count Length of names
+  @param default_value Default value if option is not present
+  @return Option position in names, default_value if not present, or -1 if
+  it is not valid
+  */
+static int sink_parse_name(json_object *sink_json,
+			   const char *key,
+			   const char *const *names,
+			   size_t names_count,
+			   int default_value) {
+	const char *str = PARSE_CJSON_CHILD_STR(sink_json, key, NULL);
+	if (NULL == str) {
+		return default_value;
+	}
+
+	for (size_t i = 0; i < names_count; ++i) {
+		if (0 == strcmp(str, names[i])) {
+			return (int)i;
+		}
+	}
+
+	rdlog(LOG_ERR, "Invalid sink %s %s", key, str);
+	return -1;
+}
+
+/** Free sink resources. Sender threads must be stopped.
+  @param sink Sink
+  */
+static void sink_done(struct rb_output_sink *sink) {
+	rb_sink_queue_done(&sink->queue);
+	if (sink->rkt) {
+		rd_kafka_topic_destroy(sink->rkt);
+	}
+	for (size_t i = 0; i < SINK_FILTERS_COUNT; ++i) {
+		sink_filter_done(&sink->filters[i]);
+	}
+	if (sink->spool) {
+		rb_spool_done(sink->spool);
+	}
+	free(sink->threads);
+	free(sink->name);
+}
+
+/** Parse sink filters
+  @param sink Sink
+  @param filter_json Sink filter JSON object, or NULL
+  @return true if success, false in other case
+  */
+static bool sink_parse_filters(struct rb_output_sink *sink,
+			       json_object *filter_json) {
+	for (size_t i = 0; filter_json && i < SINK_FILTERS_COUNT; ++i) {
+		json_object *values = NULL;
+		if (json_object_object_get_ex(filter_json,
+					      sink_filter_keys[i].key,
+					      &values) &&
+		    !sink_filter_parse(&sink->filters[i], values)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/** Look for sink avro schema in schema store
+  @param sink Sink
+  @param sink_json Sink configuration
+  @param topic Sink topic, or NULL
+  @return true if success, false in other case
+  */
+static bool sink_parse_schema(struct rb_output_sink *sink,
+			      json_object *sink_json,
+			      const char *topic) {
+	if (OUTPUT_FORMAT_AVRO != sink->format) {
+		return true;
+	}
+
+	char default_subject[BUFSIZ];
+	const char *subject = PARSE_CJSON_CHILD_STR(sink_json, "schema", NULL);
+	if (NULL == subject && topic) {
+		// Default subject name strategy of schema registries
+		snprintf(default_subject,
+			 sizeof(default_subject),
+			 "%s-value",
+			 topic);
+		subject = default_subject;
+	}
+
+	if (NULL == subject || NULL == sink->handlers->schema_store) {
+		rdlog(LOG_ERR,
+		      "Sink %s needs schema_store and schema",
+		      sink->name);
+		return false;
+	}
+
+	sink->schema = rb_avro_schema_store_get(sink->handlers->schema_store,
+						subject);
+	if (NULL == sink->schema) {
+		rdlog(LOG_ERR,
+		      "Sink %s schema %s not found",
+		      sink->name,
+		      subject);
+		return false;
+	}
+
+	return true;
+}
+
+/** Open sink spool, if configured
+  @param sink Sink
+  @param sink_json Sink configuration
+  @return true if success, false in other case
+  */
+static bool sink_parse_spool(struct rb_output_sink *sink,
+			     json_object *sink_json) {
+	json_object *spool_json = NULL;
+	if (!json_object_object_get_ex(sink_json, "spool", &spool_json)) {
+		return true;
+	}
+
+	const int64_t max_size = PARSE_CJSON_CHILD_INT64(
+			spool_json, "max_size", SINK_SPOOL_DEFAULT_MAX_SIZE);
+	const int64_t max_age = PARSE_CJSON_CHILD_INT64(
+			spool_json, "max_age", SINK_SPOOL_DEFAULT_MAX_AGE);
+	const int64_t segment_size =
+			PARSE_CJSON_CHILD_INT64(spool_json,
+						"segment_size",
+						SINK_SPOOL_DEFAULT_SEGMENT_SIZE);
+	sink->replay_rate = PARSE_CJSON_CHILD_INT64(
+			spool_json, "replay_rate", SINK_DEFAULT_REPLAY_RATE);
+
+	const char *spool_dir = sink->handlers->spool_dir;
+	if (NULL == spool_dir) {
+		rdlog(LOG_ERR, "Sink %s needs spool_dir", sink->name);
+		return false;
+	}
+
+	if (max_size <= 0 || max_age <= 0 || segment_size <= 0 ||
+	    sink->replay_rate <= 0) {
+		rdlog(LOG_ERR,
+		      "Sink %s spool limits and replay_rate must be positive",
+		      sink->name);
+		return false;
+	}
+
+	if (0 != mkdir(spool_dir, 0750) && EEXIST != errno) {
+		rdlog(LOG_ERR,
+		      "Couldn't create spool directory %s: %s",
+		      spool_dir,
+		      strerror(errno));
+		return false;
+	}
+
+	const struct rb_spool_limits limits = {
+			.max_size = (uint64_t)max_size,
+			.max_age = (uint64_t)max_age,
+			.segment_size = (uint64_t)segment_size,
+	};
+	char dir[PATH_MAX];
+	snprintf(dir, sizeof(dir), "%s/%s", spool_dir, sink->name);
+	sink->spool = rb_spool_new(dir, &limits);
+	return NULL != sink->spool;
+}
+
+/** Parse sink queue watermarks and overflow policy. Sink spool must be
+  already parsed.
+  @param sink Sink
+  @param sink_json Sink configuration
+  @param queue_size Sink queue size
+  @return true if success, false in other case
+  */
+static bool sink_parse_overflow(struct rb_output_sink *sink,
+				json_object *sink_json,
+				int64_t queue_size) {
+	const int policy = sink_parse_name(
+			sink_json,
+			"overflow",
+			rb_sink_queue_policies,
+			RD_ARRAYSIZE(rb_sink_queue_policies),
+			sink->spool ? RB_SINK_QUEUE_SPOOL
+				    : RB_SINK_QUEUE_DROP_NEWEST);
+	const int64_t high_watermark = PARSE_CJSON_CHILD_INT64(
+			sink_json, "high_watermark", queue_size);
+	const int64_t default_low_watermark =
+			high_watermark * SINK_DEFAULT_LOW_WATERMARK / 100;
+	const int64_t low_watermark = PARSE_CJSON_CHILD_INT64(
+			sink_json,
+			"low_watermark",
+			default_low_watermark > 0 ? default_low_watermark : 1);
+
+	if (policy < 0) {
+		return false;
+	}
+
+	if (RB_SINK_QUEUE_SPOOL == policy && NULL == sink->spool) {
+		rdlog(LOG_ERR,
+		      "Sink %s spool overflow policy needs a spool",
+		      sink->name);
+		return false;
+	}
+
+	if (low_watermark <= 0 || low_watermark > high_watermark ||
+	    high_watermark > queue_size) {
+		rdlog(LOG_ERR,
+		      "Sink %s watermarks must be 0 < low_watermark <= "
+		      "high_watermark <= queue_size",
+		      sink->name);
+		return false;
+	}
+
+	sink->queue.policy = (enum rb_sink_queue_policy)policy;
+	sink->queue.high_watermark = (size_t)high_watermark;
+	sink->queue.low_watermark = (size_t)low_watermark;
+	return true;
+}
+
+/** Initialize a sink from its configuration
+  @param sink Sink to initialize. It must be zeroed.
+  @param sink_json Sink configuration
+  @param handlers Output handlers
+  @return true if success, false in other case. Sink must be freed with
+  sink_done in any case.
+  */
+static bool sink_init(struct rb_output_sink *sink,
+		      json_object *sink_json,
+		      const struct rb_output_handlers *handlers) {
+	static const char *const types[] = {
+			[SINK_KAFKA] = "kafka", [SINK_HTTP] = "http",
+	};
+	const char *formats[OUTPUT_FORMATS_COUNT];
+	for (size_t i = 0; i < RD_ARRAYSIZE(formats); ++i) {
+		formats[i] = output_formats[i].name;
+	}
+
+	rb_sink_queue_init(&sink->queue, SINK_QUEUE_DEFAULT_SIZE);
+	sink->handlers = handlers;
+	sink->kafka_key = handlers->kafka_key;
+	const int type = sink_parse_name(
+			sink_json, "type", types, RD_ARRAYSIZE(types), 0);
+	const int format = sink_parse_name(sink_json,
+					   "format",
+					   formats,
+					   RD_ARRAYSIZE(formats),
+					   OUTPUT_FORMAT_JSON);
+	const char *name = PARSE_CJSON_CHILD_STR(sink_json, "name", types[0]);
+	const char *topic = PARSE_CJSON_CHILD_STR(
+			sink_json, "topic", handlers->kafka_topic);
+	const char *key = PARSE_CJSON_CHILD_STR(sink_json, "key", NULL);
+	const int64_t queue_size = PARSE_CJSON_CHILD_INT64(
+			sink_json, "queue_size", SINK_QUEUE_DEFAULT_SIZE);
+	const int64_t threads =
+			PARSE_CJSON_CHILD_INT64(sink_json, "threads", 1);
+	json_object *filter_json = NULL;
+	json_object_object_get_ex(sink_json, "filter", &filter_json);
+
+	sink->name = strdup(name);
+	if (NULL == sink->name) {
+		rdlog(LOG_ERR, "Couldn't allocate sink (OOM?)");
+		return false;
+	}
+
+	if (type < 0 || format < 0 ||
+	    (key && !rb_output_kafka_key_parse(key, &sink->kafka_key))) {
+		rdlog(LOG_ERR, "Invalid sink %s configuration", sink->name);
+		return false;
+	}
+
+	if (queue_size <= 0 || threads <= 0) {
+		rdlog(LOG_ERR,
+		      "Sink %s queue_size and threads must be positive",
+		      sink->name);
+		return false;
+	}
+
+	sink->type = (enum sink_type)type;
+	sink->format = (enum output_format)format;
+	if (!sink_parse_filters(sink, filter_json) ||
+	    !sink_parse_schema(sink, sink_json, topic)) {
+		return false;
+	}
+
+	switch (sink->type) {
+	case SINK_KAFKA:
+		if (NULL == handlers->rk || NULL == topic) {
+			rdlog(LOG_ERR,
+			      "Sink %s needs kafka_broker and topic",
+			      sink->name);
+			return false;
+		}
+
+		rd_kafka_topic_conf_t *rkt_conf =
+				rd_kafka_topic_conf_dup(handlers->rkt_conf);
+		// Delivery reports need the sink
+		rd_kafka_topic_conf_set_opaque(rkt_conf, sink);
+		sink->rkt = rd_kafka_topic_new(handlers->rk, topic, rkt_conf);
+		if (NULL == sink->rkt) {
+			rdlog(LOG_ERR,
+			      "Couldn't create sink %s topic %s: %s",
+			      sink->name,
+			      topic,
+			      rd_kafka_err2str(rd_kafka_last_error()));
+			return false;
+		}
+		break;
+
+	case SINK_HTTP:
+		if (NULL == handlers->http_handler) {
+			rdlog(LOG_ERR,
+			      "Sink %s needs http_endpoint",
+			      sink->name);
+			return false;
+		}
+		break;
+
+	default:
+		return false;
+	};
+
+	if (!sink_parse_spool(sink, sink_json) ||
+	    !sink_parse_overflow(sink, sink_json, queue_size)) {
+		return false;
+	}
+
+	sink->threads = calloc((size_t)threads, sizeof(sink->threads[0]));
+	if (NULL == sink->threads) {
+		rdlog(LOG_ERR, "Couldn't allocate sink threads (OOM?)");
+		return false;
+	}
+	sink->threads_size = (size_t)threads;
+	sink->healthy = 1;
+
+	return true;
+}
+
+/** Start sink sender and maintenance threads
+  @param sink Sink
+  @return true if success, false in other case
+  */
+static bool sink_start(struct rb_output_sink *sink) {
+	const int maint_rc = pthread_create(
+			&sink->maint_thread, NULL, sink_maintainer, sink);
+	if (0 != maint_rc) {
+		rdlog(LOG_ERR,
+		      "Couldn't create sink %s maintenance thread: %s",
+		      sink->name,
+		      strerror(maint_rc));
+		return false;
+	}
+	sink->maint_running = true;
+
+	for (; sink->threads_count < sink->threads_size;
+	     ++sink->threads_count) {
+		const int rc = pthread_create(
+				&sink->threads[sink->threads_count],
+				NULL,
+				sink_sender,
+				sink);
+		if (0 != rc) {
+			rdlog(LOG_ERR,
+			      "Couldn't create sink %s thread: %s",
+			      sink->name,
+			      strerror(rc));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/** Stop sink sender and maintenance threads, waiting for them to send all
+  queued messages. Spooled messages are kept for the next run.
+  @param sink Sink
+  */
+static void sink_stop(struct rb_output_sink *sink) {
+	static const struct sink_stats no_stats;
+	struct sink_stats stats;
+
+	rb_sink_queue_stop(&sink->queue);
+	for (size_t i = 0; i < sink->threads_count; ++i) {
+		pthread_join(sink->threads[i], NULL);
+	}
+	if (sink->maint_running) {
+		pthread_join(sink->maint_thread, NULL);
+	}
+
+	sink_stats_get(sink, &stats);
+	sink_stats_log(sink, &stats, &no_stats, " in total");
+}
+
+/*
+ * OUTPUT
+ */
+
+struct rb_output {
+	struct rb_output_handlers handlers; ///< Output handlers
+	struct rb_output_sink *sinks;       ///< Sinks
+	size_t sinks_count;		    ///< Length of sinks
+};
+
+/** Default sinks configuration: one for every handler
+  @param handlers Output handlers
+  @return Sinks configuration, or NULL in case of error
+  */
+static json_object *
+output_default_sinks(const struct rb_output_handlers *handlers) {
+	json_object *ret = json_object_new_array();
+	if (NULL == ret) {
+		return NULL;
+	}
+
+	if (handlers->rk) {
+		json_object_array_add(ret,
+				      json_tokener_parse("{\"name\":"
+							 "\"kafka\"}"));
+	}
+	if (handlers->http_handler) {
+		json_object_array_add(
+				ret,
+				json_tokener_parse("{\"name\":\"http\","
+						   "\"type\":\"http\"}"));
+	}
+
+	return ret;
+}
+
+struct rb_output *rb_output_new(json_object *sinks,
+				const struct rb_output_handlers *handlers) {
+	json_object *default_sinks = NULL;
+	struct rb_output *ret = calloc(1, sizeof(*ret));
+	if (NULL == ret) {
+		rdlog(LOG_ERR, "Couldn't allocate output (OOM?)");
+		return NULL;
+	}
+
+	ret->handlers = *handlers;
+	if (NULL == sinks) {
+		sinks = default_sinks = output_default_sinks(handlers);
+		if (NULL == sinks) {
+			rdlog(LOG_ERR, "Couldn't allocate output (OOM?)");
+			goto err;
+		}
+	}
+
+	const size_t sinks_count = (size_t)json_object_array_length(sinks);
+	ret->sinks = calloc(sinks_count, sizeof(ret->sinks[0]));
+	if (sinks_count > 0 && NULL == ret->sinks) {
+		rdlog(LOG_ERR, "Couldn't allocate output sinks (OOM?)");
+		goto err;
+	}
+
+	for (; ret->sinks_count < sinks_count; ++ret->sinks_count) {
+		struct rb_output_sink *sink = &ret->sinks[ret->sinks_count];
+		json_object *sink_json = json_object_array_get_idx(
+				sinks, (int)ret->sinks_count);
+
+		if (!sink_init(sink, sink_json, &ret->handlers) ||
+		    !sink_start(sink)) {
+			ret->sinks_count++; // Release the failed sink too
+			goto err;
+		}
+
+		while (ret->sinks[sink->encoder].format != sink->format ||
+		       ret->sinks[sink->encoder].schema != sink->schema) {
+			sink->encoder++;
+		}
+	}
+
+	if (default_sinks) {
+		json_object_put(default_sinks);
+	}
+
+	return ret;
+
+err:
+	if (default_sinks) {
+		json_object_put(default_sinks);
+	}
+	rb_output_done(ret);
+	return NULL;
+}
+
+void rb_output_send(struct rb_output *output, rb_message_list *msgs) {
+	while (!rb_message_list_empty(msgs)) {
+		rb_message_array_t *json = rb_message_list_first(msgs);
+		rb_message_list_remove(msgs, json);
+
+		// Messages serialized for every sink encoder, if any sink
+		// needs it
+		const size_t encoders = output->sinks_count;
+		rb_message_array_t *formatted[encoders ? encoders : 1];
+		bool serialized[encoders ? encoders : 1];
+		// Messages each encoder could not serialize
+		size_t dropped[encoders ? encoders : 1];
+		memset(formatted, 0, sizeof(formatted));
+		memset(serialized, 0, sizeof(serialized));
+		memset(dropped, 0, sizeof(dropped));
+
+		for (size_t i = 0; json->count > 0 && i < output->sinks_count;
+		     ++i) {
+			struct rb_output_sink *sink = &output->sinks[i];
+			if (!sink_match(sink, json)) {
+				continue;
+			}
+
+			size_t *sink_dropped = &dropped[sink->encoder];
+			if (!serialized[sink->encoder]) {
+				serialized[sink->encoder] = true;
+				const output_serializer serialize =
+						output_formats[sink->format]
+								.serialize;
+				formatted[sink->encoder] =
+						serialize(json,
+							  sink->schema,
+							  sink_dropped);
+				if (NULL == formatted[sink->encoder]) {
+					*sink_dropped = json->count;
+				}
+			}
+
+			rb_message_array_t *sink_msgs =
+					formatted[sink->encoder];
+			if (*sink_dropped > 0) {
+				sink_count(sink,
+					   SINK_COUNTER_DROPPED_SERIALIZATION,
+					   *sink_dropped);
+			}
+			if (NULL == sink_msgs || 0 == sink_msgs->count) {
+				continue;
+			}
+
+			rb_message_array_get(sink_msgs);
+			if (!sink_push(sink, sink_msgs)) {
+				sink_overflow(sink, sink_msgs);
+				rb_message_array_put(sink_msgs);
+			}
+		}
+
+		for (size_t i = 0; i < RD_ARRAYSIZE(formatted); ++i) {
+			if (formatted[i]) {
+				rb_message_array_put(formatted[i]);
+			}
+		}
+		rb_message_array_put(json);
+	}
+}
+
+void rb_output_done(struct rb_output *output) {
+	for (size_t i = 0; i < output->sinks_count; ++i) {
+		sink_stop(&output->sinks[i]);
+	}
+
+	// Delivery reports reference sinks and their spools
+	rd_kafka_t *rk = output->handlers.rk;
+	while (rk && rd_kafka_outq_len(rk) > 0) {
+		rd_kafka_poll(rk, 100);
+	}
+
+	for (size_t i = 0; i < output->sinks_count; ++i) {
+		sink_done(&output->sinks[i]);
+	}
+
+	free(output->sinks);
+	free(output);
+}
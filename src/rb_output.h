@@ -0,0 +1,106 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "rb_message_list.h"
+
+#include <json-c/json.h>
+#include <librdkafka/rdkafka.h>
+
+#include <stdbool.h>
+
+struct rb_avro_schema_store;
+struct rb_http_handler_s;
+
+/** Output stage. Sensors messages are routed to named sinks, every one with
+  its own filters, destination, format and bounded queue, served by its own
+  sender threads. So a slow sink does not stall polling workers. */
+struct rb_output;
+
+/// Kafka messages key
+enum rb_output_kafka_key {
+	RB_OUTPUT_KAFKA_KEY_NONE, ///< No key, messages are spread over partitions
+	RB_OUTPUT_KAFKA_KEY_SENSOR_NAME, ///< Sensor name
+	RB_OUTPUT_KAFKA_KEY_SENSOR_ID,   ///< Sensor id
+	RB_OUTPUT_KAFKA_KEY_MONITOR,     ///< Monitor name
+};
+
+/** Parse a kafka key name
+  @param name Key name (none, sensor_name, sensor_id, monitor)
+  @param key Parsed key
+  @return true if success, false if unknown key
+  */
+bool rb_output_kafka_key_parse(const char *name, enum rb_output_kafka_key *key);
+
+/// Output handlers and defaults, shared by all sinks
+struct rb_output_handlers {
+	rd_kafka_t *rk; ///< Kafka handler, or NULL if no kafka output
+	/// Kafka topics configuration. Every sink uses a copy of it.
+	const rd_kafka_topic_conf_t *rkt_conf;
+	const char *kafka_topic;	  ///< Default sink kafka topic
+	enum rb_output_kafka_key kafka_key; ///< Default kafka key
+	/// HTTP handler, or NULL if no HTTP output
+	struct rb_http_handler_s *http_handler;
+	/// Avro schemas, or NULL if no avro output
+	const struct rb_avro_schema_store *schema_store;
+	/// Directory of sinks spools, or NULL if no sink spools messages
+	const char *spool_dir;
+};
+
+/** Creates and start a new output stage
+  @param sinks Sinks JSON configuration array. If NULL, one sink is created
+  for every handler, with no filters.
+  @param handlers Output handlers. They must be alive until output is done.
+  @return New output, or NULL in case of error
+  */
+struct rb_output *rb_output_new(/* @todo const */ json_object *sinks,
+				const struct rb_output_handlers *handlers);
+
+/** Route messages to all the sinks they pass through. Messages are
+  serialized once per format, and shared between sinks.
+  @param output Output
+  @param msgs Messages to send. It will be empty at return.
+  */
+void rb_output_send(struct rb_output *output, rb_message_list *msgs);
+
+/** Handle a kafka delivery report: failed messages are spooled, and
+  replayed ones are acknowledged to their spool.
+  @param rkmessage Delivered message
+  */
+void rb_output_kafka_delivered(const rd_kafka_message_t *rkmessage);
+
+#ifdef HAVE_RBHTTP
+/** Handle a HTTP delivery report: failed messages are spooled, and sink is
+  marked unhealthy until a message is delivered again.
+  @param opaque Message opaque, the sink that sent it
+  @param delivered Message was delivered
+  @param payload Message payload
+  @param len Payload length
+  */
+void rb_output_http_delivered(void *opaque,
+			      bool delivered,
+			      const char *payload,
+			      size_t len);
+#endif
+
+/** Stop output stage, sending all queued messages, and free it
+  @param output Output
+  */
+void rb_output_done(struct rb_output *output);
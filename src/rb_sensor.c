@@ -23,12 +23,16 @@
 
 #include "rb_json.h"
 
+#include "rb_monitor_template.h"
 #include "rb_sensor_monitor_array.h"
+#include "rb_snmp_plan.h"
 
 #include <librd/rd.h>
 #include <librd/rdfloat.h>
 #include <librd/rdlog.h>
 
+#include <inttypes.h>
+
 static const char SENSOR_NAME_ENRICHMENT_KEY[] = "sensor_name";
 static const char SENSOR_ID_ENRICHMENT_KEY[] = "sensor_id";
 
@@ -42,11 +46,67 @@ struct rb_sensor_s {
 #endif
 
 	struct monitor_snmp_session snmp_sess; ///< SNMP session
+	struct rb_snmp_plan *snmp_plan;	///< SNMP monitors request plan
 	rb_monitors_array_t *monitors;	 ///< Monitors to ask for
 	rb_monitor_value_array_t *last_vals;   ///< Last values
+	/// last_vals pools. Kept values are copied from the current one to the
+	/// other one at the end of every cycle, so they don't fragment.
+	struct {
+		struct rb_arena arenas[2];
+		size_t current; ///< Pool last_vals live in
+	} last_vals_pool;
 	ssize_t **op_vars; ///< Operation variables that needs each monitor
 	json_object *enrichment; ///< Enrichment to use in monitors
 	int refcnt;		 ///< Reference counting
+
+	/// Poll schedule
+	struct {
+		uint64_t interval_ms; ///< Sensor interval, 0 if default one
+		/// Monitor i is due every monitors_every[i] cycles. NULL if all
+		/// monitors are due in every cycle
+		uint64_t *monitors_every;
+		uint64_t cycle; ///< Next cycle number
+	} schedule;
+
+	/// Cycles in flight tracking
+	struct {
+		int state; ///< See sensor_cycle_state
+		/// Overrun policy, see rb_sensor_overrun_policy
+		int policy;
+		uint64_t skipped; ///< Dropped cycles
+		uint64_t late;    ///< Cycles started after they were due
+	} cycle;
+
+	/// Cycle messages batch
+	struct {
+		int mode;	   ///< Batch mode, see rb_message_batch
+		char *shared;      ///< Serialized enrichment, hoisted to header
+		size_t shared_len; ///< Length of shared
+	} batch;
+
+	/// Asynchronous SNMP requests
+	struct {
+		/// Process context with received responses
+		struct process_sensor_monitor_ctx *process_ctx;
+		/// Callback to call when all responses are received
+		void (*ready_cb)(rb_sensor_t *sensor, void *opaque);
+		void *opaque; ///< ready_cb opaque
+		int state;    ///< Async state, see sensor_snmp_async_state
+	} snmp_async;
+};
+
+/// Sensor asynchronous SNMP state
+enum sensor_snmp_async_state {
+	SENSOR_SNMP_ASYNC_IDLE,    ///< No requests in flight
+	SENSOR_SNMP_ASYNC_PENDING, ///< Waiting for responses
+	SENSOR_SNMP_ASYNC_READY,   ///< Responses received, not processed yet
+};
+
+/// Sensor cycle state
+enum sensor_cycle_state {
+	SENSOR_CYCLE_IDLE,	     ///< No cycle in flight
+	SENSOR_CYCLE_INFLIGHT,	 ///< Cycle in flight
+	SENSOR_CYCLE_INFLIGHT_PENDING, ///< Cycle in flight, and one coalesced
 };
 
 #ifdef RB_SENSOR_MAGIC
@@ -160,7 +220,10 @@ sensor_common_attrs_parse_json(rb_sensor_t *sensor,
 
 	json_object_object_get_ex(
 			sensor_info, "enrichment", &sensor->enrichment);
-	if (NULL == sensor->enrichment) {
+	if (sensor->enrichment) {
+		// Sensor can outlive its JSON description
+		json_object_get(sensor->enrichment);
+	} else {
 		sensor->enrichment = json_object_new_object();
 		if (NULL == sensor->enrichment) {
 			rdlog(LOG_CRIT,
@@ -179,6 +242,12 @@ sensor_common_attrs_parse_json(rb_sensor_t *sensor,
 		goto err;
 	}
 
+	sensor->batch.shared = rb_monitor_template_enrichment(
+			sensor->enrichment, &sensor->batch.shared_len);
+	if (NULL == sensor->batch.shared) {
+		goto err;
+	}
+
 	if (NULL != sensor->monitors) {
 		const size_t monitors_count = sensor->monitors->count;
 		sensor->op_vars = get_monitors_dependencies(sensor->monitors);
@@ -218,6 +287,285 @@ static void sensor_set_defaults(rb_sensor_t *sensor) {
 	sensor->magic = RB_SENSOR_MAGIC;
 #endif
 	sensor->refcnt = 1;
+	sensor->cycle.policy = RB_SENSOR_OVERRUN_DEFAULT;
+	sensor->batch.mode = RB_MESSAGE_BATCH_DEFAULT;
+	for (size_t i = 0; i < RD_ARRAYSIZE(sensor->last_vals_pool.arenas);
+	     ++i) {
+		// Usually only a few monitors need to keep their values
+		rb_arena_init(&sensor->last_vals_pool.arenas[i], 4096);
+	}
+}
+
+bool rb_sensor_overrun_policy_parse(const char *name,
+				    enum rb_sensor_overrun_policy *policy) {
+	static const struct {
+		const char *name;
+		enum rb_sensor_overrun_policy policy;
+	} policies[] = {
+			{"skip", RB_SENSOR_OVERRUN_SKIP},
+			{"coalesce", RB_SENSOR_OVERRUN_COALESCE},
+			{"delay", RB_SENSOR_OVERRUN_DELAY},
+	};
+
+	for (size_t i = 0; i < RD_ARRAYSIZE(policies); ++i) {
+		if (0 == strcmp(name, policies[i].name)) {
+			*policy = policies[i].policy;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Parse sensor overrun policy
+  @param sensor Sensor
+  @param sensor_info Sensor JSON
+  */
+static void sensor_parse_overrun_policy(rb_sensor_t *sensor,
+					json_object *sensor_info) {
+	enum rb_sensor_overrun_policy policy;
+	const char *policy_name = PARSE_CJSON_CHILD_STR(
+			sensor_info, "overrun_policy", NULL);
+	if (NULL == policy_name) {
+		return;
+	}
+
+	if (!rb_sensor_overrun_policy_parse(policy_name, &policy)) {
+		rdlog(LOG_WARNING,
+		      "Invalid overrun_policy %s of sensor %s, using default",
+		      policy_name,
+		      rb_sensor_name(sensor));
+		return;
+	}
+
+	sensor->cycle.policy = policy;
+}
+
+/** Parse sensor messages batch mode
+  @param sensor Sensor
+  @param sensor_info Sensor JSON
+  */
+static void sensor_parse_message_batch(rb_sensor_t *sensor,
+				       json_object *sensor_info) {
+	enum rb_message_batch batch;
+	const char *batch_name = PARSE_CJSON_CHILD_STR(
+			sensor_info, "message_batch", NULL);
+	if (NULL == batch_name) {
+		return;
+	}
+
+	if (!rb_message_batch_parse(batch_name, &batch)) {
+		rdlog(LOG_WARNING,
+		      "Invalid message_batch %s of sensor %s, using default",
+		      batch_name,
+		      rb_sensor_name(sensor));
+		return;
+	}
+
+	sensor->batch.mode = batch;
+}
+
+void rb_sensor_batch_messages(rb_sensor_t *sensor,
+			      enum rb_message_batch default_batch,
+			      rb_message_list *msgs) {
+	const enum rb_message_batch batch =
+			sensor->batch.mode == RB_MESSAGE_BATCH_DEFAULT
+					? default_batch
+					: sensor->batch.mode;
+
+	if (batch == RB_MESSAGE_BATCH_NONE) {
+		return;
+	}
+
+	rb_message_array_t *array =
+			rb_message_list_batch(msgs,
+					      batch,
+					      sensor->batch.shared,
+					      sensor->batch.shared_len);
+	if (array) {
+		rb_message_list_push(msgs, array);
+	}
+}
+
+enum rb_sensor_cycle_status
+rb_sensor_cycle_start(rb_sensor_t *sensor,
+		      enum rb_sensor_overrun_policy default_policy) {
+	if (__sync_bool_compare_and_swap(&sensor->cycle.state,
+					 SENSOR_CYCLE_IDLE,
+					 SENSOR_CYCLE_INFLIGHT)) {
+		return RB_SENSOR_CYCLE_STARTED;
+	}
+
+	const enum rb_sensor_overrun_policy policy =
+			sensor->cycle.policy == RB_SENSOR_OVERRUN_DEFAULT
+					? default_policy
+					: sensor->cycle.policy;
+
+	switch (policy) {
+	case RB_SENSOR_OVERRUN_DELAY:
+		return RB_SENSOR_CYCLE_DELAYED;
+
+	case RB_SENSOR_OVERRUN_COALESCE:
+		if (__sync_bool_compare_and_swap(
+				    &sensor->cycle.state,
+				    SENSOR_CYCLE_INFLIGHT,
+				    SENSOR_CYCLE_INFLIGHT_PENDING)) {
+			return RB_SENSOR_CYCLE_COALESCED;
+		}
+		// Already one pending (or just finished), so drop this one
+		break;
+
+	case RB_SENSOR_OVERRUN_SKIP:
+	case RB_SENSOR_OVERRUN_DEFAULT:
+	default:
+		break;
+	};
+
+	const uint64_t skipped =
+			ATOMIC_OP(add, fetch, &sensor->cycle.skipped, 1);
+	rdlog(LOG_WARNING,
+	      "Sensor %s previous cycle still in flight, skipping "
+	      "(%" PRIu64 " skipped cycles)",
+	      rb_sensor_name(sensor),
+	      skipped);
+	return RB_SENSOR_CYCLE_SKIPPED;
+}
+
+void rb_sensor_cycle_late(rb_sensor_t *sensor) {
+	const uint64_t late = ATOMIC_OP(add, fetch, &sensor->cycle.late, 1);
+	rdlog(LOG_WARNING,
+	      "Sensor %s cycle started late (%" PRIu64 " late cycles)",
+	      rb_sensor_name(sensor),
+	      late);
+}
+
+bool rb_sensor_cycle_done(rb_sensor_t *sensor) {
+	if (__sync_bool_compare_and_swap(&sensor->cycle.state,
+					 SENSOR_CYCLE_INFLIGHT_PENDING,
+					 SENSOR_CYCLE_INFLIGHT)) {
+		rb_sensor_cycle_late(sensor);
+		return true;
+	}
+
+	__sync_bool_compare_and_swap(&sensor->cycle.state,
+				     SENSOR_CYCLE_INFLIGHT,
+				     SENSOR_CYCLE_IDLE);
+	return false;
+}
+
+/** Parse sensor poll schedule
+  @param sensor Sensor
+  @param sensor_info Sensor JSON
+  */
+static void sensor_parse_schedule(rb_sensor_t *sensor,
+				  json_object *sensor_info) {
+	const double interval_s =
+			PARSE_CJSON_CHILD_DOUBLE(sensor_info, "interval", 0);
+	if (interval_s < 0) {
+		rdlog(LOG_WARNING,
+		      "Invalid interval %lf of sensor %s, using default one",
+		      interval_s,
+		      rb_sensor_name(sensor));
+	} else if (interval_s > 0) {
+		sensor->schedule.interval_ms =
+				(uint64_t)(interval_s * 1000 + 0.5);
+	}
+}
+
+/** Greatest common divisor
+  @param a First number
+  @param b Second number
+  @return gcd(a, b)
+  */
+static uint64_t gcd_u64(uint64_t a, uint64_t b) {
+	while (b) {
+		const uint64_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/** Round an interval to the nearest multiple of a resolution
+  @param x Interval
+  @param res Resolution
+  @return Rounded interval, at least one resolution unit
+  */
+static uint64_t round_resolution(uint64_t x, uint64_t res) {
+	return x < res ? res : (x + res / 2) / res * res;
+}
+
+uint64_t rb_sensor_poll_period_ms(rb_sensor_t *sensor,
+				  uint64_t default_interval_ms,
+				  uint64_t resolution_ms) {
+	const uint64_t sensor_interval = sensor->schedule.interval_ms
+						 ? sensor->schedule.interval_ms
+						 : default_interval_ms;
+	const size_t monitors_count = sensor->monitors->count;
+	uint64_t period = round_resolution(sensor_interval, resolution_ms);
+	bool all_every_cycle = true;
+
+	for (size_t i = 0; i < monitors_count; ++i) {
+		const uint64_t interval = rb_monitor_interval_ms(
+				rb_monitors_array_elm_at(sensor->monitors, i));
+		if (interval) {
+			period = gcd_u64(period,
+					 round_resolution(interval,
+							  resolution_ms));
+		}
+	}
+
+	free(sensor->schedule.monitors_every);
+	sensor->schedule.monitors_every = calloc(
+			monitors_count, sizeof(sensor->schedule.monitors_every[0]));
+	if (NULL == sensor->schedule.monitors_every) {
+		rdlog(LOG_ERR,
+		      "Couldn't allocate sensor %s schedule, polling all "
+		      "monitors every %" PRIu64 "ms",
+		      rb_sensor_name(sensor),
+		      period);
+		return period;
+	}
+
+	for (size_t i = 0; i < monitors_count; ++i) {
+		const uint64_t interval = rb_monitor_interval_ms(
+				rb_monitors_array_elm_at(sensor->monitors, i));
+		sensor->schedule.monitors_every[i] =
+				round_resolution(interval ? interval
+							  : sensor_interval,
+						 resolution_ms) /
+				period;
+		if (sensor->schedule.monitors_every[i] != 1) {
+			all_every_cycle = false;
+		}
+	}
+
+	if (all_every_cycle) {
+		free(sensor->schedule.monitors_every);
+		sensor->schedule.monitors_every = NULL;
+	}
+
+	return period;
+}
+
+/** Start a new sensor cycle, marking the monitors to process in it
+  @param sensor Sensor
+  @param process_ctx Process context of the cycle
+  */
+static void sensor_new_cycle(rb_sensor_t *sensor,
+			     struct process_sensor_monitor_ctx *process_ctx) {
+	const uint64_t cycle =
+			ATOMIC_OP(fetch, add, &sensor->schedule.cycle, 1);
+	if (NULL == sensor->schedule.monitors_every) {
+		return;
+	}
+
+	const size_t monitors_count = sensor->monitors->count;
+	uint8_t *due = process_sensor_monitor_ctx_due(process_ctx,
+						      monitors_count);
+	for (size_t i = 0; due && i < monitors_count; ++i) {
+		due[i] = 0 == cycle % sensor->schedule.monitors_every[i];
+	}
 }
 
 static bool sensor_parse_snmp(rb_sensor_t *sensor, json_object *sensor_info) {
@@ -269,7 +617,37 @@ static bool sensor_parse_snmp(rb_sensor_t *sensor, json_object *sensor_info) {
 		sess_config.peername = "localhost:161";
 	}
 
-	return new_snmp_session(&sensor->snmp_sess, &sess_config);
+	if (!new_snmp_session(&sensor->snmp_sess, &sess_config)) {
+		return false;
+	}
+
+	const int64_t max_varbinds = PARSE_CJSON_CHILD_INT64(
+			sensor_info,
+			"snmp_max_varbinds",
+			RB_SNMP_PLAN_DEFAULT_MAX_VARBINDS);
+	const int64_t max_pdu_size = PARSE_CJSON_CHILD_INT64(
+			sensor_info,
+			"snmp_max_pdu_size",
+			RB_SNMP_PLAN_DEFAULT_MAX_PDU_SIZE);
+	const int64_t max_repetitions = PARSE_CJSON_CHILD_INT64(
+			sensor_info,
+			"snmp_max_repetitions",
+			RB_SNMP_PLAN_DEFAULT_MAX_REPETITIONS);
+	if (max_varbinds <= 0 || max_pdu_size <= 0 || max_repetitions <= 0) {
+		rdlog(LOG_ERR,
+		      "Invalid snmp_max_varbinds, snmp_max_pdu_size or "
+		      "snmp_max_repetitions in sensor %s",
+		      rb_sensor_name(sensor));
+		return false;
+	}
+
+	const struct rb_snmp_plan_limits plan_limits = {
+			.max_varbinds = (size_t)max_varbinds,
+			.max_pdu_size = (size_t)max_pdu_size,
+			.max_repetitions = (long)max_repetitions,
+	};
+	sensor->snmp_plan = rb_snmp_plan_new(sensor->monitors, &plan_limits);
+	return true;
 }
 
 /// @TODO make sensor_info const
@@ -287,6 +665,10 @@ rb_sensor_t *parse_rb_sensor(/* const */ json_object *sensor_info) {
 		goto sensor_common_attrs_err;
 	}
 
+	sensor_parse_schedule(ret, sensor_info);
+	sensor_parse_overrun_policy(ret, sensor_info);
+	sensor_parse_message_batch(ret, sensor_info);
+
 	const bool snmp_parser_ok = sensor_parse_snmp(ret, sensor_info);
 	if (unlikely(!snmp_parser_ok)) {
 		goto snmp_parse_err;
@@ -300,24 +682,168 @@ sensor_common_attrs_err:
 	return NULL;
 }
 
-/** Process a sensor
+/** All sensor SNMP responses has been received
+  @param vsensor Sensor
+  */
+static void sensor_snmp_async_done(void *vsensor) {
+	rb_sensor_t *sensor = vsensor;
+	sensor->snmp_async.state = SENSOR_SNMP_ASYNC_READY;
+	sensor->snmp_async.ready_cb(sensor, sensor->snmp_async.opaque);
+}
+
+enum rb_sensor_snmp_async_status
+rb_sensor_snmp_async_request(rb_sensor_t *sensor,
+			     struct rb_snmp_engine *engine,
+			     void (*ready_cb)(rb_sensor_t *sensor,
+					      void *opaque),
+			     void *opaque) {
+	if (ATOMIC_OP(add, fetch, &sensor->snmp_async.state, 0) ==
+	    SENSOR_SNMP_ASYNC_READY) {
+		return RB_SENSOR_SNMP_ASYNC_READY;
+	}
+
+	if (NULL == sensor->snmp_plan) {
+		return RB_SENSOR_SNMP_ASYNC_READY;
+	}
+
+	if (!__sync_bool_compare_and_swap(&sensor->snmp_async.state,
+					  SENSOR_SNMP_ASYNC_IDLE,
+					  SENSOR_SNMP_ASYNC_PENDING)) {
+		rdlog(LOG_WARNING,
+		      "Sensor %s SNMP requests still in flight, skipping",
+		      rb_sensor_name(sensor));
+		return RB_SENSOR_SNMP_ASYNC_BUSY;
+	}
+
+	// Context outlives this cycle, so it can't use worker arena
+	struct process_sensor_monitor_ctx *process_ctx =
+			new_process_sensor_monitor_ctx(&sensor->snmp_sess, NULL);
+	if (NULL == process_ctx) {
+		goto ctx_err;
+	}
+
+	const bool async_ok =
+			process_sensor_monitor_ctx_async(process_ctx,
+							 sensor->monitors->count,
+							 sensor_snmp_async_done,
+							 sensor);
+	if (!async_ok) {
+		goto async_err;
+	}
+
+	sensor_new_cycle(sensor, process_ctx);
+
+	sensor->snmp_async.process_ctx = process_ctx;
+	sensor->snmp_async.ready_cb = ready_cb;
+	sensor->snmp_async.opaque = opaque;
+
+	process_sensor_monitor_ctx_snmp_async_request(
+			process_ctx, sensor->snmp_plan, engine);
+	if (process_sensor_monitor_ctx_async_wait(process_ctx)) {
+		/* Don't touch sensor anymore, it can be processed by now */
+		return RB_SENSOR_SNMP_ASYNC_PENDING;
+	}
+
+	sensor->snmp_async.state = SENSOR_SNMP_ASYNC_READY;
+	return RB_SENSOR_SNMP_ASYNC_READY;
+
+async_err:
+	destroy_process_sensor_monitor_ctx(process_ctx);
+ctx_err:
+	/* Fallback to synchronous processing */
+	sensor->snmp_async.state = SENSOR_SNMP_ASYNC_IDLE;
+	return RB_SENSOR_SNMP_ASYNC_READY;
+}
+
+/** Move last values to the spare pool, and release current one
   @param sensor Sensor
-  @param ret Messages returned
-  @return true if OK, false in other case
   */
-bool process_rb_sensor(rb_sensor_t *sensor, rb_message_list *ret) {
-	return process_monitors_array(sensor,
-				      sensor->monitors,
-				      sensor->last_vals,
-				      sensor->op_vars,
-				      ret);
+static void sensor_keep_last_vals(rb_sensor_t *sensor) {
+	const size_t current = sensor->last_vals_pool.current;
+	struct rb_arena *next = &sensor->last_vals_pool.arenas[current ^ 1];
+
+	for (size_t i = 0; i < sensor->last_vals->count; ++i) {
+		if (NULL == sensor->last_vals->elms[i]) {
+			continue;
+		}
+
+		// If copy fails, value will just be sent again
+		sensor->last_vals->elms[i] =
+				monitor_value_copy(next, sensor->last_vals->elms[i]);
+	}
+
+	rb_arena_reset(&sensor->last_vals_pool.arenas[current]);
+	sensor->last_vals_pool.current = current ^ 1;
+}
+
+bool process_rb_sensor(rb_sensor_t *sensor,
+		       struct rb_arena *arena,
+		       rb_message_list *ret) {
+	struct process_sensor_monitor_ctx *process_ctx = NULL;
+	const bool async_ready = ATOMIC_OP(add,
+					   fetch,
+					   &sensor->snmp_async.state,
+					   0) == SENSOR_SNMP_ASYNC_READY;
+
+	if (async_ready) {
+		process_ctx = sensor->snmp_async.process_ctx;
+		sensor->snmp_async.process_ctx = NULL;
+		process_sensor_monitor_ctx_set_arena(process_ctx, arena);
+	} else {
+		process_ctx = new_process_sensor_monitor_ctx(
+				&sensor->snmp_sess, arena);
+		if (NULL == process_ctx) {
+			rb_arena_reset(arena);
+			return false;
+		}
+
+		sensor_new_cycle(sensor, process_ctx);
+		if (sensor->snmp_plan &&
+		    process_sensor_monitor_ctx_snmp_responses(
+				    process_ctx, sensor->monitors->count)) {
+			process_sensor_monitor_ctx_snmp_sync_request(
+					process_ctx, sensor->snmp_plan);
+		}
+	}
+
+	const bool ok = process_monitors_array(process_ctx,
+					       sensor->monitors,
+					       sensor->last_vals,
+					       sensor->op_vars,
+					       ret);
+
+	destroy_process_sensor_monitor_ctx(process_ctx);
+	sensor_keep_last_vals(sensor);
+	rb_arena_reset(arena);
+	if (async_ready) {
+		__sync_bool_compare_and_swap(&sensor->snmp_async.state,
+					     SENSOR_SNMP_ASYNC_READY,
+					     SENSOR_SNMP_ASYNC_IDLE);
+	}
+	return ok;
 }
 
 /** Free allocated memory for sensor
   @param sensor Sensor to free
   */
 static void sensor_done(rb_sensor_t *sensor) {
-	destroy_snmp_session(&sensor->snmp_sess);
+	if (sensor->cycle.skipped || sensor->cycle.late) {
+		rdlog(LOG_INFO,
+		      "Sensor %s had %" PRIu64 " skipped and %" PRIu64
+		      " late cycles",
+		      rb_sensor_name(sensor),
+		      sensor->cycle.skipped,
+		      sensor->cycle.late);
+	}
+	free(sensor->schedule.monitors_every);
+	if (sensor->snmp_async.process_ctx) {
+		destroy_process_sensor_monitor_ctx(
+				sensor->snmp_async.process_ctx);
+	}
+	rb_snmp_plan_done(sensor->snmp_plan);
+	if (sensor->snmp_sess.sessp) {
+		destroy_snmp_session(&sensor->snmp_sess);
+	}
 	if (sensor->op_vars) {
 		free_monitors_dependencies(sensor->op_vars,
 					   sensor->monitors->count);
@@ -325,16 +851,15 @@ static void sensor_done(rb_sensor_t *sensor) {
 	if (sensor->monitors) {
 		rb_monitors_array_done(sensor->monitors);
 	}
-	for (size_t i = 0; sensor->last_vals && i < sensor->last_vals->count;
+	rb_monitor_value_array_done(sensor->last_vals);
+	for (size_t i = 0; i < RD_ARRAYSIZE(sensor->last_vals_pool.arenas);
 	     ++i) {
-		if (sensor->last_vals->elms[i]) {
-			rb_monitor_value_done(sensor->last_vals->elms[i]);
-		}
+		rb_arena_done(&sensor->last_vals_pool.arenas[i]);
 	}
-	rb_monitor_value_array_done(sensor->last_vals);
 	if (sensor->enrichment) {
 		json_object_put(sensor->enrichment);
 	}
+	free(sensor->batch.shared);
 	free(sensor);
 }
 
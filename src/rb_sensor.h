@@ -19,15 +19,18 @@
 
 #pragma once
 
+#include "rb_arena.h"
 #include "rb_array.h"
 #include "rb_message_list.h"
 #include "rb_snmp.h"
+#include "rb_snmp_engine.h"
 
 #include <json-c/json.h>
 #include <librd/rdqueue.h>
 #include <librdkafka/rdkafka.h>
 
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct rb_sensor_s rb_sensor_t;
 
@@ -38,7 +41,121 @@ void assert_rb_sensor(rb_sensor_t *sensor);
 #endif
 
 rb_sensor_t *parse_rb_sensor(/* const */ json_object *sensor_info);
-bool process_rb_sensor(rb_sensor_t *sensor, rb_message_list *ret);
+
+/** Process a sensor cycle
+  @param sensor Sensor
+  @param arena Cycle arena. All cycle temporaries are allocated in it, and it
+  is reset before return.
+  @param ret Messages returned
+  @return true if OK, false in other case
+  */
+bool process_rb_sensor(rb_sensor_t *sensor,
+		       struct rb_arena *arena,
+		       rb_message_list *ret);
+
+/** Pack sensor cycle messages in one message, if sensor batch mode says so
+  @param sensor Sensor
+  @param default_batch Batch mode to use if sensor does not have one
+  @param msgs Cycle messages. If they are packed, it only contains the batch
+  message at return.
+  */
+void rb_sensor_batch_messages(rb_sensor_t *sensor,
+			      enum rb_message_batch default_batch,
+			      rb_message_list *msgs);
+
+/// Sensor asynchronous SNMP request status
+enum rb_sensor_snmp_async_status {
+	/// Sensor can be processed right now with process_rb_sensor
+	RB_SENSOR_SNMP_ASYNC_READY,
+	/// Requests in flight, ready_cb will be called when all are done
+	RB_SENSOR_SNMP_ASYNC_PENDING,
+	/// Previous requests still in flight, skip this sensor round
+	RB_SENSOR_SNMP_ASYNC_BUSY,
+};
+
+/** Asynchronously request all sensor SNMP values through SNMP engine. When
+  sensor is ready, you can process it with process_rb_sensor.
+  @param sensor Sensor
+  @param engine SNMP engine
+  @param ready_cb Callback to call when all responses are received. It is
+  called from SNMP engine thread, so it should not block.
+  @param opaque Opaque to send to ready_cb
+  @return Async request status
+  */
+enum rb_sensor_snmp_async_status
+rb_sensor_snmp_async_request(rb_sensor_t *sensor,
+			     struct rb_snmp_engine *engine,
+			     void (*ready_cb)(rb_sensor_t *sensor,
+					      void *opaque),
+			     void *opaque);
+
+/// What to do when a sensor is due while its previous cycle is in flight
+enum rb_sensor_overrun_policy {
+	/// Use default policy (only valid as a sensor setting)
+	RB_SENSOR_OVERRUN_DEFAULT = -1,
+	/// Drop the new cycle
+	RB_SENSOR_OVERRUN_SKIP,
+	/// Run one more cycle as soon as the in flight one finishes. All cycles
+	/// due meanwhile are merged in it.
+	RB_SENSOR_OVERRUN_COALESCE,
+	/// Start the new cycle when the in flight one finishes, and shift the
+	/// sensor schedule after it
+	RB_SENSOR_OVERRUN_DELAY,
+};
+
+/** Parse an overrun policy name
+  @param name Policy name (skip, coalesce, delay)
+  @param policy Parsed policy
+  @return true if success, false if unknown policy
+  */
+bool rb_sensor_overrun_policy_parse(const char *name,
+				    enum rb_sensor_overrun_policy *policy);
+
+/// Result of trying to start a sensor cycle
+enum rb_sensor_cycle_status {
+	/// Cycle started, you can queue the sensor
+	RB_SENSOR_CYCLE_STARTED,
+	/// Previous cycle in flight, this one is dropped
+	RB_SENSOR_CYCLE_SKIPPED,
+	/// Previous cycle in flight, this one will run when it finishes
+	RB_SENSOR_CYCLE_COALESCED,
+	/// Previous cycle in flight, try to start this one later
+	RB_SENSOR_CYCLE_DELAYED,
+};
+
+/** Try to start a sensor cycle. Only one cycle per sensor can be in flight,
+  so two workers never process the same sensor at the same time.
+  @param sensor Sensor
+  @param default_policy Overrun policy to use if sensor has not its own
+  @return Cycle start status
+  */
+enum rb_sensor_cycle_status
+rb_sensor_cycle_start(rb_sensor_t *sensor,
+		      enum rb_sensor_overrun_policy default_policy);
+
+/** Mark sensor cycle as late, because it has been delayed
+  @param sensor Sensor
+  */
+void rb_sensor_cycle_late(rb_sensor_t *sensor);
+
+/** Finish a sensor cycle
+  @param sensor Sensor
+  @return true if a coalesced cycle is pending. In that case, sensor is still
+  in flight and it has to be processed again.
+  */
+bool rb_sensor_cycle_done(rb_sensor_t *sensor);
+
+/** Prepare sensor poll schedule. Sensor timer period will be the greatest
+  common divisor of sensor and its monitors intervals, and every monitor will
+  be processed only in the cycles its interval has elapsed.
+  @param sensor Sensor
+  @param default_interval_ms Interval of sensors with no interval
+  @param resolution_ms Scheduler resolution. Intervals will be rounded to it.
+  @return Sensor timer period, in milliseconds
+  */
+uint64_t rb_sensor_poll_period_ms(rb_sensor_t *sensor,
+				  uint64_t default_interval_ms,
+				  uint64_t resolution_ms);
 
 /** Obtains sensor name
   @param sensor Sensor
@@ -23,9 +23,16 @@
 
 #include "rb_sensor.h"
 
+#include "poller/proc.h"
 #include "poller/system.h"
+#include "poller/system_cache.h"
+#include "poller/system_stream.h"
+#include "rb_expr.h"
 #include "rb_libmatheval.h"
+#include "rb_monitor_template.h"
+#include "rb_number.h"
 #include "rb_snmp.h"
+#include "rb_snmp_plan.h"
 
 #include "rb_json.h"
 
@@ -34,9 +41,14 @@
 
 #include <math.h>
 #include <matheval.h>
+#include <pthread.h>
+#include <string.h>
 
 static const char DEFAULT_TIMESTAMP_SEP[] = ":";
 
+/// Output decimals if monitor does not set them, as printf "%lf"
+#define RB_MONITOR_DEFAULT_PRECISION 6
+
 /// X-macro to define monitor operations
 /// _X(menum,cmd,value_type,fn)
 #define MONITOR_CMDS_X                                                         \
@@ -45,11 +57,18 @@ static const char DEFAULT_TIMESTAMP_SEP[] = ":";
 	   "system",                                                           \
 	   "system",                                                           \
 	   rb_monitor_get_system_external_value)                               \
+	/* Will read and parse a /proc or /sys file */                         \
+	_X(RB_MONITOR_T__PROC, "proc", "proc", rb_monitor_get_proc_value)      \
 	/* Will ask SNMP server for a given oid */                             \
 	_X(RB_MONITOR_T__OID,                                                  \
 	   "oid",                                                              \
 	   "snmp",                                                             \
 	   rb_monitor_get_snmp_external_value)                                 \
+	/* Will walk a SNMP subtree, returning a vector */                     \
+	_X(RB_MONITOR_T__WALK,                                                 \
+	   "walk",                                                             \
+	   "snmp",                                                             \
+	   rb_monitor_get_snmp_walk_value)                                     \
 	/* Will operate over previous results */                               \
 	_X(RB_MONITOR_T__OP, "op", "op", rb_monitor_get_op_result)
 
@@ -67,13 +86,42 @@ struct rb_monitor_s {
 	  key with value instance-%d */
 	const char *instance_prefix;
 	const char *group_id; ///< Sensor group id
+	int priority;	 ///< Output priority, lowest are dropped first
 	bool send;	    ///< Send the monitor to output or not
 	bool timestamp_given; ///< Timestamp is given in response
 	bool integer;	 ///< Response must be an integer
+	int precision;	///< Output decimals, or RB_NUMBER_PRECISION_SHORTEST
 	const char *splittok; ///< How to split response
 	const char *splitop;  ///< Do a final operation with tokens
 	const char *cmd_arg;  ///< Argument given to command
+	oid *snmp_oid;	 ///< Parsed cmd_arg, if it is a SNMP monitor
+	size_t snmp_oid_len;  ///< snmp_oid length
+	struct rb_monitor_op *op; ///< Compiled operation, if op monitor
+	struct proc_query *proc;  ///< Parsed query, if proc monitor
+	uint64_t interval_ms;     ///< Poll interval, 0 if sensor one
+	uint64_t timeout_ms;      ///< System command timeout
+	uint64_t cache_ttl_ms;    ///< Max age of a shared system command output
+	/// System command output format
+	enum system_output_format system_format;
+	const char *field; ///< Field of structured system output
+	/// Long running command, if streaming system monitor
+	struct system_stream *stream;
 	json_object *enrichment;
+	/// Output message template
+	struct rb_monitor_template *message_template;
+};
+
+/** Compiled operation. Variable i value is taken from monitor dependency i */
+struct rb_monitor_op {
+	/// Vectorized bytecode. If the operation is not supported by it, NULL
+	/// and evaluator is used instead
+	struct rb_expr *expr;
+	void *evaluator; ///< libmatheval evaluator
+	/// Evaluator variables and values. Values are filled in each evaluation
+	struct libmatheval_vars *vars;
+	/// libmatheval evaluator is not thread safe, since it saves variables
+	/// values in its own tree
+	pthread_mutex_t lock;
 };
 
 static const char *rb_monitor_type(const rb_monitor_t *monitor) {
@@ -99,6 +147,11 @@ const json_object *rb_monitor_enrichment(const rb_monitor_t *monitor) {
 	return monitor->enrichment;
 }
 
+const struct rb_monitor_template *
+rb_monitor_message_template(const rb_monitor_t *monitor) {
+	return monitor->message_template;
+}
+
 const char *rb_monitor_instance_prefix(const rb_monitor_t *monitor) {
 	return monitor->instance_prefix;
 }
@@ -119,73 +172,63 @@ bool rb_monitor_is_integer(const rb_monitor_t *monitor) {
 	return monitor->integer;
 }
 
+bool rb_monitor_is_snmp(const rb_monitor_t *monitor) {
+	return monitor->type == RB_MONITOR_T__OID;
+}
+
+bool rb_monitor_is_snmp_walk(const rb_monitor_t *monitor) {
+	return monitor->type == RB_MONITOR_T__WALK;
+}
+
+const oid *rb_monitor_snmp_oid(const rb_monitor_t *monitor, size_t *len) {
+	*len = monitor->snmp_oid_len;
+	return monitor->snmp_oid;
+}
+
+uint64_t rb_monitor_interval_ms(const rb_monitor_t *monitor) {
+	return monitor->interval_ms;
+}
+
 bool rb_monitor_send(const rb_monitor_t *monitor) {
 	return monitor->send;
 }
 
 const char *rb_monitor_get_cmd_data(const rb_monitor_t *monitor) {
-	return monitor->argument;
+	return monitor->cmd_arg;
 }
 
 void rb_monitor_get_op_variables(const rb_monitor_t *monitor,
 				 char ***vars,
 				 size_t *vars_size) {
-	void *evaluator = NULL;
 	(*vars) = NULL;
 	*vars_size = 0;
 
-	struct {
-		char **vars;
-		int count;
-	} all_vars;
-
-	if (monitor->type != RB_MONITOR_T__OP) {
-		goto no_deps;
-	}
-
-	evaluator = evaluator_create((char *)monitor->cmd_arg);
-	if (NULL == evaluator) {
-		rdlog(LOG_ERR,
-		      "Couldn't create an evaluator from %s",
-		      monitor->cmd_arg);
-		goto no_deps;
+	if (NULL == monitor->op || 0 == monitor->op->vars->count) {
+		return;
 	}
 
-	evaluator_get_variables(evaluator, &all_vars.vars, &all_vars.count);
-	(*vars) = malloc((size_t)all_vars.count * sizeof((*vars)[0]));
+	const struct libmatheval_vars *op_vars = monitor->op->vars;
+	(*vars) = malloc(op_vars->count * sizeof((*vars)[0]));
 	if (*vars == NULL) {
 		rdlog(LOG_CRIT,
-		      "Couldn't allocate memory for %d vars",
-		      all_vars.count);
-		goto no_deps;
+		      "Couldn't allocate memory for %zu vars",
+		      op_vars->count);
+		return;
 	}
-	for (int i = 0; i < all_vars.count; ++i) {
-		(*vars)[i] = strdup(all_vars.vars[i]);
+
+	for (size_t i = 0; i < op_vars->count; ++i) {
+		(*vars)[i] = strdup(op_vars->names[i]);
 		if (NULL == (*vars)[i]) {
 			rdlog(LOG_ERR,
 			      "Couldn't strdup %s (OOM?)",
-			      all_vars.vars[i]);
-			for (int j = 0; j < i; ++j) {
-				free((*vars)[j]);
-				(*vars)[j] = NULL;
-			}
-			goto no_deps;
+			      op_vars->names[i]);
+			rb_monitor_free_op_variables(*vars, i);
+			*vars = NULL;
+			return;
 		}
 	}
-	*vars_size = (size_t)all_vars.count;
-	evaluator_destroy(evaluator);
-	return;
-
-no_deps:
-	if (*vars) {
-		free(*vars);
-	}
-	*vars = NULL;
-	*vars_size = 0;
 
-	if (evaluator) {
-		evaluator_destroy(evaluator);
-	}
+	*vars_size = op_vars->count;
 }
 
 void rb_monitor_free_op_variables(char **vars, size_t vars_size) {
@@ -204,6 +247,81 @@ static void free_const_str(const char *str) {
 	free(aux);
 }
 
+/** Free a compiled operation
+  @param op Operation
+  */
+static void rb_monitor_op_done(struct rb_monitor_op *op) {
+	if (op->expr) {
+		rb_expr_done(op->expr);
+	}
+	if (op->evaluator) {
+		evaluator_destroy(op->evaluator);
+	}
+	if (op->vars) {
+		delete_libmatheval_vars(op->vars);
+	}
+	pthread_mutex_destroy(&op->lock);
+	free(op);
+}
+
+/** Compile an operation
+  @param operation Operation string
+  @param monitor_name Monitor name, for logging purposes
+  @return New compiled operation, or NULL if error
+  */
+static struct rb_monitor_op *rb_monitor_op_new(const char *operation,
+					       const char *monitor_name) {
+	struct {
+		char **vars;
+		int count;
+	} all_vars;
+
+	struct rb_monitor_op *ret = calloc(1, sizeof(*ret));
+	if (NULL == ret) {
+		rdlog(LOG_CRIT, "Couldn't allocate monitor operation (OOM?)");
+		return NULL;
+	}
+	pthread_mutex_init(&ret->lock, NULL);
+
+	ret->expr = rb_expr_compile(operation);
+	if (ret->expr) {
+		all_vars.vars = rb_expr_vars_names(ret->expr);
+		all_vars.count = (int)rb_expr_vars_count(ret->expr);
+	} else {
+		// Not supported by bytecode, fallback to libmatheval
+		ret->evaluator = evaluator_create((char *)operation);
+		if (NULL == ret->evaluator) {
+			rdlog(LOG_ERR,
+			      "Couldn't create an evaluator from %s "
+			      "(monitor %s)",
+			      operation,
+			      monitor_name);
+			goto err;
+		}
+
+		evaluator_get_variables(ret->evaluator,
+					&all_vars.vars,
+					&all_vars.count);
+	}
+
+	ret->vars = new_libmatheval_vars((size_t)all_vars.count);
+	if (NULL == ret->vars) {
+		goto err;
+	}
+
+	// Names are owned by expr or evaluator
+	for (int i = 0; i < all_vars.count; ++i) {
+		ret->vars->names[i] = all_vars.vars[i];
+	}
+	ret->vars->count = (size_t)all_vars.count;
+
+	return ret;
+
+err:
+	rb_monitor_op_done(ret);
+	return NULL;
+}
+
 void rb_monitor_done(rb_monitor_t *monitor) {
 	free_const_str(monitor->name);
 	free_const_str(monitor->argument);
@@ -213,9 +331,23 @@ void rb_monitor_done(rb_monitor_t *monitor) {
 	free_const_str(monitor->splittok);
 	free_const_str(monitor->splitop);
 	free_const_str(monitor->cmd_arg);
+	free_const_str(monitor->field);
+	free(monitor->snmp_oid);
+	if (monitor->op) {
+		rb_monitor_op_done(monitor->op);
+	}
+	if (monitor->proc) {
+		proc_query_done(monitor->proc);
+	}
+	if (monitor->stream) {
+		system_stream_done(monitor->stream);
+	}
 	if (monitor->enrichment) {
 		json_object_put(monitor->enrichment);
 	}
+	if (monitor->message_template) {
+		rb_monitor_template_put(monitor->message_template);
+	}
 	free(monitor);
 }
 
@@ -226,7 +358,7 @@ void rb_monitor_done(rb_monitor_t *monitor) {
 static double toDouble(const char *str) {
 	char *endPtr;
 	errno = 0;
-	double d = strtod(str, &endPtr);
+	double d = rb_number_parse(str, &endPtr);
 	return d;
 }
 
@@ -270,6 +402,64 @@ static bool valid_split_op(const char *split_op) {
 	return false;
 }
 
+/** Parse monitor output precision
+  @param json_monitor JSON monitor
+  @param name Monitor name
+  @return Number of decimals, or RB_NUMBER_PRECISION_SHORTEST
+  */
+static int parse_rb_monitor_precision(json_object *json_monitor,
+				      const char *name) {
+	json_object *json_precision = NULL;
+	json_object_object_get_ex(json_monitor, "precision", &json_precision);
+	if (NULL == json_precision) {
+		return RB_MONITOR_DEFAULT_PRECISION;
+	}
+
+	if (json_object_is_type(json_precision, json_type_string) &&
+	    0 == strcmp("shortest", json_object_get_string(json_precision))) {
+		return RB_NUMBER_PRECISION_SHORTEST;
+	}
+
+	const int64_t precision = json_object_get_int64(json_precision);
+	if (!json_object_is_type(json_precision, json_type_int) ||
+	    precision < 0 || precision > RB_NUMBER_PRECISION_MAX) {
+		rdlog(LOG_WARNING,
+		      "Invalid precision %s of monitor %s, using default",
+		      json_object_get_string(json_precision),
+		      name);
+		return RB_MONITOR_DEFAULT_PRECISION;
+	}
+
+	return (int)precision;
+}
+
+/** Resolve monitor OID, so we don't need to do it in every request
+  @param monitor SNMP monitor
+  @return true if OID could be resolved, false in other case
+  */
+static bool parse_rb_monitor_oid(rb_monitor_t *monitor) {
+	oid name[MAX_OID_LEN];
+	size_t name_len = MAX_OID_LEN;
+
+	if (!read_objid(monitor->cmd_arg, name, &name_len)) {
+		rdlog(LOG_ERR,
+		      "Couldn't resolve OID %s of monitor %s, discarding",
+		      monitor->cmd_arg,
+		      monitor->name);
+		return false;
+	}
+
+	monitor->snmp_oid = malloc(name_len * sizeof(name[0]));
+	if (NULL == monitor->snmp_oid) {
+		rdlog(LOG_CRIT, "Couldn't allocate monitor OID (OOM?)");
+		return false;
+	}
+
+	memcpy(monitor->snmp_oid, name, name_len * sizeof(name[0]));
+	monitor->snmp_oid_len = name_len;
+	return true;
+}
+
 /** Parse a JSON monitor
   @param type Type of monitor (oid, system, op...)
   @param cmd_arg Argument of monitor (desired oid, system command, operation...)
@@ -298,6 +488,15 @@ static rb_monitor_t *parse_rb_monitor0(enum monitor_cmd_type type,
 	/// @todo change to true/false
 	int aux_timestamp_given = PARSE_CJSON_CHILD_INT64(
 			json_monitor, "timestamp_given", 0);
+	const double interval_s =
+			PARSE_CJSON_CHILD_DOUBLE(json_monitor, "interval", 0);
+	const double timeout_s = PARSE_CJSON_CHILD_DOUBLE(
+			json_monitor, "timeout", SYSTEM_DEFAULT_TIMEOUT_MS / 1000.);
+	const char *format = PARSE_CJSON_CHILD_STR(json_monitor, "format", NULL);
+	const double cache_ttl_s =
+			PARSE_CJSON_CHILD_DOUBLE(json_monitor, "cache_ttl", 0);
+	int stream = PARSE_CJSON_CHILD_INT64(json_monitor, "stream", 0);
+	enum system_output_format system_format = SYSTEM_OUTPUT_LINE;
 
 	if (aux_split_op && !valid_split_op(aux_split_op)) {
 		rdlog(LOG_WARNING,
@@ -308,6 +507,47 @@ static rb_monitor_t *parse_rb_monitor0(enum monitor_cmd_type type,
 		aux_split_op = NULL;
 	}
 
+	if (interval_s < 0) {
+		rdlog(LOG_WARNING,
+		      "Invalid interval %lf of monitor %s, using sensor one",
+		      interval_s,
+		      aux_name);
+	}
+
+	if (timeout_s <= 0) {
+		rdlog(LOG_WARNING,
+		      "Invalid timeout %lf of monitor %s, using default",
+		      timeout_s,
+		      aux_name);
+	}
+
+	if (cache_ttl_s < 0) {
+		rdlog(LOG_WARNING,
+		      "Invalid cache_ttl %lf of monitor %s, not caching",
+		      cache_ttl_s,
+		      aux_name);
+	}
+
+	if (format && type != RB_MONITOR_T__SYSTEM) {
+		rdlog(LOG_WARNING,
+		      "Output format is only valid in system monitors (%s)",
+		      aux_name);
+	} else if (format &&
+		   !system_output_format_parse(format, &system_format)) {
+		rdlog(LOG_WARNING,
+		      "Invalid output format %s of monitor %s, using line",
+		      format,
+		      aux_name);
+	}
+
+	if (stream && (type != RB_MONITOR_T__SYSTEM ||
+		       system_format != SYSTEM_OUTPUT_LINE)) {
+		rdlog(LOG_WARNING,
+		      "Stream is only valid in line format system monitors (%s)",
+		      aux_name);
+		stream = 0;
+	}
+
 	if (type == RB_MONITOR_T__OP && aux_timestamp_given) {
 		rdlog(LOG_WARNING,
 		      "Can't provide timestamp in op monitor (%s)",
@@ -334,9 +574,21 @@ static rb_monitor_t *parse_rb_monitor0(enum monitor_cmd_type type,
 			json_monitor, "instance_prefix", NULL);
 	ret->group_id = PARSE_CJSON_CHILD_DUP_STR(
 			json_monitor, "group_id", NULL);
+	ret->priority = (int)PARSE_CJSON_CHILD_INT64(
+			json_monitor, "priority", 0);
 	ret->timestamp_given = aux_timestamp_given;
 	ret->send = PARSE_CJSON_CHILD_INT64(json_monitor, "send", 1);
 	ret->integer = PARSE_CJSON_CHILD_INT64(json_monitor, "integer", 0);
+	ret->precision = parse_rb_monitor_precision(json_monitor, aux_name);
+	ret->interval_ms = interval_s > 0 ? (uint64_t)(interval_s * 1000 + 0.5)
+					  : 0;
+	ret->timeout_ms = timeout_s > 0 ? (uint64_t)(timeout_s * 1000 + 0.5)
+					: SYSTEM_DEFAULT_TIMEOUT_MS;
+	ret->cache_ttl_ms = cache_ttl_s > 0
+					    ? (uint64_t)(cache_ttl_s * 1000 + 0.5)
+					    : 0;
+	ret->system_format = system_format;
+	ret->field = PARSE_CJSON_CHILD_DUP_STR(json_monitor, "field", NULL);
 	ret->type = type;
 	ret->cmd_arg = strdup(cmd_arg);
 
@@ -382,6 +634,35 @@ static rb_monitor_t *parse_rb_monitor0(enum monitor_cmd_type type,
 		rdlog(LOG_CRIT, "Couldn't allocate cmd_arg (OOM?)");
 		rb_monitor_done(ret);
 		ret = NULL;
+	} else if ((type == RB_MONITOR_T__OID || type == RB_MONITOR_T__WALK) &&
+		   !parse_rb_monitor_oid(ret)) {
+		rb_monitor_done(ret);
+		ret = NULL;
+	} else if (type == RB_MONITOR_T__OP &&
+		   NULL == (ret->op = rb_monitor_op_new(ret->cmd_arg,
+							ret->name))) {
+		rb_monitor_done(ret);
+		ret = NULL;
+	} else if (type == RB_MONITOR_T__PROC &&
+		   NULL == (ret->proc = proc_query_new(ret->cmd_arg))) {
+		rb_monitor_done(ret);
+		ret = NULL;
+	} else if (stream &&
+		   NULL == (ret->stream = system_stream_new(ret->cmd_arg))) {
+		rb_monitor_done(ret);
+		ret = NULL;
+	} else if (NULL == (ret->message_template = rb_monitor_template_new(
+					    ret->name,
+					    ret->name_split_suffix,
+					    ret->instance_prefix,
+					    ret->group_id,
+					    ret->priority,
+					    ret->integer,
+					    ret->precision,
+					    ret->enrichment,
+					    sensor_enrichment))) {
+		rb_monitor_done(ret);
+		ret = NULL;
 	}
 
 err:
@@ -408,205 +689,1381 @@ parse_rb_monitor(json_object *json_monitor,
 	return NULL;
 }
 
+/** SNMP walk row */
+struct snmp_walk_row {
+	char *instance; ///< OID index, relative to walk root
+	double number;  ///< Numeric value
+};
+
+/** SNMP response of a monitor */
+struct snmp_monitor_response {
+	char *value;    ///< Text value, or NULL if no (valid) response
+	double number;  ///< Numeric value
+	bool number_ok; ///< Numeric value is valid
+
+	/// Walk monitor rows
+	struct {
+		struct snmp_walk_row *rows;
+		size_t count;
+		size_t size;
+	} walk;
+};
+
+/** SNMP plan request sent asynchronously */
+struct snmp_async_pdu {
+	struct process_sensor_monitor_ctx *ctx; ///< Owner context
+	const struct rb_snmp_plan *plan;	///< Plan of the request
+	struct rb_snmp_engine *engine;		///< Engine to send through
+	struct rb_snmp_plan_request *request;   ///< OIDs to request
+};
+
+/** SNMP subtree walk in progress */
+struct snmp_walk {
+	struct process_sensor_monitor_ctx *ctx; ///< Owner context
+	const struct rb_snmp_plan *plan;	///< Plan of the walk
+	const struct rb_snmp_plan_walk *walk;   ///< Subtree to walk
+	struct rb_snmp_engine *engine;		///< Engine, if async
+	oid last[MAX_OID_LEN];			///< Last OID received
+	size_t last_len;			///< last length
+};
+
 /** Context of sensor monitors processing */
 struct process_sensor_monitor_ctx {
 	struct monitor_snmp_session *snmp_sessp; ///< Base SNMP session
+	struct rb_arena *arena; ///< Cycle arena, monitor values live in it
+	bool in_arena;		///< Context itself is allocated in arena
+
+	/// SNMP responses, indexed by monitor position
+	struct snmp_monitor_response *snmp_responses;
+	size_t snmp_responses_count; ///< Length of snmp_responses
+
+	/// Async SNMP requests
+	struct {
+		struct snmp_walk *walks; ///< Walks in progress
+		/// Pending responses + 1 guard, released in async_wait
+		int pending;
+		void (*done_cb)(void *opaque); ///< All responses received
+		void *opaque;		       ///< done_cb opaque
+	} snmp_async;
+
+	size_t monitor_idx; ///< Monitor currently being processed
+
+	/// Monitors to process in this cycle, or NULL if all of them
+	uint8_t *due;
+	size_t due_count; ///< Length of due
+
+	/// Proc files read in this cycle, created by first proc monitor
+	struct proc_snapshot *proc_snapshot;
+
+	/// Structured system commands output of this cycle, so every command is
+	/// executed once no matter how many monitors use it
+	struct {
+		struct system_cycle_output {
+			const char *command; ///< Command executed
+			char *output; ///< Command output, NULL if error
+		} * outputs;
+		size_t count;    ///< Number of outputs
+		size_t capacity; ///< Length of outputs
+	} system;
 };
 
 struct process_sensor_monitor_ctx *
-new_process_sensor_monitor_ctx(struct monitor_snmp_session *snmp_sessp) {
-	struct process_sensor_monitor_ctx *ret = calloc(1, sizeof(*ret));
+new_process_sensor_monitor_ctx(struct monitor_snmp_session *snmp_sessp,
+			       struct rb_arena *arena) {
+	struct process_sensor_monitor_ctx *ret =
+			arena ? rb_arena_calloc(arena, 1, sizeof(*ret))
+			      : calloc(1, sizeof(*ret));
 	if (NULL == ret) {
 		rdlog(LOG_ERR, "Couldn't allocate process sensor monitors ctx");
 	} else {
 		ret->snmp_sessp = snmp_sessp;
+		ret->arena = arena;
+		ret->in_arena = NULL != arena;
 	}
 
 	return ret;
 }
 
-void destroy_process_sensor_monitor_ctx(
-		struct process_sensor_monitor_ctx *ctx) {
-	free(ctx);
+void process_sensor_monitor_ctx_set_arena(
+		struct process_sensor_monitor_ctx *ctx, struct rb_arena *arena) {
+	ctx->arena = arena;
 }
 
-/* FW declaration */
-static struct monitor_value *
-process_novector_monitor(const char *value_buf, double number, time_t now);
-
-static struct monitor_value *process_vector_monitor(const rb_monitor_t *monitor,
-						    const char *value_buf,
-						    time_t now);
+struct rb_arena *
+process_sensor_monitor_ctx_arena(const struct process_sensor_monitor_ctx *ctx) {
+	return ctx->arena;
+}
 
-/** Base function to obtain an external value, and to manage it as a vector or
-  as an integer
-  @param monitor Monitor to process
-  @param get_value_cb Callback to get value
-  @param get_value_cb_ctx Context send to get_value_cb
-  @return Monitor values array
+/** Free process context SNMP responses
+  @param ctx Process context
   */
-static struct monitor_value *
-rb_monitor_get_external_value(const rb_monitor_t *monitor,
-			      bool (*get_value_cb)(char *buf,
-						   size_t bufsiz,
-						   double *number,
-						   void *ctx,
-						   const char *arg),
-			      void *get_value_cb_ctx) {
-	double number = 0;
-	char value_buf[BUFSIZ];
-	value_buf[0] = '\0';
-	struct monitor_value *ret = NULL;
-	const bool ok = get_value_cb(value_buf,
-				     sizeof(value_buf),
-				     &number,
-				     get_value_cb_ctx,
-				     monitor->cmd_arg);
-
-	if (0 == strlen(value_buf)) {
-		rdlog(LOG_WARNING, "Not seeing %s value.", monitor->name);
-		return false;
-	}
-
-	if (!monitor->splittok) {
-		if (!ok) {
-			rdlog(LOG_WARNING,
-			      "Value '%s' of [%s:%s] is not a number",
-			      value_buf,
-			      monitor->cmd_arg,
-			      monitor->name);
-			return false;
+static void process_sensor_monitor_ctx_snmp_responses_done(
+		struct process_sensor_monitor_ctx *ctx) {
+	for (size_t i = 0; i < ctx->snmp_responses_count; ++i) {
+		struct snmp_monitor_response *response =
+				&ctx->snmp_responses[i];
+		free(response->value);
+		for (size_t j = 0; j < response->walk.count; ++j) {
+			free(response->walk.rows[j].instance);
 		}
-		ret = process_novector_monitor(value_buf, number, time(NULL));
-	} else /* We have a vector here */ {
-		ret = process_vector_monitor(monitor, value_buf, time(NULL));
+		free(response->walk.rows);
 	}
-
-	return ret;
-}
-
-/** Convenience function to obtain system values */
-static struct monitor_value *rb_monitor_get_system_external_value(
-		const rb_monitor_t *monitor,
-		struct process_sensor_monitor_ctx *process_ctx,
-		rb_monitor_value_array_t *ops_vars) {
-	(void)process_ctx;
-	(void)ops_vars;
-	return rb_monitor_get_external_value(
-			monitor, system_solve_response, NULL);
+	free(ctx->snmp_responses);
+	ctx->snmp_responses = NULL;
+	ctx->snmp_responses_count = 0;
 }
 
-/** Convenience function */
-static bool snmp_solve_response0(char *value_buf,
-				 size_t value_buf_len,
-				 double *number,
-				 void *session,
-				 const char *oid_string) {
-	return snmp_solve_response(value_buf,
-				   value_buf_len,
-				   number,
-				   (struct monitor_snmp_session *)session,
-				   oid_string);
+void destroy_process_sensor_monitor_ctx(
+		struct process_sensor_monitor_ctx *ctx) {
+	process_sensor_monitor_ctx_snmp_responses_done(ctx);
+	free(ctx->snmp_async.walks);
+	free(ctx->due);
+	if (ctx->proc_snapshot) {
+		proc_snapshot_done(ctx->proc_snapshot);
+	}
+	for (size_t i = 0; i < ctx->system.count; ++i) {
+		free(ctx->system.outputs[i].output);
+	}
+	free(ctx->system.outputs);
+	if (!ctx->in_arena) {
+		free(ctx);
+	}
 }
 
-/** Convenience function to obtain SNMP values */
-static struct monitor_value *rb_monitor_get_snmp_external_value(
-		const rb_monitor_t *monitor,
-		struct process_sensor_monitor_ctx *process_ctx,
-		rb_monitor_value_array_t *op_vars) {
-	(void)op_vars;
-	return rb_monitor_get_external_value(
-			monitor, snmp_solve_response0, process_ctx->snmp_sessp);
-}
+uint8_t *process_sensor_monitor_ctx_due(struct process_sensor_monitor_ctx *ctx,
+					size_t monitors_count) {
+	free(ctx->due);
+	ctx->due_count = 0;
 
-/** Create a libmatheval vars using op_vars */
-static struct libmatheval_vars *
-op_libmatheval_vars(rb_monitor_value_array_t *op_vars, char **names) {
-	struct libmatheval_vars *libmatheval_vars =
-			new_libmatheval_vars(op_vars->count);
-	size_t expected_v_elms = 0;
-	if (NULL == libmatheval_vars) {
-		/// @todo error treatment
+	ctx->due = malloc(monitors_count * sizeof(ctx->due[0]));
+	if (NULL == ctx->due) {
+		rdlog(LOG_ERR, "Couldn't allocate monitors due mask (OOM?)");
 		return NULL;
 	}
 
-	for (size_t i = 0; i < op_vars->count; ++i) {
-		assert(rb_monitor_value_array_at(op_vars, 0)->type ==
-		       rb_monitor_value_array_at(op_vars, i)->type);
+	memset(ctx->due, 1, monitors_count * sizeof(ctx->due[0]));
+	ctx->due_count = monitors_count;
+	return ctx->due;
+}
 
-		struct monitor_value *mv =
-				rb_monitor_value_array_at(op_vars, i);
+bool process_sensor_monitor_ctx_monitor_due(
+		const struct process_sensor_monitor_ctx *ctx,
+		size_t monitor_idx) {
+	return monitor_idx >= ctx->due_count || ctx->due[monitor_idx];
+}
 
-		if (mv) {
-			libmatheval_vars->names[i] = names[i];
-
-			if (0 == libmatheval_vars->count) {
-				if (MONITOR_VALUE_T__ARRAY == mv->type) {
-					expected_v_elms =
-							mv->array.children_count;
-				}
-			} else if (mv->type == MONITOR_VALUE_T__ARRAY &&
-				   mv->array.children_count !=
-						   expected_v_elms) {
-				rdlog(LOG_ERR,
-				      "trying to operate on vectors of "
-				      "different size:"
-				      "[(previous size):%zu] != [%s:%zu]",
-				      expected_v_elms,
-				      names[i],
-				      mv->array.children_count);
-				goto err;
+/** Checks if any monitor that needs a plan PDU is due in this cycle
+  @param ctx Process context
+  @param plan Plan
+  @param pdu_idx PDU index in plan
+  @return true if we need to send the PDU
+  */
+static bool snmp_plan_pdu_due(const struct process_sensor_monitor_ctx *ctx,
+			      const struct rb_snmp_plan *plan,
+			      size_t pdu_idx) {
+	const struct rb_snmp_plan_pdu *pdu = &plan->pdus[pdu_idx];
+
+	for (size_t i = pdu->first_oid; i < pdu->first_oid + pdu->oids_count;
+	     ++i) {
+		const struct rb_snmp_plan_oid *plan_oid = &plan->oids[i];
+		for (size_t j = 0; j < plan_oid->monitors_count; ++j) {
+			if (process_sensor_monitor_ctx_monitor_due(
+					    ctx, plan_oid->monitors[j])) {
+				return true;
 			}
-
-			libmatheval_vars->count++;
 		}
 	}
 
-	return libmatheval_vars;
-err:
-	delete_libmatheval_vars(libmatheval_vars);
-	return NULL;
+	return false;
 }
 
-/** Do a monitor operation
-  @param f evaluator
-  @param libmatheval_vars prepared libmathevals with names and values
-  @param monitor Monitor operation belongs
-  @param now This time
-  @return New monitor value
-  */
-static struct monitor_value *
-rb_monitor_op_value0(void *f,
-		     struct libmatheval_vars *libmatheval_vars,
-		     const rb_monitor_t *monitor,
-		     const time_t now) {
+bool process_sensor_monitor_ctx_snmp_responses(
+		struct process_sensor_monitor_ctx *ctx, size_t monitors_count) {
+	process_sensor_monitor_ctx_snmp_responses_done(ctx);
 
-	const char *operation = monitor->cmd_arg;
-	const double number = evaluator_evaluate(f,
-						 libmatheval_vars->count,
-						 libmatheval_vars->names,
-						 libmatheval_vars->values);
+	ctx->snmp_responses =
+			calloc(monitors_count, sizeof(ctx->snmp_responses[0]));
+	if (NULL == ctx->snmp_responses) {
+		rdlog(LOG_ERR, "Couldn't allocate SNMP responses");
+		return false;
+	}
 
-	rdlog(LOG_DEBUG,
-	      "Result of operation [%s]: %lf",
-	      monitor->cmd_arg,
-	      number);
+	ctx->snmp_responses_count = monitors_count;
+	return true;
+}
 
-	if (!isnormal(number)) {
-		rdlog(LOG_ERR,
-		      "OP %s return a bad value: %lf. Skipping.",
-		      operation,
-		      number);
-		return NULL;
-	}
+bool process_sensor_monitor_ctx_async(struct process_sensor_monitor_ctx *ctx,
+				      size_t monitors_count,
+				      void (*done_cb)(void *opaque),
+				      void *opaque) {
+	assert(ctx);
+	assert(done_cb);
 
-	char val_buf[64];
-	sprintf(val_buf, "%lf", number);
+	if (!process_sensor_monitor_ctx_snmp_responses(ctx, monitors_count)) {
+		return false;
+	}
 
-	return process_novector_monitor(val_buf, number, now);
+	ctx->snmp_async.done_cb = done_cb;
+	ctx->snmp_async.opaque = opaque;
+	ctx->snmp_async.pending = 1; /* Guard */
+	return true;
+}
+
+/** Decrement async pending responses, and notify if all of them are done
+  @param ctx Process context
+  @return true if we were the last pending response
+  */
+static bool process_sensor_monitor_ctx_async_dec(
+		struct process_sensor_monitor_ctx *ctx) {
+	return 0 == ATOMIC_OP(sub, fetch, &ctx->snmp_async.pending, 1);
+}
+
+bool process_sensor_monitor_ctx_async_wait(
+		struct process_sensor_monitor_ctx *ctx) {
+	return !process_sensor_monitor_ctx_async_dec(ctx);
+}
+
+/** Save a SNMP response variable in monitor response slot
+  @param monitor_idx Monitor index
+  @param var Response variable
+  @param vctx Process context
+  */
+static void snmp_monitor_response_save(size_t monitor_idx,
+				       const netsnmp_variable_list *var,
+				       void *vctx) {
+	struct process_sensor_monitor_ctx *ctx = vctx;
+	struct snmp_monitor_response *response;
+	char value_buf[BUFSIZ];
+	value_buf[0] = '\0';
+
+	assert(monitor_idx < ctx->snmp_responses_count);
+	response = &ctx->snmp_responses[monitor_idx];
+	response->number_ok = snmp_variable_value(
+			value_buf, sizeof(value_buf), &response->number, var);
+	response->value = strdup(value_buf);
+}
+
+/** Log an SNMP engine request error
+  @param status Request status
+  */
+static void snmp_async_error_log(int status) {
+	if (status == RB_SNMP_ENGINE_STAT_CANCELLED) {
+		// Engine stopping, not an error
+		rdlog(LOG_DEBUG, "Snmp request cancelled");
+		return;
+	}
+
+	rdlog(LOG_ERR,
+	      "Snmp error: %s",
+	      status == STAT_TIMEOUT ? "Timeout" : "Error");
+}
+
+/** Free an async plan request
+  @param async_pdu Async request
+  */
+static void snmp_async_pdu_done(struct snmp_async_pdu *async_pdu) {
+	free(async_pdu->request);
+	free(async_pdu);
+}
+
+/** Creates an async plan request
+  @param ctx Process context
+  @param plan Plan
+  @param engine Engine to send request through
+  @param request OIDs to request. Async request takes ownership
+  @return New async request, or NULL in case of error
+  */
+static struct snmp_async_pdu *
+snmp_async_pdu_new(struct process_sensor_monitor_ctx *ctx,
+		   const struct rb_snmp_plan *plan,
+		   struct rb_snmp_engine *engine,
+		   struct rb_snmp_plan_request *request) {
+	struct snmp_async_pdu *ret = malloc(sizeof(*ret));
+	if (NULL == ret) {
+		rdlog(LOG_ERR, "Couldn't allocate SNMP async PDU (OOM?)");
+		free(request);
+		return NULL;
+	}
+
+	ret->ctx = ctx;
+	ret->plan = plan;
+	ret->engine = engine;
+	ret->request = request;
+	return ret;
+}
+
+static void snmp_async_pdu_cb(int status,
+			      struct snmp_pdu *response,
+			      void *opaque);
+
+/** Send an async plan request. It is freed if it can't be sent.
+  @param async_pdu Async request
+  @return true if sent
+  */
+static bool snmp_async_pdu_send(struct snmp_async_pdu *async_pdu) {
+	struct snmp_pdu *pdu =
+			rb_snmp_plan_pdu(async_pdu->plan, async_pdu->request);
+	if (NULL == pdu || !rb_snmp_engine_send(async_pdu->engine,
+						async_pdu->ctx->snmp_sessp,
+						pdu,
+						snmp_async_pdu_cb,
+						async_pdu)) {
+		snmp_async_pdu_done(async_pdu);
+		return false;
+	}
+
+	return true;
+}
+
+/** Send the second half of a too big async request
+  @param async_pdu Async request to split. It keeps the first half
+  @return false if request could not be split
+  */
+static bool snmp_async_pdu_split(struct snmp_async_pdu *async_pdu) {
+	struct process_sensor_monitor_ctx *ctx = async_pdu->ctx;
+	struct rb_snmp_plan_request *request =
+			rb_snmp_plan_request_split(async_pdu->request);
+	if (NULL == request) {
+		return false;
+	}
+
+	struct snmp_async_pdu *second_half = snmp_async_pdu_new(
+			ctx, async_pdu->plan, async_pdu->engine, request);
+	if (NULL == second_half) {
+		return true;
+	}
+
+	// Current request pending count is still held, so this can't be the
+	// last one
+	ATOMIC_OP(add, fetch, &ctx->snmp_async.pending, 1);
+	if (!snmp_async_pdu_send(second_half)) {
+		process_sensor_monitor_ctx_async_dec(ctx);
+	}
+
+	return true;
+}
+
+/** SNMP engine callback. Save response in process context slots, and send
+  again the request if agent asks for it */
+static void snmp_async_pdu_cb(int status,
+			      struct snmp_pdu *response,
+			      void *opaque) {
+	struct snmp_async_pdu *async_pdu = opaque;
+	struct process_sensor_monitor_ctx *ctx = async_pdu->ctx;
+	enum rb_snmp_plan_dispatch_rc rc = RB_SNMP_PLAN_DISPATCH_DONE;
+
+	if (status != STAT_SUCCESS || NULL == response) {
+		snmp_async_error_log(status);
+	} else {
+		rc = rb_snmp_plan_dispatch(async_pdu->plan,
+					   async_pdu->request,
+					   response,
+					   snmp_monitor_response_save,
+					   ctx);
+	}
+
+	if (rc == RB_SNMP_PLAN_DISPATCH_SPLIT &&
+	    !snmp_async_pdu_split(async_pdu)) {
+		rc = RB_SNMP_PLAN_DISPATCH_DONE;
+	}
+
+	if (rc == RB_SNMP_PLAN_DISPATCH_DONE) {
+		snmp_async_pdu_done(async_pdu);
+	} else if (snmp_async_pdu_send(async_pdu)) {
+		// Pending count is kept for the new request
+		return;
+	}
+
+	if (process_sensor_monitor_ctx_async_dec(ctx)) {
+		ctx->snmp_async.done_cb(ctx->snmp_async.opaque);
+	}
+}
+
+/** Save a walk row in monitor response slot
+  @param response Monitor response slot
+  @param walk Walk the row belongs
+  @param var Row variable
+  */
+static void snmp_walk_row_save(struct snmp_monitor_response *response,
+			       const struct rb_snmp_plan_walk *walk,
+			       const netsnmp_variable_list *var) {
+	char instance[MAX_OID_LEN * 11];
+	size_t instance_len = 0;
+	double number = 0;
+
+	if (!snmp_variable_number(&number, var)) {
+		rdlog(LOG_DEBUG,
+		      "Not numeric variable type %d in SNMP walk",
+		      var->type);
+		return;
+	}
+
+	instance[0] = '\0';
+	for (size_t i = walk->root_len; i < var->name_length; ++i) {
+		const int print_rc = snprintf(&instance[instance_len],
+					      sizeof(instance) - instance_len,
+					      "%s%lu",
+					      i == walk->root_len ? "" : ".",
+					      (unsigned long)var->name[i]);
+		if (print_rc < 0 ||
+		    (size_t)print_rc >= sizeof(instance) - instance_len) {
+			break;
+		}
+		instance_len += (size_t)print_rc;
+	}
+
+	if (response->walk.count == response->walk.size) {
+		const size_t new_size = response->walk.size
+						? 2 * response->walk.size
+						: 16;
+		struct snmp_walk_row *rows =
+				realloc(response->walk.rows,
+					new_size * sizeof(rows[0]));
+		if (NULL == rows) {
+			rdlog(LOG_ERR, "Couldn't allocate SNMP walk row (OOM?)");
+			return;
+		}
+
+		response->walk.rows = rows;
+		response->walk.size = new_size;
+	}
+
+	struct snmp_walk_row *row = &response->walk.rows[response->walk.count];
+	row->instance = strdup(instance);
+	if (NULL == row->instance) {
+		rdlog(LOG_ERR, "Couldn't allocate SNMP walk row (OOM?)");
+		return;
+	}
+	row->number = number;
+	response->walk.count++;
+}
+
+/** Process a walk response
+  @param walk Walk in progress
+  @param response Walk request response
+  @return true if walk has to continue, false if it is done
+  */
+static bool snmp_walk_response(struct snmp_walk *walk,
+			       const struct snmp_pdu *response) {
+	struct snmp_monitor_response *monitor_response =
+			&walk->ctx->snmp_responses[walk->walk->monitor_idx];
+	const netsnmp_variable_list *var = NULL;
+
+	if (response->errstat != SNMP_ERR_NOERROR) {
+		// SNMPv1 agents ends GETNEXT walks with noSuchName
+		rdlog(LOG_DEBUG,
+		      "SNMP walk finished with error: %s",
+		      snmp_errstring((int)response->errstat));
+		return false;
+	}
+
+	if (NULL == response->variables) {
+		return false;
+	}
+
+	for (var = response->variables; var; var = var->next_variable) {
+		if (!rb_snmp_plan_walk_in_subtree(walk->walk, var)) {
+			return false;
+		}
+
+		// Agent must return increasing OIDs, or we could loop forever
+		if (snmp_oid_compare(var->name,
+				     var->name_length,
+				     walk->last,
+				     walk->last_len) <= 0) {
+			rdlog(LOG_ERR, "SNMP agent returned a non increasing OID");
+			return false;
+		}
+
+		snmp_walk_row_save(monitor_response, walk->walk, var);
+		memcpy(walk->last, var->name, var->name_length * sizeof(oid));
+		walk->last_len = var->name_length;
+	}
+
+	return true;
+}
+
+/** Creates the next walk request PDU
+  @param walk Walk in progress
+  @return New PDU, or NULL in case of error
+  */
+static struct snmp_pdu *snmp_walk_next_pdu(const struct snmp_walk *walk) {
+	const netsnmp_session *session =
+			snmp_sess_session(walk->ctx->snmp_sessp->sessp);
+	return rb_snmp_plan_walk_pdu(walk->plan,
+				     session->version,
+				     walk->last,
+				     walk->last_len);
+}
+
+/** Initialize a walk
+  @param walk Walk to initialize
+  @param ctx Process context
+  @param plan Plan
+  @param plan_walk Plan walk
+  @param engine Engine, if async
+  */
+static void snmp_walk_init(struct snmp_walk *walk,
+			   struct process_sensor_monitor_ctx *ctx,
+			   const struct rb_snmp_plan *plan,
+			   const struct rb_snmp_plan_walk *plan_walk,
+			   struct rb_snmp_engine *engine) {
+	walk->ctx = ctx;
+	walk->plan = plan;
+	walk->walk = plan_walk;
+	walk->engine = engine;
+	memcpy(walk->last, plan_walk->root, plan_walk->root_len * sizeof(oid));
+	walk->last_len = plan_walk->root_len;
+}
+
+/** Send next walk request through engine
+  @param walk Walk in progress
+  @return true if request was sent
+  */
+static bool snmp_walk_async_send(struct snmp_walk *walk);
+
+/** SNMP engine walk callback. Save rows, and ask for next ones */
+static void snmp_walk_async_cb(int status,
+			       struct snmp_pdu *response,
+			       void *opaque) {
+	struct snmp_walk *walk = opaque;
+	struct process_sensor_monitor_ctx *ctx = walk->ctx;
+
+	if (status != STAT_SUCCESS || NULL == response) {
+		snmp_async_error_log(status);
+	} else if (snmp_walk_response(walk, response) &&
+		   snmp_walk_async_send(walk)) {
+		// Pending count is kept for the next request
+		return;
+	}
+
+	if (process_sensor_monitor_ctx_async_dec(ctx)) {
+		ctx->snmp_async.done_cb(ctx->snmp_async.opaque);
+	}
+}
+
+static bool snmp_walk_async_send(struct snmp_walk *walk) {
+	struct snmp_pdu *pdu = snmp_walk_next_pdu(walk);
+	if (NULL == pdu) {
+		return false;
+	}
+
+	return rb_snmp_engine_send(walk->engine,
+				   walk->ctx->snmp_sessp,
+				   pdu,
+				   snmp_walk_async_cb,
+				   walk);
+}
+
+size_t process_sensor_monitor_ctx_snmp_async_request(
+		struct process_sensor_monitor_ctx *ctx,
+		const struct rb_snmp_plan *plan,
+		struct rb_snmp_engine *engine) {
+	size_t ret = 0;
+
+	for (size_t i = 0; i < plan->pdus_count; ++i) {
+		if (!snmp_plan_pdu_due(ctx, plan, i)) {
+			continue;
+		}
+
+		struct rb_snmp_plan_request *request =
+				rb_snmp_plan_request_new(plan, i);
+		if (NULL == request) {
+			continue;
+		}
+
+		struct snmp_async_pdu *async_pdu =
+				snmp_async_pdu_new(ctx, plan, engine, request);
+		if (NULL == async_pdu) {
+			continue;
+		}
+
+		ATOMIC_OP(add, fetch, &ctx->snmp_async.pending, 1);
+		if (snmp_async_pdu_send(async_pdu)) {
+			ret++;
+		} else {
+			/* Guard is still held, so this can't be the last one */
+			process_sensor_monitor_ctx_async_dec(ctx);
+		}
+	}
+
+	free(ctx->snmp_async.walks);
+	ctx->snmp_async.walks = calloc(plan->walks_count,
+				       sizeof(ctx->snmp_async.walks[0]));
+	if (NULL == ctx->snmp_async.walks && plan->walks_count > 0) {
+		rdlog(LOG_ERR, "Couldn't allocate SNMP async walks (OOM?)");
+		return ret;
+	}
+
+	for (size_t i = 0; i < plan->walks_count; ++i) {
+		struct snmp_walk *walk = &ctx->snmp_async.walks[i];
+		if (!process_sensor_monitor_ctx_monitor_due(
+				    ctx, plan->walks[i].monitor_idx)) {
+			continue;
+		}
+
+		snmp_walk_init(walk, ctx, plan, &plan->walks[i], engine);
+
+		ATOMIC_OP(add, fetch, &ctx->snmp_async.pending, 1);
+		if (snmp_walk_async_send(walk)) {
+			ret++;
+		} else {
+			process_sensor_monitor_ctx_async_dec(ctx);
+		}
+	}
+
+	return ret;
+}
+
+/** Send a plan request synchronously, and save responses in process context
+  slots. Request is sent again, or split, if agent asks for it.
+  @param ctx Process context
+  @param plan Plan
+  @param request Request to send
+  */
+static void snmp_plan_sync_request(struct process_sensor_monitor_ctx *ctx,
+				   const struct rb_snmp_plan *plan,
+				   struct rb_snmp_plan_request *request) {
+	enum rb_snmp_plan_dispatch_rc rc = RB_SNMP_PLAN_DISPATCH_RETRY;
+
+	while (rc != RB_SNMP_PLAN_DISPATCH_DONE) {
+		struct snmp_pdu *response = NULL;
+		struct snmp_pdu *pdu = rb_snmp_plan_pdu(plan, request);
+		if (NULL == pdu) {
+			return;
+		}
+
+		rc = RB_SNMP_PLAN_DISPATCH_DONE;
+		const int status = snmp_sess_synch_response(
+				ctx->snmp_sessp->sessp, pdu, &response);
+		if (status != STAT_SUCCESS || NULL == response) {
+			const netsnmp_session *session =
+					snmp_sess_session(ctx->snmp_sessp->sessp);
+			rdlog(LOG_ERR,
+			      "Snmp error: %s",
+			      snmp_api_errstring(session->s_snmp_errno));
+		} else {
+			rc = rb_snmp_plan_dispatch(plan,
+						   request,
+						   response,
+						   snmp_monitor_response_save,
+						   ctx);
+		}
+
+		if (response) {
+			snmp_free_pdu(response);
+		}
+
+		if (rc == RB_SNMP_PLAN_DISPATCH_SPLIT) {
+			struct rb_snmp_plan_request *second_half =
+					rb_snmp_plan_request_split(request);
+			if (NULL == second_half) {
+				return;
+			}
+
+			snmp_plan_sync_request(ctx, plan, second_half);
+			free(second_half);
+		}
+	}
+}
+
+void process_sensor_monitor_ctx_snmp_sync_request(
+		struct process_sensor_monitor_ctx *ctx,
+		const struct rb_snmp_plan *plan) {
+	for (size_t i = 0; i < plan->pdus_count; ++i) {
+		if (!snmp_plan_pdu_due(ctx, plan, i)) {
+			continue;
+		}
+
+		struct rb_snmp_plan_request *request =
+				rb_snmp_plan_request_new(plan, i);
+		if (NULL == request) {
+			continue;
+		}
+
+		snmp_plan_sync_request(ctx, plan, request);
+		free(request);
+	}
+
+	for (size_t i = 0; i < plan->walks_count; ++i) {
+		struct snmp_walk walk;
+		bool keep_walking = true;
+
+		if (!process_sensor_monitor_ctx_monitor_due(
+				    ctx, plan->walks[i].monitor_idx)) {
+			continue;
+		}
+
+		snmp_walk_init(&walk, ctx, plan, &plan->walks[i], NULL);
+		while (keep_walking) {
+			struct snmp_pdu *response = NULL;
+			struct snmp_pdu *pdu = snmp_walk_next_pdu(&walk);
+			if (NULL == pdu) {
+				break;
+			}
+
+			const int status = snmp_sess_synch_response(
+					ctx->snmp_sessp->sessp, pdu, &response);
+			if (status != STAT_SUCCESS) {
+				rdlog(LOG_ERR,
+				      "Snmp error walking monitor %zu",
+				      plan->walks[i].monitor_idx);
+			}
+			keep_walking = status == STAT_SUCCESS && response &&
+				       snmp_walk_response(&walk, response);
+
+			if (response) {
+				snmp_free_pdu(response);
+			}
+		}
+	}
+}
+
+/* FW declaration */
+static struct monitor_value *process_novector_monitor(struct rb_arena *arena,
+						      double number,
+						      time_t now);
+
+static struct monitor_value *process_vector_monitor(struct rb_arena *arena,
+						    const rb_monitor_t *monitor,
+						    const char *value_buf,
+						    time_t now);
+
+/** Do the vector split operation over valid children, if monitor has one
+  @param arena Arena to allocate result from
+  @param monitor Monitor
+  @param mv Monitor value array
+  @param now This time
+  */
+static void monitor_value_array_split_op(struct rb_arena *arena,
+					 const rb_monitor_t *monitor,
+					 struct monitor_value *mv,
+					 time_t now) {
+	double sum = 0;
+	size_t count = 0;
+
+	if (NULL == monitor->splitop) {
+		return;
+	}
+
+	for (size_t i = 0; i < mv->array.children_count; ++i) {
+		if (monitor_value_array_valid(mv, i)) {
+			sum += mv->array.values[i];
+			count++;
+		}
+	}
+
+	if (0 == count) {
+		return;
+	}
+
+	const double result =
+			0 == strcmp("sum", monitor->splitop) ? sum : sum / count;
+	mv->array.split_op_result = process_novector_monitor(arena, result, now);
+}
+
+/** Base function to obtain an external value, and to manage it as a vector or
+  as an integer
+  @param monitor Monitor to process
+  @param arena Arena to allocate values from
+  @param get_value_cb Callback to get value
+  @param get_value_cb_ctx Context send to get_value_cb
+  @return Monitor values array
+  */
+static struct monitor_value *
+rb_monitor_get_external_value(const rb_monitor_t *monitor,
+			      struct rb_arena *arena,
+			      bool (*get_value_cb)(char *buf,
+						   size_t bufsiz,
+						   double *number,
+						   void *ctx,
+						   const char *arg),
+			      void *get_value_cb_ctx) {
+	double number = 0;
+	char value_buf[BUFSIZ];
+	value_buf[0] = '\0';
+	struct monitor_value *ret = NULL;
+	const bool ok = get_value_cb(value_buf,
+				     sizeof(value_buf),
+				     &number,
+				     get_value_cb_ctx,
+				     monitor->cmd_arg);
+
+	if (0 == strlen(value_buf)) {
+		rdlog(LOG_WARNING, "Not seeing %s value.", monitor->name);
+		return false;
+	}
+
+	if (!monitor->splittok) {
+		if (!ok) {
+			rdlog(LOG_WARNING,
+			      "Value '%s' of [%s:%s] is not a number",
+			      value_buf,
+			      monitor->cmd_arg,
+			      monitor->name);
+			return false;
+		}
+		ret = process_novector_monitor(arena, number, time(NULL));
+	} else /* We have a vector here */ {
+		ret = process_vector_monitor(
+				arena, monitor, value_buf, time(NULL));
+	}
+
+	return ret;
+}
+
+/// Synchronous SNMP request parameters
+struct snmp_solve_response_params {
+	struct monitor_snmp_session *session; ///< Session to ask through
+	const rb_monitor_t *monitor;	  ///< Monitor to ask for
+};
+
+/** Convenience function */
+static bool snmp_solve_response0(char *value_buf,
+				 size_t value_buf_len,
+				 double *number,
+				 void *vparams,
+				 const char *oid_string) {
+	const struct snmp_solve_response_params *params = vparams;
+	(void)oid_string;
+	return snmp_solve_response(value_buf,
+				   value_buf_len,
+				   number,
+				   params->session,
+				   params->monitor->snmp_oid,
+				   params->monitor->snmp_oid_len);
+}
+
+/** Convenience function to obtain already received SNMP values */
+static bool snmp_received_solve_response0(char *value_buf,
+					  size_t value_buf_len,
+					  double *number,
+					  void *vresponse,
+					  const char *oid_string) {
+	const struct snmp_monitor_response *response = vresponse;
+	(void)oid_string;
+
+	if (NULL == response->value) {
+		return false;
+	}
+
+	snprintf(value_buf, value_buf_len, "%s", response->value);
+	*number = response->number;
+	return response->number_ok;
+}
+
+/** Convenience function to obtain SNMP values */
+static struct monitor_value *rb_monitor_get_snmp_external_value(
+		const rb_monitor_t *monitor,
+		struct process_sensor_monitor_ctx *process_ctx,
+		rb_monitor_value_array_t *op_vars) {
+	(void)op_vars;
+	if (process_ctx->monitor_idx < process_ctx->snmp_responses_count) {
+		return rb_monitor_get_external_value(
+				monitor,
+				process_ctx->arena,
+				snmp_received_solve_response0,
+				&process_ctx->snmp_responses
+						 [process_ctx->monitor_idx]);
+	}
+
+	struct snmp_solve_response_params params = {
+			.session = process_ctx->snmp_sessp, .monitor = monitor,
+	};
+	return rb_monitor_get_external_value(monitor,
+					     process_ctx->arena,
+					     snmp_solve_response0,
+					     &params);
+}
+
+/** Obtain SNMP walk values as a vector, directly from received rows */
+static struct monitor_value *rb_monitor_get_snmp_walk_value(
+		const rb_monitor_t *monitor,
+		struct process_sensor_monitor_ctx *process_ctx,
+		rb_monitor_value_array_t *op_vars) {
+	(void)op_vars;
+	const time_t now = time(NULL);
+	struct rb_arena *arena = process_ctx->arena;
+
+	if (process_ctx->monitor_idx >= process_ctx->snmp_responses_count) {
+		rdlog(LOG_WARNING, "Not seeing %s value.", monitor->name);
+		return NULL;
+	}
+
+	const struct snmp_monitor_response *response =
+			&process_ctx->snmp_responses[process_ctx->monitor_idx];
+	if (0 == response->walk.count) {
+		rdlog(LOG_WARNING, "Not seeing %s value.", monitor->name);
+		return NULL;
+	}
+
+	const size_t n = response->walk.count;
+	struct monitor_value *mv = new_monitor_value_array(arena, n);
+	if (NULL == mv) {
+		return NULL;
+	}
+
+	// Rows live in process context, so instances must be copied
+	mv->array.instances =
+			rb_arena_calloc(arena, n, sizeof(mv->array.instances[0]));
+	if (NULL == mv->array.instances) {
+		rdlog(LOG_ERR, "Couldn't allocate vector instances (OOM?)");
+		return NULL;
+	}
+
+	for (size_t i = 0; i < n; ++i) {
+		const struct snmp_walk_row *row = &response->walk.rows[i];
+		mv->array.instances[i] = rb_arena_strdup(arena, row->instance);
+		if (NULL == mv->array.instances[i]) {
+			rdlog(LOG_ERR, "Couldn't copy vector instance (OOM?)");
+			return NULL;
+		}
+		monitor_value_array_set(mv, i, now, row->number);
+	}
+
+	monitor_value_array_split_op(arena, monitor, mv, now);
+	return mv;
+}
+
+/// Named instances values being collected
+struct instance_monitor_values {
+	struct rb_arena *arena; ///< Arena to allocate values from
+	double *values;		///< Vector values
+	const char **instances; ///< Vector instances
+	size_t count;		///< Number of children
+	size_t capacity;	///< Length of values and instances
+	bool scalar;		///< Value is a scalar, not a vector
+	double value;		///< Scalar value
+	time_t now;		///< Time of processing
+};
+
+/** Collect a named instance value
+  @param instance Vector instance, or NULL if scalar
+  @param instance_len Length of instance
+  @param value Value
+  @param vvalues Instance monitor values
+  */
+static void instance_monitor_value_cb(const char *instance,
+				      size_t instance_len,
+				      double value,
+				      void *vvalues) {
+	struct instance_monitor_values *values = vvalues;
+
+	if (NULL == instance) {
+		values->scalar = true;
+		values->value = value;
+		return;
+	}
+
+	if (values->count == values->capacity) {
+		const size_t new_capacity =
+				values->capacity ? 2 * values->capacity : 16;
+		double *new_values = rb_arena_realloc(
+				values->arena,
+				values->values,
+				values->capacity * sizeof(new_values[0]),
+				new_capacity * sizeof(new_values[0]));
+		const char **new_instances =
+				new_values ? rb_arena_realloc(
+						     values->arena,
+						     values->instances,
+						     values->capacity *
+							     sizeof(new_instances[0]),
+						     new_capacity *
+							     sizeof(new_instances[0]))
+					   : NULL;
+		if (NULL == new_instances) {
+			rdlog(LOG_ERR, "Couldn't grow vector children (OOM?)");
+			return;
+		}
+		values->values = new_values;
+		values->instances = new_instances;
+		values->capacity = new_capacity;
+	}
+
+	const char *instance_copy =
+			rb_arena_strndup(values->arena, instance, instance_len);
+	if (NULL == instance_copy) {
+		rdlog(LOG_ERR, "Couldn't copy vector instance (OOM?)");
+		return;
+	}
+
+	values->values[values->count] = value;
+	values->instances[values->count] = instance_copy;
+	values->count++;
+}
+
+/** Creates monitor value from collected named instances
+  @param monitor Monitor
+  @param values Collected values
+  @return Monitor value
+  */
+static struct monitor_value *
+instance_monitor_values_result(const rb_monitor_t *monitor,
+			       struct instance_monitor_values *values) {
+	if (values->scalar) {
+		return process_novector_monitor(
+				values->arena, values->value, values->now);
+	}
+
+	if (0 == values->count) {
+		rdlog(LOG_WARNING, "Not seeing %s value.", monitor->name);
+		return NULL;
+	}
+
+	struct monitor_value *mv =
+			new_monitor_value_array(values->arena, values->count);
+	if (NULL == mv) {
+		return NULL;
+	}
+
+	// Instances are already in arena, so they can be shared
+	mv->array.instances = values->instances;
+	for (size_t i = 0; i < values->count; ++i) {
+		monitor_value_array_set(mv, i, values->now, values->values[i]);
+	}
+
+	monitor_value_array_split_op(values->arena, monitor, mv, values->now);
+	return mv;
+}
+
+/** Obtain /proc or /sys values, reading each file once per cycle */
+static struct monitor_value *
+rb_monitor_get_proc_value(const rb_monitor_t *monitor,
+			  struct process_sensor_monitor_ctx *process_ctx,
+			  rb_monitor_value_array_t *op_vars) {
+	(void)op_vars;
+	struct instance_monitor_values values = {
+			.arena = process_ctx->arena, .now = time(NULL),
+	};
+
+	if (NULL == process_ctx->proc_snapshot) {
+		process_ctx->proc_snapshot = proc_snapshot_new();
+		if (NULL == process_ctx->proc_snapshot) {
+			return NULL;
+		}
+	}
+
+	proc_query_eval(monitor->proc,
+			process_ctx->proc_snapshot,
+			instance_monitor_value_cb,
+			&values);
+	return instance_monitor_values_result(monitor, &values);
+}
+
+/** Get a structured system command output, executing it only if it has not
+  been executed in this cycle yet
+  @param monitor Monitor
+  @param process_ctx Process context
+  @return Command output, or NULL in case of error
+  */
+static const char *
+system_cycle_output(const rb_monitor_t *monitor,
+		    struct process_sensor_monitor_ctx *process_ctx) {
+	for (size_t i = 0; i < process_ctx->system.count; ++i) {
+		if (0 == strcmp(process_ctx->system.outputs[i].command,
+				monitor->cmd_arg)) {
+			return process_ctx->system.outputs[i].output;
+		}
+	}
+
+	if (process_ctx->system.count == process_ctx->system.capacity) {
+		const size_t new_capacity = process_ctx->system.capacity
+						    ? 2 * process_ctx->system
+								      .capacity
+						    : 4;
+		struct system_cycle_output *outputs = realloc(
+				process_ctx->system.outputs,
+				new_capacity * sizeof(outputs[0]));
+		if (NULL == outputs) {
+			rdlog(LOG_ERR, "Couldn't grow system outputs (OOM?)");
+			return NULL;
+		}
+		process_ctx->system.outputs = outputs;
+		process_ctx->system.capacity = new_capacity;
+	}
+
+	// Errors are saved too, so the command is not retried in this cycle
+	struct system_cycle_output *output =
+			&process_ctx->system.outputs[process_ctx->system
+							     .count++];
+	output->command = monitor->cmd_arg;
+	output->output = system_output_cached(monitor->cmd_arg,
+					      monitor->timeout_ms,
+					      monitor->cache_ttl_ms);
+	return output->output;
+}
+
+/** Obtain values from a structured system command output */
+static struct monitor_value *rb_monitor_get_system_structured_value(
+		const rb_monitor_t *monitor,
+		struct process_sensor_monitor_ctx *process_ctx) {
+	struct instance_monitor_values values = {
+			.arena = process_ctx->arena, .now = time(NULL),
+	};
+	const char *output = system_cycle_output(monitor, process_ctx);
+	if (NULL == output) {
+		rdlog(LOG_WARNING, "Not seeing %s value.", monitor->name);
+		return NULL;
+	}
+
+	system_output_parse(monitor->system_format,
+			    output,
+			    monitor->field,
+			    instance_monitor_value_cb,
+			    &values);
+	return instance_monitor_values_result(monitor, &values);
+}
+
+/** Convenience function to obtain an already received stream line */
+static bool stream_line_solve_response0(char *value_buf,
+					size_t value_buf_len,
+					double *number,
+					void *vline,
+					const char *command) {
+	const char *line = vline;
+	(void)command;
+
+	snprintf(value_buf, value_buf_len, "%s", line);
+	char *endptr;
+	*number = rb_number_parse(value_buf, &endptr);
+	return value_buf != endptr;
+}
+
+/** Convenience function to obtain streaming system values */
+static struct monitor_value *rb_monitor_get_system_stream_value(
+		const rb_monitor_t *monitor,
+		struct process_sensor_monitor_ctx *process_ctx) {
+	char line[BUFSIZ];
+	size_t skipped = 0;
+
+	if (!system_stream_last_line(
+			    monitor->stream, line, sizeof(line), &skipped)) {
+		rdlog(LOG_DEBUG, "No new line in %s stream", monitor->name);
+		return NULL;
+	}
+
+	if (skipped > 0) {
+		rdlog(LOG_DEBUG,
+		      "Skipped %zu old lines of %s stream",
+		      skipped,
+		      monitor->name);
+	}
+
+	return rb_monitor_get_external_value(monitor,
+					     process_ctx->arena,
+					     stream_line_solve_response0,
+					     line);
+}
+
+/** Convenience function to obtain system values */
+static struct monitor_value *rb_monitor_get_system_external_value(
+		const rb_monitor_t *monitor,
+		struct process_sensor_monitor_ctx *process_ctx,
+		rb_monitor_value_array_t *ops_vars) {
+	(void)ops_vars;
+	if (monitor->stream) {
+		return rb_monitor_get_system_stream_value(monitor,
+							  process_ctx);
+	}
+
+	if (SYSTEM_OUTPUT_LINE != monitor->system_format) {
+		return rb_monitor_get_system_structured_value(monitor,
+							      process_ctx);
+	}
+
+	struct system_solve_params params = {
+			.timeout_ms = monitor->timeout_ms,
+			.ttl_ms = monitor->cache_ttl_ms,
+	};
+	return rb_monitor_get_external_value(monitor,
+					     process_ctx->arena,
+					     system_solve_response,
+					     &params);
+}
+
+/** Check that operation variables can be used in operation
+  @param op_vars Operation variables values
+  @param names Operation variables names
+  @param allow_mixed Allow to mix vectors and scalars
+  @param vector_len Vectors length (0 if no vector is present)
+  @return true if all variables are present and vectors have the same size
+  */
+static bool op_vars_check(rb_monitor_value_array_t *op_vars,
+			  char **names,
+			  bool allow_mixed,
+			  size_t *vector_len) {
+	size_t expected_v_elms = 0;
+	bool vector_seen = false;
+
+	for (size_t i = 0; i < op_vars->count; ++i) {
+		const struct monitor_value *mv =
+				rb_monitor_value_array_at(op_vars, i);
+
+		if (NULL == mv) {
+			rdlog(LOG_DEBUG,
+			      "No value for variable %s, can't operate",
+			      names[i]);
+			return false;
+		}
+
+		if (!allow_mixed &&
+		    mv->type != rb_monitor_value_array_at(op_vars, 0)->type) {
+			rdlog(LOG_ERR,
+			      "trying to operate on vectors and scalars: [%s]",
+			      names[i]);
+			return false;
+		}
+
+		if (mv->type != MONITOR_VALUE_T__ARRAY) {
+			continue;
+		}
+
+		if (!vector_seen) {
+			expected_v_elms = mv->array.children_count;
+			vector_seen = true;
+		} else if (mv->array.children_count != expected_v_elms) {
+			rdlog(LOG_ERR,
+			      "trying to operate on vectors of "
+			      "different size:"
+			      "[(previous size):%zu] != [%s:%zu]",
+			      expected_v_elms,
+			      names[i],
+			      mv->array.children_count);
+			return false;
+		}
+	}
+
+	*vector_len = expected_v_elms;
+	return true;
+}
+
+/** Check an operation result
+  @param monitor Monitor operation belongs
+  @param number Result
+  @return true if result is normal
+  */
+static bool rb_monitor_op_result_ok(const rb_monitor_t *monitor,
+				    double number) {
+	if (!isnormal(number)) {
+		rdlog(LOG_ERR,
+		      "OP %s return a bad value: %lf. Skipping.",
+		      monitor->cmd_arg,
+		      number);
+		return false;
+	}
+
+	return true;
+}
+
+/** Do a monitor operation using compiled bytecode. Vectors are evaluated at
+  once, and scalars are broadcasted to vectors when they are mixed. Vector
+  values columns are used directly as expression variables, and the result is
+  evaluated directly in the returned value columns.
+  @param arena Arena to allocate result and temporaries from
+  @param expr Compiled expression
+  @param op_vars Operation variables values
+  @param n Vectors length
+  @param vector Some operation variable is a vector
+  @param monitor Monitor operation belongs
+  @param now This time
+  @return New monitor value
+  */
+static struct monitor_value *
+rb_monitor_op_expr(struct rb_arena *arena,
+		   const struct rb_expr *expr,
+		   rb_monitor_value_array_t *op_vars,
+		   size_t n,
+		   bool vector,
+		   const rb_monitor_t *monitor,
+		   time_t now) {
+	bool result_vector = false;
+	const size_t vars_count = op_vars->count;
+
+	struct rb_expr_value *vars =
+			rb_arena_calloc(arena, vars_count, sizeof(vars[0]));
+	// Scalar results still need one element
+	struct monitor_value *mv = new_monitor_value_array(arena, n ? n : 1);
+	if (NULL == vars || NULL == mv) {
+		rdlog(LOG_ERR,
+		      "Couldn't allocate monitor %s operation buffer (OOM?)",
+		      monitor->name);
+		return NULL;
+	}
+
+	for (size_t v = 0; v < vars_count; ++v) {
+		const struct monitor_value *mv_v =
+				rb_monitor_value_array_at(op_vars, v);
+		if (MONITOR_VALUE_T__VALUE == mv_v->type) {
+			vars[v].values = &mv_v->value.value;
+			vars[v].valid = NULL;
+			vars[v].vector = false;
+		} else {
+			vars[v].values = mv_v->array.values;
+			vars[v].valid = mv_v->array.valid;
+			vars[v].vector = true;
+		}
+	}
+
+	if (!rb_expr_eval(expr,
+			  arena,
+			  vars,
+			  n,
+			  mv->array.values,
+			  mv->array.valid,
+			  &result_vector)) {
+		return NULL;
+	}
+
+	if (!vector || !result_vector) {
+		// Scalar operation, or vector reduced to scalar
+		const double number = mv->array.values[0];
+		if (!monitor_value_array_valid(mv, 0) ||
+		    !rb_monitor_op_result_ok(monitor, number)) {
+			return NULL;
+		}
+
+		return process_novector_monitor(arena, number, now);
+	}
+
+	for (size_t i = 0; i < n; ++i) {
+		mv->array.timestamps[i] = now;
+		if (monitor_value_array_valid(mv, i) &&
+		    !rb_monitor_op_result_ok(monitor, mv->array.values[i])) {
+			rb_bitmap_clear(mv->array.valid, i);
+		}
+	}
+
+	monitor_value_array_split_op(arena, monitor, mv, now);
+	return mv;
+}
+
+/** Do a monitor operation
+  @param f evaluator
+  @param libmatheval_vars prepared libmathevals with names and values
+  @param monitor Monitor operation belongs
+  @param number Operation result
+  @return true if result is valid
+  */
+static bool rb_monitor_op_value0(void *f,
+				 struct libmatheval_vars *libmatheval_vars,
+				 const rb_monitor_t *monitor,
+				 double *number) {
+	*number = evaluator_evaluate(f,
+				     libmatheval_vars->count,
+				     libmatheval_vars->names,
+				     libmatheval_vars->values);
+
+	rdlog(LOG_DEBUG,
+	      "Result of operation [%s]: %lf",
+	      monitor->cmd_arg,
+	      *number);
+
+	return rb_monitor_op_result_ok(monitor, *number);
 }
 
 /** Do a monitor value operation, with no array involved
+  @param arena Arena to allocate result from
   @param f Evaluator
   @param op_vars Operations variables with names
   @param monitor Montior this operation belongs
@@ -614,7 +2071,8 @@ rb_monitor_op_value0(void *f,
   @return new monitor value with operation result
   */
 static struct monitor_value *
-rb_monitor_op_value(void *f,
+rb_monitor_op_value(struct rb_arena *arena,
+		    void *f,
 		    rb_monitor_value_array_t *op_vars,
 		    struct libmatheval_vars *libmatheval_vars,
 		    const rb_monitor_t *monitor,
@@ -629,7 +2087,10 @@ rb_monitor_op_value(void *f,
 		libmatheval_vars->values[v] = mv_v->value.value;
 	}
 
-	return rb_monitor_op_value0(f, libmatheval_vars, monitor, now);
+	double number = 0;
+	return rb_monitor_op_value0(f, libmatheval_vars, monitor, &number)
+		       ? process_novector_monitor(arena, number, now)
+		       : NULL;
 }
 
 /** Gets an operation result of vector position i
@@ -637,17 +2098,16 @@ rb_monitor_op_value(void *f,
   @param libmatheval_vars Libmatheval prepared variables
   @param v_pos Vector position we want to evaluate
   @param monitor Monitor this operation belongs
-  @param now Time of operation
-  @return Montior value with vector index i of the result
+  @param number Result of vector index i
+  @return true if result is valid
   @todo merge with rb_monitor_op_value
   */
-static struct monitor_value *
-rb_monitor_op_vector_i(void *f,
-		       rb_monitor_value_array_t *op_vars,
-		       struct libmatheval_vars *libmatheval_vars,
-		       size_t v_pos,
-		       const rb_monitor_t *monitor,
-		       const time_t now) {
+static bool rb_monitor_op_vector_i(void *f,
+				   rb_monitor_value_array_t *op_vars,
+				   struct libmatheval_vars *libmatheval_vars,
+				   size_t v_pos,
+				   const rb_monitor_t *monitor,
+				   double *number) {
 	/* Foreach variable in operation, use element i of vector */
 	for (size_t v = 0; v < op_vars->count; ++v) {
 		const struct monitor_value *mv_v =
@@ -655,22 +2115,19 @@ rb_monitor_op_vector_i(void *f,
 		assert(mv_v);
 		assert(MONITOR_VALUE_T__ARRAY == mv_v->type);
 
-		const struct monitor_value *mv_v_i =
-				mv_v->array.children[v_pos];
-		if (NULL == mv_v_i) {
+		if (!monitor_value_array_valid(mv_v, v_pos)) {
 			// We don't have this value, so we can't do operation
-			return NULL;
+			return false;
 		}
 
-		assert(MONITOR_VALUE_T__VALUE == mv_v_i->type);
-
-		libmatheval_vars->values[v] = mv_v_i->value.value;
+		libmatheval_vars->values[v] = mv_v->array.values[v_pos];
 	}
 
-	return rb_monitor_op_value0(f, libmatheval_vars, monitor, now);
+	return rb_monitor_op_value0(f, libmatheval_vars, monitor, number);
 }
 
 /** Makes a vector operation
+  @param arena Arena to allocate result from
   @param f libmatheval evaluator
   @param op_vars Monitor values of operation variables
   @param libmatheval_vars Libmatheval variables template
@@ -679,59 +2136,35 @@ rb_monitor_op_vector_i(void *f,
   @todo op_vars should be const
   */
 static struct monitor_value *
-rb_monitor_op_vector(void *f,
+rb_monitor_op_vector(struct rb_arena *arena,
+		     void *f,
 		     rb_monitor_value_array_t *op_vars,
 		     struct libmatheval_vars *libmatheval_vars,
 		     const rb_monitor_t *monitor,
 		     time_t now) {
-	double sum = 0;
-	size_t count = 0;
 	const struct monitor_value *mv_0 =
 			rb_monitor_value_array_at(op_vars, 0);
-	struct monitor_value *split_op = NULL;
-	struct monitor_value **children =
-			calloc(mv_0->array.children_count, sizeof(children[0]));
-	if (NULL == children) {
-		/* @todo Error treatment */
-		rdlog(LOG_ERR,
-		      "Couldn't create monitor value %s"
-		      " children (out of memory?)",
-		      monitor->name);
+	const size_t n = mv_0->array.children_count;
+	struct monitor_value *mv = new_monitor_value_array(arena, n);
+	if (NULL == mv) {
 		return NULL;
 	}
 
 	// Foreach member of vector
-	for (size_t i = 0; i < mv_0->array.children_count; ++i) {
-		children[i] = rb_monitor_op_vector_i(
-				f, op_vars, libmatheval_vars, i, monitor, now);
-
-		if (NULL != children[i]) {
-			sum += children[i]->value.value;
-			count++;
+	for (size_t i = 0; i < n; ++i) {
+		double number = 0;
+		if (rb_monitor_op_vector_i(f,
+					   op_vars,
+					   libmatheval_vars,
+					   i,
+					   monitor,
+					   &number)) {
+			monitor_value_array_set(mv, i, now, number);
 		}
 	} /* foreach member of vector */
 
-	if (monitor->splitop && count > 0) {
-		char string_value[64];
-
-		const double split_op_value =
-				0 == strcmp(monitor->splitop, "sum")
-						? sum
-						: sum / count;
-
-		/// @todo check if number is normal
-		/// @todo check snprintf return
-		snprintf(string_value,
-			 sizeof(string_value),
-			 "%lf",
-			 split_op_value);
-
-		split_op = process_novector_monitor(
-				string_value, split_op_value, now);
-	}
-
-	return new_monitor_value_array(
-			mv_0->array.children_count, children, split_op);
+	monitor_value_array_split_op(arena, monitor, mv, now);
+	return mv;
 }
 
 /** Process an operation monitor
@@ -744,14 +2177,8 @@ static struct monitor_value *
 rb_monitor_get_op_result(const rb_monitor_t *monitor,
 			 struct process_sensor_monitor_ctx *process_ctx,
 			 rb_monitor_value_array_t *op_vars) {
-	(void)process_ctx;
 	struct monitor_value *ret = NULL;
-	const char *operation = monitor->cmd_arg;
-
-	struct {
-		char **vars;
-		int vars_len;
-	} f_vars;
+	struct rb_monitor_op *op = monitor->op;
 
 	/// @todo error treatment in this cases
 	if (NULL == op_vars) {
@@ -762,59 +2189,71 @@ rb_monitor_get_op_result(const rb_monitor_t *monitor,
 		return NULL;
 	}
 
-	void *const f = evaluator_create((char *)operation);
-	if (NULL == f) {
-		rdlog(LOG_ERR,
-		      "Couldn't create evaluator (invalid op [%s]?",
-		      operation);
+	assert(op);
+	assert(op_vars->count == op->vars->count);
+	size_t vector_len = 0;
+	if (!op_vars_check(op_vars,
+			   op->vars->names,
+			   NULL != op->expr,
+			   &vector_len)) {
 		return NULL;
 	}
 
-	evaluator_get_variables(f, &f_vars.vars, &f_vars.vars_len);
-
 	const time_t now = time(NULL);
-	struct libmatheval_vars *libmatheval_vars =
-			op_libmatheval_vars(op_vars, f_vars.vars);
-	if (NULL == libmatheval_vars) {
-		goto libmatheval_error;
-	}
-
 	const struct monitor_value *mv_0 =
 			rb_monitor_value_array_at(op_vars, 0);
-	if (mv_0) {
-		switch (mv_0->type) {
-		case MONITOR_VALUE_T__ARRAY:
-			ret = rb_monitor_op_vector(f,
-						   op_vars,
-						   libmatheval_vars,
-						   monitor,
-						   now);
-			break;
-		case MONITOR_VALUE_T__VALUE:
-			ret = rb_monitor_op_value(f,
-						  op_vars,
-						  libmatheval_vars,
-						  monitor,
-						  now);
-			break;
-		default:
-			/// @todo error treatment
-			rdlog(LOG_CRIT, "Unknown operation monitor type!");
-			ret = NULL;
-			break;
-		};
+
+	if (op->expr) {
+		bool vector = false;
+		for (size_t i = 0; i < op_vars->count; ++i) {
+			vector |= MONITOR_VALUE_T__ARRAY ==
+				  rb_monitor_value_array_at(op_vars, i)->type;
+		}
+
+		return rb_monitor_op_expr(process_ctx->arena,
+					  op->expr,
+					  op_vars,
+					  vector_len,
+					  vector,
+					  monitor,
+					  now);
 	}
 
-	delete_libmatheval_vars(libmatheval_vars);
-libmatheval_error:
-	evaluator_destroy(f);
+	pthread_mutex_lock(&op->lock);
+	switch (mv_0->type) {
+	case MONITOR_VALUE_T__ARRAY:
+		ret = rb_monitor_op_vector(process_ctx->arena,
+					   op->evaluator,
+					   op_vars,
+					   op->vars,
+					   monitor,
+					   now);
+		break;
+	case MONITOR_VALUE_T__VALUE:
+		ret = rb_monitor_op_value(process_ctx->arena,
+					  op->evaluator,
+					  op_vars,
+					  op->vars,
+					  monitor,
+					  now);
+		break;
+	default:
+		/// @todo error treatment
+		rdlog(LOG_CRIT, "Unknown operation monitor type!");
+		ret = NULL;
+		break;
+	};
+	pthread_mutex_unlock(&op->lock);
+
 	return ret;
 }
 
 struct monitor_value *
 process_sensor_monitor(struct process_sensor_monitor_ctx *process_ctx,
 		       const rb_monitor_t *monitor,
+		       size_t monitor_idx,
 		       rb_monitor_value_array_t *op_vars) {
+	process_ctx->monitor_idx = monitor_idx;
 	switch (monitor->type) {
 #define _X(menum, cmd, type, fn)                                               \
 	case menum:                                                            \
@@ -836,21 +2275,14 @@ process_sensor_monitor(struct process_sensor_monitor_ctx *process_ctx,
 */
 
 /** Process a no-vector monitor
-  @param monitor Monitor to process
-  @param value_buf Value in text format
+  @param arena Arena to allocate value from
   @param value Value in double format
   @param now Time of processing
 */
-static struct monitor_value *
-process_novector_monitor(const char *value_buf, double value, time_t now) {
-	struct monitor_value *mv = NULL;
-
-	rd_calloc_struct(&mv,
-			 sizeof(*mv),
-			 -1,
-			 value_buf,
-			 &mv->value.string_value,
-			 RD_MEM_END_TOKEN);
+static struct monitor_value *process_novector_monitor(struct rb_arena *arena,
+						      double value,
+						      time_t now) {
+	struct monitor_value *mv = rb_arena_calloc(arena, 1, sizeof(*mv));
 
 	if (mv) {
 #ifdef MONITOR_VALUE_MAGIC
@@ -886,16 +2318,13 @@ static size_t vector_elements(const char *haystack, const char *splittok) {
 /** Extract value of a vector
   @param vector_values String to extract values from
   @param splittok Split token
-  @param str_value Value in string format
-  @param str_size str_value length
+  @param value Extracted value
   @param timestamp_sep Timestamp separator (if any)
   @param timestamp If timestamp_sep is defined, extracted timestamp
   @return Next token to iterate
   */
 static bool extract_vector_value(const char *vector_values,
 				 const char *splittok,
-				 const char **str_value,
-				 size_t *str_size,
 				 double *value,
 				 const char *timestamp_sep,
 				 time_t *timestamp) {
@@ -937,35 +2366,29 @@ static bool extract_vector_value(const char *vector_values,
 		return false;
 	}
 
-	*str_value = vector_values;
-	*str_size = (size_t)(end_token - vector_values);
 	return true;
 }
 
 /** Process a vector monitor
+  @param arena Arena to allocate values from
   @param monitor Monitor to process
   @param value_buf Value to process (string format)
   @param now This time
   @todo this could be joint with operation on vector
 */
-static struct monitor_value *process_vector_monitor(const rb_monitor_t *monitor,
+static struct monitor_value *process_vector_monitor(struct rb_arena *arena,
+						    const rb_monitor_t *monitor,
 						    const char *value_buf,
 						    time_t now) {
 	const size_t n_children = vector_elements(value_buf, monitor->splittok);
 	const char *tok = NULL;
 
-	struct monitor_value **children =
-			calloc(n_children, sizeof(children[0]));
-	struct monitor_value *split_op = NULL;
-	if (NULL == children) {
-		rdlog(LOG_ERR,
-		      "Couldn't allocate vector children (out of "
-		      "memory?)");
+	struct monitor_value *mv = new_monitor_value_array(arena, n_children);
+	if (NULL == mv) {
 		return NULL;
 	}
 
-	size_t mean_count = 0, count = 0;
-	double sum = 0;
+	size_t count = 0;
 	for (count = 0, tok = value_buf; tok;
 	     tok = strstr(tok, monitor->splittok), count++) {
 		if (count > 0) {
@@ -973,8 +2396,6 @@ static struct monitor_value *process_vector_monitor(const rb_monitor_t *monitor,
 		}
 
 		time_t i_timestamp = 0;
-		const char *i_value_str = NULL;
-		size_t i_value_str_size = 0;
 		double i_value = 0;
 
 		if (0 == strcmp(tok, monitor->splittok)) {
@@ -988,8 +2409,6 @@ static struct monitor_value *process_vector_monitor(const rb_monitor_t *monitor,
 		const bool get_value_rc = extract_vector_value(
 				tok,
 				monitor->splittok,
-				&i_value_str,
-				&i_value_str_size,
 				&i_value,
 				monitor->timestamp_given ? DEFAULT_TIMESTAMP_SEP
 							 : NULL,
@@ -999,32 +2418,13 @@ static struct monitor_value *process_vector_monitor(const rb_monitor_t *monitor,
 			continue;
 		}
 
-		children[count] = process_novector_monitor(
-				i_value_str,
-				i_value,
-				i_timestamp ? i_timestamp : now);
-
-		if (NULL != children[count]) {
-			sum += i_value;
-			mean_count++;
-		}
+		monitor_value_array_set(mv,
+					count,
+					i_timestamp ? i_timestamp : now,
+					i_value);
 	}
 
 	// Last token reached. Do we have an operation to do?
-	if (NULL != monitor->splitop && mean_count > 0) {
-		char split_op_result[1024];
-		const double result = (0 == strcmp("sum", monitor->splitop))
-						      ? sum
-						      : sum / mean_count;
-
-		/// @todo check snprint result
-		snprintf(split_op_result,
-			 sizeof(split_op_result),
-			 "%lf",
-			 result);
-		split_op = process_novector_monitor(
-				split_op_result, result, now);
-	}
-
-	return new_monitor_value_array(n_children, children, split_op);
+	monitor_value_array_split_op(arena, monitor, mv, now);
+	return mv;
 }
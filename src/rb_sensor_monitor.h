@@ -20,11 +20,13 @@
 #pragma once
 
 #include "rb_snmp.h"
+#include "rb_snmp_engine.h"
 #include "rb_value.h"
 
 #include <json-c/json.h>
 
 #include <stdbool.h>
+#include <stdint.h>
 
 /* FW declaration */
 struct rb_sensor_s;
@@ -50,32 +52,143 @@ parse_rb_monitor(json_object *json_monitor, json_object *sensor_enrichment);
 void rb_monitor_done(rb_monitor_t *monitor);
 
 /** Creates a new monitor process ctx
-  @param monitors_count # of monitors
   @param snmp_sessp Session to make SNMP request
+  @param arena Cycle arena. Context and monitor values are allocated from it.
+  If NULL, context is allocated from heap (so it can outlive a worker cycle,
+  like asynchronous SNMP ones), and arena must be set with
+  process_sensor_monitor_ctx_set_arena before processing monitors.
   @return New monitor process ctx
   */
 struct process_sensor_monitor_ctx *
-new_process_sensor_monitor_ctx(struct monitor_snmp_session *snmp_sessp);
+new_process_sensor_monitor_ctx(struct monitor_snmp_session *snmp_sessp,
+			       struct rb_arena *arena);
+
+/** Set the arena monitor values are allocated from
+  @param ctx Process context
+  @param arena Cycle arena
+  */
+void process_sensor_monitor_ctx_set_arena(
+		struct process_sensor_monitor_ctx *ctx, struct rb_arena *arena);
+
+/** Arena monitor values are allocated from
+  @param ctx Process context
+  @return Cycle arena
+  */
+struct rb_arena *
+process_sensor_monitor_ctx_arena(const struct process_sensor_monitor_ctx *ctx);
 
 /** Destroy process sensor monitor context
   @param ctx Context to free
   */
 void destroy_process_sensor_monitor_ctx(struct process_sensor_monitor_ctx *ctx);
 
-/// @todo delete this FW declaration
-struct rb_sensor_s;
+/** Prepare a process context to hold monitors SNMP responses. If prepared,
+  SNMP monitors will use these responses instead of asking the agent.
+  @param ctx Process context
+  @param monitors_count # of monitors that will be processed with ctx
+  @return true if success, false in other case
+  */
+bool process_sensor_monitor_ctx_snmp_responses(
+		struct process_sensor_monitor_ctx *ctx, size_t monitors_count);
+
+/** Prepare a process context to receive SNMP responses asynchronously. After
+  this call, you can send requests with
+  process_sensor_monitor_ctx_snmp_async_request and then call
+  process_sensor_monitor_ctx_async_wait.
+  @param ctx Process context
+  @param monitors_count # of monitors that will be processed with ctx
+  @param done_cb Callback to call when all responses has been received
+  @param opaque Opaque to send to done_cb
+  @return true if success, false in other case
+  */
+bool process_sensor_monitor_ctx_async(struct process_sensor_monitor_ctx *ctx,
+				      size_t monitors_count,
+				      void (*done_cb)(void *opaque),
+				      void *opaque);
+
+/** Done requesting SNMP async values
+  @param ctx Process context
+  @return true if there are requests in flight, so done_cb will be called
+  when all of them are done. False if all requests are done, so you can
+  process monitors right now.
+  */
+bool process_sensor_monitor_ctx_async_wait(
+		struct process_sensor_monitor_ctx *ctx);
+
+/** Prepare a process context to process only some monitors in this cycle.
+  Monitors not due will not be requested nor processed.
+  @param ctx Process context
+  @param monitors_count # of monitors that will be processed with ctx
+  @return Due mask, with all monitors due. Set to 0 the ones that should not
+  be processed. NULL in case of error, and then all monitors will be processed
+  */
+uint8_t *process_sensor_monitor_ctx_due(struct process_sensor_monitor_ctx *ctx,
+					size_t monitors_count);
+
+/** Checks if a monitor has to be processed in this cycle
+  @param ctx Process context
+  @param monitor_idx Monitor index in sensor monitors
+  @return true if monitor is due
+  */
+bool process_sensor_monitor_ctx_monitor_due(
+		const struct process_sensor_monitor_ctx *ctx,
+		size_t monitor_idx);
+
+/* FW declaration */
+struct rb_snmp_plan;
+
+/** Asynchronously send all SNMP plan PDUs, saving responses in process ctx.
+  @param ctx Process ctx, prepared with process_sensor_monitor_ctx_async
+  @param plan SNMP request plan. It must be alive until done_cb is called
+  @param engine SNMP engine to send requests through
+  @return Number of PDUs sent
+  */
+size_t process_sensor_monitor_ctx_snmp_async_request(
+		struct process_sensor_monitor_ctx *ctx,
+		const struct rb_snmp_plan *plan,
+		struct rb_snmp_engine *engine);
+
+/** Synchronously send all SNMP plan PDUs, saving responses in process ctx.
+  @param ctx Process ctx, prepared with
+  process_sensor_monitor_ctx_snmp_responses
+  @param plan SNMP request plan
+  */
+void process_sensor_monitor_ctx_snmp_sync_request(
+		struct process_sensor_monitor_ctx *ctx,
+		const struct rb_snmp_plan *plan);
 
 /** Process a sensor monitor
   @param process_ctx Process context
   @param monitor Monitor to process
+  @param monitor_idx Monitor index in sensor monitors
   @param op_vars Variables that require operations
   @param ret Returned messages
   */
 struct monitor_value *
 process_sensor_monitor(struct process_sensor_monitor_ctx *process_ctx,
 		       const rb_monitor_t *monitor,
+		       size_t monitor_idx,
 		       rb_monitor_value_array_t *op_vars);
 
+/** Checks if monitor value is obtained via SNMP
+  @param monitor Monitor to check
+  @return true if monitor needs SNMP
+  */
+bool rb_monitor_is_snmp(const rb_monitor_t *monitor);
+
+/** Checks if monitor is a SNMP subtree walk
+  @param monitor Monitor to check
+  @return true if monitor walks a SNMP subtree
+  */
+bool rb_monitor_is_snmp_walk(const rb_monitor_t *monitor);
+
+/** Gets SNMP monitor parsed OID
+  @param monitor SNMP or walk monitor
+  @param len OID length
+  @return Monitor OID
+  */
+const oid *rb_monitor_snmp_oid(const rb_monitor_t *monitor, size_t *len);
+
 /** Gets if monitor expect timestamp
   @param monitor Monitor to get data
   @return requested data
@@ -112,12 +225,28 @@ const char *rb_monitor_group_id(const rb_monitor_t *monitor);
   */
 bool rb_monitor_is_integer(const rb_monitor_t *monitor);
 
+/** Gets monitor poll interval
+  @param monitor Monitor to get data
+  @return Interval in milliseconds, or 0 if monitor uses sensor interval
+  */
+uint64_t rb_monitor_interval_ms(const rb_monitor_t *monitor);
+
 /** Gets monitor send variable
   @param monitor Monitor to get data
   @return requested data
   */
 bool rb_monitor_send(const rb_monitor_t *monitor);
 
+/* FW declaration */
+struct rb_monitor_template;
+
+/** Get monitor output message template
+  @param monitor Monitor to get template
+  @return Monitor message template
+  */
+const struct rb_monitor_template *
+rb_monitor_message_template(const rb_monitor_t *monitor);
+
 /** Get monitor enrichment
  * @param monitor Monitor to get enrichment
  * @return Monitor enrichment
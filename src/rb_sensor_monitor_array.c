@@ -77,52 +77,38 @@ process_monitor_value_v_print(const rb_monitor_t *monitor,
 	assert(new_mv->type == MONITOR_VALUE_T__ARRAY);
 	assert(old_mv->type == MONITOR_VALUE_T__ARRAY);
 
-	struct monitor_value *print_children[new_mv->array.children_count];
-	memset(print_children,
-	       0,
-	       new_mv->array.children_count * sizeof(print_children[0]));
+	const size_t n = new_mv->array.children_count;
+	uint64_t print_valid[RB_BITMAP_WORDS(n) + 1];
+	memset(print_valid, 0, sizeof(print_valid));
 
 	/* Print all values that have changed */
 	size_t i = 0;
-	for (i = 0; i < new_mv->array.children_count &&
-		    i < old_mv->array.children_count;
-	     ++i) {
-		struct monitor_value *new_mv_i = new_mv->array.children[i];
-		const struct monitor_value *old_mv_i =
-				old_mv->array.children[i];
-
-		if (new_mv_i) {
-			const bool update = (NULL == old_mv_i ||
-					     rb_monitor_value_cmp_timestamp(
-							     old_mv_i,
-							     new_mv_i) < 0 ||
-					     rd_dne(old_mv_i->value.value,
-						    new_mv_i->value.value));
-
-			if (update) {
-				print_children[i] = new_mv_i;
-			}
+	for (i = 0; i < n && i < old_mv->array.children_count; ++i) {
+		if (!monitor_value_array_valid(new_mv, i)) {
+			continue;
+		}
+
+		const bool update =
+				!monitor_value_array_valid(old_mv, i) ||
+				old_mv->array.timestamps[i] <
+						new_mv->array.timestamps[i] ||
+				rd_dne(old_mv->array.values[i],
+				       new_mv->array.values[i]);
+
+		if (update) {
+			rb_bitmap_set(print_valid, i);
 		}
 	}
 
 	/* Print all new variables, if any */
-	for (; i < new_mv->array.children_count; ++i) {
-		print_children[i] = new_mv->array.children[i];
+	for (; i < n; ++i) {
+		if (monitor_value_array_valid(new_mv, i)) {
+			rb_bitmap_set(print_valid, i);
+		}
 	}
 
-	// clang-format off
-	struct monitor_value to_print = {
-#ifdef MONITOR_VALUE_MAGIC
-		.magic = MONITOR_VALUE_MAGIC,
-#endif
-		.type = MONITOR_VALUE_T__ARRAY,
-		.array = {
-			.children_count = new_mv->array.children_count,
-			.split_op_result = new_mv->array.split_op_result,
-			.children = print_children,
-		},
-	};
-	// clang-format on
+	struct monitor_value to_print = *new_mv;
+	to_print.array.valid = print_valid;
 
 	return print_monitor_value(&to_print, monitor);
 }
@@ -155,8 +141,10 @@ process_monitor_value_v(const rb_monitor_t *monitor,
 	}
 
 	SWAP(old_mv->array.children_count, new_mv->array.children_count);
-	SWAP(old_mv->array.children, new_mv->array.children);
-	rb_monitor_value_done(new_mv);
+	SWAP(old_mv->array.values, new_mv->array.values);
+	SWAP(old_mv->array.timestamps, new_mv->array.timestamps);
+	SWAP(old_mv->array.valid, new_mv->array.valid);
+	SWAP(old_mv->array.instances, new_mv->array.instances);
 	return ret;
 }
 
@@ -189,16 +177,12 @@ process_monitor_value(const rb_monitor_t *monitor,
 			msgs = print_monitor_value(monitor_value, monitor);
 		}
 
-		if (old_mv) {
-			rb_monitor_value_done(old_mv);
-		}
 		ret_mv = monitor_value;
 	} else if (monitor_value->type == MONITOR_VALUE_T__ARRAY) {
 		msgs = process_monitor_value_v(monitor, monitor_value, old_mv);
-	} else {
-		// No use for the new monitor value
-		rb_monitor_value_done(monitor_value);
 	}
+	// else, no use for the new monitor value. It is released with cycle
+	// arena
 
 	if (msgs) {
 		rb_message_list_push(ret, msgs);
@@ -207,27 +191,29 @@ process_monitor_value(const rb_monitor_t *monitor,
 	return ret_mv;
 }
 
-bool process_monitors_array(rb_sensor_t *sensor,
+bool process_monitors_array(struct process_sensor_monitor_ctx *process_ctx,
 			    rb_monitors_array_t *monitors,
 			    rb_monitor_value_array_t *last_known_monitor_values,
 			    ssize_t **monitors_deps,
 			    rb_message_list *ret) {
 	bool aok = true;
-	struct process_sensor_monitor_ctx *process_ctx = NULL;
-
-	monitor_snmp_session *snmp_sess = rb_sensor_snmp_session(sensor);
-	process_ctx = new_process_sensor_monitor_ctx(snmp_sess);
 
 	for (size_t i = 0; aok && i < monitors->count; ++i) {
+		if (!process_sensor_monitor_ctx_monitor_due(process_ctx, i)) {
+			continue;
+		}
+
 		rb_monitor_value_array_t *op_vars =
 				rb_monitor_value_array_select(
+						process_sensor_monitor_ctx_arena(
+								process_ctx),
 						last_known_monitor_values,
 						monitors_deps[i]);
 
 		const rb_monitor_t *monitor =
 				rb_monitors_array_elm_at(monitors, i);
 		struct monitor_value *value = process_sensor_monitor(
-				process_ctx, monitor, op_vars);
+				process_ctx, monitor, i, op_vars);
 		if (value) {
 			struct monitor_value *last_known_monitor_value_i =
 					last_known_monitor_values->elms[i];
@@ -239,8 +225,6 @@ bool process_monitors_array(rb_sensor_t *sensor,
 					last_known_monitor_value_i,
 					ret);
 		}
-
-		rb_monitor_value_array_done(op_vars);
 	}
 
 	for (size_t i = 0; aok && i < monitors->count; ++i) {
@@ -248,18 +232,11 @@ bool process_monitors_array(rb_sensor_t *sensor,
 		so we delete them */
 		const rb_monitor_t *monitor =
 				rb_monitors_array_elm_at(monitors, i);
-		if (last_known_monitor_values->elms[i] &&
-		    !rb_monitor_timestamp_provided(monitor)) {
-			rb_monitor_value_done(
-					last_known_monitor_values->elms[i]);
+		if (!rb_monitor_timestamp_provided(monitor)) {
 			last_known_monitor_values->elms[i] = NULL;
 		}
 	}
 
-	if (process_ctx) {
-		destroy_process_sensor_monitor_ctx(process_ctx);
-	}
-
 	return aok;
 }
 
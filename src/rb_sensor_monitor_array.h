@@ -36,10 +36,6 @@ typedef struct rb_array rb_monitors_array_t;
 rb_monitors_array_t *parse_rb_monitors(json_object *monitors_array_json,
 				       json_object *sensor_enrichment);
 
-/// @todo Delete this FW declaration, we only need to use operation previous
-/// values
-struct rb_sensor_s;
-
 /** Extract an indexed monitor of a monitor array
   @param array Monitors array
   @param i Index to extract
@@ -48,14 +44,15 @@ struct rb_sensor_s;
 rb_monitor_t *rb_monitors_array_elm_at(rb_monitors_array_t *array, size_t i);
 
 /** Process all monitors in sensor, returning result in ret
-  @param sensor Current sensor
+  @param process_ctx Process context
   @param monitors Array of monitors to ask
-  @param last_known_monitor_values Last monitor values, to be able to compare
+  @param last_known_monitor_values Last monitor values, to be able to compare.
+  New values are allocated in process_ctx arena, so they must be copied before
+  resetting it.
   @param monitors_deps Monitor dependencies
-  @param snmp_params SNMP connection parameters
   @param ret Message returning function
   @warning This function assumes ALL fields of sensor_data will be populated */
-bool process_monitors_array(struct rb_sensor_s *sensor,
+bool process_monitors_array(struct process_sensor_monitor_ctx *process_ctx,
 			    rb_monitors_array_t *monitors,
 			    rb_monitor_value_array_t *last_known_monitor_values,
 			    ssize_t **monitors_deps,
@@ -17,13 +17,269 @@
 	along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include <rb_sensor_queue.h>
+#include "config.h"
 
-void sensor_queue_init(sensor_queue_t *queue) {
-	memset(queue, 0, sizeof(*queue)); // Needed even with init()
-	rd_fifoq_init(queue);
+#include "rb_sensor_queue.h"
+
+#include <librd/rdlog.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Initial capacity of each worker deque
+#define SENSOR_DEQUE_INITIAL_CAPACITY 16
+
+struct sensor_queue_worker {
+	pthread_mutex_t lock; ///< Protects deque
+	rb_sensor_t **elms;   ///< Deque ring buffer
+	size_t capacity;      ///< Length of elms
+	size_t head;	  ///< First element position
+	size_t count;	 ///< Number of elements in deque
+
+	/// Wake up condition. Protected by queue sleep_lock.
+	pthread_cond_t cond;
+	bool sleeping; ///< Worker is waiting in cond. Protected by sleep_lock.
+};
+
+/** Grows a worker deque. Need to hold worker lock.
+  @param worker Worker
+  @return 0 if success, !0 in other case
+  */
+static int sensor_deque_grow(struct sensor_queue_worker *worker) {
+	const size_t new_capacity = worker->capacity
+						    ? 2 * worker->capacity
+						    : SENSOR_DEQUE_INITIAL_CAPACITY;
+	rb_sensor_t **elms = malloc(new_capacity * sizeof(elms[0]));
+	if (NULL == elms) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < worker->count; ++i) {
+		elms[i] = worker->elms[(worker->head + i) % worker->capacity];
+	}
+
+	free(worker->elms);
+	worker->elms = elms;
+	worker->capacity = new_capacity;
+	worker->head = 0;
+	return 0;
+}
+
+/** Extract sensors from a worker deque
+  @param worker Worker to extract from
+  @param sensors Sensors extracted
+  @param max_sensors Max sensors to extract
+  @param steal Extract half of the deque from its back, instead of from its
+  front
+  @return Number of sensors extracted
+  */
+static size_t sensor_deque_pop(struct sensor_queue_worker *worker,
+			       rb_sensor_t **sensors,
+			       size_t max_sensors,
+			       bool steal) {
+	size_t ret = 0;
+
+	pthread_mutex_lock(&worker->lock);
+	ret = steal ? (worker->count + 1) / 2 : worker->count;
+	if (ret > max_sensors) {
+		ret = max_sensors;
+	}
+
+	if (steal) {
+		// Thief takes the most recently queued sensors, so owner still
+		// process the oldest ones
+		for (size_t i = 0; i < ret; ++i) {
+			const size_t pos = worker->head + worker->count - ret + i;
+			sensors[i] = worker->elms[pos % worker->capacity];
+		}
+	} else {
+		for (size_t i = 0; i < ret; ++i) {
+			const size_t pos = worker->head + i;
+			sensors[i] = worker->elms[pos % worker->capacity];
+		}
+		worker->head = ret ? (worker->head + ret) % worker->capacity
+				   : worker->head;
+	}
+	worker->count -= ret;
+	pthread_mutex_unlock(&worker->lock);
+
+	return ret;
+}
+
+/** Sensor home worker
+  @param queue Queue
+  @param sensor Sensor
+  @return Home worker index
+  */
+static size_t sensor_home_worker(const sensor_queue_t *queue,
+				 const rb_sensor_t *sensor) {
+	// Fibonacci hashing of sensor address, stable during sensor life
+	const uint64_t hash = (uint64_t)(uintptr_t)sensor *
+			      UINT64_C(11400714819323198485);
+	return (size_t)(hash >> 32) % queue->workers_count;
+}
+
+int sensor_queue_init(sensor_queue_t *queue, size_t workers_count) {
+	memset(queue, 0, sizeof(*queue));
+	queue->workers = calloc(workers_count, sizeof(queue->workers[0]));
+	if (NULL == queue->workers) {
+		rdlog(LOG_ERR, "Couldn't allocate workers queues (OOM?)");
+		return -1;
+	}
+
+	queue->workers_count = workers_count;
+	pthread_mutex_init(&queue->sleep_lock, NULL);
+	for (size_t i = 0; i < workers_count; ++i) {
+		pthread_mutex_init(&queue->workers[i].lock, NULL);
+		pthread_cond_init(&queue->workers[i].cond, NULL);
+	}
+
+	return 0;
 }
 
 void sensor_queue_done(sensor_queue_t *queue) {
-	rd_fifoq_destroy(queue);
+	for (size_t i = 0; i < queue->workers_count; ++i) {
+		struct sensor_queue_worker *worker = &queue->workers[i];
+		// Release sensors that no worker will process
+		for (size_t j = 0; j < worker->count; ++j) {
+			const size_t pos = (worker->head + j) % worker->capacity;
+			rb_sensor_put(worker->elms[pos]);
+		}
+		pthread_mutex_destroy(&worker->lock);
+		pthread_cond_destroy(&worker->cond);
+		free(worker->elms);
+	}
+	pthread_mutex_destroy(&queue->sleep_lock);
+	free(queue->workers);
+}
+
+/** Wake up a sleeping worker, preferring sensor home worker
+  @param queue Queue
+  @param home Home worker of queued sensor
+  */
+static void sensor_queue_wakeup(sensor_queue_t *queue, size_t home) {
+	pthread_mutex_lock(&queue->sleep_lock);
+	for (size_t i = 0; i < queue->workers_count; ++i) {
+		struct sensor_queue_worker *worker =
+				&queue->workers[(home + i) %
+						queue->workers_count];
+		if (worker->sleeping) {
+			worker->sleeping = false;
+			ATOMIC_OP(sub, fetch, &queue->sleepers, 1);
+			pthread_cond_signal(&worker->cond);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&queue->sleep_lock);
+}
+
+void queue_sensor(sensor_queue_t *queue, rb_sensor_t *sensor) {
+	const size_t home = sensor_home_worker(queue, sensor);
+	struct sensor_queue_worker *worker = &queue->workers[home];
+
+	if (ATOMIC_OP(add, fetch, &queue->stop, 0)) {
+		// No worker will pop it
+		rb_sensor_put(sensor);
+		return;
+	}
+
+	pthread_mutex_lock(&worker->lock);
+	if (worker->count == worker->capacity &&
+	    0 != sensor_deque_grow(worker)) {
+		pthread_mutex_unlock(&worker->lock);
+		rdlog(LOG_ERR,
+		      "Couldn't queue sensor %s (OOM?)",
+		      rb_sensor_name(sensor));
+		rb_sensor_put(sensor);
+		return;
+	}
+	worker->elms[(worker->head + worker->count) % worker->capacity] =
+			sensor;
+	worker->count++;
+	pthread_mutex_unlock(&worker->lock);
+
+	// Pairs with sleepers increment in pop_sensors: either we see the
+	// sleeper, or it sees the pending sensor before waiting
+	ATOMIC_OP(add, fetch, &queue->pending, 1);
+	if (ATOMIC_OP(add, fetch, &queue->sleepers, 0) > 0) {
+		sensor_queue_wakeup(queue, home);
+	}
+}
+
+/** Try to extract sensors from worker own deque, or steal them from other
+  workers deques
+  @param queue Queue
+  @param worker Worker index
+  @param sensors Sensors extracted
+  @param max_sensors Max sensors to extract
+  @return Number of sensors extracted
+  */
+static size_t pop_sensors0(sensor_queue_t *queue,
+			   size_t worker,
+			   rb_sensor_t **sensors,
+			   size_t max_sensors) {
+	size_t ret = 0;
+
+	for (size_t i = 0; 0 == ret && i < queue->workers_count; ++i) {
+		const size_t victim = (worker + i) % queue->workers_count;
+		ret = sensor_deque_pop(&queue->workers[victim],
+				       sensors,
+				       max_sensors,
+				       victim != worker);
+	}
+
+	if (ret) {
+		ATOMIC_OP(sub, fetch, &queue->pending, ret);
+	}
+
+	return ret;
+}
+
+size_t pop_sensors(sensor_queue_t *queue,
+		   size_t worker_idx,
+		   rb_sensor_t **sensors,
+		   size_t max_sensors) {
+	struct sensor_queue_worker *worker = &queue->workers[worker_idx];
+	size_t ret = 0;
+
+	assert(worker_idx < queue->workers_count);
+
+	while (!ATOMIC_OP(add, fetch, &queue->stop, 0)) {
+		ret = pop_sensors0(queue, worker_idx, sensors, max_sensors);
+		if (ret) {
+			break;
+		}
+
+		pthread_mutex_lock(&queue->sleep_lock);
+		worker->sleeping = true;
+		ATOMIC_OP(add, fetch, &queue->sleepers, 1);
+		if (0 == ATOMIC_OP(add, fetch, &queue->pending, 0) &&
+		    !queue->stop) {
+			pthread_cond_wait(&worker->cond, &queue->sleep_lock);
+		}
+
+		if (worker->sleeping) {
+			// Not woken up by a producer
+			worker->sleeping = false;
+			ATOMIC_OP(sub, fetch, &queue->sleepers, 1);
+		}
+		pthread_mutex_unlock(&queue->sleep_lock);
+	}
+
+	for (size_t i = 0; i < ret; ++i) {
+		assert_rb_sensor(sensors[i]);
+	}
+
+	return ret;
+}
+
+void sensor_queue_stop(sensor_queue_t *queue) {
+	pthread_mutex_lock(&queue->sleep_lock);
+	ATOMIC_OP(add, fetch, &queue->stop, 1);
+	for (size_t i = 0; i < queue->workers_count; ++i) {
+		pthread_cond_signal(&queue->workers[i].cond);
+	}
+	pthread_mutex_unlock(&queue->sleep_lock);
 }
@@ -21,44 +21,63 @@
 
 #include "rb_sensor.h"
 
-#include <librd/rdqueue.h>
-#include <librd/rdthread.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
 
-#include <assert.h>
+/// Max number of sensors a worker takes from the queue at once
+#define SENSOR_QUEUE_BATCH 8
 
-/// Sensors queue
-typedef rd_fifoq_t sensor_queue_t;
+/// Worker own sensors deque
+struct sensor_queue_worker;
+
+/** Sensors queue. Every worker owns a deque, and every sensor has a home
+  worker, so the same sensor is usually processed by the same thread. Idle
+  workers steal sensors from other workers deques, and sleep with no timeout
+  when there is nothing to do. */
+typedef struct sensor_queue {
+	struct sensor_queue_worker *workers; ///< Workers deques
+	size_t workers_count;		     ///< Length of workers
+	size_t pending;			     ///< Sensors queued in any deque
+	size_t sleepers;		     ///< Workers waiting for sensors
+	int stop;			     ///< Wake up and return workers
+	pthread_mutex_t sleep_lock;	  ///< Protects sleeping workers
+} sensor_queue_t;
 
 /** Initialize a new sensor queue
   @param queue Queue to init
+  @param workers_count Number of workers that will pop from the queue
+  @return 0 if success, !0 in other case
   */
-void sensor_queue_init(sensor_queue_t *queue);
-/** Destroy a sensor queue
+int sensor_queue_init(sensor_queue_t *queue, size_t workers_count);
+/** Destroy a sensor queue, releasing sensors still queued
   @param queue Queue to finish
   */
 void sensor_queue_done(sensor_queue_t *queue);
 
-/** Queue a sensor
+/** Queue a sensor in its home worker deque, waking up a worker if needed.
+  Queue takes sensor reference. If queue is stopped, sensor is released.
   @param queue Queue
   @param sensor Sensor
   */
-#define queue_sensor rd_fifoq_add
+void queue_sensor(sensor_queue_t *queue, rb_sensor_t *sensor);
 
-/** Pop a sensor from the queue sensor
+/** Pop a batch of sensors. It will try worker own deque first, and will steal
+  from other workers if it is empty. If there is no sensor in any deque, it
+  will wait until one is queued or the queue is stopped.
   @param queue Queue of sensors
-  @tmo_ms Timeout in ms
-  @return Sensor extracted, or NULL if any
+  @param worker Worker index
+  @param sensors Sensors extracted
+  @param max_sensors Max sensors to extract
+  @return Number of sensors extracted, or 0 if queue was stopped
   */
-static rb_sensor_t *
-pop_sensor(sensor_queue_t *queue, int tmo_ms) __attribute__((unused));
-static rb_sensor_t *pop_sensor(sensor_queue_t *queue, int tmo_ms) {
-	rb_sensor_t *sensor = NULL;
-	rd_fifoq_elm_t *elm = rd_fifoq_pop_timedwait(queue, tmo_ms);
-	if (elm) {
-		sensor = elm->rfqe_ptr;
-		rd_fifoq_elm_release(queue, elm);
-		assert_rb_sensor(sensor);
-	}
+size_t pop_sensors(sensor_queue_t *queue,
+		   size_t worker,
+		   rb_sensor_t **sensors,
+		   size_t max_sensors);
 
-	return sensor;
-}
+/** Wake up all workers waiting in pop_sensors, and make it return 0 from now
+  on
+  @param queue Queue
+  */
+void sensor_queue_stop(sensor_queue_t *queue);
@@ -0,0 +1,194 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_sensor_scheduler.h"
+
+#include "rb_timer_wheel.h"
+
+#include <librd/rdlog.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <time.h>
+
+/// Sensor poll schedule
+struct sensor_schedule {
+	struct rb_timer timer; ///< Wheel timer. Must be the first member
+	rb_sensor_t *sensor;   ///< Sensor to poll
+	uint64_t period;       ///< Poll period, in ticks
+	bool delayed;	  ///< Cycle delayed by an overrun
+};
+
+struct rb_sensors_scheduler {
+	struct rb_timer_wheel wheel;	///< Sensors timers
+	struct sensor_schedule *schedules; ///< Sensors schedules
+	size_t schedules_count;		   ///< Length of schedules
+	sensor_queue_t *queue;		   ///< Queue to push due sensors
+	/// Overrun policy of sensors with no policy
+	enum rb_sensor_overrun_policy overrun_policy;
+};
+
+/** Current monotonic tick
+  @return Monotonic clock, in scheduler ticks
+  */
+static uint64_t scheduler_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000 +
+		(uint64_t)ts.tv_nsec / 1000000) /
+	       RB_SENSORS_SCHEDULER_TICK_MS;
+}
+
+/** Deterministic sensor phase inside its period, so the same sensor is
+  always polled at the same offset, and different sensors are spread.
+  @param sensor Sensor
+  @param period Sensor period
+  @return Phase offset
+  */
+static uint64_t sensor_phase(const rb_sensor_t *sensor, uint64_t period) {
+	// FNV-1a
+	uint64_t hash = UINT64_C(14695981039346656037);
+	for (const char *c = rb_sensor_name(sensor); *c; ++c) {
+		hash ^= (uint8_t)*c;
+		hash *= UINT64_C(1099511628211);
+	}
+
+	return hash % period;
+}
+
+struct rb_sensors_scheduler *
+rb_sensors_scheduler_new(rb_sensors_array_t *sensors,
+			 uint64_t default_interval_ms,
+			 enum rb_sensor_overrun_policy overrun_policy,
+			 sensor_queue_t *queue) {
+	struct rb_sensors_scheduler *ret = calloc(1, sizeof(*ret));
+	if (NULL == ret) {
+		rdlog(LOG_ERR, "Couldn't allocate sensors scheduler (OOM?)");
+		return NULL;
+	}
+
+	ret->schedules = calloc(sensors->count, sizeof(ret->schedules[0]));
+	if (NULL == ret->schedules && sensors->count > 0) {
+		rdlog(LOG_ERR, "Couldn't allocate sensors schedules (OOM?)");
+		free(ret);
+		return NULL;
+	}
+
+	const uint64_t now = scheduler_now();
+	ret->queue = queue;
+	ret->overrun_policy = overrun_policy;
+	rb_timer_wheel_init(&ret->wheel, now);
+
+	for (size_t i = 0; i < sensors->count; ++i) {
+		struct sensor_schedule *schedule = &ret->schedules[i];
+		rb_sensor_t *sensor = sensors->elms[i];
+		const uint64_t period_ms = rb_sensor_poll_period_ms(
+				sensor,
+				default_interval_ms,
+				RB_SENSORS_SCHEDULER_TICK_MS);
+
+		schedule->sensor = sensor;
+		schedule->period = period_ms / RB_SENSORS_SCHEDULER_TICK_MS;
+		rb_timer_wheel_add(&ret->wheel,
+				   &schedule->timer,
+				   now + sensor_phase(sensor, schedule->period));
+	}
+	ret->schedules_count = sensors->count;
+
+	return ret;
+}
+
+/** Sensor timer expired: queue it if previous cycle is done, and schedule
+  next poll
+  @param timer Sensor timer
+  @param vscheduler Scheduler
+  */
+static void scheduler_sensor_due(struct rb_timer *timer, void *vscheduler) {
+	static const uint64_t delay_retry = RB_SENSORS_SCHEDULER_DELAY_RETRY_MS /
+					    RB_SENSORS_SCHEDULER_TICK_MS;
+	struct rb_sensors_scheduler *scheduler = vscheduler;
+	struct sensor_schedule *schedule = (struct sensor_schedule *)timer;
+	const uint64_t now = scheduler->wheel.now;
+	uint64_t next = timer->expires + schedule->period;
+
+	switch (rb_sensor_cycle_start(schedule->sensor,
+				      scheduler->overrun_policy)) {
+	case RB_SENSOR_CYCLE_STARTED:
+		if (schedule->delayed) {
+			// Shift schedule after the delayed cycle
+			rb_sensor_cycle_late(schedule->sensor);
+			schedule->delayed = false;
+			next = now + schedule->period;
+		}
+
+		rb_sensor_get(schedule->sensor);
+		queue_sensor(scheduler->queue, schedule->sensor);
+		break;
+
+	case RB_SENSOR_CYCLE_DELAYED:
+		schedule->delayed = true;
+		next = now + (delay_retry < schedule->period ? delay_retry
+							     : schedule->period);
+		break;
+
+	case RB_SENSOR_CYCLE_SKIPPED:
+	case RB_SENSOR_CYCLE_COALESCED:
+	default:
+		break;
+	};
+
+	if (next <= now) {
+		// We are late (suspended?). Keep phase, but don't burst.
+		const uint64_t late = now - next;
+		next += (late / schedule->period + 1) * schedule->period;
+	}
+
+	rb_timer_wheel_add(&scheduler->wheel, timer, next);
+}
+
+void rb_sensors_scheduler_run(struct rb_sensors_scheduler *scheduler,
+			      uint64_t max_wait_ms) {
+	const uint64_t now = scheduler_now();
+	rb_timer_wheel_advance(
+			&scheduler->wheel, now, scheduler_sensor_due, scheduler);
+
+	uint64_t next = rb_timer_wheel_next(&scheduler->wheel);
+	const uint64_t max_next =
+			now + max_wait_ms / RB_SENSORS_SCHEDULER_TICK_MS;
+	if (next > max_next) {
+		next = max_next;
+	}
+
+	const uint64_t next_ms = next * RB_SENSORS_SCHEDULER_TICK_MS;
+	const struct timespec wakeup = {
+			.tv_sec = (time_t)(next_ms / 1000),
+			.tv_nsec = (long)(next_ms % 1000) * 1000000,
+	};
+
+	const int rc = clock_nanosleep(
+			CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL);
+	if (0 != rc && EINTR != rc) {
+		rdlog(LOG_ERR, "Couldn't sleep scheduler: %s", strerror(rc));
+	}
+}
+
+void rb_sensors_scheduler_done(struct rb_sensors_scheduler *scheduler) {
+	free(scheduler->schedules);
+	free(scheduler);
+}
@@ -0,0 +1,62 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "rb_sensor.h"
+#include "rb_sensor_queue.h"
+
+#include <stdint.h>
+
+/// Scheduler resolution, in milliseconds
+#define RB_SENSORS_SCHEDULER_TICK_MS 10
+/// Time to retry starting a delayed sensor cycle, in milliseconds
+#define RB_SENSORS_SCHEDULER_DELAY_RETRY_MS 100
+
+/** Sensors poll scheduler. Every sensor is queued each time its poll period
+  elapses, driven by a hierarchical timing wheel. Each sensor has a
+  deterministic phase offset inside its period, so sensors with the same
+  period are spread over it instead of being queued in the same burst. */
+struct rb_sensors_scheduler;
+
+/** Creates a sensors scheduler
+  @param sensors Sensors to schedule. They must be alive until scheduler is
+  done.
+  @param default_interval_ms Interval of sensors with no interval
+  @param overrun_policy Overrun policy of sensors with no policy
+  @param queue Queue to push sensors to when they are due
+  @return New scheduler, or NULL in case of error
+  */
+struct rb_sensors_scheduler *
+rb_sensors_scheduler_new(rb_sensors_array_t *sensors,
+			 uint64_t default_interval_ms,
+			 enum rb_sensor_overrun_policy overrun_policy,
+			 sensor_queue_t *queue);
+
+/** Queue due sensors, and sleep until next sensor is due
+  @param scheduler Scheduler
+  @param max_wait_ms Max time to sleep
+  */
+void rb_sensors_scheduler_run(struct rb_sensors_scheduler *scheduler,
+			      uint64_t max_wait_ms);
+
+/** Free a sensors scheduler
+  @param scheduler Scheduler
+  */
+void rb_sensors_scheduler_done(struct rb_sensors_scheduler *scheduler);
@@ -0,0 +1,276 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_sink_queue.h"
+
+#include <librd/rdlog.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/// Initial capacity of queues ring buffer
+#define QUEUE_INITIAL_CAPACITY 64
+
+const char *const rb_sink_queue_policies[RB_SINK_QUEUE_POLICIES_COUNT] = {
+		[RB_SINK_QUEUE_DROP_NEWEST] = "drop_newest",
+		[RB_SINK_QUEUE_DROP_OLDEST] = "drop_oldest",
+		[RB_SINK_QUEUE_DROP_PRIORITY] = "drop_priority",
+		[RB_SINK_QUEUE_BLOCK] = "block",
+		[RB_SINK_QUEUE_SPOOL] = "spool",
+};
+
+void rb_sink_queue_init(struct rb_sink_queue *queue, size_t max_messages) {
+	memset(queue, 0, sizeof(*queue));
+	queue->high_watermark = queue->low_watermark = max_messages;
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->cond, NULL);
+	pthread_cond_init(&queue->room_cond, NULL);
+	pthread_cond_init(&queue->stop_cond, NULL);
+}
+
+void rb_sink_queue_done(struct rb_sink_queue *queue) {
+	for (size_t i = 0; i < queue->count; ++i) {
+		const size_t pos = (queue->head + i) % queue->capacity;
+		rb_message_array_put(queue->elms[pos]);
+	}
+	free(queue->elms);
+	pthread_cond_destroy(&queue->cond);
+	pthread_cond_destroy(&queue->room_cond);
+	pthread_cond_destroy(&queue->stop_cond);
+	pthread_mutex_destroy(&queue->lock);
+}
+
+/** Grows a sink queue ring buffer. Need to hold queue lock.
+  @param queue Queue
+  @return 0 if success, !0 in other case
+  */
+static int queue_grow(struct rb_sink_queue *queue) {
+	const size_t new_capacity = queue->capacity
+					    ? 2 * queue->capacity
+					    : QUEUE_INITIAL_CAPACITY;
+	rb_message_array_t **elms = malloc(new_capacity * sizeof(elms[0]));
+	if (NULL == elms) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < queue->count; ++i) {
+		elms[i] = queue->elms[(queue->head + i) % queue->capacity];
+	}
+
+	free(queue->elms);
+	queue->elms = elms;
+	queue->capacity = new_capacity;
+	queue->head = 0;
+	return 0;
+}
+
+/** Remove a messages array from queue. Need to hold queue lock.
+  @param queue Queue
+  @param i Position of array, relative to queue head
+  @return Removed array
+  */
+static rb_message_array_t *queue_remove(struct rb_sink_queue *queue,
+					size_t i) {
+	rb_message_array_t *ret =
+			queue->elms[(queue->head + i) % queue->capacity];
+
+	// Close the gap with the previous elements
+	for (; i > 0; --i) {
+		queue->elms[(queue->head + i) % queue->capacity] =
+				queue->elms[(queue->head + i - 1) %
+					    queue->capacity];
+	}
+	queue->head = (queue->head + 1) % queue->capacity;
+	queue->count--;
+	queue->messages -= ret->count;
+
+	return ret;
+}
+
+/** Position of the oldest array with the lowest priority, if lower than
+  the given one. Need to hold queue lock.
+  @param queue Queue
+  @param priority Priority
+  @return Array position, relative to queue head, or queue->count if no
+  array has a lower priority
+  */
+static size_t queue_lowest_priority(const struct rb_sink_queue *queue,
+				    int priority) {
+	size_t ret = queue->count;
+	for (size_t i = 0; i < queue->count; ++i) {
+		const rb_message_array_t *msgs =
+				queue->elms[(queue->head + i) % queue->capacity];
+		if (msgs->priority < priority) {
+			ret = i;
+			priority = msgs->priority;
+		}
+	}
+
+	return ret;
+}
+
+/** Drop queued arrays to make room for new messages, following queue
+  overflow policy. Need to hold queue lock.
+  @param queue Queue
+  @param msgs New messages array
+  @return Number of dropped messages
+  */
+static size_t queue_evict(struct rb_sink_queue *queue,
+			  const rb_message_array_t *msgs) {
+	size_t ret = 0;
+	while (queue->count > 0 &&
+	       queue->messages + msgs->count > queue->low_watermark) {
+		size_t i = 0;
+		if (RB_SINK_QUEUE_DROP_PRIORITY == queue->policy) {
+			i = queue_lowest_priority(queue, msgs->priority);
+			if (i == queue->count) {
+				break;
+			}
+		}
+
+		rb_message_array_t *dropped = queue_remove(queue, i);
+		ret += dropped->count;
+		rb_message_array_put(dropped);
+	}
+
+	if (queue->messages + msgs->count <= queue->low_watermark) {
+		queue->overloaded = false;
+	}
+
+	return ret;
+}
+
+bool rb_sink_queue_push(struct rb_sink_queue *queue,
+			rb_message_array_t *msgs,
+			const char *sink_name,
+			size_t *evicted,
+			bool *blocked) {
+	bool ret = false;
+	*evicted = 0;
+	*blocked = false;
+
+	pthread_mutex_lock(&queue->lock);
+	// Big arrays are accepted in an empty queue
+	if (!queue->overloaded && queue->count > 0 &&
+	    queue->messages + msgs->count > queue->high_watermark) {
+		queue->overloaded = true;
+		rdlog(LOG_WARNING,
+		      "Sink %s queue reached high watermark (%zu messages), "
+		      "applying %s policy",
+		      sink_name,
+		      queue->messages,
+		      rb_sink_queue_policies[queue->policy]);
+	}
+
+	switch (queue->policy) {
+	case RB_SINK_QUEUE_DROP_OLDEST:
+	case RB_SINK_QUEUE_DROP_PRIORITY:
+		if (queue->overloaded) {
+			*evicted = queue_evict(queue, msgs);
+		}
+		break;
+	case RB_SINK_QUEUE_BLOCK:
+		while (queue->overloaded && !queue->stop) {
+			*blocked = true;
+			pthread_cond_wait(&queue->room_cond, &queue->lock);
+		}
+		break;
+	default:
+		break;
+	};
+
+	// Lowest priority arrays are accepted up to high watermark
+	const bool room =
+			0 == queue->count ||
+			((!queue->overloaded ||
+			  RB_SINK_QUEUE_DROP_PRIORITY == queue->policy) &&
+			 queue->messages + msgs->count <=
+					 queue->high_watermark);
+	if (room && (queue->count < queue->capacity ||
+		     0 == queue_grow(queue))) {
+		queue->elms[(queue->head + queue->count) % queue->capacity] =
+				msgs;
+		queue->count++;
+		queue->messages += msgs->count;
+		ret = true;
+		pthread_cond_signal(&queue->cond);
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return ret;
+}
+
+rb_message_array_t *rb_sink_queue_pop(struct rb_sink_queue *queue,
+				      const char *sink_name) {
+	rb_message_array_t *ret = NULL;
+
+	pthread_mutex_lock(&queue->lock);
+	while (0 == queue->count && !queue->stop) {
+		pthread_cond_wait(&queue->cond, &queue->lock);
+	}
+
+	if (queue->count > 0) {
+		ret = queue_remove(queue, 0);
+	}
+
+	if (queue->overloaded && queue->messages <= queue->low_watermark) {
+		queue->overloaded = false;
+		rdlog(LOG_INFO,
+		      "Sink %s queue back to low watermark",
+		      sink_name);
+		pthread_cond_broadcast(&queue->room_cond);
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return ret;
+}
+
+void rb_sink_queue_stop(struct rb_sink_queue *queue) {
+	pthread_mutex_lock(&queue->lock);
+	queue->stop = true;
+	pthread_cond_broadcast(&queue->cond);
+	pthread_cond_broadcast(&queue->room_cond);
+	pthread_cond_broadcast(&queue->stop_cond);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+bool rb_sink_queue_wait_stop(struct rb_sink_queue *queue,
+			     int timeout_ms,
+			     size_t *messages) {
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&queue->lock);
+	while (!queue->stop &&
+	       0 == pthread_cond_timedwait(
+			       &queue->stop_cond, &queue->lock, &deadline))
+		;
+	const bool ret = queue->stop;
+	*messages = queue->messages;
+	pthread_mutex_unlock(&queue->lock);
+
+	return ret;
+}
@@ -0,0 +1,113 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "rb_message_list.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/// What to do with new messages when a sink queue is over its high watermark
+enum rb_sink_queue_policy {
+	RB_SINK_QUEUE_DROP_NEWEST, ///< Drop new messages
+	/// Drop queued messages, oldest first, until queue is below low
+	/// watermark
+	RB_SINK_QUEUE_DROP_OLDEST,
+	/// Drop queued messages with lower priority than the new ones, lowest
+	/// and oldest first. New messages are dropped if there are not enough.
+	RB_SINK_QUEUE_DROP_PRIORITY,
+	/// Block workers until queue is below low watermark
+	RB_SINK_QUEUE_BLOCK,
+	RB_SINK_QUEUE_SPOOL, ///< Spool new messages
+	RB_SINK_QUEUE_POLICIES_COUNT,
+};
+
+/// Policies names, as they appear in config
+extern const char *const rb_sink_queue_policies[RB_SINK_QUEUE_POLICIES_COUNT];
+
+/// Sink bounded queue of messages arrays
+struct rb_sink_queue {
+	pthread_mutex_t lock;	 ///< Protects queue
+	pthread_cond_t cond;	  ///< Signaled when arrays are queued
+	pthread_cond_t room_cond;     ///< Signaled when queue is not overloaded
+	pthread_cond_t stop_cond;     ///< Signaled when queue is stopped
+	rb_message_array_t **elms; ///< Ring buffer
+	size_t capacity;	   ///< Length of elms
+	size_t head;		   ///< First element position
+	size_t count;		   ///< Number of arrays in queue
+	size_t messages;	   ///< Number of messages in queue
+	size_t high_watermark;     ///< Max number of messages in queue
+	/// Overloaded queue accepts messages again below this number of
+	/// messages
+	size_t low_watermark;
+	enum rb_sink_queue_policy policy; ///< What to do when overloaded
+	bool overloaded; ///< Queue reached high watermark, and not low yet
+	bool stop;       ///< Senders must return when queue is empty
+};
+
+/** Initialize a queue. Watermarks and policy can be set before using it.
+  @param queue Queue
+  @param max_messages High and low watermark
+  */
+void rb_sink_queue_init(struct rb_sink_queue *queue, size_t max_messages);
+
+/** Release queue resources and queued messages
+  @param queue Queue
+  */
+void rb_sink_queue_done(struct rb_sink_queue *queue);
+
+/** Queue a messages array, applying queue overflow policy if it is over its
+  high watermark. It only blocks with block policy.
+  @param queue Queue
+  @param msgs Messages array
+  @param sink_name Sink name, for logging
+  @param evicted Queued messages dropped to make room for the new ones
+  @param blocked If push had to wait for room in queue
+  @return true if queued, false if it must be dropped or spooled
+  */
+bool rb_sink_queue_push(struct rb_sink_queue *queue,
+			rb_message_array_t *msgs,
+			const char *sink_name,
+			size_t *evicted,
+			bool *blocked);
+
+/** Extract a messages array from queue, waiting for it if queue is empty
+  @param queue Queue
+  @param sink_name Sink name, for logging
+  @return Messages array, or NULL if queue is stopped and empty
+  */
+rb_message_array_t *rb_sink_queue_pop(struct rb_sink_queue *queue,
+				      const char *sink_name);
+
+/** Make senders return when queue is empty
+  @param queue Queue
+  */
+void rb_sink_queue_stop(struct rb_sink_queue *queue);
+
+/** Wait until queue is stopped, or timeout
+  @param queue Queue
+  @param timeout_ms Max time to wait
+  @param messages Number of messages in queue at return
+  @return true if queue is stopped
+  */
+bool rb_sink_queue_wait_stop(struct rb_sink_queue *queue,
+			     int timeout_ms,
+			     size_t *messages);
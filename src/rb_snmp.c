@@ -18,6 +18,9 @@
 */
 
 #include "rb_snmp.h"
+
+#include "rb_number.h"
+
 #include <assert.h>
 #include <librd/rd.h>
 #include <librd/rdlog.h>
@@ -25,6 +28,8 @@
 bool new_snmp_session(struct monitor_snmp_session *ss,
 		      netsnmp_session *params) {
 
+	memset(&ss->engine, 0, sizeof(ss->engine));
+	TAILQ_INIT(&ss->engine.waiting);
 	ss->sessp = snmp_sess_open(params);
 	if (unlikely(NULL == ss->sessp)) {
 		char *strerror_buf = NULL;
@@ -36,18 +41,96 @@ bool new_snmp_session(struct monitor_snmp_session *ss,
 	return ss->sessp != NULL;
 }
 
+bool snmp_variable_value(char *value_buf,
+			 size_t value_buf_len,
+			 double *number,
+			 const netsnmp_variable_list *var) {
+	const size_t effective_len = RD_MIN(value_buf_len, var->val_len);
+
+	assert(value_buf);
+	assert(number);
+
+	// See in /usr/include/net-snmp/types.h
+	switch (var->type) {
+	case ASN_GAUGE:
+	case ASN_INTEGER:
+		if (value_buf_len >= RB_NUMBER_INT_BUFSIZ) {
+			rb_number_format_int(value_buf, *var->val.integer);
+		} else {
+			snprintf(value_buf,
+				 value_buf_len,
+				 "%ld",
+				 *var->val.integer);
+		}
+		*number = *var->val.integer;
+		return true;
+	case ASN_OCTET_STR:
+		if (effective_len == 0) {
+			return false;
+		}
+
+		snprintf(value_buf,
+			 value_buf_len,
+			 "%.*s",
+			 (int)var->val_len,
+			 var->val.string);
+
+		*number = rb_number_parse(value_buf, NULL);
+		return true;
+
+	default:
+		rdlog(LOG_WARNING,
+		      "Unknow variable type %d in SNMP response",
+		      var->type);
+		return false;
+	};
+}
+
+bool snmp_variable_number(double *number, const netsnmp_variable_list *var) {
+	char buf[64];
+
+	assert(number);
+
+	switch (var->type) {
+	case ASN_INTEGER:
+		*number = *var->val.integer;
+		return true;
+	case ASN_GAUGE:
+	case ASN_COUNTER:
+	case ASN_TIMETICKS:
+		*number = (unsigned long)*var->val.integer;
+		return true;
+	case ASN_COUNTER64:
+		*number = (double)var->val.counter64->high * 4294967296.0 +
+			  (double)var->val.counter64->low;
+		return true;
+	case ASN_OCTET_STR:
+		if (0 == var->val_len) {
+			return false;
+		}
+
+		snprintf(buf,
+			 sizeof(buf),
+			 "%.*s",
+			 (int)var->val_len,
+			 var->val.string);
+		*number = rb_number_parse(buf, NULL);
+		return true;
+	default:
+		return false;
+	};
+}
+
 bool snmp_solve_response(char *value_buf,
 			 size_t value_buf_len,
 			 double *number,
 			 struct monitor_snmp_session *session,
-			 const char *oid_string) {
+			 const oid *name,
+			 size_t name_len) {
 	struct snmp_pdu *pdu = snmp_pdu_create(SNMP_MSG_GET);
 	struct snmp_pdu *response = NULL;
 
-	oid entry_oid[MAX_OID_LEN];
-	size_t entry_oid_len = MAX_OID_LEN;
-	read_objid(oid_string, entry_oid, &entry_oid_len);
-	snmp_add_null_var(pdu, entry_oid, entry_oid_len);
+	snmp_add_null_var(pdu, name, name_len);
 	const int status = snmp_sess_synch_response(
 			session->sessp, pdu, &response);
 	/* A lot of variables. Just if we pass SNMPV3 someday.
@@ -69,46 +152,14 @@ bool snmp_solve_response(char *value_buf,
 	} else if (NULL == response) {
 		rdlog(LOG_ERR, "No SNMP response given.");
 	} else {
+		ret = snmp_variable_value(value_buf,
+					  value_buf_len,
+					  number,
+					  response->variables);
 		rdlog(LOG_DEBUG,
-		      "SNMP OID %s response type %d: %s",
-		      oid_string,
+		      "SNMP response type %d: %s",
 		      response->variables->type,
 		      value_buf);
-		const size_t effective_len = RD_MIN(
-				value_buf_len, response->variables->val_len);
-
-		// See in /usr/include/net-snmp/types.h
-		switch (response->variables->type) {
-		case ASN_GAUGE:
-		case ASN_INTEGER:
-			snprintf(value_buf,
-				 value_buf_len,
-				 "%ld",
-				 *response->variables->val.integer);
-			*number = *response->variables->val.integer;
-			ret = 1;
-			break;
-		case ASN_OCTET_STR:
-			if (effective_len == 0) {
-				ret = 0;
-				break;
-			}
-
-			snprintf(value_buf,
-				 value_buf_len,
-				 "%.*s",
-				 (int)response->variables->val_len,
-				 response->variables->val.string);
-
-			*number = strtod(value_buf, NULL);
-			ret = 1;
-			break;
-
-		default:
-			rdlog(LOG_WARNING,
-			      "Unknow variable type %d in SNMP response",
-			      response->variables->type);
-		};
 	}
 
 	if (response) {
@@ -136,5 +187,7 @@ int net_snmp_version(const char *string_version, const char *sensor_name) {
 }
 
 void destroy_snmp_session(struct monitor_snmp_session *s) {
+	assert(0 == s->engine.inflight);
+	assert(TAILQ_EMPTY(&s->engine.waiting));
 	snmp_sess_close(s->sessp);
 }
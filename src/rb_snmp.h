@@ -24,11 +24,25 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <sys/queue.h>
+
+/* FW declaration */
+struct rb_snmp_engine_request;
 
 /// Structure to be able to safely pass-around net-snmp pointer
 typedef struct monitor_snmp_session {
 	// Private data - Do not use
 	void *sessp; ///< net-snmp session opaque pointer
+
+	/// Async engine private data. Only accessed from engine thread
+	struct {
+		size_t inflight; ///< Requests sent and waiting for response
+		/// Requests waiting for an in-flight slot
+		TAILQ_HEAD(, rb_snmp_engine_request) waiting;
+		/// Engine active sessions list entry
+		TAILQ_ENTRY(monitor_snmp_session) active_entry;
+		bool active; ///< Session is in engine active list
+	} engine;
 } monitor_snmp_session;
 
 /** Creates a new net-snmp session based on config
@@ -45,14 +59,38 @@ bool new_snmp_session(struct monitor_snmp_session *ss, netsnmp_session *params);
   @param number      If possible, the response will be saved in double format
   here
   @param _session    SNMP session to use
-  @param _oid_string String representing oid
+  @param name        OID to ask for
+  @param name_len    OID length
   @return            0 if number was not setted; non 0 otherwise.
  */
 bool snmp_solve_response(char *value_buf,
 			 size_t value_buf_len,
 			 double *number,
 			 struct monitor_snmp_session *session,
-			 const char *oid_string);
+			 const oid *name,
+			 size_t name_len);
+
+/** Extract a SNMP response variable value
+  @param value_buf   Return buffer where the response will be saved (text
+  format)
+  @param value_buf_len Buffer value_buf length
+  @param number      If possible, the response will be saved in double format
+  here
+  @param var         Response variable
+  @return            0 if number was not setted; non 0 otherwise.
+  */
+bool snmp_variable_value(char *value_buf,
+			 size_t value_buf_len,
+			 double *number,
+			 const netsnmp_variable_list *var);
+
+/** Extract a SNMP response variable numeric value, with no text conversion
+  if possible
+  @param number Numeric value
+  @param var Response variable
+  @return true if variable has a numeric value, false in other case
+  */
+bool snmp_variable_number(double *number, const netsnmp_variable_list *var);
 
 void destroy_snmp_session(struct monitor_snmp_session *);
 
@@ -0,0 +1,436 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include "utils.h"
+
+#include "rb_snmp_engine.h"
+
+#include <librd/rd.h>
+#include <librd/rdlog.h>
+
+#include <net-snmp/library/large_fd_set.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/// Maximum time engine thread waits in select, so it can check run flag
+#define SNMP_ENGINE_MAX_WAIT_S 1
+
+/// Engine request
+struct rb_snmp_engine_request {
+	TAILQ_ENTRY(rb_snmp_engine_request) entry; ///< Request list entry
+	struct rb_snmp_engine *engine;		   ///< Engine it belongs
+	struct monitor_snmp_session *session;      ///< Session to send through
+	struct snmp_pdu *pdu;			   ///< PDU to send
+	struct snmp_pdu *response;		   ///< Response PDU clone
+	int status;				   ///< Request status
+	bool sent;				   ///< PDU is owned by net-snmp
+	rb_snmp_engine_cb cb;			   ///< User callback
+	void *opaque;				   ///< User callback opaque
+};
+
+/// Requests list
+TAILQ_HEAD(rb_snmp_engine_requests, rb_snmp_engine_request);
+
+struct rb_snmp_engine {
+	pthread_t thread;	///< Event loop thread
+	int run;		 ///< Engine thread should keep running
+	size_t max_inflight;     ///< Max in flight requests per session
+	int wakeup_pipe[2];      ///< Wakes up engine when a request arrives
+	pthread_mutex_t lock;    ///< Protects submitted and stopping
+	/// Requests submitted by other threads
+	struct rb_snmp_engine_requests submitted;
+	bool stopping; ///< Engine does not accept requests anymore
+
+	/* Engine thread only data */
+	/// Sessions with requests in flight or waiting
+	TAILQ_HEAD(, monitor_snmp_session) active;
+	/// Requests with response, waiting for callback call
+	struct rb_snmp_engine_requests completed;
+};
+
+/** Mark a request as completed
+  @param req Request
+  @param status Request status
+  */
+static void snmp_engine_request_complete(struct rb_snmp_engine_request *req,
+					 int status) {
+	req->status = status;
+	TAILQ_INSERT_TAIL(&req->engine->completed, req, entry);
+}
+
+/** net-snmp async callback. We only save the response here, since net-snmp
+  will keep touching session after this function returns
+  */
+static int snmp_engine_response_cb(int operation,
+				   netsnmp_session *sp,
+				   int reqid,
+				   netsnmp_pdu *pdu,
+				   void *magic) {
+	struct rb_snmp_engine_request *req = magic;
+	(void)sp;
+	(void)reqid;
+
+	switch (operation) {
+	case NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE:
+		req->response = snmp_clone_pdu(pdu);
+		if (NULL == req->response) {
+			rdlog(LOG_ERR, "Couldn't clone SNMP response (OOM?)");
+		}
+		snmp_engine_request_complete(req,
+					     req->response ? STAT_SUCCESS
+							   : STAT_ERROR);
+		break;
+
+	case NETSNMP_CALLBACK_OP_TIMED_OUT:
+		snmp_engine_request_complete(req, STAT_TIMEOUT);
+		break;
+
+	default:
+		// Request is still alive, net-snmp will retry or time it out
+		rdlog(LOG_DEBUG, "SNMP callback operation %d", operation);
+		break;
+	};
+
+	return 1;
+}
+
+/** Send a request through its session
+  @param req Request to send
+  */
+static void snmp_engine_request_send(struct rb_snmp_engine_request *req) {
+	struct monitor_snmp_session *session = req->session;
+
+	const int reqid = snmp_sess_async_send(
+			session->sessp, req->pdu, snmp_engine_response_cb, req);
+	if (0 == reqid) {
+		char *errstr = NULL;
+		snmp_sess_error(session->sessp, NULL, NULL, &errstr);
+		rdlog(LOG_ERR, "Couldn't send SNMP request: %s", errstr);
+		free(errstr);
+		snmp_free_pdu(req->pdu);
+		req->pdu = NULL;
+		snmp_engine_request_complete(req, STAT_ERROR);
+		return;
+	}
+
+	req->pdu = NULL; // net-snmp owns it now
+	req->sent = true;
+	session->engine.inflight++;
+}
+
+/** Send session waiting requests while it has free in-flight slots
+  @param engine SNMP engine
+  @param session Session to flush
+  */
+static void snmp_engine_session_flush(struct rb_snmp_engine *engine,
+				      struct monitor_snmp_session *session) {
+	struct rb_snmp_engine_request *req = NULL;
+	while (session->engine.inflight < engine->max_inflight &&
+	       (req = TAILQ_FIRST(&session->engine.waiting))) {
+		TAILQ_REMOVE(&session->engine.waiting, req, entry);
+		snmp_engine_request_send(req);
+	}
+}
+
+/** Move submitted requests to their sessions, and send as many as possible
+  @param engine SNMP engine
+  */
+static void snmp_engine_dispatch_submitted(struct rb_snmp_engine *engine) {
+	struct rb_snmp_engine_requests submitted;
+	struct rb_snmp_engine_request *req = NULL;
+
+	TAILQ_INIT(&submitted);
+	pthread_mutex_lock(&engine->lock);
+	while ((req = TAILQ_FIRST(&engine->submitted))) {
+		TAILQ_REMOVE(&engine->submitted, req, entry);
+		TAILQ_INSERT_TAIL(&submitted, req, entry);
+	}
+	pthread_mutex_unlock(&engine->lock);
+
+	while ((req = TAILQ_FIRST(&submitted))) {
+		struct monitor_snmp_session *session = req->session;
+		TAILQ_REMOVE(&submitted, req, entry);
+		TAILQ_INSERT_TAIL(&session->engine.waiting, req, entry);
+		if (!session->engine.active) {
+			session->engine.active = true;
+			TAILQ_INSERT_TAIL(&engine->active,
+					  session,
+					  engine.active_entry);
+		}
+		snmp_engine_session_flush(engine, session);
+	}
+}
+
+/** Wait for sessions responses, and process them
+  @param engine SNMP engine
+  @param fdset fd set to use
+  */
+static void snmp_engine_poll(struct rb_snmp_engine *engine,
+			     netsnmp_large_fd_set *fdset) {
+	struct monitor_snmp_session *session = NULL;
+	struct timeval timeout = {.tv_sec = SNMP_ENGINE_MAX_WAIT_S};
+	int numfds = engine->wakeup_pipe[0] + 1;
+
+	NETSNMP_LARGE_FD_ZERO(fdset);
+	NETSNMP_LARGE_FD_SET(engine->wakeup_pipe[0], fdset);
+
+	TAILQ_FOREACH(session, &engine->active, engine.active_entry) {
+		int block = 1;
+		struct timeval session_timeout = {0};
+		snmp_sess_select_info2(session->sessp,
+				       &numfds,
+				       fdset,
+				       &session_timeout,
+				       &block);
+		if (!block && timercmp(&session_timeout, &timeout, <)) {
+			timeout = session_timeout;
+		}
+	}
+
+	const int count = netsnmp_large_fd_set_select(
+			numfds, fdset, NULL, NULL, &timeout);
+	if (count < 0) {
+		if (errno != EINTR) {
+			rdlog(LOG_ERR,
+			      "SNMP engine select error: %s",
+			      gnu_strerror_r(errno));
+		}
+		return;
+	}
+
+	if (count > 0 && NETSNMP_LARGE_FD_ISSET(engine->wakeup_pipe[0], fdset)) {
+		char buf[BUFSIZ];
+		while (read(engine->wakeup_pipe[0], buf, sizeof(buf)) > 0) {
+			;
+		}
+	}
+
+	TAILQ_FOREACH(session, &engine->active, engine.active_entry) {
+		if (count > 0) {
+			snmp_sess_read2(session->sessp, fdset);
+		}
+		snmp_sess_timeout(session->sessp);
+	}
+}
+
+/** Process completed requests, calling their callbacks
+  @param engine SNMP engine
+  @param cancel Call callbacks with cancelled status, whatever the request
+  status is
+  */
+static void snmp_engine_run_completed(struct rb_snmp_engine *engine,
+				      bool cancel) {
+	struct rb_snmp_engine_request *req = NULL;
+	while ((req = TAILQ_FIRST(&engine->completed))) {
+		struct monitor_snmp_session *session = req->session;
+		TAILQ_REMOVE(&engine->completed, req, entry);
+
+		if (req->sent) {
+			session->engine.inflight--;
+		}
+		snmp_engine_session_flush(engine, session);
+		if (0 == session->engine.inflight &&
+		    TAILQ_EMPTY(&session->engine.waiting) &&
+		    session->engine.active) {
+			session->engine.active = false;
+			TAILQ_REMOVE(&engine->active,
+				     session,
+				     engine.active_entry);
+		}
+
+		// Session could be freed in callback, don't touch it after
+		if (cancel) {
+			req->cb(RB_SNMP_ENGINE_STAT_CANCELLED,
+				NULL,
+				req->opaque);
+		} else {
+			req->cb(req->status, req->response, req->opaque);
+		}
+
+		if (req->response) {
+			snmp_free_pdu(req->response);
+		}
+		free(req);
+	}
+}
+
+/** Stop accepting requests, and cancel the ones that has not been sent yet
+  @param engine SNMP engine
+  */
+static void snmp_engine_cancel_waiting(struct rb_snmp_engine *engine) {
+	struct rb_snmp_engine_request *req = NULL;
+	struct monitor_snmp_session *session = NULL;
+
+	pthread_mutex_lock(&engine->lock);
+	engine->stopping = true;
+	while ((req = TAILQ_FIRST(&engine->submitted))) {
+		TAILQ_REMOVE(&engine->submitted, req, entry);
+		snmp_free_pdu(req->pdu);
+		req->pdu = NULL;
+		snmp_engine_request_complete(req,
+					     RB_SNMP_ENGINE_STAT_CANCELLED);
+	}
+	pthread_mutex_unlock(&engine->lock);
+
+	TAILQ_FOREACH(session, &engine->active, engine.active_entry) {
+		while ((req = TAILQ_FIRST(&session->engine.waiting))) {
+			TAILQ_REMOVE(&session->engine.waiting, req, entry);
+			snmp_free_pdu(req->pdu);
+			req->pdu = NULL;
+			snmp_engine_request_complete(
+					req, RB_SNMP_ENGINE_STAT_CANCELLED);
+		}
+	}
+}
+
+/** Engine thread main loop
+  @param vengine SNMP engine
+  @return NULL
+  */
+static void *snmp_engine_loop(void *vengine) {
+	struct rb_snmp_engine *engine = vengine;
+	netsnmp_large_fd_set fdset;
+	netsnmp_large_fd_set_init(&fdset, FD_SETSIZE);
+
+	while (ATOMIC_OP(add, fetch, &engine->run, 0)) {
+		snmp_engine_dispatch_submitted(engine);
+		snmp_engine_poll(engine, &fdset);
+		snmp_engine_run_completed(engine, false);
+	}
+
+	// Wait for in-flight requests, since net-snmp owns them. All
+	// callbacks are called, so users can release requests resources.
+	snmp_engine_cancel_waiting(engine);
+	snmp_engine_run_completed(engine, true);
+	while (!TAILQ_EMPTY(&engine->active)) {
+		snmp_engine_poll(engine, &fdset);
+		snmp_engine_run_completed(engine, true);
+	}
+
+	netsnmp_large_fd_set_cleanup(&fdset);
+	return NULL;
+}
+
+struct rb_snmp_engine *rb_snmp_engine_new(size_t max_inflight) {
+	struct rb_snmp_engine *engine = calloc(1, sizeof(*engine));
+	if (NULL == engine) {
+		rdlog(LOG_ERR, "Couldn't allocate SNMP engine (OOM?)");
+		return NULL;
+	}
+
+	engine->run = 1;
+	engine->max_inflight = max_inflight > 0 ? max_inflight : 1;
+	TAILQ_INIT(&engine->submitted);
+	TAILQ_INIT(&engine->active);
+	TAILQ_INIT(&engine->completed);
+
+	if (0 != pipe2(engine->wakeup_pipe, O_NONBLOCK | O_CLOEXEC)) {
+		rdlog(LOG_ERR,
+		      "Couldn't create SNMP engine pipe: %s",
+		      gnu_strerror_r(errno));
+		goto pipe_err;
+	}
+
+	pthread_mutex_init(&engine->lock, NULL);
+	const int create_rc = pthread_create(
+			&engine->thread, NULL, snmp_engine_loop, engine);
+	if (0 != create_rc) {
+		rdlog(LOG_ERR,
+		      "Couldn't create SNMP engine thread: %s",
+		      gnu_strerror_r(create_rc));
+		goto thread_err;
+	}
+
+	return engine;
+
+thread_err:
+	pthread_mutex_destroy(&engine->lock);
+	close(engine->wakeup_pipe[0]);
+	close(engine->wakeup_pipe[1]);
+pipe_err:
+	free(engine);
+	return NULL;
+}
+
+/** Wake up engine thread
+  @param engine Engine to wake up
+  */
+static void snmp_engine_wakeup(struct rb_snmp_engine *engine) {
+	static const char wakeup = 0;
+	if (write(engine->wakeup_pipe[1], &wakeup, sizeof(wakeup)) < 0 &&
+	    errno != EAGAIN) {
+		rdlog(LOG_ERR,
+		      "Couldn't wake up SNMP engine: %s",
+		      gnu_strerror_r(errno));
+	}
+}
+
+bool rb_snmp_engine_send(struct rb_snmp_engine *engine,
+			 struct monitor_snmp_session *session,
+			 struct snmp_pdu *pdu,
+			 rb_snmp_engine_cb cb,
+			 void *opaque) {
+	struct rb_snmp_engine_request *req = calloc(1, sizeof(*req));
+	if (NULL == req) {
+		rdlog(LOG_ERR, "Couldn't allocate SNMP request (OOM?)");
+		snmp_free_pdu(pdu);
+		return false;
+	}
+
+	req->engine = engine;
+	req->session = session;
+	req->pdu = pdu;
+	req->cb = cb;
+	req->opaque = opaque;
+
+	pthread_mutex_lock(&engine->lock);
+	const bool stopping = engine->stopping;
+	const bool wakeup = TAILQ_EMPTY(&engine->submitted);
+	if (!stopping) {
+		TAILQ_INSERT_TAIL(&engine->submitted, req, entry);
+	}
+	pthread_mutex_unlock(&engine->lock);
+
+	if (stopping) {
+		snmp_free_pdu(pdu);
+		free(req);
+		return false;
+	}
+
+	if (wakeup) {
+		snmp_engine_wakeup(engine);
+	}
+
+	return true;
+}
+
+void rb_snmp_engine_done(struct rb_snmp_engine *engine) {
+	ATOMIC_OP(sub, fetch, &engine->run, 1);
+	snmp_engine_wakeup(engine);
+	pthread_join(engine->thread, NULL);
+
+	pthread_mutex_destroy(&engine->lock);
+	close(engine->wakeup_pipe[0]);
+	close(engine->wakeup_pipe[1]);
+	free(engine);
+}
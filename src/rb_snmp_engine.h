@@ -0,0 +1,73 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "rb_snmp.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/// Asynchronous SNMP engine. It multiplexes all sensors SNMP sessions in one
+/// event loop thread, so no worker thread is blocked waiting for a response.
+struct rb_snmp_engine;
+
+/// Request status when engine is stopped before request completion
+#define RB_SNMP_ENGINE_STAT_CANCELLED (-1)
+
+/** SNMP engine response callback. It is called from the engine thread, so it
+  should not block.
+  @param status STAT_SUCCESS if response is valid, STAT_TIMEOUT or STAT_ERROR
+  in other case, or RB_SNMP_ENGINE_STAT_CANCELLED if engine is stopping
+  @param response SNMP response, or NULL if status is not STAT_SUCCESS. It
+  will be freed after callback returns.
+  @param opaque Opaque provided in rb_snmp_engine_send
+  */
+typedef void (*rb_snmp_engine_cb)(int status,
+				  struct snmp_pdu *response,
+				  void *opaque);
+
+/** Creates and start a new SNMP engine
+  @param max_inflight Maximum number of requests in flight per session
+  @return New SNMP engine, or NULL in case of error
+  */
+struct rb_snmp_engine *rb_snmp_engine_new(size_t max_inflight);
+
+/** Stop the SNMP engine and free its resources. Pending requests callbacks
+  are called with RB_SNMP_ENGINE_STAT_CANCELLED status, so their resources
+  can be released.
+  @param engine Engine to free
+  */
+void rb_snmp_engine_done(struct rb_snmp_engine *engine);
+
+/** Queue a SNMP request in the engine
+  @param engine SNMP engine
+  @param session Session to send PDU through. It must be alive until callback
+  is called.
+  @param pdu PDU to send. Engine takes ownership of it in any case.
+  @param cb Callback to call with response
+  @param opaque Opaque to send to callback
+  @return true if queued. If false (engine stopping, or out of memory),
+  callback will not be called.
+  */
+bool rb_snmp_engine_send(struct rb_snmp_engine *engine,
+			 struct monitor_snmp_session *session,
+			 struct snmp_pdu *pdu,
+			 rb_snmp_engine_cb cb,
+			 void *opaque);
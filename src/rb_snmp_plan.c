@@ -0,0 +1,426 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_snmp_plan.h"
+
+#include <librd/rd.h>
+#include <librd/rdlog.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/// Estimated fixed size of a GET PDU with no varbinds: message header,
+/// community and PDU header
+#define SNMP_PLAN_PDU_OVERHEAD 64
+
+/** Estimated BER encoded size of a NULL varbind with given OID
+  @param name OID
+  @param name_len OID length
+  @return Estimated size
+  */
+static size_t snmp_plan_varbind_size(const oid *name, size_t name_len) {
+	size_t ret = 1; // First two subids are encoded in one byte
+	for (size_t i = 2; i < name_len; ++i) {
+		oid subid = name[i];
+		do {
+			ret++;
+			subid >>= 7;
+		} while (subid);
+	}
+
+	// Sequence header + OID header + NULL value
+	return ret + 2 + 2 + 2;
+}
+
+/** Search an OID in plan
+  @param plan Plan
+  @param name OID to search
+  @param name_len OID length
+  @return OID entry, or NULL if not found
+  */
+static struct rb_snmp_plan_oid *snmp_plan_find_oid(struct rb_snmp_plan *plan,
+						   const oid *name,
+						   size_t name_len) {
+	for (size_t i = 0; i < plan->oids_count; ++i) {
+		struct rb_snmp_plan_oid *plan_oid = &plan->oids[i];
+		if (0 == snmp_oid_compare(plan_oid->name,
+					  plan_oid->name_len,
+					  name,
+					  name_len)) {
+			return plan_oid;
+		}
+	}
+
+	return NULL;
+}
+
+/** Add a monitor to a plan OID entry
+  @param plan_oid Plan OID entry
+  @param monitor_idx Monitor index
+  @return true if success, false in other case
+  */
+static bool snmp_plan_oid_add_monitor(struct rb_snmp_plan_oid *plan_oid,
+				      size_t monitor_idx) {
+	size_t *monitors = realloc(
+			plan_oid->monitors,
+			(plan_oid->monitors_count + 1) * sizeof(monitors[0]));
+	if (NULL == monitors) {
+		rdlog(LOG_ERR, "Couldn't allocate SNMP plan monitors (OOM?)");
+		return false;
+	}
+
+	monitors[plan_oid->monitors_count++] = monitor_idx;
+	plan_oid->monitors = monitors;
+	return true;
+}
+
+/** Add a monitor to plan
+  @param plan Plan
+  @param monitor Monitor to add
+  @param monitor_idx Monitor index in monitors array
+  @return true if success, false in other case
+  */
+static bool snmp_plan_add_monitor(struct rb_snmp_plan *plan,
+				  const rb_monitor_t *monitor,
+				  size_t monitor_idx) {
+	size_t name_len = 0;
+	const oid *name = rb_monitor_snmp_oid(monitor, &name_len);
+
+	struct rb_snmp_plan_oid *plan_oid =
+			snmp_plan_find_oid(plan, name, name_len);
+	if (NULL == plan_oid) {
+		plan_oid = &plan->oids[plan->oids_count++];
+		memcpy(plan_oid->name, name, name_len * sizeof(name[0]));
+		plan_oid->name_len = name_len;
+	}
+
+	return snmp_plan_oid_add_monitor(plan_oid, monitor_idx);
+}
+
+/** Split plan OIDs in PDUs
+  @param plan Plan
+  @param max_varbinds Max varbinds per PDU
+  @param max_pdu_size Max estimated PDU size
+  */
+static void snmp_plan_split_pdus(struct rb_snmp_plan *plan,
+				 size_t max_varbinds,
+				 size_t max_pdu_size) {
+	struct rb_snmp_plan_pdu *pdu = NULL;
+	size_t pdu_size = 0;
+
+	for (size_t i = 0; i < plan->oids_count; ++i) {
+		const size_t varbind_size = snmp_plan_varbind_size(
+				plan->oids[i].name, plan->oids[i].name_len);
+
+		if (NULL == pdu || pdu->oids_count >= max_varbinds ||
+		    pdu_size + varbind_size > max_pdu_size) {
+			pdu = &plan->pdus[plan->pdus_count++];
+			pdu->first_oid = i;
+			pdu->oids_count = 0;
+			pdu_size = SNMP_PLAN_PDU_OVERHEAD;
+		}
+
+		pdu->oids_count++;
+		pdu_size += varbind_size;
+	}
+}
+
+/** Add a walk monitor to plan
+  @param plan Plan
+  @param monitor Monitor to add
+  @param monitor_idx Monitor index in monitors array
+  */
+static void snmp_plan_add_walk(struct rb_snmp_plan *plan,
+			       const rb_monitor_t *monitor,
+			       size_t monitor_idx) {
+	struct rb_snmp_plan_walk *walk = &plan->walks[plan->walks_count++];
+	const oid *root = rb_monitor_snmp_oid(monitor, &walk->root_len);
+
+	memcpy(walk->root, root, walk->root_len * sizeof(root[0]));
+	walk->monitor_idx = monitor_idx;
+}
+
+struct rb_snmp_plan *rb_snmp_plan_new(rb_monitors_array_t *monitors,
+				      const struct rb_snmp_plan_limits *limits) {
+	size_t snmp_monitors = 0, walk_monitors = 0;
+	size_t max_varbinds = limits->max_varbinds;
+
+	for (size_t i = 0; i < monitors->count; ++i) {
+		const rb_monitor_t *monitor =
+				rb_monitors_array_elm_at(monitors, i);
+		if (rb_monitor_is_snmp(monitor)) {
+			snmp_monitors++;
+		} else if (rb_monitor_is_snmp_walk(monitor)) {
+			walk_monitors++;
+		}
+	}
+
+	if (0 == snmp_monitors && 0 == walk_monitors) {
+		return NULL;
+	}
+
+	if (0 == max_varbinds) {
+		max_varbinds = 1;
+	}
+
+	struct rb_snmp_plan *ret = calloc(1, sizeof(*ret));
+	if (NULL == ret) {
+		goto err;
+	}
+
+	ret->max_repetitions =
+			limits->max_repetitions > 0 ? limits->max_repetitions : 1;
+
+	// At most, one OID and one PDU per monitor
+	ret->oids = calloc(snmp_monitors + 1, sizeof(ret->oids[0]));
+	ret->pdus = calloc(snmp_monitors + 1, sizeof(ret->pdus[0]));
+	ret->walks = calloc(walk_monitors + 1, sizeof(ret->walks[0]));
+	if (NULL == ret->oids || NULL == ret->pdus || NULL == ret->walks) {
+		goto err;
+	}
+
+	for (size_t i = 0; i < monitors->count; ++i) {
+		const rb_monitor_t *monitor =
+				rb_monitors_array_elm_at(monitors, i);
+		if (rb_monitor_is_snmp_walk(monitor)) {
+			snmp_plan_add_walk(ret, monitor, i);
+		} else if (rb_monitor_is_snmp(monitor) &&
+			   !snmp_plan_add_monitor(ret, monitor, i)) {
+			rb_snmp_plan_done(ret);
+			return NULL;
+		}
+	}
+
+	snmp_plan_split_pdus(ret, max_varbinds, limits->max_pdu_size);
+	rdlog(LOG_DEBUG,
+	      "SNMP plan: %zu monitors, %zu OIDs, %zu PDUs, %zu walks",
+	      snmp_monitors,
+	      ret->oids_count,
+	      ret->pdus_count,
+	      ret->walks_count);
+	return ret;
+
+err:
+	rdlog(LOG_ERR, "Couldn't allocate SNMP plan (OOM?)");
+	rb_snmp_plan_done(ret);
+	return NULL;
+}
+
+void rb_snmp_plan_done(struct rb_snmp_plan *plan) {
+	if (NULL == plan) {
+		return;
+	}
+
+	for (size_t i = 0; plan->oids && i < plan->oids_count; ++i) {
+		free(plan->oids[i].monitors);
+	}
+	free(plan->oids);
+	free(plan->pdus);
+	free(plan->walks);
+	free(plan);
+}
+
+struct rb_snmp_plan_request *
+rb_snmp_plan_request_new(const struct rb_snmp_plan *plan, size_t pdu_idx) {
+	const struct rb_snmp_plan_pdu *plan_pdu = &plan->pdus[pdu_idx];
+	struct rb_snmp_plan_request *ret =
+			malloc(sizeof(*ret) +
+			       plan_pdu->oids_count * sizeof(ret->oids[0]));
+	if (NULL == ret) {
+		rdlog(LOG_ERR, "Couldn't allocate SNMP request (OOM?)");
+		return NULL;
+	}
+
+	ret->oids_count = plan_pdu->oids_count;
+	for (size_t i = 0; i < plan_pdu->oids_count; ++i) {
+		ret->oids[i] = plan_pdu->first_oid + i;
+	}
+
+	return ret;
+}
+
+struct rb_snmp_plan_request *
+rb_snmp_plan_request_split(struct rb_snmp_plan_request *request) {
+	const size_t first_half = request->oids_count / 2;
+	const size_t second_half = request->oids_count - first_half;
+	struct rb_snmp_plan_request *ret = malloc(
+			sizeof(*ret) + second_half * sizeof(ret->oids[0]));
+	if (NULL == ret) {
+		rdlog(LOG_ERR, "Couldn't allocate SNMP request (OOM?)");
+		return NULL;
+	}
+
+	ret->oids_count = second_half;
+	memcpy(ret->oids,
+	       &request->oids[first_half],
+	       second_half * sizeof(ret->oids[0]));
+	request->oids_count = first_half;
+	return ret;
+}
+
+struct snmp_pdu *rb_snmp_plan_pdu(const struct rb_snmp_plan *plan,
+				  const struct rb_snmp_plan_request *request) {
+	struct snmp_pdu *pdu = snmp_pdu_create(SNMP_MSG_GET);
+	if (NULL == pdu) {
+		rdlog(LOG_ERR, "Couldn't create SNMP PDU");
+		return NULL;
+	}
+
+	for (size_t i = 0; i < request->oids_count; ++i) {
+		const struct rb_snmp_plan_oid *plan_oid =
+				&plan->oids[request->oids[i]];
+		snmp_add_null_var(pdu, plan_oid->name, plan_oid->name_len);
+	}
+
+	return pdu;
+}
+
+/** Handle an agent error response
+  @param plan Plan
+  @param request Request that caused the error
+  @param response Response PDU
+  @return What to do with the request next
+  */
+static enum rb_snmp_plan_dispatch_rc
+snmp_plan_dispatch_error(const struct rb_snmp_plan *plan,
+			 struct rb_snmp_plan_request *request,
+			 const struct snmp_pdu *response) {
+	switch (response->errstat) {
+	case SNMP_ERR_TOOBIG:
+		if (request->oids_count > 1) {
+			rdlog(LOG_DEBUG,
+			      "SNMP response too big for %zu OIDs, splitting",
+			      request->oids_count);
+			return RB_SNMP_PLAN_DISPATCH_SPLIT;
+		}
+		break;
+
+	case SNMP_ERR_NOSUCHNAME:
+	case SNMP_ERR_BADVALUE:
+		// errindex starts at 1
+		if (response->errindex > 0 &&
+		    (size_t)response->errindex <= request->oids_count) {
+			const size_t bad = (size_t)response->errindex - 1;
+			const struct rb_snmp_plan_oid *plan_oid =
+					&plan->oids[request->oids[bad]];
+			char oid_buf[BUFSIZ];
+			snprint_objid(oid_buf,
+				      sizeof(oid_buf),
+				      plan_oid->name,
+				      plan_oid->name_len);
+			rdlog(LOG_ERR,
+			      "SNMP error in response: %s (%s)",
+			      snmp_errstring((int)response->errstat),
+			      oid_buf);
+
+			memmove(&request->oids[bad],
+				&request->oids[bad + 1],
+				(request->oids_count - bad - 1) *
+						sizeof(request->oids[0]));
+			request->oids_count--;
+			return request->oids_count > 0
+					       ? RB_SNMP_PLAN_DISPATCH_RETRY
+					       : RB_SNMP_PLAN_DISPATCH_DONE;
+		}
+		break;
+
+	default:
+		break;
+	};
+
+	rdlog(LOG_ERR,
+	      "SNMP error in response: %s (index %ld)",
+	      snmp_errstring((int)response->errstat),
+	      response->errindex);
+	return RB_SNMP_PLAN_DISPATCH_DONE;
+}
+
+enum rb_snmp_plan_dispatch_rc
+rb_snmp_plan_dispatch(const struct rb_snmp_plan *plan,
+		      struct rb_snmp_plan_request *request,
+		      const struct snmp_pdu *response,
+		      void (*cb)(size_t monitor_idx,
+				 const netsnmp_variable_list *var,
+				 void *opaque),
+		      void *opaque) {
+	const netsnmp_variable_list *var = response->variables;
+
+	if (response->errstat != SNMP_ERR_NOERROR) {
+		return snmp_plan_dispatch_error(plan, request, response);
+	}
+
+	/* Agent must answer GET variables in the same order we asked */
+	for (size_t i = 0; var && i < request->oids_count;
+	     ++i, var = var->next_variable) {
+		const struct rb_snmp_plan_oid *plan_oid =
+				&plan->oids[request->oids[i]];
+		if (0 != snmp_oid_compare(plan_oid->name,
+					  plan_oid->name_len,
+					  var->name,
+					  var->name_length)) {
+			rdlog(LOG_ERR, "Unexpected OID in SNMP response");
+			continue;
+		}
+
+		for (size_t j = 0; j < plan_oid->monitors_count; ++j) {
+			cb(plan_oid->monitors[j], var, opaque);
+		}
+	}
+
+	return RB_SNMP_PLAN_DISPATCH_DONE;
+}
+
+struct snmp_pdu *rb_snmp_plan_walk_pdu(const struct rb_snmp_plan *plan,
+				       long version,
+				       const oid *from,
+				       size_t from_len) {
+	const bool bulk = version != SNMP_VERSION_1;
+	struct snmp_pdu *pdu =
+			snmp_pdu_create(bulk ? SNMP_MSG_GETBULK : SNMP_MSG_GETNEXT);
+	if (NULL == pdu) {
+		rdlog(LOG_ERR, "Couldn't create SNMP PDU");
+		return NULL;
+	}
+
+	if (bulk) {
+		pdu->non_repeaters = 0;
+		pdu->max_repetitions = plan->max_repetitions;
+	}
+
+	snmp_add_null_var(pdu, from, from_len);
+	return pdu;
+}
+
+bool rb_snmp_plan_walk_in_subtree(const struct rb_snmp_plan_walk *walk,
+				  const netsnmp_variable_list *var) {
+	switch (var->type) {
+	case SNMP_ENDOFMIBVIEW:
+	case SNMP_NOSUCHOBJECT:
+	case SNMP_NOSUCHINSTANCE:
+		return false;
+	default:
+		break;
+	};
+
+	return var->name_length > walk->root_len &&
+	       0 == snmp_oidtree_compare(walk->root,
+					 walk->root_len,
+					 var->name,
+					 var->name_length);
+}
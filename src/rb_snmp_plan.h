@@ -0,0 +1,168 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "rb_sensor_monitor_array.h"
+#include "rb_snmp.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/// Default maximum number of varbinds in a plan PDU
+#define RB_SNMP_PLAN_DEFAULT_MAX_VARBINDS 32
+/// Default maximum (estimated) encoded size of a plan PDU
+#define RB_SNMP_PLAN_DEFAULT_MAX_PDU_SIZE 1400
+/// Default GETBULK max-repetitions of walk requests
+#define RB_SNMP_PLAN_DEFAULT_MAX_REPETITIONS 10
+
+/// Unique OID to ask for, and monitors that need it
+struct rb_snmp_plan_oid {
+	oid name[MAX_OID_LEN]; ///< Parsed OID
+	size_t name_len;       ///< OID length
+	size_t *monitors;      ///< Monitors index that needs this OID
+	size_t monitors_count; ///< Length of monitors
+};
+
+/// OIDs requested in the same GET PDU
+struct rb_snmp_plan_pdu {
+	size_t first_oid;  ///< First OID of the PDU in plan oids
+	size_t oids_count; ///< Number of OIDs in the PDU
+};
+
+/// Subtree to walk
+struct rb_snmp_plan_walk {
+	oid root[MAX_OID_LEN]; ///< Subtree root OID
+	size_t root_len;       ///< Root OID length
+	size_t monitor_idx;    ///< Walk monitor index
+};
+
+/** Sensor SNMP request plan: all sensor OID monitors coalesced in the
+  minimum number of multi-varbind GET PDUs, and all subtrees to walk */
+struct rb_snmp_plan {
+	struct rb_snmp_plan_oid *oids; ///< Unique OIDs
+	size_t oids_count;	     ///< Length of oids
+	struct rb_snmp_plan_pdu *pdus; ///< PDUs to send
+	size_t pdus_count;	     ///< Length of pdus
+	struct rb_snmp_plan_walk *walks; ///< Subtrees to walk
+	size_t walks_count;		 ///< Length of walks
+	long max_repetitions;		 ///< Walk GETBULK max-repetitions
+};
+
+/// SNMP request plan limits
+struct rb_snmp_plan_limits {
+	size_t max_varbinds;  ///< Max varbinds per GET PDU
+	size_t max_pdu_size;  ///< Max estimated encoded GET PDU size
+	long max_repetitions; ///< Walk GETBULK max-repetitions
+};
+
+/** Creates a SNMP request plan with all SNMP monitors of a monitors array
+  @param monitors Monitors array
+  @param limits Plan limits
+  @return New plan, or NULL if there is no SNMP monitor or error. Free it with
+  rb_snmp_plan_done
+  */
+struct rb_snmp_plan *rb_snmp_plan_new(rb_monitors_array_t *monitors,
+				      const struct rb_snmp_plan_limits *limits);
+
+/** Free a plan created with rb_snmp_plan_new
+  @param plan Plan to free
+  */
+void rb_snmp_plan_done(struct rb_snmp_plan *plan);
+
+/** Plan OIDs requested in the same GET PDU. It starts with all OIDs of a plan
+  PDU, and it can shrink if the agent reports errors */
+struct rb_snmp_plan_request {
+	size_t oids_count; ///< Number of OIDs in the request
+	size_t oids[];     ///< Plan OIDs index
+};
+
+/** Creates a request with all OIDs of a plan PDU
+  @param plan Plan
+  @param pdu_idx PDU index in plan
+  @return New request, or NULL in case of error. Free it with free()
+  */
+struct rb_snmp_plan_request *
+rb_snmp_plan_request_new(const struct rb_snmp_plan *plan, size_t pdu_idx);
+
+/** Split a request in two halves
+  @param request Request to split. It keeps the first half of OIDs
+  @return New request with the second half of OIDs, or NULL in case of error.
+  Free it with free()
+  */
+struct rb_snmp_plan_request *
+rb_snmp_plan_request_split(struct rb_snmp_plan_request *request);
+
+/** Creates a SNMP GET PDU of a plan request
+  @param plan Plan
+  @param request Request
+  @return New PDU, or NULL in case of error
+  */
+struct snmp_pdu *rb_snmp_plan_pdu(const struct rb_snmp_plan *plan,
+				  const struct rb_snmp_plan_request *request);
+
+/// Result of a request response dispatch
+enum rb_snmp_plan_dispatch_rc {
+	/// Response variables dispatched, or unrecoverable error
+	RB_SNMP_PLAN_DISPATCH_DONE,
+	/// Agent rejected a variable, that has been removed from request. Send
+	/// the request again to get the rest of them
+	RB_SNMP_PLAN_DISPATCH_RETRY,
+	/// Response is too big. Split the request and send both halves
+	RB_SNMP_PLAN_DISPATCH_SPLIT,
+};
+
+/** Dispatch a plan request response variables to the monitors that asked for
+  them
+  @param plan Plan
+  @param request Request. OID rejected by agent is removed from it
+  @param response Response PDU
+  @param cb Callback to call for each monitor variable
+  @param opaque Opaque to send to callback
+  @return What to do with the request next
+  */
+enum rb_snmp_plan_dispatch_rc
+rb_snmp_plan_dispatch(const struct rb_snmp_plan *plan,
+		      struct rb_snmp_plan_request *request,
+		      const struct snmp_pdu *response,
+		      void (*cb)(size_t monitor_idx,
+				 const netsnmp_variable_list *var,
+				 void *opaque),
+		      void *opaque);
+
+/** Creates a request to continue a subtree walk
+  @param plan Plan
+  @param version Session SNMP version. SNMPv1 has no GETBULK, so GETNEXT will
+  be used.
+  @param from Last OID received, or walk root OID
+  @param from_len from length
+  @return New PDU, or NULL in case of error
+  */
+struct snmp_pdu *rb_snmp_plan_walk_pdu(const struct rb_snmp_plan *plan,
+				       long version,
+				       const oid *from,
+				       size_t from_len);
+
+/** Checks if a response variable belongs to walk subtree
+  @param walk Walk
+  @param var Variable to check
+  @return true if variable is inside walk subtree
+  */
+bool rb_snmp_plan_walk_in_subtree(const struct rb_snmp_plan_walk *walk,
+				  const netsnmp_variable_list *var);
@@ -0,0 +1,709 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_spool.h"
+
+#include <librd/rdlog.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+/// Spooled record mark, to detect torn or corrupted segments
+#define SPOOL_RECORD_MAGIC 0x52425331u
+/// Max records written in one writev call
+#define SPOOL_WRITEV_RECORDS 128
+/// Segment files suffix
+#define SPOOL_SEGMENT_SUFFIX ".seg"
+
+/// Spooled record header. Key and payload follow it.
+struct spool_record_hdr {
+	uint32_t magic;    ///< SPOOL_RECORD_MAGIC
+	uint32_t len;      ///< Payload length
+	uint32_t key_len;  ///< Key length
+	uint32_t reserved; ///< Reserved, 0
+	int64_t timestamp; ///< Message timestamp
+};
+
+struct rb_spool_segment {
+	TAILQ_ENTRY(rb_spool_segment) entry; ///< Spool segments entry
+	uint64_t id;			     ///< Segment file number
+	int fd;      ///< Append descriptor, or -1 if segment is sealed
+	size_t size; ///< Segment size
+	time_t mtime; ///< Last write
+	/// Number of records. Only valid if segment was written in this run or
+	/// it is mapped.
+	size_t records;
+
+	char *map;	  ///< Segment mapping, if mapped
+	size_t map_size;    ///< Valid records length in map
+	size_t read_offset; ///< Next record to replay
+	size_t replayed;    ///< Replayed records
+	size_t acked;       ///< Acknowledged replayed records
+	bool discarded;     ///< Segment is not in spool anymore
+};
+
+struct rb_spool {
+	pthread_mutex_t lock;		 ///< Protects spool
+	char *dir;			 ///< Spool directory
+	struct rb_spool_limits limits;   ///< Spool limits
+	/// Segments, oldest first
+	TAILQ_HEAD(spool_segments, rb_spool_segment) segments;
+	uint64_t next_id;		       ///< Next segment id
+	uint64_t size;			       ///< Size of all segments
+	uint64_t discarded;		       ///< Discarded records
+};
+
+/*
+ * SEGMENTS
+ */
+
+/** Segment file path
+  @param spool Spool
+  @param id Segment id
+  @param buf Buffer to print path
+  @param size Buffer size
+  */
+static void spool_segment_path(const struct rb_spool *spool,
+			       uint64_t id,
+			       char *buf,
+			       size_t size) {
+	snprintf(buf,
+		 size,
+		 "%s/%020" PRIu64 SPOOL_SEGMENT_SUFFIX,
+		 spool->dir,
+		 id);
+}
+
+static struct rb_spool_segment *spool_segment_new(uint64_t id) {
+	struct rb_spool_segment *ret = calloc(1, sizeof(*ret));
+	if (NULL == ret) {
+		rdlog(LOG_ERR, "Couldn't allocate spool segment (OOM?)");
+		return NULL;
+	}
+
+	ret->id = id;
+	ret->fd = -1;
+	return ret;
+}
+
+static void spool_segment_free(struct rb_spool_segment *segment) {
+	if (segment->fd >= 0) {
+		close(segment->fd);
+	}
+	if (segment->map) {
+		munmap(segment->map, segment->size);
+	}
+	free(segment);
+}
+
+/** Stop appending to a segment
+  @param segment Segment
+  */
+static void spool_segment_seal(struct rb_spool_segment *segment) {
+	if (segment->fd >= 0) {
+		close(segment->fd);
+		segment->fd = -1;
+	}
+}
+
+/** Map a sealed segment, and count its valid records
+  @param spool Spool
+  @param segment Segment
+  @return 0 if success, !0 in other case
+  */
+static int spool_segment_map(const struct rb_spool *spool,
+			     struct rb_spool_segment *segment) {
+	char path[PATH_MAX];
+	spool_segment_path(spool, segment->id, path, sizeof(path));
+
+	if (0 == segment->size) {
+		return 0;
+	}
+
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		rdlog(LOG_ERR,
+		      "Couldn't open spool segment %s: %s",
+		      path,
+		      strerror(errno));
+		return -1;
+	}
+
+	segment->map = mmap(NULL, segment->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (MAP_FAILED == segment->map) {
+		rdlog(LOG_ERR,
+		      "Couldn't map spool segment %s: %s",
+		      path,
+		      strerror(errno));
+		segment->map = NULL;
+		return -1;
+	}
+
+	// Stop at first torn or corrupted record
+	size_t offset = 0;
+	segment->records = 0;
+	while (offset + sizeof(struct spool_record_hdr) <= segment->size) {
+		struct spool_record_hdr hdr;
+		memcpy(&hdr, &segment->map[offset], sizeof(hdr));
+		const size_t record_size =
+				sizeof(hdr) + (size_t)hdr.key_len + hdr.len;
+		if (SPOOL_RECORD_MAGIC != hdr.magic ||
+		    record_size > segment->size - offset) {
+			rdlog(LOG_WARNING,
+			      "Spool segment %s truncated at %zu",
+			      path,
+			      offset);
+			break;
+		}
+		offset += record_size;
+		segment->records++;
+	}
+
+	segment->map_size = offset;
+	return 0;
+}
+
+/** Check if all segment records have been replayed and acknowledged
+  @param segment Segment
+  @return true if segment is done
+  */
+static bool spool_segment_delivered(const struct rb_spool_segment *segment) {
+	return segment->fd < 0 && segment->read_offset == segment->map_size &&
+	       (segment->map || 0 == segment->size) &&
+	       segment->acked == segment->replayed;
+}
+
+/** Remove a segment from spool and disk. It is freed when all its replayed
+  records are acknowledged.
+  @param spool Spool
+  @param segment Segment
+  @param delivered All segment records were delivered
+  */
+static void spool_segment_remove(struct rb_spool *spool,
+				 struct rb_spool_segment *segment,
+				 bool delivered) {
+	char path[PATH_MAX];
+	spool_segment_path(spool, segment->id, path, sizeof(path));
+
+	if (!delivered) {
+		if (segment->fd < 0 && NULL == segment->map) {
+			// Recovered segment, need to count its records
+			spool_segment_map(spool, segment);
+		}
+		spool->discarded += segment->records - segment->replayed;
+	}
+
+	TAILQ_REMOVE(&spool->segments, segment, entry);
+	spool->size -= segment->size;
+	spool_segment_seal(segment);
+	unlink(path);
+
+	if (segment->acked == segment->replayed) {
+		spool_segment_free(segment);
+	} else {
+		segment->discarded = true;
+	}
+}
+
+/** Remove segments older than max age
+  @param spool Spool
+  */
+static void spool_expire(struct rb_spool *spool) {
+	const time_t oldest = time(NULL) - (time_t)spool->limits.max_age;
+	struct rb_spool_segment *segment = NULL;
+
+	while ((segment = TAILQ_FIRST(&spool->segments)) &&
+	       segment->mtime < oldest) {
+		spool_segment_remove(spool, segment, false);
+	}
+}
+
+/** Active segment, creating a new one if it does not exist or it is full
+  @param spool Spool
+  @return Active segment, or NULL in case of error
+  */
+static struct rb_spool_segment *spool_active_segment(struct rb_spool *spool) {
+	struct rb_spool_segment *last =
+			TAILQ_LAST(&spool->segments, spool_segments);
+	if (last && last->fd >= 0) {
+		if (last->size < spool->limits.segment_size) {
+			return last;
+		}
+		spool_segment_seal(last);
+	}
+
+	char path[PATH_MAX];
+	struct rb_spool_segment *ret = spool_segment_new(spool->next_id);
+	if (NULL == ret) {
+		return NULL;
+	}
+
+	spool_segment_path(spool, ret->id, path, sizeof(path));
+	ret->fd = open(path,
+		       O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+		       0644);
+	if (ret->fd < 0) {
+		rdlog(LOG_ERR,
+		      "Couldn't create spool segment %s: %s",
+		      path,
+		      strerror(errno));
+		free(ret);
+		return NULL;
+	}
+
+	ret->mtime = time(NULL);
+	spool->next_id++;
+	TAILQ_INSERT_TAIL(&spool->segments, ret, entry);
+	return ret;
+}
+
+/*
+ * SPOOL
+ */
+
+/** Write all iovec buffers, retrying partial writes
+  @param fd File descriptor
+  @param iov Buffers. They are modified.
+  @param iovcnt Number of buffers
+  @return 0 if success, -1 in other case
+  */
+static int spool_writev(int fd, struct iovec *iov, int iovcnt) {
+	while (iovcnt > 0) {
+		const ssize_t rc = writev(fd, iov, iovcnt);
+		if (rc < 0) {
+			if (EINTR == errno) {
+				continue;
+			}
+			return -1;
+		}
+
+		size_t written = (size_t)rc;
+		while (iovcnt > 0 && written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+
+	return 0;
+}
+
+/** Append records to the active segment. Need to hold spool lock.
+  @param spool Spool
+  @param segment Active segment
+  @param records Records to append
+  @param count Number of records
+  @return 0 if success, !0 in other case
+  */
+static int spool_append0(struct rb_spool *spool,
+			 struct rb_spool_segment *segment,
+			 const struct rb_spool_record *records,
+			 size_t count) {
+	struct spool_record_hdr hdrs[SPOOL_WRITEV_RECORDS];
+	struct iovec iov[3 * SPOOL_WRITEV_RECORDS];
+	size_t size = 0;
+	int iovcnt = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		hdrs[i] = (struct spool_record_hdr){
+				.magic = SPOOL_RECORD_MAGIC,
+				.len = (uint32_t)records[i].len,
+				.key_len = (uint32_t)records[i].key_len,
+				.timestamp = records[i].timestamp,
+		};
+		iov[iovcnt++] = (struct iovec){&hdrs[i], sizeof(hdrs[i])};
+		if (records[i].key_len) {
+			iov[iovcnt++] = (struct iovec){(void *)records[i].key,
+						       records[i].key_len};
+		}
+		iov[iovcnt++] = (struct iovec){(void *)records[i].payload,
+					       records[i].len};
+		size += sizeof(hdrs[i]) + records[i].key_len + records[i].len;
+	}
+
+	if (0 != spool_writev(segment->fd, iov, iovcnt)) {
+		rdlog(LOG_ERR,
+		      "Couldn't write spool segment: %s",
+		      strerror(errno));
+		// Torn records are discarded when segment is mapped
+		struct stat st;
+		if (0 == fstat(segment->fd, &st)) {
+			spool->size += (uint64_t)st.st_size - segment->size;
+			segment->size = (size_t)st.st_size;
+		}
+		spool_segment_seal(segment);
+		return -1;
+	}
+
+	segment->size += size;
+	segment->records += count;
+	segment->mtime = time(NULL);
+	spool->size += size;
+	return 0;
+}
+
+size_t rb_spool_append(struct rb_spool *spool,
+		       const struct rb_spool_record *records,
+		       size_t count) {
+	size_t ret = 0;
+
+	pthread_mutex_lock(&spool->lock);
+	spool_expire(spool);
+
+	while (ret < count) {
+		struct rb_spool_segment *segment = NULL;
+		size_t batch = 0, batch_size = 0;
+
+		// Records that fit in the active segment and in spool
+		while (ret + batch < count && batch < SPOOL_WRITEV_RECORDS) {
+			const struct rb_spool_record *record =
+					&records[ret + batch];
+			const size_t record_size =
+					sizeof(struct spool_record_hdr) +
+					record->key_len + record->len;
+			if (record_size > spool->limits.max_size ||
+			    record->len > UINT32_MAX ||
+			    record->key_len > UINT32_MAX) {
+				break;
+			}
+
+			// Make room discarding oldest segments
+			struct rb_spool_segment *oldest = NULL;
+			while (spool->size + batch_size + record_size >
+					       spool->limits.max_size &&
+			       (oldest = TAILQ_FIRST(&spool->segments))) {
+				if (batch > 0 && oldest->fd >= 0) {
+					// Can't discard the batch segment
+					break;
+				}
+				spool_segment_remove(spool, oldest, false);
+			}
+
+			if (spool->size + batch_size + record_size >
+			    spool->limits.max_size) {
+				break;
+			}
+
+			if (NULL == segment) {
+				segment = spool_active_segment(spool);
+				if (NULL == segment) {
+					break;
+				}
+			}
+
+			batch++;
+			batch_size += record_size;
+			if (segment->size + batch_size >=
+			    spool->limits.segment_size) {
+				break;
+			}
+		}
+
+		if (0 == batch) {
+			// Record can't be spooled
+			spool->discarded++;
+			ret++;
+			continue;
+		}
+
+		if (0 != spool_append0(spool, segment, &records[ret], batch)) {
+			spool->discarded += batch;
+		}
+		ret += batch;
+	}
+	pthread_mutex_unlock(&spool->lock);
+
+	return ret;
+}
+
+size_t rb_spool_replay(struct rb_spool *spool,
+		       struct rb_spool_record *records,
+		       size_t max) {
+	size_t ret = 0;
+	struct rb_spool_segment *segment = NULL, *next = NULL;
+
+	pthread_mutex_lock(&spool->lock);
+	spool_expire(spool);
+
+	for (segment = TAILQ_FIRST(&spool->segments); segment && ret < max;
+	     segment = next) {
+		next = TAILQ_NEXT(segment, entry);
+		if (segment->fd >= 0) {
+			if (0 == segment->size) {
+				break;
+			}
+			// Replay active segment records too
+			spool_segment_seal(segment);
+		}
+
+		if (NULL == segment->map && segment->size > 0 &&
+		    0 != spool_segment_map(spool, segment)) {
+			spool_segment_remove(spool, segment, false);
+			continue;
+		}
+
+		while (ret < max && segment->read_offset < segment->map_size) {
+			const char *cursor =
+					&segment->map[segment->read_offset];
+			struct spool_record_hdr hdr;
+			memcpy(&hdr, cursor, sizeof(hdr));
+			cursor += sizeof(hdr);
+
+			records[ret++] = (struct rb_spool_record){
+					.key = hdr.key_len ? cursor : NULL,
+					.key_len = hdr.key_len,
+					.payload = cursor + hdr.key_len,
+					.len = hdr.len,
+					.timestamp = hdr.timestamp,
+					.segment = segment,
+			};
+			segment->read_offset +=
+					sizeof(hdr) + hdr.key_len + hdr.len;
+			segment->replayed++;
+		}
+
+		if (spool_segment_delivered(segment)) {
+			// Empty or corrupted segment
+			spool_segment_remove(spool, segment, true);
+		}
+	}
+	pthread_mutex_unlock(&spool->lock);
+
+	return ret;
+}
+
+void rb_spool_ack(struct rb_spool *spool, struct rb_spool_segment *segment) {
+	pthread_mutex_lock(&spool->lock);
+	segment->acked++;
+	if (segment->discarded) {
+		if (segment->acked == segment->replayed) {
+			spool_segment_free(segment);
+		}
+	} else if (spool_segment_delivered(segment)) {
+		spool_segment_remove(spool, segment, true);
+	}
+	pthread_mutex_unlock(&spool->lock);
+}
+
+uint64_t rb_spool_discarded(struct rb_spool *spool) {
+	pthread_mutex_lock(&spool->lock);
+	const uint64_t ret = spool->discarded;
+	pthread_mutex_unlock(&spool->lock);
+	return ret;
+}
+
+/*
+ * SPOOL CREATION
+ */
+
+static int spool_segment_cmp(const void *va, const void *vb) {
+	const struct rb_spool_segment *const *a = va, *const *b = vb;
+	return (*a)->id < (*b)->id ? -1 : (*a)->id > (*b)->id;
+}
+
+/** Recover segments of previous runs
+  @param spool Spool
+  @return 0 if success, !0 in other case
+  */
+static int spool_recover(struct rb_spool *spool) {
+	struct rb_spool_segment **segments = NULL;
+	size_t count = 0, capacity = 0;
+	struct dirent *entry = NULL;
+	int ret = 0;
+
+	DIR *dir = opendir(spool->dir);
+	if (NULL == dir) {
+		rdlog(LOG_ERR,
+		      "Couldn't open spool directory %s: %s",
+		      spool->dir,
+		      strerror(errno));
+		return -1;
+	}
+
+	while ((entry = readdir(dir))) {
+		char path[PATH_MAX];
+		char *endptr = NULL;
+		struct stat st;
+		const uint64_t id = strtoull(entry->d_name, &endptr, 10);
+		if (endptr == entry->d_name ||
+		    0 != strcmp(endptr, SPOOL_SEGMENT_SUFFIX)) {
+			continue;
+		}
+
+		spool_segment_path(spool, id, path, sizeof(path));
+		if (0 != stat(path, &st)) {
+			continue;
+		}
+
+		if (0 == st.st_size) {
+			unlink(path);
+			continue;
+		}
+
+		if (count == capacity) {
+			capacity = capacity ? 2 * capacity : 16;
+			struct rb_spool_segment **tmp = realloc(
+					segments, capacity * sizeof(tmp[0]));
+			if (NULL == tmp) {
+				rdlog(LOG_ERR,
+				      "Couldn't allocate spool (OOM?)");
+				ret = -1;
+				break;
+			}
+			segments = tmp;
+		}
+
+		struct rb_spool_segment *segment = spool_segment_new(id);
+		if (NULL == segment) {
+			ret = -1;
+			break;
+		}
+		segment->size = (size_t)st.st_size;
+		segment->mtime = st.st_mtime;
+		segments[count++] = segment;
+	}
+	closedir(dir);
+
+	if (count > 0) {
+		qsort(segments, count, sizeof(segments[0]), spool_segment_cmp);
+	}
+	for (size_t i = 0; i < count; ++i) {
+		TAILQ_INSERT_TAIL(&spool->segments, segments[i], entry);
+		spool->size += segments[i]->size;
+		spool->next_id = segments[i]->id + 1;
+	}
+	free(segments);
+
+	if (count > 0) {
+		rdlog(LOG_INFO,
+		      "Recovered %zu spool segments (%" PRIu64 " bytes) in %s",
+		      count,
+		      spool->size,
+		      spool->dir);
+	}
+
+	return ret;
+}
+
+struct rb_spool *rb_spool_new(const char *dir,
+			      const struct rb_spool_limits *limits) {
+	if (0 != mkdir(dir, 0755) && EEXIST != errno) {
+		rdlog(LOG_ERR,
+		      "Couldn't create spool directory %s: %s",
+		      dir,
+		      strerror(errno));
+		return NULL;
+	}
+
+	struct rb_spool *ret = calloc(1, sizeof(*ret));
+	if (NULL == ret || NULL == (ret->dir = strdup(dir))) {
+		rdlog(LOG_ERR, "Couldn't allocate spool (OOM?)");
+		free(ret);
+		return NULL;
+	}
+
+	pthread_mutex_init(&ret->lock, NULL);
+	TAILQ_INIT(&ret->segments);
+	ret->limits = *limits;
+
+	if (0 != spool_recover(ret)) {
+		rb_spool_done(ret);
+		return NULL;
+	}
+
+	return ret;
+}
+
+/** Drop the delivered records of a partially replayed segment, so they are
+  not replayed again in the next run
+  @param spool Spool
+  @param segment Segment
+  */
+static void spool_segment_compact(const struct rb_spool *spool,
+				  struct rb_spool_segment *segment) {
+	char path[PATH_MAX], tmp_path[PATH_MAX];
+	if (NULL == segment->map || 0 == segment->read_offset ||
+	    segment->acked != segment->replayed) {
+		return;
+	}
+
+	spool_segment_path(spool, segment->id, path, sizeof(path));
+	const int tmp_path_len =
+			snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	if (tmp_path_len < 0 || (size_t)tmp_path_len >= sizeof(tmp_path)) {
+		rdlog(LOG_WARNING,
+		      "Spool segment %s path too long to compact it, its "
+		      "delivered records will be replayed again",
+		      path);
+		return;
+	}
+
+	const int fd = open(tmp_path,
+			    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			    0644);
+	if (fd < 0) {
+		return;
+	}
+
+	struct iovec iov = {
+			.iov_base = &segment->map[segment->read_offset],
+			.iov_len = segment->map_size - segment->read_offset,
+	};
+	const int rc = spool_writev(fd, &iov, 1);
+	close(fd);
+	if (0 != rc || 0 != rename(tmp_path, path)) {
+		rdlog(LOG_WARNING,
+		      "Couldn't compact spool segment %s, its delivered "
+		      "records will be replayed again",
+		      path);
+		unlink(tmp_path);
+	}
+}
+
+void rb_spool_done(struct rb_spool *spool) {
+	struct rb_spool_segment *segment = NULL;
+
+	while ((segment = TAILQ_FIRST(&spool->segments))) {
+		TAILQ_REMOVE(&spool->segments, segment, entry);
+		spool_segment_compact(spool, segment);
+		spool_segment_free(segment);
+	}
+
+	pthread_mutex_destroy(&spool->lock);
+	free(spool->dir);
+	free(spool);
+}
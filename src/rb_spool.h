@@ -0,0 +1,102 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Bounded on-disk spool of messages. It is an append-only log, split in
+  segment files that are written with writev and read back with mmap.
+  Segments are removed when all their messages have been delivered, or when
+  spool limits are exceeded. */
+struct rb_spool;
+
+/// Spool segment. Replayed records keep a reference to it until they are
+/// acknowledged.
+struct rb_spool_segment;
+
+/// Spool limits
+struct rb_spool_limits {
+	uint64_t max_size;     ///< Max size of all segments, in bytes
+	uint64_t max_age;      ///< Max segment age, in seconds
+	uint64_t segment_size; ///< Size to start a new segment, in bytes
+};
+
+/// Spooled message
+struct rb_spool_record {
+	const void *payload; ///< Message payload
+	size_t len;	  ///< Payload length
+	const void *key;     ///< Message key, or NULL
+	size_t key_len;      ///< Key length
+	int64_t timestamp;   ///< Message timestamp, in milliseconds
+	/// Segment the record was replayed from. Only set by rb_spool_replay.
+	struct rb_spool_segment *segment;
+};
+
+/** Open a spool, recovering segments of previous runs
+  @param dir Spool directory. It is created if it does not exist.
+  @param limits Spool limits
+  @return New spool, or NULL in case of error
+  */
+struct rb_spool *rb_spool_new(const char *dir,
+			      const struct rb_spool_limits *limits);
+
+/** Append records to spool. Oldest segments are discarded if needed to make
+  room for them.
+  @param spool Spool
+  @param records Records to append
+  @param count Length of records
+  @return Number of appended records
+  */
+size_t rb_spool_append(struct rb_spool *spool,
+		       const struct rb_spool_record *records,
+		       size_t count);
+
+/** Get the next records to replay. Segments are not removed until all their
+  records are acknowledged.
+  @param spool Spool
+  @param records Records to fill. Payload and key point to spool memory, valid
+  until they are acknowledged.
+  @param max Length of records
+  @return Number of records
+  */
+size_t rb_spool_replay(struct rb_spool *spool,
+		       struct rb_spool_record *records,
+		       size_t max);
+
+/** Acknowledge a replayed record, because it was delivered or appended to
+  spool again
+  @param spool Spool
+  @param segment Record segment
+  */
+void rb_spool_ack(struct rb_spool *spool, struct rb_spool_segment *segment);
+
+/** Number of spooled records discarded because of spool limits
+  @param spool Spool
+  @return Discarded records
+  */
+uint64_t rb_spool_discarded(struct rb_spool *spool);
+
+/** Close spool. Not replayed records are kept on disk for the next run.
+  Replayed records must be acknowledged before.
+  @param spool Spool
+  */
+void rb_spool_done(struct rb_spool *spool);
@@ -0,0 +1,177 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_timer_wheel.h"
+
+#include <string.h>
+
+#define WHEEL_MASK ((uint64_t)RB_TIMER_WHEEL_SLOTS - 1)
+
+/// Level shift
+#define WHEEL_SHIFT(level) ((level)*RB_TIMER_WHEEL_BITS)
+
+/// Farthest tick delta the wheel can hold
+#define WHEEL_MAX_DELTA                                                        \
+	((UINT64_C(1) << WHEEL_SHIFT(RB_TIMER_WHEEL_LEVELS)) - 1)
+
+void rb_timer_wheel_init(struct rb_timer_wheel *wheel, uint64_t now) {
+	memset(wheel, 0, sizeof(*wheel));
+	wheel->now = now;
+}
+
+/** Link a timer in a slot
+  @param slot Slot
+  @param timer Timer
+  */
+static void wheel_slot_link(struct rb_timer **slot, struct rb_timer *timer) {
+	timer->next = *slot;
+	timer->pprev = slot;
+	if (*slot) {
+		(*slot)->pprev = &timer->next;
+	}
+	*slot = timer;
+}
+
+/** Place timer in its slot, relative to wheel current tick
+  @param wheel Wheel
+  @param timer Timer with expires set
+  */
+static void wheel_place(struct rb_timer_wheel *wheel, struct rb_timer *timer) {
+	uint64_t delta = timer->expires - wheel->now;
+	size_t level = 0;
+
+	if (delta > WHEEL_MAX_DELTA) {
+		// It will be cascaded again when we reach this slot
+		delta = WHEEL_MAX_DELTA;
+	}
+
+	while (delta >> WHEEL_SHIFT(level + 1)) {
+		level++;
+	}
+
+	const uint64_t at = wheel->now + delta;
+	const size_t slot = (at >> WHEEL_SHIFT(level)) & WHEEL_MASK;
+	wheel_slot_link(&wheel->slots[level][slot], timer);
+}
+
+void rb_timer_wheel_add(struct rb_timer_wheel *wheel,
+			struct rb_timer *timer,
+			uint64_t expires) {
+	timer->expires = expires > wheel->now ? expires : wheel->now + 1;
+	wheel_place(wheel, timer);
+	wheel->count++;
+}
+
+void rb_timer_wheel_del(struct rb_timer_wheel *wheel, struct rb_timer *timer) {
+	*timer->pprev = timer->next;
+	if (timer->next) {
+		timer->next->pprev = timer->pprev;
+	}
+	timer->next = NULL;
+	timer->pprev = NULL;
+	wheel->count--;
+}
+
+/** Move all timers of an upper level slot to lower levels
+  @param wheel Wheel
+  @param level Level
+  @param slot Slot
+  */
+static void
+wheel_cascade(struct rb_timer_wheel *wheel, size_t level, size_t slot) {
+	struct rb_timer *timer = wheel->slots[level][slot];
+	wheel->slots[level][slot] = NULL;
+
+	while (timer) {
+		struct rb_timer *next = timer->next;
+		wheel_place(wheel, timer);
+		timer = next;
+	}
+}
+
+size_t rb_timer_wheel_advance(struct rb_timer_wheel *wheel,
+			      uint64_t now,
+			      void (*cb)(struct rb_timer *timer, void *opaque),
+			      void *opaque) {
+	size_t ret = 0;
+
+	while (wheel->now < now) {
+		const uint64_t tick = ++wheel->now;
+
+		// Cascade upper levels when lower ones complete a rotation
+		for (size_t level = 1; level < RB_TIMER_WHEEL_LEVELS; ++level) {
+			if (tick & ((UINT64_C(1) << WHEEL_SHIFT(level)) - 1)) {
+				break;
+			}
+			wheel_cascade(wheel,
+				      level,
+				      (tick >> WHEEL_SHIFT(level)) & WHEEL_MASK);
+		}
+
+		struct rb_timer **slot = &wheel->slots[0][tick & WHEEL_MASK];
+		struct rb_timer *timer = *slot;
+		*slot = NULL;
+		while (timer) {
+			struct rb_timer *next = timer->next;
+			timer->next = NULL;
+			timer->pprev = NULL;
+			wheel->count--;
+			ret++;
+			cb(timer, opaque);
+			timer = next;
+		}
+	}
+
+	return ret;
+}
+
+uint64_t rb_timer_wheel_next(const struct rb_timer_wheel *wheel) {
+	if (0 == wheel->count) {
+		return UINT64_MAX;
+	}
+
+	uint64_t ret = UINT64_MAX;
+
+	for (uint64_t i = 1; i < RB_TIMER_WHEEL_SLOTS; ++i) {
+		if (wheel->slots[0][(wheel->now + i) & WHEEL_MASK]) {
+			ret = wheel->now + i;
+			break;
+		}
+	}
+
+	// Upper level timers can expire before lower level ones if they were
+	// added earlier, so their cascade can't be skipped
+	for (size_t level = 1; level < RB_TIMER_WHEEL_LEVELS; ++level) {
+		const uint64_t level_now = wheel->now >> WHEEL_SHIFT(level);
+		for (uint64_t i = 1; i <= RB_TIMER_WHEEL_SLOTS; ++i) {
+			const uint64_t cascade = (level_now + i)
+						 << WHEEL_SHIFT(level);
+			if (cascade >= ret) {
+				break;
+			}
+
+			if (wheel->slots[level][(level_now + i) & WHEEL_MASK]) {
+				ret = cascade;
+				break;
+			}
+		}
+	}
+
+	return ret;
+}
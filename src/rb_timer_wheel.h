@@ -0,0 +1,89 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Bits of each wheel level
+#define RB_TIMER_WHEEL_BITS 6
+/// Slots of each wheel level
+#define RB_TIMER_WHEEL_SLOTS (1 << RB_TIMER_WHEEL_BITS)
+/// Wheel levels. Timers beyond 2^(BITS*LEVELS) ticks are cascaded again
+#define RB_TIMER_WHEEL_LEVELS 4
+
+/// Wheel timer. Embed it in your own struct.
+struct rb_timer {
+	struct rb_timer *next;   ///< Next timer in slot
+	struct rb_timer **pprev; ///< Previous timer next pointer
+	uint64_t expires;	///< Expiration tick
+};
+
+/** Hierarchical timing wheel. Level 0 has one slot per tick, and each upper
+  level slot covers a whole lower level rotation. Timers are moved (cascaded)
+  to lower levels when the wheel reach their slot, so add, delete and expire
+  are O(1). It is not thread safe. */
+struct rb_timer_wheel {
+	uint64_t now; ///< Last processed tick
+	struct rb_timer *slots[RB_TIMER_WHEEL_LEVELS][RB_TIMER_WHEEL_SLOTS];
+	size_t count; ///< Timers in wheel
+};
+
+/** Initialize a timing wheel
+  @param wheel Wheel
+  @param now Current tick
+  */
+void rb_timer_wheel_init(struct rb_timer_wheel *wheel, uint64_t now);
+
+/** Add a timer to the wheel
+  @param wheel Wheel
+  @param timer Timer, not present in any wheel
+  @param expires Expiration tick. If it is in the past, timer will expire in
+  next tick.
+  */
+void rb_timer_wheel_add(struct rb_timer_wheel *wheel,
+			struct rb_timer *timer,
+			uint64_t expires);
+
+/** Remove a timer from the wheel
+  @param wheel Wheel
+  @param timer Timer present in wheel
+  */
+void rb_timer_wheel_del(struct rb_timer_wheel *wheel, struct rb_timer *timer);
+
+/** Advance wheel up to a tick, expiring timers
+  @param wheel Wheel
+  @param now Current tick
+  @param cb Callback to call with each expired timer. Timer is removed from
+  wheel before the call, so callback can add it again.
+  @param opaque Opaque to send to callback
+  @return Number of expired timers
+  */
+size_t rb_timer_wheel_advance(struct rb_timer_wheel *wheel,
+			      uint64_t now,
+			      void (*cb)(struct rb_timer *timer, void *opaque),
+			      void *opaque);
+
+/** Next tick the wheel has work to do: a timer expiration, or a cascade that
+  can lead to one.
+  @param wheel Wheel
+  @return Tick to call rb_timer_wheel_advance, or UINT64_MAX if wheel is empty
+  */
+uint64_t rb_timer_wheel_next(const struct rb_timer_wheel *wheel);
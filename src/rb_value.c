@@ -17,32 +17,19 @@
   along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include "utils.h"
-
 #include "rb_value.h"
 
+#include "rb_monitor_template.h"
 #include "rb_sensor.h"
 #include "rb_sensor_monitor.h"
 
-#include <json-c/printbuf.h>
 #include <librd/rdlog.h>
 #include <librd/rdmem.h>
 
-struct monitor_value *new_monitor_value_array(size_t n_children,
-					      struct monitor_value **children,
-					      struct monitor_value *split_op) {
-	struct monitor_value *ret = calloc(1, sizeof(*ret));
+struct monitor_value *new_monitor_value_array(struct rb_arena *arena,
+					      size_t n_children) {
+	struct monitor_value *ret = rb_arena_calloc(arena, 1, sizeof(*ret));
 	if (NULL == ret) {
-		if (split_op) {
-			rb_monitor_value_done(split_op);
-		}
-		for (size_t i = 0; i < n_children; ++i) {
-			if (children[i]) {
-				rb_monitor_value_done(children[i]);
-			}
-		}
-		free(children);
-
 		rdlog(LOG_ERR, "Couldn't allocate monitor value");
 		return NULL;
 	}
@@ -53,162 +40,117 @@ struct monitor_value *new_monitor_value_array(size_t n_children,
 
 	ret->type = MONITOR_VALUE_T__ARRAY;
 	ret->array.children_count = n_children;
-	ret->array.split_op_result = split_op;
-	ret->array.children = children;
+	ret->array.values = rb_arena_calloc(
+			arena, n_children, sizeof(ret->array.values[0]));
+	ret->array.timestamps = rb_arena_calloc(
+			arena, n_children, sizeof(ret->array.timestamps[0]));
+	ret->array.valid = rb_arena_calloc(arena,
+					   RB_BITMAP_WORDS(n_children),
+					   sizeof(ret->array.valid[0]));
+	if (NULL == ret->array.values || NULL == ret->array.timestamps ||
+	    NULL == ret->array.valid) {
+		rdlog(LOG_ERR, "Couldn't allocate monitor value children");
+		return NULL;
+	}
 
 	return ret;
 }
 
-static void print_monitor_value_enrichment_str(struct printbuf *buf,
-					       const char *key,
-					       json_object *val) {
-	const char *str = json_object_get_string(val);
-	if (NULL == str) {
-		rdlog(LOG_ERR,
-		      "Cannot extract string value of enrichment key %s",
-		      key);
-	} else {
-		sprintbuf(buf, ",\"%s\":\"%s\"", key, str);
+/** Copy a memory block to an arena
+  @param arena Arena to copy to
+  @param src Memory to copy
+  @param size Size of src
+  @return Copy, or NULL if error
+  */
+static void *arena_memdup(struct rb_arena *arena, const void *src, size_t size) {
+	void *ret = rb_arena_calloc(arena, 1, size);
+	if (ret) {
+		memcpy(ret, src, size);
 	}
+	return ret;
 }
 
-static void print_monitor_value_enrichment_int(struct printbuf *buf,
-					       const char *key,
-					       json_object *val) {
-	errno = 0;
-	int64_t integer = json_object_get_int64(val);
-	if (errno != 0) {
-		const char *errbuf = gnu_strerror_r(errno);
-		rdlog(LOG_ERR,
-		      "Cannot extract int value of enrichment key %s: %s",
-		      key,
-		      errbuf);
-	} else {
-		sprintbuf(buf, ",\"%s\":%ld", key, integer);
+struct monitor_value *monitor_value_copy(struct rb_arena *arena,
+					 const struct monitor_value *mv) {
+	rb_monitor_value_assert(mv);
+	struct monitor_value *ret = rb_arena_calloc(arena, 1, sizeof(*ret));
+	if (NULL == ret) {
+		goto err;
 	}
-}
 
-/// @TODO we should print all with this function
-static void
-print_monitor_value_enrichment(struct printbuf *buf,
-			       const json_object *const_enrichment) {
-	json_object *enrichment = (json_object *)const_enrichment;
-
-	for (struct json_object_iterator i = json_object_iter_begin(enrichment),
-					 end = json_object_iter_end(enrichment);
-	     !json_object_iter_equal(&i, &end);
-	     json_object_iter_next(&i)) {
-		const char *key = json_object_iter_peek_name(&i);
-		json_object *val = json_object_iter_peek_value(&i);
-
-		const json_type type = json_object_get_type(val);
-		switch (type) {
-		case json_type_string:
-			print_monitor_value_enrichment_str(buf, key, val);
-			break;
-
-		case json_type_int:
-			print_monitor_value_enrichment_int(buf, key, val);
-			break;
-
-		case json_type_null:
-			sprintbuf(buf, ",\"%s\":null", key);
-			break;
-
-		case json_type_boolean: {
-			const json_bool b = json_object_get_boolean(val);
-			sprintbuf(buf,
-				  ",\"%s\":%s",
-				  key,
-				  b == FALSE ? "false" : "true");
-			break;
-		}
-		case json_type_double: {
-			const double d = json_object_get_double(val);
-			sprintbuf(buf, ",\"%s\":%lf", key, d);
-			break;
-		}
-		case json_type_object:
-		case json_type_array: {
-			rdlog(LOG_ERR,
-			      "Can't enrich with objects/array at this time");
-			break;
-		}
-		default:
-			rdlog(LOG_ERR,
-			      "Don't know how to duplicate JSON type "
-			      "%d",
-			      type);
-			break;
-		};
+	*ret = *mv;
+	if (MONITOR_VALUE_T__VALUE == mv->type) {
+		return ret;
 	}
-}
 
-#define NO_INSTANCE (-1)
-static void print_monitor_value0(rb_message *message,
-				 const struct monitor_value *monitor_value,
-				 const rb_monitor_t *monitor,
-				 int instance) {
-	assert(monitor_value->type == MONITOR_VALUE_T__VALUE);
-
-	struct printbuf *buf = printbuf_new();
-	if (likely(NULL != buf)) {
-		const char *monitor_instance_prefix =
-				rb_monitor_instance_prefix(monitor);
-		const char *monitor_name_split_suffix =
-				rb_monitor_name_split_suffix(monitor);
-		const struct json_object *monitor_enrichment =
-				rb_monitor_enrichment(monitor);
-		// @TODO use printbuf_memappend_fast instead! */
-		sprintbuf(buf, "{");
-		sprintbuf(buf,
-			  "\"timestamp\":%lu",
-			  monitor_value->value.timestamp);
-		if (NO_INSTANCE != instance && monitor_name_split_suffix) {
-			sprintbuf(buf,
-				  ",\"monitor\":\"%s%s\"",
-				  rb_monitor_name(monitor),
-				  monitor_name_split_suffix);
-		} else {
-			sprintbuf(buf,
-				  ",\"monitor\":\"%s\"",
-				  rb_monitor_name(monitor));
-		}
+	const size_t n = mv->array.children_count;
+	ret->array.values = arena_memdup(
+			arena, mv->array.values, n * sizeof(mv->array.values[0]));
+	ret->array.timestamps = arena_memdup(
+			arena,
+			mv->array.timestamps,
+			n * sizeof(mv->array.timestamps[0]));
+	ret->array.valid = arena_memdup(
+			arena,
+			mv->array.valid,
+			RB_BITMAP_WORDS(n) * sizeof(mv->array.valid[0]));
+	if (NULL == ret->array.values || NULL == ret->array.timestamps ||
+	    NULL == ret->array.valid) {
+		goto err;
+	}
 
-		if (NO_INSTANCE != instance && monitor_instance_prefix) {
-			sprintbuf(buf,
-				  ",\"instance\":\"%s%d\"",
-				  monitor_instance_prefix,
-				  instance);
+	if (mv->array.instances) {
+		ret->array.instances = rb_arena_calloc(
+				arena, n, sizeof(ret->array.instances[0]));
+		if (NULL == ret->array.instances) {
+			goto err;
 		}
+	}
 
-		if (rb_monitor_is_integer(monitor)) {
-			sprintbuf(buf,
-				  ",\"value\":%" PRId64,
-				  (int64_t)monitor_value->value.value);
-		} else {
-			sprintbuf(buf,
-				  ",\"value\":\"%lf\"",
-				  monitor_value->value.value);
+	for (size_t i = 0; mv->array.instances && i < n; ++i) {
+		if (mv->array.instances[i] &&
+		    NULL == (ret->array.instances[i] = rb_arena_strdup(
+					     arena, mv->array.instances[i]))) {
+			goto err;
 		}
+	}
 
-		if (rb_monitor_group_id(monitor)) {
-			sprintbuf(buf,
-				  ",\"group_id\":%s",
-				  rb_monitor_group_id(monitor));
+	if (mv->array.split_op_result) {
+		ret->array.split_op_result = monitor_value_copy(
+				arena, mv->array.split_op_result);
+		if (NULL == ret->array.split_op_result) {
+			return NULL;
 		}
+	}
 
-		if (monitor_enrichment) {
-			print_monitor_value_enrichment(buf, monitor_enrichment);
-		}
-		sprintbuf(buf, "}");
+	return ret;
 
-		message->payload = buf->buf;
-		message->len = (size_t)buf->bpos;
+err:
+	rdlog(LOG_ERR, "Couldn't copy monitor value (OOM?)");
+	return NULL;
+}
 
-		buf->buf = NULL;
-		printbuf_free(buf);
-	}
+#define NO_INSTANCE (-1)
+/** Print a single value
+  @param message Message to print value in
+  @param timestamp Value timestamp
+  @param value Value
+  @param value_instance Vector child instance, if it is not its position
+  @param monitor Value's monitor
+  @param instance Vector child position, or NO_INSTANCE
+  */
+static void print_monitor_value0(rb_message *message,
+				 time_t timestamp,
+				 double value,
+				 const char *value_instance,
+				 const rb_monitor_t *monitor,
+				 int instance) {
+	rb_monitor_template_print(rb_monitor_message_template(monitor),
+				  message,
+				  timestamp,
+				  value,
+				  value_instance,
+				  instance);
 }
 
 rb_message_array_t *
@@ -227,34 +169,46 @@ print_monitor_value(const struct monitor_value *monitor_value,
 		return NULL;
 	}
 
+	ret->tmpl = rb_monitor_template_get(
+			rb_monitor_message_template(monitor));
+	ret->priority = rb_monitor_template_priority(ret->tmpl);
+
 	if (monitor_value->type == MONITOR_VALUE_T__VALUE) {
 		print_monitor_value0(&ret->msgs[0],
-				     monitor_value,
+				     monitor_value->value.timestamp,
+				     monitor_value->value.value,
+				     NULL,
 				     monitor,
 				     NO_INSTANCE);
 	} else {
 		size_t i_msgs = 0;
 		assert(monitor_value->type == MONITOR_VALUE_T__ARRAY);
+		const char **instances = monitor_value->array.instances;
 		for (size_t i = 0; i < monitor_value->array.children_count;
 		     ++i) {
-			if (monitor_value->array.children[i]) {
+			if (monitor_value_array_valid(monitor_value, i)) {
 				print_monitor_value0(
 						&ret->msgs[i_msgs++],
 						monitor_value->array
-								.children[i],
+								.timestamps[i],
+						monitor_value->array.values[i],
+						instances ? instances[i] : NULL,
 						monitor,
-						i);
+						(int)i);
 			}
 		}
 
-		if (monitor_value->array.split_op_result) {
+		const struct monitor_value *split_op =
+				monitor_value->array.split_op_result;
+		if (split_op) {
 			rb_message *msg = &ret->msgs[i_msgs++];
 			assert(NULL == msg->payload);
-			print_monitor_value0(
-					msg,
-					monitor_value->array.split_op_result,
-					monitor,
-					NO_INSTANCE);
+			print_monitor_value0(msg,
+					     split_op->value.timestamp,
+					     split_op->value.value,
+					     NULL,
+					     monitor,
+					     NO_INSTANCE);
 		}
 
 		ret->count = i_msgs;
@@ -273,13 +227,16 @@ static size_t pos_array_length(const ssize_t *pos) {
 }
 
 rb_monitor_value_array_t *
-rb_monitor_value_array_select(rb_monitor_value_array_t *array, ssize_t *pos) {
+rb_monitor_value_array_select(struct rb_arena *arena,
+			      rb_monitor_value_array_t *array,
+			      ssize_t *pos) {
 	if (NULL == pos || NULL == array) {
 		return NULL;
 	}
 
 	const size_t ret_size = pos_array_length(pos);
-	rb_monitor_value_array_t *ret = rb_monitor_value_array_new(ret_size);
+	rb_monitor_value_array_t *ret =
+			rb_monitor_value_array_arena_new(arena, ret_size);
 	if (NULL == ret) {
 		rdlog(LOG_ERR, "Couldn't allocate select return (OOM?)");
 		return NULL;
@@ -294,18 +251,3 @@ rb_monitor_value_array_select(rb_monitor_value_array_t *array, ssize_t *pos) {
 
 	return ret;
 }
-
-void rb_monitor_value_done(struct monitor_value *mv) {
-	if (MONITOR_VALUE_T__ARRAY == mv->type) {
-		for (size_t i = 0; i < mv->array.children_count; ++i) {
-			if (mv->array.children[i]) {
-				rb_monitor_value_done(mv->array.children[i]);
-			}
-		}
-		if (mv->array.split_op_result) {
-			rb_monitor_value_done(mv->array.split_op_result);
-		}
-		free(mv->array.children);
-	}
-	free(mv);
-}
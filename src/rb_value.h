@@ -19,7 +19,9 @@
 
 #pragma once
 
+#include "rb_arena.h"
 #include "rb_array.h"
+#include "rb_bitmap.h"
 #include "rb_message_list.h"
 
 #include <json-c/json.h>
@@ -54,26 +56,61 @@ struct monitor_value {
 		struct {
 			time_t timestamp;
 			double value;
-			bool bad_value;
-			const char *string_value;
 		} value;
+		/// Vector, stored as columns
 		struct {
 			size_t children_count;
 			struct monitor_value *split_op_result;
-			struct monitor_value **children;
+			double *values;	///< Children values
+			time_t *timestamps; ///< Children timestamps
+			/// Children validity bitmap. Unset bit means that we
+			/// don't have this child value.
+			uint64_t *valid;
+			/// Children instances, or NULL if they are their
+			/// positions
+			const char **instances;
 		} array;
 	};
 };
 
-/** Creates a new monitor value array
+/** Creates a new monitor value array, with no valid children
+ * @param arena Arena to allocate from
  * @param n_children Number of childrens
- * @param children Childrens
- * @param split_op Split operation
  * @return New monitor value of array type
  */
-struct monitor_value *new_monitor_value_array(size_t n_children,
-					      struct monitor_value **children,
-					      struct monitor_value *split_op);
+struct monitor_value *new_monitor_value_array(struct rb_arena *arena,
+					      size_t n_children);
+
+/** Set a monitor value array child
+  @param mv Monitor value array
+  @param i Child position
+  @param timestamp Child timestamp
+  @param value Child value
+  */
+static void monitor_value_array_set(struct monitor_value *mv,
+				    size_t i,
+				    time_t timestamp,
+				    double value) RD_UNUSED;
+static void monitor_value_array_set(struct monitor_value *mv,
+				    size_t i,
+				    time_t timestamp,
+				    double value) {
+	mv->array.timestamps[i] = timestamp;
+	mv->array.values[i] = value;
+	rb_bitmap_set(mv->array.valid, i);
+}
+
+/** Check if we have a monitor value array child
+  @param mv Monitor value array
+  @param i Child position
+  @return true if child is valid
+  */
+static bool monitor_value_array_valid(const struct monitor_value *mv,
+				      size_t i) RD_UNUSED;
+static bool monitor_value_array_valid(const struct monitor_value *mv,
+				      size_t i) {
+	return rb_bitmap_test(mv->array.valid, i);
+}
 
 #ifdef MONITOR_VALUE_MAGIC
 #define rb_monitor_value_assert(monitor)                                       \
@@ -82,7 +119,13 @@ struct monitor_value *new_monitor_value_array(size_t n_children,
 #define rb_monitor_value_assert(monitor)
 #endif
 
-void rb_monitor_value_done(struct monitor_value *mv);
+/** Deep copy a monitor value to another arena
+  @param arena Arena to copy to
+  @param mv Monitor value to copy
+  @return Copy, or NULL if error
+  */
+struct monitor_value *monitor_value_copy(struct rb_arena *arena,
+					 const struct monitor_value *mv);
 
 /** Sensors array */
 typedef struct rb_array rb_monitor_value_array_t;
@@ -90,6 +133,20 @@ typedef struct rb_array rb_monitor_value_array_t;
 /** Create a new array with count capacity */
 #define rb_monitor_value_array_new(sz) rb_array_new(sz)
 
+/** Create a new array with count capacity in an arena */
+static rb_monitor_value_array_t *
+rb_monitor_value_array_arena_new(struct rb_arena *arena,
+				 size_t sz) RD_UNUSED;
+static rb_monitor_value_array_t *
+rb_monitor_value_array_arena_new(struct rb_arena *arena, size_t sz) {
+	rb_monitor_value_array_t *ret = rb_arena_calloc(
+			arena, 1, sizeof(*ret) + sz * sizeof(ret->elms[0]));
+	if (ret) {
+		ret->size = sz;
+	}
+	return ret;
+}
+
 /** Destroy a sensors array */
 #define rb_monitor_value_array_done(array) rb_array_done(array)
 
@@ -106,14 +163,16 @@ static void rb_monitor_value_array_add(rb_monitor_value_array_t *array,
 }
 
 /** Select individual positions of original array
+  @param arena Arena to allocate new array from
   @param array Original array
   @param pos list of positions (-1 terminated)
-  @return New monitor array, that needs to be free with
-	rb_monitor_value_array_done
+  @return New monitor array, released with arena
   @note Monitors are from original array, so they should not be touched
   */
 rb_monitor_value_array_t *
-rb_monitor_value_array_select(rb_monitor_value_array_t *array, ssize_t *pos);
+rb_monitor_value_array_select(struct rb_arena *arena,
+			      rb_monitor_value_array_t *array,
+			      ssize_t *pos);
 
 /** Return monitor value of an array
   @param array Array
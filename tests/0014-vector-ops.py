@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+
+from mon_test import TestMonitor, main
+from pysnmp.proto.api import v2c
+
+
+class TestVectorOps(TestMonitor):
+    ''' Vector operations tests'''
+    def test_vector_ops(self,
+                        child,
+                        kafka_handler):
+        ''' Test for vector operations and reductions '''
+        vec_a, vec_b, scalar = [1, 2, 3], [4, 5, 6], 2
+
+        variables = [('vec_a', ';'.join(str(n) for n in vec_a), True),
+                     ('vec_b', ';'.join(str(n) for n in vec_b), True),
+                     ('scalar', str(scalar), False)]
+
+        # (operation, expected vector values, expected split_op sum)
+        vector_operations = [
+            ('vec_a+vec_b', [a + b for a, b in zip(vec_a, vec_b)]),
+            ('vec_a*scalar', [a * scalar for a in vec_a]),
+            ('100*vec_a/sum(vec_a)', [100 * a / sum(vec_a) for a in vec_a]),
+        ]
+
+        # (operation, expected scalar value)
+        scalar_operations = [
+            ('sum(vec_a)', sum(vec_a)),
+            ('mean(vec_b)', sum(vec_b) / len(vec_b)),
+            ('max(vec_b)-min(vec_a)', max(vec_b) - min(vec_a)),
+        ]
+
+        snmp_responses = {
+            (1, i): v2c.OctetString(value)
+            for i, (_, value, _) in enumerate(variables)
+        }
+
+        variables_monitors = [{
+            'name': name,
+            'oid': (1, i),
+            'send': 0,
+            **({'split': ';'} if vector else {}),
+        } for i, (name, _, vector) in enumerate(variables)]
+
+        vector_monitors = [{
+            'name': 'op_' + operation,
+            'op': operation,
+            'split': ';',
+            'split_op': 'sum',
+            'instance_prefix': 'instance-',
+            'name_split_suffix': '_per_instance',
+        } for operation, _ in vector_operations]
+
+        scalar_monitors = [{
+            'name': 'op_' + operation,
+            'op': operation,
+        } for operation, _ in scalar_operations]
+
+        sensor_config = {
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+            'timeout': 100000000,
+            'community': 'public',
+            'monitors': variables_monitors + vector_monitors + scalar_monitors,
+        }
+
+        base_config = {'sensors': [sensor_config]}
+
+        message_base = {
+            'type': 'op',
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+        }
+
+        kafka_messages = [
+            message
+            for operation, values in vector_operations
+            for message in [{
+                **message_base,
+                'monitor': 'op_' + operation + '_per_instance',
+                'instance': 'instance-' + str(i),
+                'value': '{:.6f}'.format(value),
+            } for i, value in enumerate(values)] + [{
+                **message_base,
+                'monitor': 'op_' + operation,
+                'instance': None,
+                'value': '{:.6f}'.format(sum(values)),
+            }]
+        ] + [{
+            **message_base,
+            'monitor': 'op_' + operation,
+            'value': '{:.6f}'.format(value),
+        } for operation, value in scalar_operations]
+
+        t_locals = locals()
+        self.base_test(child_argv_str=t_locals['child'],
+                       **{key: t_locals[key] for key in ['base_config',
+                                                         'kafka_handler',
+                                                         'kafka_messages',
+                                                         'snmp_responses']})
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+
+from mon_test import TestMonitor, main
+
+
+class TestSystemStructured(TestMonitor):
+    ''' Structured system output tests'''
+    def test_system_structured(self,
+                               child,
+                               kafka_handler):
+        ''' Test key=value, columns and JSON system outputs '''
+        kv_command = "printf 'a=1\\nb = 2\\nc=not a number\\n'"
+        columns_command = "printf 'iface rx tx\\neth0 10 20\\nlo 1 2\\n'"
+        json_command = 'echo \'{"load": {"1": 0.5, "5": 0.25}}\''
+
+        sensor_config = {
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+            'timeout': 100000000,
+            'community': 'public',
+            'monitors': [
+                {'name': 'kv_b', 'system': kv_command, 'format': 'kv',
+                 'field': 'b'},
+                {'name': 'kv_all', 'system': kv_command, 'format': 'kv',
+                 'split_op': 'sum', 'name_split_suffix': '_per_instance'},
+                {'name': 'tx', 'system': columns_command,
+                 'format': 'columns', 'field': 'tx',
+                 'name_split_suffix': '_per_instance'},
+                {'name': 'lo_rx', 'system': columns_command,
+                 'format': 'columns', 'field': 'lo:rx'},
+                {'name': 'load_5', 'system': json_command, 'format': 'json',
+                 'field': 'load.5'},
+            ],
+        }
+
+        base_config = {'sensors': [sensor_config]}
+
+        message_base = {
+            'type': 'system',
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+        }
+
+        kafka_messages = [{
+            **message_base,
+            'monitor': monitor,
+            'value': '{:.6f}'.format(value),
+            **({'instance': instance} if instance else {}),
+        } for monitor, instance, value in [
+            ('kv_b', None, 2),
+            ('kv_all_per_instance', 'a', 1),
+            ('kv_all_per_instance', 'b', 2),
+            ('kv_all', None, 3),
+            ('tx_per_instance', 'eth0', 20),
+            ('tx_per_instance', 'lo', 2),
+            ('lo_rx', None, 1),
+            ('load_5', None, 0.25),
+        ]]
+
+        t_locals = locals()
+        self.base_test(child_argv_str=t_locals['child'],
+                       snmp_responses=None,
+                       **{key: t_locals[key] for key in ['base_config',
+                                                         'kafka_handler',
+                                                         'kafka_messages']})
+
+
+if __name__ == '__main__':
+    main()
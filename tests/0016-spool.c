@@ -0,0 +1,285 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_spool.h"
+
+#include <librd/rd.h>
+
+#include <setjmp.h> // Needs to be before of cmocka.h
+
+#include <cmocka.h>
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/// Test records per append
+#define RECORDS 100
+/// Small segments, so tests use many of them
+#define SEGMENT_SIZE 1024
+
+static const struct rb_spool_limits spool_limits = {
+		.max_size = 1024 * 1024,
+		.max_age = 3600,
+		.segment_size = SEGMENT_SIZE,
+};
+
+/** Create an empty spool directory
+  @param dir Directory template, modified with the actual name
+  */
+static void spool_dir_new(char *dir) {
+	assert_non_null(mkdtemp(dir));
+}
+
+/** Remove spool directory and its segments
+  @param dir Directory
+  */
+static void spool_dir_done(const char *dir) {
+	DIR *d = opendir(dir);
+	assert_non_null(d);
+	for (struct dirent *ent = readdir(d); ent; ent = readdir(d)) {
+		char path[PATH_MAX];
+		if ('.' != ent->d_name[0]) {
+			snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+			unlink(path);
+		}
+	}
+	closedir(d);
+	assert_int_equal(0, rmdir(dir));
+}
+
+/** Last segment of a spool directory, by name
+  @param dir Directory
+  @param path Segment path
+  @param path_size Size of path
+  */
+static void spool_last_segment(const char *dir, char *path, size_t path_size) {
+	struct dirent **ents = NULL;
+	const int n = scandir(dir, &ents, NULL, alphasort);
+	assert_true(n > 2);
+	snprintf(path, path_size, "%s/%s", dir, ents[n - 1]->d_name);
+	for (int i = 0; i < n; ++i) {
+		free(ents[i]);
+	}
+	free(ents);
+}
+
+/** Append records with payload "msg-<i>", key "key-<i>" on even records,
+  and timestamp i
+  @param spool Spool
+  @param first First record number
+  @param count Number of records
+  */
+static void spool_append_n(struct rb_spool *spool, int first, size_t count) {
+	char payloads[count][16], keys[count][16];
+	struct rb_spool_record records[count];
+
+	for (size_t i = 0; i < count; ++i) {
+		const int n = first + (int)i;
+		snprintf(payloads[i], sizeof(payloads[i]), "msg-%d", n);
+		snprintf(keys[i], sizeof(keys[i]), "key-%d", n);
+		records[i] = (struct rb_spool_record){
+				.payload = payloads[i],
+				.len = strlen(payloads[i]),
+				.key = n % 2 ? NULL : keys[i],
+				.key_len = n % 2 ? 0 : strlen(keys[i]),
+				.timestamp = n,
+		};
+	}
+
+	assert_int_equal(count, rb_spool_append(spool, records, count));
+}
+
+/** Replay all spool records, checking they are the expected ones
+  @param spool Spool
+  @param first Expected first record number
+  @param ack Acknowledge replayed records
+  @return Number of replayed records
+  */
+static size_t spool_replay_check(struct rb_spool *spool, int first, bool ack) {
+	struct rb_spool_record records[16];
+	size_t ret = 0, n;
+
+	while ((n = rb_spool_replay(spool, records, RD_ARRAYSIZE(records)))) {
+		for (size_t i = 0; i < n; ++i, ++ret) {
+			char expected[16];
+			const int num = first + (int)ret;
+			snprintf(expected, sizeof(expected), "msg-%d", num);
+			assert_int_equal(strlen(expected), records[i].len);
+			assert_memory_equal(expected,
+					    records[i].payload,
+					    records[i].len);
+			assert_int_equal(num, records[i].timestamp);
+			if (num % 2) {
+				assert_null(records[i].key);
+			} else {
+				snprintf(expected,
+					 sizeof(expected),
+					 "key-%d",
+					 num);
+				assert_int_equal(strlen(expected),
+						 records[i].key_len);
+				assert_memory_equal(expected,
+						    records[i].key,
+						    records[i].key_len);
+			}
+			if (ack) {
+				rb_spool_ack(spool, records[i].segment);
+			}
+		}
+
+		if (!ack) {
+			break;
+		}
+	}
+
+	return ret;
+}
+
+/// @test appended records are replayed in order
+static void test_spool_append_replay() {
+	char dir[] = "/tmp/rb_monitor_spool_XXXXXX";
+	spool_dir_new(dir);
+
+	struct rb_spool *spool = rb_spool_new(dir, &spool_limits);
+	assert_non_null(spool);
+	spool_append_n(spool, 0, RECORDS);
+	spool_append_n(spool, RECORDS, RECORDS);
+	assert_int_equal(2 * RECORDS, spool_replay_check(spool, 0, true));
+	assert_int_equal(0, spool_replay_check(spool, 0, true));
+	assert_int_equal(0, rb_spool_discarded(spool));
+	rb_spool_done(spool);
+
+	spool_dir_done(dir);
+}
+
+/// @test acknowledged records are not replayed in the next run, and not
+/// acknowledged ones are
+static void test_spool_ack() {
+	char dir[] = "/tmp/rb_monitor_spool_XXXXXX";
+	struct rb_spool_record records[RECORDS];
+	spool_dir_new(dir);
+
+	struct rb_spool *spool = rb_spool_new(dir, &spool_limits);
+	assert_non_null(spool);
+	spool_append_n(spool, 0, 4 * RECORDS);
+	const size_t replayed =
+			rb_spool_replay(spool, records, RD_ARRAYSIZE(records));
+	assert_int_equal(RECORDS, replayed);
+	for (size_t i = 0; i < replayed; ++i) {
+		rb_spool_ack(spool, records[i].segment);
+	}
+	rb_spool_done(spool);
+
+	// Delivered records of partially replayed segments are compacted
+	spool = rb_spool_new(dir, &spool_limits);
+	assert_non_null(spool);
+	assert_int_equal(3 * RECORDS,
+			 spool_replay_check(spool, RECORDS, true));
+	rb_spool_done(spool);
+
+	spool = rb_spool_new(dir, &spool_limits);
+	assert_non_null(spool);
+	assert_int_equal(0, spool_replay_check(spool, 0, true));
+	rb_spool_done(spool);
+
+	spool_dir_done(dir);
+}
+
+/// @test records of a segment with a torn tail are recovered up to the last
+/// complete record
+static void test_spool_torn_tail() {
+	char dir[] = "/tmp/rb_monitor_spool_XXXXXX";
+	char path[PATH_MAX];
+	struct stat st;
+	spool_dir_new(dir);
+
+	struct rb_spool *spool = rb_spool_new(dir, &spool_limits);
+	assert_non_null(spool);
+	spool_append_n(spool, 0, RECORDS);
+	rb_spool_done(spool);
+
+	// Cut last record in half
+	spool_last_segment(dir, path, sizeof(path));
+	assert_int_equal(0, stat(path, &st));
+	assert_int_equal(0, truncate(path, st.st_size - 4));
+
+	spool = rb_spool_new(dir, &spool_limits);
+	assert_non_null(spool);
+	assert_int_equal(RECORDS - 1, spool_replay_check(spool, 0, true));
+	rb_spool_done(spool);
+
+	// Garbage after last record
+	spool = rb_spool_new(dir, &spool_limits);
+	assert_non_null(spool);
+	spool_append_n(spool, 0, RECORDS);
+	rb_spool_done(spool);
+
+	spool_last_segment(dir, path, sizeof(path));
+	FILE *segment = fopen(path, "a");
+	assert_non_null(segment);
+	fputs("garbage", segment);
+	fclose(segment);
+
+	spool = rb_spool_new(dir, &spool_limits);
+	assert_non_null(spool);
+	assert_int_equal(RECORDS, spool_replay_check(spool, 0, true));
+	rb_spool_done(spool);
+
+	spool_dir_done(dir);
+}
+
+/// @test oldest records are discarded when spool is full
+static void test_spool_max_size() {
+	char dir[] = "/tmp/rb_monitor_spool_XXXXXX";
+	const struct rb_spool_limits limits = {
+			.max_size = 4 * SEGMENT_SIZE,
+			.max_age = 3600,
+			.segment_size = SEGMENT_SIZE,
+	};
+	spool_dir_new(dir);
+
+	struct rb_spool *spool = rb_spool_new(dir, &limits);
+	assert_non_null(spool);
+	for (int i = 0; i < 10; ++i) {
+		spool_append_n(spool, i * RECORDS, RECORDS);
+	}
+
+	const uint64_t discarded = rb_spool_discarded(spool);
+	assert_true(discarded > 0);
+	assert_int_equal(10 * RECORDS - discarded,
+			 spool_replay_check(spool, (int)discarded, true));
+	rb_spool_done(spool);
+
+	spool_dir_done(dir);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_spool_append_replay),
+		cmocka_unit_test(test_spool_ack),
+		cmocka_unit_test(test_spool_torn_tail),
+		cmocka_unit_test(test_spool_max_size),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,219 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_avro.h"
+#include "rb_msgpack.h"
+
+#include <librd/rd.h>
+
+#include <setjmp.h> // Needs to be before of cmocka.h
+
+#include <cmocka.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// clang-format off
+
+static const char avro_schemas[] =
+	"{\"monitor-value\":{\"id\":258,\"schema\":{"
+		"\"type\":\"record\",\"name\":\"Monitor\",\"fields\":["
+			"{\"name\":\"timestamp\",\"type\":\"long\"},"
+			"{\"name\":\"monitor\",\"type\":\"string\"},"
+			"{\"name\":\"value\",\"type\":\"double\"},"
+			"{\"name\":\"sensor_name\",\"type\":\"string\"},"
+			"{\"name\":\"sensor_id\",\"type\":[\"null\",\"long\"]},"
+			"{\"name\":\"group_id\",\"type\":[\"null\",\"string\"],"
+							"\"default\":null},"
+			"{\"name\":\"unit\",\"type\":\"string\","
+							"\"default\":\"%\"}"
+		"]}}}";
+
+// clang-format on
+
+/** Check that a JSON value is encoded as expected
+  @param json_text JSON value text
+  @param expected Expected MessagePack encoding
+  @param expected_len Length of expected
+  */
+static void check_msgpack(const char *json_text,
+			  const char *expected,
+			  size_t expected_len) {
+	json_object *json = json_tokener_parse(json_text);
+	struct printbuf *buf = printbuf_new();
+	assert_non_null(buf);
+
+	rb_msgpack_pack_json(buf, json);
+	assert_int_equal(expected_len, buf->bpos);
+	assert_memory_equal(expected, buf->buf, expected_len);
+
+	printbuf_free(buf);
+	json_object_put(json);
+}
+
+/// @test MessagePack scalars use the smallest encoding
+static void test_msgpack_scalars() {
+	static const struct {
+		const char *json;
+		const char *msgpack;
+		size_t len;
+	} tests[] = {
+#define MSGPACK_TEST(json, msgpack) {json, msgpack, sizeof(msgpack) - 1}
+			MSGPACK_TEST("null", "\xc0"),
+			MSGPACK_TEST("true", "\xc3"),
+			MSGPACK_TEST("false", "\xc2"),
+			MSGPACK_TEST("0", "\x00"),
+			MSGPACK_TEST("127", "\x7f"),
+			MSGPACK_TEST("128", "\xcc\x80"),
+			MSGPACK_TEST("300", "\xcd\x01\x2c"),
+			MSGPACK_TEST("70000", "\xce\x00\x01\x11\x70"),
+			MSGPACK_TEST("5000000000",
+				     "\xcf\x00\x00\x00\x01\x2a\x05\xf2\x00"),
+			MSGPACK_TEST("-1", "\xff"),
+			MSGPACK_TEST("-32", "\xe0"),
+			MSGPACK_TEST("-33", "\xd0\xdf"),
+			MSGPACK_TEST("-200", "\xd1\xff\x38"),
+			MSGPACK_TEST("-40000", "\xd2\xff\xff\x63\xc0"),
+			MSGPACK_TEST("12.5",
+				     "\xcb\x40\x29\x00\x00\x00\x00\x00\x00"),
+			MSGPACK_TEST("\"cpu\"", "\xa3" "cpu"),
+#undef MSGPACK_TEST
+	};
+
+	for (size_t i = 0; i < RD_ARRAYSIZE(tests); ++i) {
+		check_msgpack(tests[i].json, tests[i].msgpack, tests[i].len);
+	}
+}
+
+/// @test MessagePack containers, and strings longer than fixstr
+static void test_msgpack_containers() {
+	static const char map[] = "\x83"
+				  "\xa7" "monitor" "\xa3" "cpu"
+				  "\xa5" "value" "\xcb\x40\x29\x00\x00\x00\x00"
+						 "\x00\x00"
+				  "\xa3" "arr" "\x92\x01\xc0";
+	check_msgpack("{\"monitor\":\"cpu\",\"value\":12.5,\"arr\":[1,null]}",
+		      map,
+		      sizeof(map) - 1);
+
+	char long_str[40] = "\"";
+	char expected[2 + 32 + 1] = "\xd9\x20";
+	memset(long_str + 1, 'a', 32);
+	strcpy(long_str + 33, "\"");
+	memset(expected + 2, 'a', 32);
+	check_msgpack(long_str, expected, 2 + 32);
+
+	check_msgpack("[]", "\x90", 1);
+	check_msgpack("{}", "\x80", 1);
+}
+
+/** Load avro schemas store from a temporary file
+  @return Schema store
+  */
+static struct rb_avro_schema_store *avro_store_new() {
+	char path[] = "/tmp/rb_monitor_avro_XXXXXX";
+	const int fd = mkstemp(path);
+	assert_true(fd >= 0);
+	assert_int_equal(sizeof(avro_schemas) - 1,
+			 write(fd, avro_schemas, sizeof(avro_schemas) - 1));
+	close(fd);
+
+	struct rb_avro_schema_store *ret = rb_avro_schema_store_new(path);
+	unlink(path);
+	assert_non_null(ret);
+	return ret;
+}
+
+/// @test Avro record with schema registry framing, values converted to field
+/// types, fields from fallback object, unions and defaults
+static void test_avro_encode() {
+	static const char expected[] =
+			"\x00\x00\x00\x01\x02"	 // Magic and schema id
+			"\x80\xbc\xc1\x96\x0b"	 // timestamp
+			"\x06" "cpu"		   // monitor
+			"\x00\x00\x00\x00\x00\x00\x29\x40" // value
+			"\x04" "s1"		   // sensor_name, from fallback
+			"\x02\x0e"		   // sensor_id, long branch
+			"\x00"			   // group_id, null default
+			"\x02" "%";		   // unit, default
+	struct rb_avro_schema_store *store = avro_store_new();
+	const struct rb_avro_schema *schema =
+			rb_avro_schema_store_get(store, "monitor-value");
+	assert_non_null(schema);
+	assert_null(rb_avro_schema_store_get(store, "unknown"));
+
+	json_object *record = json_tokener_parse(
+			"{\"timestamp\":1500000000,\"monitor\":\"cpu\","
+			"\"value\":\"12.500000\",\"sensor_id\":7}");
+	json_object *fallback = json_tokener_parse(
+			"{\"sensor_name\":\"s1\",\"sensor_id\":8}");
+	struct printbuf *buf = printbuf_new();
+	assert_non_null(buf);
+
+	assert_true(rb_avro_encode(schema, buf, record, fallback));
+	assert_int_equal(sizeof(expected) - 1, buf->bpos);
+	assert_memory_equal(expected, buf->buf, sizeof(expected) - 1);
+
+	printbuf_free(buf);
+	json_object_put(fallback);
+	json_object_put(record);
+	rb_avro_schema_store_done(store);
+}
+
+/// @test Avro records that don't match schema are rejected
+static void test_avro_mismatch() {
+	static const char *records[] = {
+			// No sensor_name
+			"{\"timestamp\":1,\"monitor\":\"cpu\",\"value\":1,"
+			"\"sensor_id\":7}",
+			// Value is not a number
+			"{\"timestamp\":1,\"monitor\":\"cpu\",\"value\":\"x\","
+			"\"sensor_name\":\"s1\",\"sensor_id\":7}",
+			// Timestamp is not an integer
+			"{\"timestamp\":1.5,\"monitor\":\"cpu\",\"value\":1,"
+			"\"sensor_name\":\"s1\",\"sensor_id\":7}",
+	};
+	struct rb_avro_schema_store *store = avro_store_new();
+	const struct rb_avro_schema *schema =
+			rb_avro_schema_store_get(store, "monitor-value");
+	assert_non_null(schema);
+
+	for (size_t i = 0; i < RD_ARRAYSIZE(records); ++i) {
+		json_object *record = json_tokener_parse(records[i]);
+		struct printbuf *buf = printbuf_new();
+		assert_non_null(record);
+		assert_false(rb_avro_encode(schema, buf, record, NULL));
+		printbuf_free(buf);
+		json_object_put(record);
+	}
+
+	rb_avro_schema_store_done(store);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_msgpack_scalars),
+		cmocka_unit_test(test_msgpack_containers),
+		cmocka_unit_test(test_avro_encode),
+		cmocka_unit_test(test_avro_mismatch),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
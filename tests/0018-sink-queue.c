@@ -0,0 +1,220 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_sink_queue.h"
+
+#include <setjmp.h> // Needs to be before of cmocka.h
+
+#include <cmocka.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+/// Queue high watermark in tests
+#define HIGH_WATERMARK 10
+/// Queue low watermark in tests
+#define LOW_WATERMARK 5
+
+/** Create a messages array with no payloads
+  @param count Number of messages
+  @param priority Array priority
+  @return New array
+  */
+static rb_message_array_t *test_array_new(size_t count, int priority) {
+	rb_message_array_t *ret = new_messages_array(count);
+	assert_non_null(ret);
+	ret->priority = priority;
+	return ret;
+}
+
+static void test_queue_init(struct rb_sink_queue *queue,
+			    enum rb_sink_queue_policy policy) {
+	rb_sink_queue_init(queue, HIGH_WATERMARK);
+	queue->low_watermark = LOW_WATERMARK;
+	queue->policy = policy;
+}
+
+/** Push an array, checking the result
+  @param queue Queue
+  @param msgs Array to push. It is released if queue rejects it.
+  @param expected_queued Expected push result
+  @param expected_evicted Expected evicted messages
+  */
+static void test_push(struct rb_sink_queue *queue,
+		      rb_message_array_t *msgs,
+		      bool expected_queued,
+		      size_t expected_evicted) {
+	size_t evicted = 0;
+	bool blocked = false;
+	const bool queued = rb_sink_queue_push(
+			queue, msgs, "test", &evicted, &blocked);
+	assert_int_equal(expected_queued, queued);
+	assert_int_equal(expected_evicted, evicted);
+	assert_false(blocked);
+	if (!queued) {
+		rb_message_array_put(msgs);
+	}
+}
+
+/** Pop an array, checking it is the expected one
+  @param queue Queue
+  @param expected Expected array
+  */
+static void test_pop(struct rb_sink_queue *queue,
+		     const rb_message_array_t *expected) {
+	rb_message_array_t *msgs = rb_sink_queue_pop(queue, "test");
+	assert_true(expected == msgs);
+	rb_message_array_put(msgs);
+}
+
+/// @test new messages are rejected over high watermark, until queue is
+/// below low watermark
+static void test_drop_newest() {
+	struct rb_sink_queue queue;
+	test_queue_init(&queue, RB_SINK_QUEUE_DROP_NEWEST);
+
+	rb_message_array_t *a = test_array_new(4, 0), *b = test_array_new(4, 0),
+			   *c = test_array_new(4, 0);
+	test_push(&queue, a, true, 0);
+	test_push(&queue, b, true, 0);
+	test_push(&queue, test_array_new(4, 0), false, 0);
+	assert_true(queue.overloaded);
+
+	test_pop(&queue, a);
+	assert_false(queue.overloaded);
+	test_push(&queue, c, true, 0);
+	assert_int_equal(8, queue.messages);
+
+	rb_sink_queue_done(&queue);
+}
+
+/// @test oldest messages are dropped until new ones fit below low watermark
+static void test_drop_oldest() {
+	struct rb_sink_queue queue;
+	test_queue_init(&queue, RB_SINK_QUEUE_DROP_OLDEST);
+
+	rb_message_array_t *c = test_array_new(4, 0), *d = test_array_new(1, 0);
+	test_push(&queue, test_array_new(4, 0), true, 0);
+	test_push(&queue, test_array_new(4, 0), true, 0);
+	test_push(&queue, c, true, 8);
+	assert_false(queue.overloaded);
+	test_push(&queue, d, true, 0);
+	assert_int_equal(2, queue.count);
+	assert_int_equal(5, queue.messages);
+
+	test_pop(&queue, c);
+	test_pop(&queue, d);
+
+	rb_sink_queue_done(&queue);
+}
+
+/// @test lowest priority messages are dropped first, and new messages are
+/// dropped if there are no queued messages with lower priority
+static void test_drop_priority() {
+	struct rb_sink_queue queue;
+	test_queue_init(&queue, RB_SINK_QUEUE_DROP_PRIORITY);
+
+	rb_message_array_t *b = test_array_new(4, 5), *c = test_array_new(4, 1),
+			   *e = test_array_new(2, 9);
+	test_push(&queue, test_array_new(4, 0), true, 0);
+	test_push(&queue, b, true, 0);
+	// Only lower priority messages are evicted, and queue is still over
+	// low watermark
+	test_push(&queue, c, true, 4);
+	assert_true(queue.overloaded);
+	assert_int_equal(8, queue.messages);
+
+	// Nothing to evict with lower priority, and no room
+	test_push(&queue, test_array_new(4, 0), false, 0);
+
+	// Lowest priority first, then oldest
+	test_push(&queue, e, true, 8);
+	assert_false(queue.overloaded);
+	assert_int_equal(1, queue.count);
+	test_pop(&queue, e);
+
+	rb_sink_queue_done(&queue);
+}
+
+static void *test_pop_delayed(void *vqueue) {
+	struct rb_sink_queue *queue = vqueue;
+	usleep(100 * 1000);
+	rb_message_array_put(rb_sink_queue_pop(queue, "test"));
+	return NULL;
+}
+
+/// @test block policy waits until queue is below low watermark
+static void test_block() {
+	struct rb_sink_queue queue;
+	pthread_t thread;
+	size_t evicted = 0;
+	bool blocked = false;
+	test_queue_init(&queue, RB_SINK_QUEUE_BLOCK);
+
+	test_push(&queue, test_array_new(4, 0), true, 0);
+	test_push(&queue, test_array_new(4, 0), true, 0);
+
+	assert_int_equal(0,
+			 pthread_create(&thread,
+					NULL,
+					test_pop_delayed,
+					&queue));
+	assert_true(rb_sink_queue_push(&queue,
+				       test_array_new(4, 0),
+				       "test",
+				       &evicted,
+				       &blocked));
+	assert_true(blocked);
+	assert_int_equal(0, evicted);
+	assert_int_equal(8, queue.messages);
+	pthread_join(thread, NULL);
+
+	rb_sink_queue_done(&queue);
+}
+
+/// @test stopped queue returns queued messages, and then NULL
+static void test_stop() {
+	struct rb_sink_queue queue;
+	size_t messages = 0;
+	test_queue_init(&queue, RB_SINK_QUEUE_DROP_NEWEST);
+
+	rb_message_array_t *a = test_array_new(3, 0);
+	test_push(&queue, a, true, 0);
+	assert_false(rb_sink_queue_wait_stop(&queue, 10, &messages));
+	assert_int_equal(3, messages);
+
+	rb_sink_queue_stop(&queue);
+	assert_true(rb_sink_queue_wait_stop(&queue, 10, &messages));
+	test_pop(&queue, a);
+	assert_null(rb_sink_queue_pop(&queue, "test"));
+
+	rb_sink_queue_done(&queue);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_drop_newest),
+		cmocka_unit_test(test_drop_oldest),
+		cmocka_unit_test(test_drop_priority),
+		cmocka_unit_test(test_block),
+		cmocka_unit_test(test_stop),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+
+from mon_test import TestMonitor, main
+from pysnmp.proto.api import v2c
+import pytest
+
+
+@pytest.fixture(params=[0, 1], ids=['sync', 'async'])
+def snmp_async(request):
+    return request.param
+
+
+class TestSNMPAsync(TestMonitor):
+    ''' Asynchronous SNMP engine tests'''
+    def test_snmp_async(self,
+                        snmp_async,
+                        child,
+                        kafka_handler):
+        ''' Test SNMP monitors and operations over them, with requests sent
+        from workers or from the SNMP engine event loop '''
+        values = [1, 20, 300, 4000]
+
+        snmp_responses = {(0, i): v2c.Integer(value)
+                          for i, value in enumerate(values)}
+
+        sensor_config = {
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+            'timeout': 100000000,
+            'community': 'public',
+            # One OID per request, so many requests are in flight
+            'snmp_max_varbinds': 1,
+            'monitors': [{
+                'name': 'mon_' + str(i),
+                'oid': (0, i),
+                'unit': '%',
+            } for i in range(len(values))] + [{
+                'name': 'total',
+                'op': '+'.join('mon_' + str(i) for i in range(len(values))),
+            }],
+        }
+
+        base_config = {
+            'conf': {
+                'snmp_async': snmp_async,
+                'snmp_max_inflight': 2,
+            },
+            'sensors': [sensor_config],
+        }
+
+        message_base = {
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+        }
+
+        kafka_messages = [{
+            **message_base,
+            'type': 'snmp',
+            'monitor': 'mon_' + str(i),
+            'unit': '%',
+            'value': '{:.6f}'.format(value),
+        } for i, value in enumerate(values)] + [{
+            **message_base,
+            'type': 'op',
+            'monitor': 'total',
+            'value': '{:.6f}'.format(sum(values)),
+        }]
+
+        t_locals = locals()
+        self.base_test(child_argv_str=t_locals['child'],
+                       **{key: t_locals[key] for key in ['base_config',
+                                                         'kafka_handler',
+                                                         'kafka_messages',
+                                                         'snmp_responses']})
+
+
+if __name__ == '__main__':
+    main()
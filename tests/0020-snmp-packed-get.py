@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+
+from mon_test import TestMonitor, main
+from pysnmp.proto.api import v2c
+import pytest
+
+
+@pytest.fixture(params=['1', '2c'])
+def snmp_version(request):
+    return request.param
+
+
+class TestSNMPPackedGet(TestMonitor):
+    ''' Multi-varbind GET requests tests'''
+    def test_snmp_packed_get(self,
+                             snmp_version,
+                             child,
+                             kafka_handler):
+        ''' Test that monitors packed in the same requests get their values,
+        even if the agent does not know one of the requested OIDs '''
+        values = [1, 2, 3, 4, 5]
+        missing_oid = (0, 99)
+
+        snmp_responses = {(0, i): v2c.Integer(value)
+                          for i, value in enumerate(values)}
+
+        # Missing OID goes in the middle of the first request
+        monitors = [('mon_0', (0, 0)),
+                    ('mon_1', (0, 1)),
+                    ('missing', missing_oid),
+                    ('mon_2', (0, 2)),
+                    ('mon_3', (0, 3)),
+                    ('mon_4', (0, 4)),
+                    ('mon_1_again', (0, 1))]
+
+        sensor_config = {
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+            'timeout': 100000000,
+            'community': 'public',
+            'snmp_version': snmp_version,
+            'snmp_max_varbinds': 3,
+            'monitors': [{'name': name, 'oid': oid}
+                         for name, oid in monitors],
+        }
+
+        base_config = {'sensors': [sensor_config]}
+
+        message_base = {
+            'type': 'snmp',
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+        }
+
+        kafka_messages = [{
+            **message_base,
+            'monitor': name,
+            'value': '{:.6f}'.format(values[oid[1]]),
+        } for name, oid in monitors if oid != missing_oid]
+
+        t_locals = locals()
+        self.base_test(child_argv_str=t_locals['child'],
+                       **{key: t_locals[key] for key in ['base_config',
+                                                         'kafka_handler',
+                                                         'kafka_messages',
+                                                         'snmp_responses']})
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+
+from mon_test import TestMonitor, main
+from snmp_agent import SNMPAgentResponder
+from pysnmp.proto.api import v2c
+import pytest
+
+
+@pytest.fixture(params=['1', '2c'])
+def snmp_version(request):
+    return request.param
+
+
+class TestSNMPWalk(TestMonitor):
+    ''' SNMP subtree walk tests'''
+    def test_snmp_walk(self,
+                       snmp_version,
+                       child,
+                       kafka_handler):
+        ''' Test walk monitors, with GETNEXT in SNMPv1 and GETBULK in
+        SNMPv2c, needing many requests to walk the subtree '''
+        column = [10, 20, 30, 40, 50]
+        walk_oid = (1,)
+
+        snmp_responses = {
+            **{walk_oid + (i + 1,): v2c.Integer(value)
+               for i, value in enumerate(column)},
+            # Next table column, must not be walked
+            (2, 1): v2c.Integer(1000),
+        }
+
+        sensor_config = {
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+            'timeout': 100000000,
+            'community': 'public',
+            'snmp_version': snmp_version,
+            'snmp_max_repetitions': 2,
+            'monitors': [{
+                'name': 'in_octets',
+                'walk': '.'.join(str(node) for node in
+                                 SNMPAgentResponder.OID_PREFIX + walk_oid),
+                'instance_prefix': 'if-',
+                'name_split_suffix': '_per_interface',
+                'split_op': 'sum',
+            }, {
+                'name': 'in_octets_mean',
+                'op': 'mean(in_octets)',
+            }],
+        }
+
+        base_config = {'sensors': [sensor_config]}
+
+        message_base = {
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+        }
+
+        kafka_messages = [{
+            **message_base,
+            'type': 'snmp',
+            'monitor': 'in_octets_per_interface',
+            'instance': 'if-' + str(i + 1),
+            'value': '{:.6f}'.format(value),
+        } for i, value in enumerate(column)] + [{
+            **message_base,
+            'type': 'snmp',
+            'monitor': 'in_octets',
+            'instance': None,
+            'value': '{:.6f}'.format(sum(column)),
+        }, {
+            **message_base,
+            'type': 'op',
+            'monitor': 'in_octets_mean',
+            'value': '{:.6f}'.format(sum(column) / len(column)),
+        }]
+
+        t_locals = locals()
+        self.base_test(child_argv_str=t_locals['child'],
+                       **{key: t_locals[key] for key in ['base_config',
+                                                         'kafka_handler',
+                                                         'kafka_messages',
+                                                         'snmp_responses']})
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+
+from mon_test import TestMonitor, TestBase, main
+
+
+class TestPollIntervals(TestMonitor):
+    ''' Sensor and monitors poll intervals tests'''
+    def test_monitor_interval(self,
+                              child,
+                              kafka_handler):
+        ''' Test that a monitor with a short interval is polled many times
+        while the rest of the sensor monitors are polled once '''
+        counter_file = TestBase.random_resource_file('monitor', 'counter')
+        n_fast_polls = 4
+
+        sensor_config = {
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+            'timeout': 100000000,
+            'community': 'public',
+            'interval': 1000,
+            'monitors': [
+                {'name': 'slow', 'system': 'echo 7'},
+                # Counts its own polls
+                {'name': 'fast',
+                 'system': 'echo >> {0}; wc -l < {0}'.format(counter_file),
+                 'interval': 0.2},
+            ],
+        }
+
+        base_config = {'sensors': [sensor_config]}
+
+        message_base = {
+            'type': 'system',
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+        }
+
+        # Slow monitor is only polled in the first cycle
+        kafka_messages = [{
+            **message_base,
+            'monitor': 'slow',
+            'value': '{:.6f}'.format(7),
+        }] + [{
+            **message_base,
+            'monitor': 'fast',
+            'value': '{:.6f}'.format(i + 1),
+        } for i in range(n_fast_polls)]
+
+        t_locals = locals()
+        self.base_test(child_argv_str=t_locals['child'],
+                       snmp_responses=None,
+                       **{key: t_locals[key] for key in ['base_config',
+                                                         'kafka_handler',
+                                                         'kafka_messages']})
+
+
+if __name__ == '__main__':
+    main()
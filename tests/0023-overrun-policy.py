@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+
+from mon_test import TestMonitor, TestBase, main
+import pytest
+
+
+@pytest.fixture(params=['skip', 'coalesce', 'delay'])
+def overrun_policy(request):
+    return request.param
+
+
+class TestOverrunPolicy(TestMonitor):
+    ''' Slow sensor cycles tests'''
+    def test_overrun_policy(self,
+                            overrun_policy,
+                            child,
+                            kafka_handler):
+        ''' Test that a sensor slower than its interval keeps being polled,
+        and that its cycles never run at the same time '''
+        counter_file = TestBase.random_resource_file('monitor', 'counter')
+        n_polls = 4
+
+        # Takes longer than sensor interval. Cycles running at the same time
+        # would read the same count
+        command = 'n=$(($(wc -l < {0}) + 1)); sleep 0.3; echo >> {0}; ' \
+                  'echo $n'.format(counter_file)
+
+        sensor_config = {
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+            'timeout': 100000000,
+            'community': 'public',
+            'interval': 0.1,
+            'overrun_policy': overrun_policy,
+            'monitors': [{'name': 'slow', 'system': command}],
+        }
+
+        base_config = {'sensors': [sensor_config]}
+
+        kafka_messages = [{
+            'type': 'system',
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+            'monitor': 'slow',
+            'value': '{:.6f}'.format(i + 1),
+        } for i in range(n_polls)]
+
+        t_locals = locals()
+        self.base_test(child_argv_str=t_locals['child'],
+                       snmp_responses=None,
+                       **{key: t_locals[key] for key in ['base_config',
+                                                         'kafka_handler',
+                                                         'kafka_messages']})
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+
+from mon_test import TestMonitor, main
+
+
+class TestSystemTimeout(TestMonitor):
+    ''' System monitors timeout tests'''
+    def test_system_timeout(self,
+                            child,
+                            kafka_handler):
+        ''' Test that commands that exceed their timeout are killed, with
+        all the processes they started, and give no value '''
+        sensor_config = {
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+            'timeout': 100000000,
+            'community': 'public',
+            'monitors': [
+                {'name': 'stuck', 'system': 'sleep 100; echo 1',
+                 'timeout': 0.5},
+                # Background child keeps output open if it is not killed
+                {'name': 'stuck_children',
+                 'system': '(sleep 100; echo 2) & sleep 100; echo 3',
+                 'timeout': 0.5},
+                {'name': 'quick', 'system': 'echo 4', 'timeout': 0.5},
+            ],
+        }
+
+        base_config = {'sensors': [sensor_config]}
+
+        kafka_messages = [{
+            'type': 'system',
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+            'monitor': 'quick',
+            'value': '{:.6f}'.format(4),
+        }]
+
+        t_locals = locals()
+        self.base_test(child_argv_str=t_locals['child'],
+                       snmp_responses=None,
+                       **{key: t_locals[key] for key in ['base_config',
+                                                         'kafka_handler',
+                                                         'kafka_messages']})
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+
+from mon_test import TestMonitor, main
+
+
+def proc_cpus():
+    ''' CPUs rows of /proc/stat '''
+    with open('/proc/stat') as f:
+        return [line.split()[0] for line in f
+                if line.startswith('cpu') and not line.startswith('cpu ')]
+
+
+def proc_meminfo(key):
+    ''' Value of a /proc/meminfo key '''
+    with open('/proc/meminfo') as f:
+        for line in f:
+            if line.startswith(key + ':'):
+                return int(line.split()[1])
+
+
+class TestProc(TestMonitor):
+    ''' Proc monitors tests'''
+    def test_proc(self,
+                  child,
+                  kafka_handler):
+        ''' Test file, key and row sources, with a row vector '''
+        with open('/proc/sys/kernel/pid_max') as f:
+            pid_max = int(f.read())
+
+        sensor_config = {
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+            'timeout': 100000000,
+            'community': 'public',
+            'monitors': [
+                {'name': 'pid_max',
+                 'proc': 'file:/proc/sys/kernel/pid_max'},
+                {'name': 'mem_total', 'proc': 'meminfo:MemTotal',
+                 'unit': 'kB'},
+                {'name': 'cpus_idle', 'proc': 'stat:cpu*:idle',
+                 'name_split_suffix': '_per_cpu', 'split_op': 'mean'},
+            ],
+        }
+
+        base_config = {'sensors': [sensor_config]}
+
+        message_base = {
+            'type': 'proc',
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+        }
+
+        # CPU times change, so only vector instances are checked
+        kafka_messages = [{
+            **message_base,
+            'monitor': 'pid_max',
+            'value': '{:.6f}'.format(pid_max),
+        }, {
+            **message_base,
+            'monitor': 'mem_total',
+            'unit': 'kB',
+            'value': '{:.6f}'.format(proc_meminfo('MemTotal')),
+        }] + [{
+            **message_base,
+            'monitor': 'cpus_idle_per_cpu',
+            'instance': cpu,
+        } for cpu in proc_cpus()] + [{
+            **message_base,
+            'monitor': 'cpus_idle',
+            'instance': None,
+        }]
+
+        t_locals = locals()
+        self.base_test(child_argv_str=t_locals['child'],
+                       snmp_responses=None,
+                       **{key: t_locals[key] for key in ['base_config',
+                                                         'kafka_handler',
+                                                         'kafka_messages']})
+
+
+if __name__ == '__main__':
+    main()
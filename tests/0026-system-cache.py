@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+
+from mon_test import TestMonitor, TestBase, main
+
+
+class TestSystemCache(TestMonitor):
+    ''' System commands results cache tests'''
+    def test_cache_ttl(self,
+                       child,
+                       kafka_handler):
+        ''' Test that a monitor with cache_ttl reuses its command output in
+        the next cycles, while a monitor with no cache runs it again '''
+        n_cycles = 3
+
+        def counter_command():
+            counter_file = TestBase.random_resource_file('monitor', 'counter')
+            return 'echo >> {0}; wc -l < {0}'.format(counter_file)
+
+        sensor_config = {
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+            'timeout': 100000000,
+            'community': 'public',
+            'interval': 0.2,
+            'monitors': [
+                {'name': 'cached', 'system': counter_command(),
+                 'cache_ttl': 3600},
+                {'name': 'not_cached', 'system': counter_command()},
+            ],
+        }
+
+        base_config = {'sensors': [sensor_config]}
+
+        message_base = {
+            'type': 'system',
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+        }
+
+        kafka_messages = [
+            message
+            for cycle in range(n_cycles)
+            for message in [{
+                **message_base,
+                'monitor': 'cached',
+                'value': '{:.6f}'.format(1),
+            }, {
+                **message_base,
+                'monitor': 'not_cached',
+                'value': '{:.6f}'.format(cycle + 1),
+            }]
+        ]
+
+        t_locals = locals()
+        self.base_test(child_argv_str=t_locals['child'],
+                       snmp_responses=None,
+                       **{key: t_locals[key] for key in ['base_config',
+                                                         'kafka_handler',
+                                                         'kafka_messages']})
+
+
+if __name__ == '__main__':
+    main()
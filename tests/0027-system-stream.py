@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+
+from mon_test import TestMonitor, main
+
+
+class TestSystemStream(TestMonitor):
+    ''' Streaming system monitors tests'''
+    def test_system_stream(self,
+                           child,
+                           kafka_handler):
+        ''' Test that a streaming command is kept running, and that every
+        cycle splits its last printed line '''
+        n_cycles = 2
+        values = [1, 2]
+
+        sensor_config = {
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+            'timeout': 100000000,
+            'community': 'public',
+            'interval': 1,
+            'monitors': [{
+                'name': 'streamed',
+                'system': "while true; do echo '{}'; sleep 0.1; done".format(
+                    ';'.join(str(v) for v in values)),
+                'stream': 1,
+                'split': ';',
+                'split_op': 'sum',
+                'instance_prefix': 'instance-',
+                'name_split_suffix': '_per_instance',
+            }],
+        }
+
+        base_config = {'sensors': [sensor_config]}
+
+        message_base = {
+            'type': 'system',
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+        }
+
+        # First cycle could run before the command prints any line, so all
+        # lines are the same and cycles are not told apart
+        kafka_messages = [
+            message
+            for _ in range(n_cycles)
+            for message in [{
+                **message_base,
+                'monitor': 'streamed_per_instance',
+                'instance': 'instance-' + str(i),
+                'value': '{:.6f}'.format(value),
+            } for i, value in enumerate(values)] + [{
+                **message_base,
+                'monitor': 'streamed',
+                'instance': None,
+                'value': '{:.6f}'.format(sum(values)),
+            }]
+        ]
+
+        t_locals = locals()
+        self.base_test(child_argv_str=t_locals['child'],
+                       snmp_responses=None,
+                       **{key: t_locals[key] for key in ['base_config',
+                                                         'kafka_handler',
+                                                         'kafka_messages']})
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+
+from mon_test import TestMonitor, main
+from mon_test_kafka import KafkaHandler
+import pytest
+
+
+@pytest.fixture(params=['array', 'ndjson'])
+def message_batch(request):
+    return request.param
+
+
+class TestBatchedMessages(TestMonitor):
+    ''' Batched output messages tests'''
+    def test_batched_messages(self,
+                              message_batch,
+                              child,
+                              kafka_handler):
+        ''' Test that all the values of a sensor cycle are sent in one
+        message, with the sensor enrichment only in its first element '''
+        values = [('one', 1), ('two', 2), ('three', 3)]
+
+        sensor_config = {
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+            'timeout': 100000000,
+            'community': 'public',
+            'monitors': [{
+                'name': name,
+                'system': 'echo {}'.format(value),
+            } for name, value in values],
+        }
+
+        base_config = {
+            'conf': {'message_batch': message_batch},
+            'sensors': [sensor_config],
+        }
+
+        kafka_messages = [[{
+            'sensor_id': 1,
+            'sensor_name': 'sensor-test-01',
+            'monitor': None,
+        }] + [{
+            'type': 'system',
+            'sensor_id': None,
+            'sensor_name': None,
+            'monitor': name,
+            'value': '{:.6f}'.format(value),
+        } for name, value in values]]
+
+        check_messages_callback = KafkaHandler.assert_batches_keys
+
+        t_locals = locals()
+        self.base_test(child_argv_str=t_locals['child'],
+                       snmp_responses=None,
+                       **{key: t_locals[key] for key in [
+                           'base_config',
+                           'kafka_handler',
+                           'kafka_messages',
+                           'check_messages_callback']})
+
+
+if __name__ == '__main__':
+    main()
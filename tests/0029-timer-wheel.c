@@ -0,0 +1,116 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_timer_wheel.h"
+
+#include <setjmp.h> // Needs to be before of cmocka.h
+
+#include <cmocka.h>
+
+/// Expiration callback, that records last expired timer
+static void test_expire_cb(struct rb_timer *timer, void *opaque) {
+	struct rb_timer **last = opaque;
+	*last = timer;
+}
+
+/** Advance wheel, checking expired timers
+  @param wheel Wheel
+  @param now Tick to advance to
+  @param expected Expected last expired timer, or NULL if none
+  @param expected_count Expected number of expired timers
+  */
+static void test_advance(struct rb_timer_wheel *wheel,
+			 uint64_t now,
+			 const struct rb_timer *expected,
+			 size_t expected_count) {
+	struct rb_timer *last = NULL;
+	const size_t expired =
+			rb_timer_wheel_advance(wheel, now, test_expire_cb, &last);
+	assert_int_equal(expected_count, expired);
+	assert_true(expected == last);
+}
+
+/// @test add, delete and expire level 0 timers
+static void test_level0() {
+	struct rb_timer_wheel wheel;
+	struct rb_timer a, b;
+	rb_timer_wheel_init(&wheel, 10);
+	assert_true(UINT64_MAX == rb_timer_wheel_next(&wheel));
+
+	// Past expiration expires in next tick
+	rb_timer_wheel_add(&wheel, &a, 5);
+	assert_true(11 == rb_timer_wheel_next(&wheel));
+	rb_timer_wheel_del(&wheel, &a);
+	assert_true(UINT64_MAX == rb_timer_wheel_next(&wheel));
+
+	rb_timer_wheel_add(&wheel, &a, 20);
+	rb_timer_wheel_add(&wheel, &b, 15);
+	assert_true(15 == rb_timer_wheel_next(&wheel));
+	test_advance(&wheel, 14, NULL, 0);
+	test_advance(&wheel, 15, &b, 1);
+	assert_true(20 == rb_timer_wheel_next(&wheel));
+	test_advance(&wheel, 30, &a, 1);
+	assert_true(UINT64_MAX == rb_timer_wheel_next(&wheel));
+}
+
+/// @test upper level timer that expires before a later added level 0 one
+static void test_mixed_levels() {
+	struct rb_timer_wheel wheel;
+	struct rb_timer upper, lower;
+	rb_timer_wheel_init(&wheel, 0);
+
+	// Beyond level 0 rotation, so it goes to level 1
+	rb_timer_wheel_add(&wheel, &upper, 70);
+	test_advance(&wheel, 60, NULL, 0);
+	// Within level 0 rotation, but after the upper timer
+	rb_timer_wheel_add(&wheel, &lower, 100);
+
+	// Upper timer cascade must not be skipped
+	assert_true(64 == rb_timer_wheel_next(&wheel));
+	test_advance(&wheel, 64, NULL, 0);
+	assert_true(70 == rb_timer_wheel_next(&wheel));
+	test_advance(&wheel, 70, &upper, 1);
+	assert_true(100 == rb_timer_wheel_next(&wheel));
+	test_advance(&wheel, 100, &lower, 1);
+	assert_true(UINT64_MAX == rb_timer_wheel_next(&wheel));
+}
+
+/// @test timers far in the future are cascaded through all levels
+static void test_far_timer() {
+	struct rb_timer_wheel wheel;
+	struct rb_timer far;
+	const uint64_t expires = 3 * RB_TIMER_WHEEL_SLOTS * RB_TIMER_WHEEL_SLOTS;
+	rb_timer_wheel_init(&wheel, 0);
+
+	rb_timer_wheel_add(&wheel, &far, expires);
+	test_advance(&wheel, expires - 1, NULL, 0);
+	assert_true(expires == rb_timer_wheel_next(&wheel));
+	test_advance(&wheel, expires, &far, 1);
+	assert_true(0 == wheel.count);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_level0),
+		cmocka_unit_test(test_mixed_levels),
+		cmocka_unit_test(test_far_timer),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
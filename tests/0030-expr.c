@@ -0,0 +1,167 @@
+/*
+  Copyright (C) 2016 Eneo Tecnologia S.L.
+  Copyright (C) 2017 Eugenio Perez
+  Author: Eugenio Perez <eupm90@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Affero General Public License as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Affero General Public License for more details.
+
+  You should have received a copy of the GNU Affero General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rb_bitmap.h"
+#include "rb_expr.h"
+
+#include <setjmp.h> // Needs to be before of cmocka.h
+
+#include <cmocka.h>
+
+#include <math.h>
+
+/// Vector variables length in tests
+#define VECTOR_LEN 4
+
+/** Evaluate a scalar expression with no variables
+  @param expression Expression
+  @return Expression result
+  */
+static double test_eval_scalar(const char *expression) {
+	double result[1];
+	uint64_t result_valid[RB_BITMAP_WORDS(1)];
+	bool result_vector = true;
+
+	struct rb_expr *expr = rb_expr_compile(expression);
+	assert_non_null(expr);
+	assert_int_equal(0, rb_expr_vars_count(expr));
+	assert_true(rb_expr_eval(expr,
+				 NULL,
+				 NULL,
+				 1,
+				 result,
+				 result_valid,
+				 &result_vector));
+	assert_false(result_vector);
+	assert_true(rb_bitmap_test(result_valid, 0));
+	rb_expr_done(expr);
+
+	return result[0];
+}
+
+/** Check a scalar expression result
+  @param expression Expression
+  @param expected Expected result
+  */
+static void test_scalar(const char *expression, double expected) {
+	const double result = test_eval_scalar(expression);
+	assert_true(fabs(result - expected) < 1e-9);
+}
+
+/// @test exponentiation is left associative, as in libmatheval
+static void test_power() {
+	test_scalar("2^3^2", 64);
+	test_scalar("2^3^2^2", 4096);
+	test_scalar("(2^3)^2", 64);
+	test_scalar("2^(3^2)", 512);
+	test_scalar("2*3^2", 18);
+}
+
+/// @test unary minus binds looser than exponentiation in the base
+static void test_unary() {
+	test_scalar("-2^2", -4);
+	test_scalar("(-2)^2", 4);
+	test_scalar("2^-1", 0.5);
+	test_scalar("2^-1^2", 0.25);
+	test_scalar("--3", 3);
+	test_scalar("+3-2", 1);
+	test_scalar("3*-2", -6);
+}
+
+/// @test functions and constants
+static void test_functions() {
+	test_scalar("sqrt(16)+abs(-3)", 7);
+	test_scalar("exp(0)^2", 1);
+	test_scalar("2^sqrt(4)^2", 16);
+	test_scalar("log(e)", 1);
+	test_scalar("cos(pi)", -1);
+}
+
+/// @test invalid expressions are not compiled
+static void test_invalid() {
+	static const char *invalid[] = {
+			"1+", "2^", "2^^3", "(1", "erf(1)", "1 2",
+	};
+
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+		assert_null(rb_expr_compile(invalid[i]));
+	}
+}
+
+/// @test vector variables, with missing elements and reductions
+static void test_vector() {
+	static const double x_values[VECTOR_LEN] = {1, 2, 3, 4};
+	static const double y_value = 2;
+	uint64_t x_valid[RB_BITMAP_WORDS(VECTOR_LEN)] = {0};
+	double result[VECTOR_LEN];
+	uint64_t result_valid[RB_BITMAP_WORDS(VECTOR_LEN)];
+	bool result_vector = false;
+
+	for (size_t i = 0; i < VECTOR_LEN; ++i) {
+		if (i != 2) {
+			rb_bitmap_set(x_valid, i);
+		}
+	}
+
+	struct rb_expr *expr = rb_expr_compile("-x^y + sum(x)");
+	assert_non_null(expr);
+	assert_int_equal(2, rb_expr_vars_count(expr));
+	char **names = rb_expr_vars_names(expr);
+	assert_string_equal("x", names[0]);
+	assert_string_equal("y", names[1]);
+
+	const struct rb_expr_value vars[] = {
+			{.values = x_values, .valid = x_valid, .vector = true},
+			{.values = &y_value, .valid = NULL, .vector = false},
+	};
+	assert_true(rb_expr_eval(expr,
+				 NULL,
+				 vars,
+				 VECTOR_LEN,
+				 result,
+				 result_valid,
+				 &result_vector));
+	assert_true(result_vector);
+
+	// Missing elements are skipped by sum
+	for (size_t i = 0; i < VECTOR_LEN; ++i) {
+		if (i == 2) {
+			assert_false(rb_bitmap_test(result_valid, i));
+			continue;
+		}
+
+		assert_true(rb_bitmap_test(result_valid, i));
+		assert_true(fabs(result[i] - (7 - x_values[i] * x_values[i])) <
+			    1e-9);
+	}
+
+	rb_expr_done(expr);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_power),
+		cmocka_unit_test(test_unary),
+		cmocka_unit_test(test_functions),
+		cmocka_unit_test(test_invalid),
+		cmocka_unit_test(test_vector),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -14,9 +14,13 @@ import json
 class MonitorKafkaMessages(object):
     ''' Base SNMP message for testing '''
 
-    def __init__(self, topic_name, expected_kafka_messages):
+    def __init__(self,
+                 topic_name,
+                 expected_kafka_messages,
+                 check_messages_callback=KafkaHandler.assert_messages_keys):
         self.__topic_name = topic_name
         self.__messages = expected_kafka_messages
+        self.__check_messages_callback = check_messages_callback
 
     def test(self, kafka_handler):
         ''' Do the SNMP message test.
@@ -25,7 +29,7 @@ class MonitorKafkaMessages(object):
           - kafka handler:
         '''
         kafka_handler.check_kafka_messages(
-                     check_messages_callback=KafkaHandler.assert_messages_keys,
+                     check_messages_callback=self.__check_messages_callback,
                      topic_name=self.__topic_name,
                      messages=self.__messages)
 
@@ -145,7 +149,8 @@ class TestMonitor(TestBase):
                   child_argv_str,
                   snmp_responses,
                   kafka_handler,
-                  kafka_messages):
+                  kafka_messages,
+                  check_messages_callback=KafkaHandler.assert_messages_keys):
         ''' Base monitor test
 
         Arguments:
@@ -156,6 +161,8 @@ class TestMonitor(TestBase):
           - snmp_responses: Expected SNMP agent responses
           - messages: kafka messages to expect
           - kafka_handler: Kafka handler to use
+          - check_messages_callback: Function to check received messages
+            against expected ones
         '''
         config_file, config = self.__create_config_file(base_config)
         snmp_agent_port = int(
@@ -175,7 +182,9 @@ class TestMonitor(TestBase):
             try:
                 t_test = MonitorKafkaMessages(
                                     topic_name=kafka_topic,
-                                    expected_kafka_messages=kafka_messages)
+                                    expected_kafka_messages=kafka_messages,
+                                    check_messages_callback=(
+                                        check_messages_callback))
                 t_test.test(kafka_handler=kafka_handler)
             finally:
                 child.send_signal(signal.SIGINT)
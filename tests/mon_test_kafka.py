@@ -41,6 +41,21 @@ class KafkaHandler(object):
                 else:
                     assert(message[dimension] == value)
 
+    def assert_batches_keys(expected_batches, received_messages):
+        ''' Assert that every received message is a batch, a JSON array or
+        newline delimited JSON values, and that its values match the
+        expected_batches dimensions as in assert_messages_keys'''
+
+        assert(len(expected_batches) == len(received_messages))
+        for batch, message in zip(expected_batches, received_messages):
+            message = message.decode()
+            if message.startswith('['):
+                values = [json.dumps(v) for v in json.loads(message)]
+            else:
+                values = [line for line in message.splitlines() if line]
+
+            KafkaHandler.assert_messages_keys(batch, values)
+
     def check_kafka_messages(self,
                              check_messages_callback,
                              topic_name,
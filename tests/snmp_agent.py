@@ -21,7 +21,24 @@ class SNMPAgentResponder(instrum.AbstractMibInstrumController):
         }
 
     def readVars(self, vars, acInfo=(None, None)):
-        return [(oid, self.__responses[oid]) for oid, _ in vars]
+        # SNMPv1 requests get a noSuchName error for unknown OIDs
+        return [(oid, self.__responses.get(oid, v2c.NoSuchInstance()))
+                for oid, _ in vars]
+
+    def readNextVars(self, vars, acInfo=(None, None)):
+        ''' Answer GETNEXT and GETBULK requests, walking responses in OID
+        order '''
+        def next_var(oid):
+            try:
+                next_oid = min(response_oid
+                               for response_oid in self.__responses
+                               if response_oid > tuple(oid))
+            except ValueError:
+                return (oid, v2c.EndOfMibView())
+
+            return (v2c.ObjectName(next_oid), self.__responses[next_oid])
+
+        return [next_var(oid) for oid, _ in vars]
 
 
 class SNMPAgent(Process):
@@ -63,6 +80,8 @@ class SNMPAgent(Process):
         )
 
         cmdrsp.GetCommandResponder(snmpEngine, snmpContext)
+        cmdrsp.NextCommandResponder(snmpEngine, snmpContext)
+        cmdrsp.BulkCommandResponder(snmpEngine, snmpContext)
 
         snmpEngine.transportDispatcher.jobStarted(1)
         self.__barrier.wait()